@@ -0,0 +1,565 @@
+#define _GNU_SOURCE // pread, strdup
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "art.h"
+#include "read.h"
+#include "helper.h"
+#include "frames.h"
+#include "hash.h"
+#include "simd.h"
+#include "stats.h"
+
+// --- Windowed reads over the tag ---
+// Frame headers are served from one TAG_READ_AHEAD window; a read only happens when the
+// walk leaves it, which for most tags means once before the artwork and once after it.
+typedef struct {
+    int fd;
+    uint64_t start;           // File position of buffer[0]
+    size_t len;
+    uint8_t buffer[TAG_READ_AHEAD];
+} ArtWindow;
+
+// Pointer to file position pos with at least `need` bytes behind it (*avail says how many),
+// or NULL if the file ends first
+static uint8_t *window_at(ArtWindow *window, uint64_t pos, size_t need, size_t *avail) {
+    if (pos < window->start || pos + need > window->start + window->len) {
+        ssize_t got = pread(window->fd, window->buffer, sizeof(window->buffer), pos);
+        STATS_ADD(STAT_SYSCALLS, 1);
+        STATS_ADD(STAT_BYTES_READ, got > 0 ? got : 0);
+        window->start = pos;
+        window->len = (got > 0) ? (size_t)got : 0;
+    }
+    size_t left = window->start + window->len - pos;
+    if (left < need) {
+        return NULL;
+    }
+    *avail = left;
+    return window->buffer + (pos - window->start);
+}
+
+// Parses the fields in front of the picture: encoding, MIME type (v2.2: 3-char format),
+// picture type and description. Returns their length, or 0 if they don't fit in `size`.
+static uint32_t parse_picture_header(const uint8_t *data, size_t size, uint8_t version, ArtImage *image) {
+    if (size < 2) {
+        return 0;
+    }
+    uint8_t encoding = data[0];
+    size_t pos;
+
+    if (version == 2) {
+        if (size < 5) {
+            return 0;
+        }
+        memcpy(image->format, data + 1, 3);
+        image->format[3] = '\0';
+        pos = 4;
+    } else {
+        const uint8_t *end = memchr(data + 1, 0, size - 1);
+        if (!end) {
+            return 0;
+        }
+        size_t len = end - (data + 1);
+        if (len >= sizeof(image->format)) {
+            len = sizeof(image->format) - 1;
+        }
+        memcpy(image->format, data + 1, len);
+        image->format[len] = '\0';
+        pos = (end - data) + 1;
+    }
+    if (pos >= size) {
+        return 0;
+    }
+    image->picture_type = data[pos++];
+
+    // Description: terminated by 0x00, or by 0x00 0x00 on a character boundary for UTF-16
+    bool wide = (encoding == 1 || encoding == 2);
+    for (size_t i = pos; i < size; i += wide ? 2 : 1) {
+        if (!wide && data[i] == 0) {
+            return (uint32_t)(i + 1);
+        }
+        if (wide && i + 1 < size && data[i] == 0 && data[i + 1] == 0) {
+            return (uint32_t)(i + 2);
+        }
+    }
+    return 0;
+}
+
+// Reports the picture frames of a tag that was read (and resynchronised) in full. Only
+// v2.2/v2.3 tags unsynchronised as a whole come here: their frames have no position in the
+// file that could be copied from.
+static int report_from_memory(int fd, TagData *tags, ArtImageFn fn, void *user) {
+    int count = 0;
+    for (uint32_t i = 0; i < tags->frame_count; i++) {
+        const TagFrame *frame = &tags->frames[i];
+        if (frame_kind(frame->id) != FRAME_KIND_PICTURE ||
+            (frame->flags & (FRAME_FLAG_COMPRESSED | FRAME_FLAG_ENCRYPTED))) {
+            continue;
+        }
+
+        ArtImage image;
+        memset(&image, 0, sizeof(ArtImage));
+        const uint8_t *data = tag_frame_data(tags, frame);
+        uint32_t header_len = parse_picture_header(data, frame->size, tags->header.version_major, &image);
+        if (header_len == 0 || strcmp(image.format, "-->") == 0) {
+            continue; // Malformed, or a link to an image elsewhere
+        }
+        image.memory = data + header_len;
+        image.size = frame->size - header_len;
+        fn(fd, &image, user);
+        count++;
+    }
+    return count;
+}
+
+int art_find_images(int fd, ArtImageFn fn, void *user) {
+    ArtWindow *window = malloc(sizeof(ArtWindow));
+    if (!window) {
+        return -1;
+    }
+    window->fd = fd;
+    window->start = 0;
+    window->len = 0;
+
+    size_t avail;
+    ID3Header header;
+    const uint8_t *head = window_at(window, 0, ID3_HEADER_SIZE, &avail);
+    if (!head || !decode_id3_header(head, &header)) {
+        free(window);
+        return -1;
+    }
+
+    if (header.version_major < 4 && (header.flags & ID3_FLAG_UNSYNC)) {
+        free(window);
+        TagData tags;
+        tag_data_init(&tags);
+        int count = -1;
+        if (read_tag_buffer(fd, &tags)) {
+            parse_tag_frames(&tags);
+            count = report_from_memory(fd, &tags, fn, user);
+        }
+        tag_data_free(&tags);
+        return count;
+    }
+
+    STATS_TIMER_START(frames_start);
+    uint8_t version = header.version_major;
+    uint64_t tag_end = ID3_HEADER_SIZE + (uint64_t)header.size;
+    const uint8_t *body = window_at(window, ID3_HEADER_SIZE, header.size < 4 ? header.size : 4, &avail);
+    uint64_t pos = ID3_HEADER_SIZE + (body ? first_frame_offset(&header, body) : header.size);
+    int count = 0;
+
+    while (pos < tag_end) {
+        size_t header_size = (version == 2) ? ID3V22_FRAME_HEADER_SIZE : ID3_FRAME_HEADER_SIZE;
+        ID3FrameHeader frame_header;
+        const uint8_t *frame = window_at(window, pos, header_size, &avail);
+        if (!frame || !decode_frame_header(frame, tag_end - pos, version, &frame_header)) {
+            break; // Padding, end of file, or a frame running past the tag
+        }
+        STATS_ADD(STAT_FRAMES_PARSED, 1);
+        uint64_t content = pos + frame_header.header_size;
+        pos = content + frame_header.size;
+
+        uint16_t flags = frame_header.flags;
+        uint32_t additions = frame_flag_additions(flags, version);
+        if (frame_kind(frame_header.id) != FRAME_KIND_PICTURE ||
+            (flags & (FRAME_FLAG_COMPRESSED | FRAME_FLAG_ENCRYPTED)) || additions > frame_header.size) {
+            continue;
+        }
+
+        ArtImage image;
+        memset(&image, 0, sizeof(ArtImage));
+        uint64_t stored = content + additions;
+        uint32_t stored_size = frame_header.size - additions;
+        image.unsync = version == 4 && ((flags & FRAME_FLAG_UNSYNC) || (header.flags & ID3_FLAG_UNSYNC));
+
+        size_t need = (stored_size < sizeof(window->buffer)) ? stored_size : sizeof(window->buffer);
+        uint8_t *fields = window_at(window, stored, need, &avail);
+        if (!fields) {
+            break;
+        }
+        size_t field_size = need;
+        if (image.unsync) {
+            // Decoded in the window itself, which then no longer mirrors the file
+            field_size = unsync_decode(fields, fields, need);
+            window->len = 0;
+        }
+        uint32_t header_len = parse_picture_header(fields, field_size, version, &image);
+        if (header_len == 0 || strcmp(image.format, "-->") == 0) {
+            continue;
+        }
+
+        if (image.unsync) {
+            image.offset = stored;
+            image.size = stored_size;
+            image.skip = header_len;
+        } else {
+            image.offset = stored + header_len;
+            image.size = stored_size - header_len;
+        }
+        fn(fd, &image, user);
+        count++;
+    }
+    STATS_TIMER_STOP(PHASE_FRAMES, frames_start);
+
+    free(window);
+    return count;
+}
+
+static bool write_all(int fd, const uint8_t *data, size_t size) {
+    while (size > 0) {
+        ssize_t put = write(fd, data, size);
+        STATS_ADD(STAT_SYSCALLS, 1);
+        if (put < 0 && errno == EINTR) {
+            continue;
+        }
+        if (put <= 0) {
+            return false;
+        }
+        STATS_ADD(STAT_BYTES_WRITTEN, put);
+        data += put;
+        size -= put;
+    }
+    return true;
+}
+
+// Reads the stored bytes in COPY_BUFFER_SIZE chunks, decoding them if the frame is
+// unsynchronised, and hands the image bytes to the hash and/or out_fd (either may be unused)
+static bool stream_image(int fd, const ArtImage *image, Hash64State *hash, int out_fd, uint64_t *written) {
+    uint8_t *buffer = malloc(COPY_BUFFER_SIZE);
+    if (!buffer) {
+        return false;
+    }
+
+    uint64_t pos = image->offset;
+    uint64_t left = image->size;
+    uint64_t skip = image->skip;
+    size_t carry = 0;   // A 0xFF held back because its pair may continue in the next chunk
+    bool ok = true;
+    *written = 0;
+
+    while (ok && left > 0) {
+        size_t want = (left < COPY_BUFFER_SIZE - carry) ? left : COPY_BUFFER_SIZE - carry;
+        ssize_t got = pread(fd, buffer + carry, want, pos);
+        STATS_ADD(STAT_SYSCALLS, 1);
+        if (got <= 0) {
+            ok = false; // Read error, or the file ends inside the frame
+            break;
+        }
+        STATS_ADD(STAT_BYTES_READ, got);
+        pos += got;
+        left -= got;
+
+        size_t size = carry + got;
+        carry = 0;
+        if (image->unsync) {
+            if (left > 0 && buffer[size - 1] == 0xFF) {
+                carry = 1;
+                size--;
+            }
+            size = unsync_decode(buffer, buffer, size);
+        }
+
+        size_t drop = (skip < size) ? skip : size;
+        skip -= drop;
+        if (hash) {
+            hash64_update(hash, buffer + drop, size - drop);
+        }
+        if (out_fd >= 0) {
+            ok = write_all(out_fd, buffer + drop, size - drop);
+        }
+        *written += size - drop;
+        if (carry) {
+            buffer[0] = 0xFF;
+        }
+    }
+
+    free(buffer);
+    return ok;
+}
+
+// Streams one image to out_fd (an empty file opened for writing)
+bool art_write_image(int fd, const ArtImage *image, int out_fd, uint64_t *written) {
+    if (image->memory) {
+        *written = image->size;
+        return write_all(out_fd, image->memory, image->size);
+    }
+    if (image->unsync) {
+        return stream_image(fd, image, NULL, out_fd, written);
+    }
+
+    STATS_TIMER_START(copy_start);
+    bool ok = copy_file_region(fd, image->offset, out_fd, 0, image->size) != COPY_FAILED;
+    STATS_ADD(STAT_BYTES_COPIED, ok ? image->size : 0);
+    STATS_TIMER_STOP(PHASE_AUDIO_COPY, copy_start);
+    *written = ok ? image->size : 0;
+    return ok;
+}
+
+bool art_hash_image(int fd, const ArtImage *image, uint64_t *hash) {
+    if (image->memory) {
+        *hash = hash64(image->memory, image->size);
+        return true;
+    }
+
+    Hash64State state;
+    uint64_t hashed;
+    hash64_init(&state);
+    if (!stream_image(fd, image, &state, -1, &hashed)) {
+        return false;
+    }
+    *hash = hash64_final(&state);
+    return true;
+}
+
+// File extension for the image's MIME type or v2.2 format; "bin" when it is not an image type we know
+const char *art_file_extension(const ArtImage *image) {
+    static const char *const types[][2] = {
+        { "image/jpeg", "jpg" }, { "image/jpg", "jpg" }, { "image/png", "png" }, { "image/gif", "gif" },
+        { "image/webp", "webp" }, { "image/bmp", "bmp" }, { "image/tiff", "tif" },
+        { "JPG", "jpg" }, { "PNG", "png" }, { "GIF", "gif" }, { "BMP", "bmp" },
+    };
+    for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+        if (strcasecmp(image->format, types[i][0]) == 0) {
+            return types[i][1];
+        }
+    }
+    return "bin";
+}
+
+// --- Library Extraction ---
+struct ArtExtractor {
+    char *out_dir;
+    bool dedupe;
+    pthread_mutex_t lock;     // Guards the hash set and the counts
+    uint64_t *seen;           // Open-addressing set of content hashes written (0 = empty slot)
+    size_t seen_count;
+    size_t seen_capacity;
+    ArtCounts counts;
+};
+
+typedef struct {
+    ArtExtractor *extractor;
+    const char *path;
+    char stem[256];           // MP3 file name without its extension
+    int index;                // Images of this file seen so far
+} ArtFileJob;
+
+ArtExtractor *art_extractor_create(const char *out_dir, bool dedupe) {
+    ArtExtractor *extractor = calloc(1, sizeof(ArtExtractor));
+    if (!extractor) {
+        return NULL;
+    }
+    extractor->out_dir = strdup(out_dir);
+    extractor->dedupe = dedupe;
+    if (!extractor->out_dir || (mkdir(out_dir, 0755) != 0 && errno != EEXIST)) {
+        free(extractor->out_dir);
+        free(extractor);
+        return NULL;
+    }
+    pthread_mutex_init(&extractor->lock, NULL);
+    return extractor;
+}
+
+void art_extractor_destroy(ArtExtractor *extractor) {
+    if (!extractor) {
+        return;
+    }
+    pthread_mutex_destroy(&extractor->lock);
+    free(extractor->seen);
+    free(extractor->out_dir);
+    free(extractor);
+}
+
+void art_extractor_counts(ArtExtractor *extractor, ArtCounts *counts) {
+    pthread_mutex_lock(&extractor->lock);
+    *counts = extractor->counts;
+    pthread_mutex_unlock(&extractor->lock);
+}
+
+static bool seen_insert_slot(uint64_t *table, size_t capacity, uint64_t hash) {
+    size_t slot = hash & (capacity - 1);
+    while (table[slot] != 0) {
+        if (table[slot] == hash) {
+            return false;
+        }
+        slot = (slot + 1) & (capacity - 1);
+    }
+    table[slot] = hash;
+    return true;
+}
+
+// Claims a content hash; false if another image with the same bytes claimed it first.
+// Called with the lock held.
+static bool claim_hash(ArtExtractor *extractor, uint64_t hash) {
+    hash = hash ? hash : 1; // 0 marks an empty slot
+
+    if ((extractor->seen_count + 1) * 2 > extractor->seen_capacity) {
+        size_t new_capacity = extractor->seen_capacity ? extractor->seen_capacity * 2 : 1024;
+        uint64_t *grown = calloc(new_capacity, sizeof(uint64_t));
+        if (grown) {
+            for (size_t i = 0; i < extractor->seen_capacity; i++) {
+                if (extractor->seen[i]) {
+                    seen_insert_slot(grown, new_capacity, extractor->seen[i]);
+                }
+            }
+            free(extractor->seen);
+            extractor->seen = grown;
+            extractor->seen_capacity = new_capacity;
+        } else if (extractor->seen_count + 1 >= extractor->seen_capacity) {
+            return true; // Out of memory with a full table: write the image rather than lose it
+        }
+    }
+
+    if (!seen_insert_slot(extractor->seen, extractor->seen_capacity, hash)) {
+        return false;
+    }
+    extractor->seen_count++;
+    return true;
+}
+
+// Gives a claim back after its image could not be written, so the next copy is tried.
+// Called with the lock held.
+static void release_hash(ArtExtractor *extractor, uint64_t hash) {
+    hash = hash ? hash : 1;
+    if (!extractor->seen) {
+        return;
+    }
+    size_t mask = extractor->seen_capacity - 1;
+    size_t slot = hash & mask;
+    while (extractor->seen[slot] != hash) {
+        if (extractor->seen[slot] == 0) {
+            return; // Never stored (out of memory when it was claimed)
+        }
+        slot = (slot + 1) & mask;
+    }
+    // Backward-shift deletion: later entries of the probe run move into the hole when their
+    // home slot lies at or before it, so no lookup stops short of them
+    for (size_t next = (slot + 1) & mask; extractor->seen[next] != 0; next = (next + 1) & mask) {
+        size_t home = extractor->seen[next] & mask;
+        if (((next - home) & mask) >= ((next - slot) & mask)) {
+            extractor->seen[slot] = extractor->seen[next];
+            slot = next;
+        }
+    }
+    extractor->seen[slot] = 0;
+    extractor->seen_count--;
+}
+
+static void count_image(ArtExtractor *extractor, bool written, bool duplicate, uint64_t bytes) {
+    pthread_mutex_lock(&extractor->lock);
+    extractor->counts.images += written ? 1 : 0;
+    extractor->counts.duplicates += duplicate ? 1 : 0;
+    extractor->counts.failures += (!written && !duplicate) ? 1 : 0;
+    extractor->counts.bytes_written += bytes;
+    pthread_mutex_unlock(&extractor->lock);
+}
+
+// An image that was not written; with --dedupe its hash is released (see release_hash)
+static void count_failure(ArtExtractor *extractor, uint64_t hash) {
+    if (extractor->dedupe) {
+        pthread_mutex_lock(&extractor->lock);
+        release_hash(extractor, hash);
+        pthread_mutex_unlock(&extractor->lock);
+    }
+    count_image(extractor, false, false, 0);
+}
+
+static void extract_one(int fd, const ArtImage *image, void *user) {
+    ArtFileJob *job = user;
+    ArtExtractor *extractor = job->extractor;
+    const char *extension = art_file_extension(image);
+    char out_path[4096];
+    int out_fd = -1;
+    uint64_t hash = 0;
+    job->index++;
+
+    if (extractor->dedupe) {
+        if (!art_hash_image(fd, image, &hash)) {
+            count_image(extractor, false, false, 0);
+            return;
+        }
+        pthread_mutex_lock(&extractor->lock);
+        bool claimed = claim_hash(extractor, hash);
+        pthread_mutex_unlock(&extractor->lock);
+
+        snprintf(out_path, sizeof(out_path), "%s/%016llx.%s", extractor->out_dir,
+                 (unsigned long long)hash, extension);
+        out_fd = claimed ? open(out_path, O_WRONLY | O_CREAT | O_EXCL, 0644) : -1;
+        if (out_fd < 0 && (!claimed || errno == EEXIST)) {
+            count_image(extractor, false, true, 0); // Written earlier in this run or a previous one
+            return;
+        }
+    } else {
+        // <stem>.<ext>, then <stem>-2.<ext>, ... for a second image or a name already taken
+        for (int n = job->index; out_fd < 0 && n < job->index + 1000; n++) {
+            if (n == 1) {
+                snprintf(out_path, sizeof(out_path), "%s/%s.%s", extractor->out_dir, job->stem, extension);
+            } else {
+                snprintf(out_path, sizeof(out_path), "%s/%s-%d.%s", extractor->out_dir, job->stem, n, extension);
+            }
+            out_fd = open(out_path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+            if (out_fd < 0 && errno != EEXIST) {
+                break;
+            }
+        }
+    }
+    STATS_ADD(STAT_SYSCALLS, 1);
+
+    if (out_fd < 0) {
+        fprintf(stderr, "Error: Could not create an image file for %s: %s\n", job->path, strerror(errno));
+        count_failure(extractor, hash);
+        return;
+    }
+
+    uint64_t written = 0;
+    bool ok = art_write_image(fd, image, out_fd, &written);
+    if (close(out_fd) != 0) {
+        ok = false;
+    }
+    if (!ok) {
+        fprintf(stderr, "Error: Could not extract the artwork of %s.\n", job->path);
+        unlink(out_path);
+        count_failure(extractor, hash);
+        return;
+    }
+    printf("%s\t%s\t%s\n", job->path, out_path, image->format);
+    count_image(extractor, true, false, written);
+}
+
+bool art_extract_file(ArtExtractor *extractor, const char *path) {
+    ArtFileJob job;
+    job.extractor = extractor;
+    job.path = path;
+    job.index = 0;
+
+    const char *name = strrchr(path, '/');
+    name = name ? name + 1 : path;
+    snprintf(job.stem, sizeof(job.stem), "%s", name);
+    char *dot = strrchr(job.stem, '.');
+    if (dot && dot != job.stem) {
+        *dot = '\0';
+    }
+
+    int fd = open(path, O_RDONLY);
+    STATS_ADD(STAT_SYSCALLS, 1);
+    int found = (fd >= 0) ? art_find_images(fd, extract_one, &job) : -1;
+    if (fd >= 0) {
+        close(fd);
+    }
+
+    pthread_mutex_lock(&extractor->lock);
+    extractor->counts.files++;
+    pthread_mutex_unlock(&extractor->lock);
+    return found >= 0;
+}
+
+void art_extract_visit(const char *path, void *extractor) {
+    art_extract_file(extractor, path);
+}
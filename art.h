@@ -0,0 +1,49 @@
+#ifndef ART_H
+#define ART_H
+
+#include "types.h"
+
+// --- Artwork (APIC / v2.2 PIC) Extraction ---
+// The tag is walked frame header by frame header with small reads, so an image is never
+// read just to be skipped. Images go from the MP3 to the output file inside the kernel
+// (copy_file_range / sendfile, see copy_file_region); unsynchronised frames are decoded
+// through one COPY_BUFFER_SIZE buffer. Memory use does not depend on the image size.
+typedef struct {
+    char format[64];          // MIME type ("image/jpeg"), or the v2.2 image format ("JPG")
+    uint8_t picture_type;     // 3 = front cover
+    uint64_t offset;          // File position of the stored bytes
+    uint64_t size;            // Stored bytes from offset
+    uint32_t skip;            // Unsynchronised frames: decoded bytes before the image starts
+    bool unsync;              // Stored bytes must be decoded on the way out
+    const uint8_t *memory;    // Image already in memory (tag unsynchronised as a whole), or NULL
+} ArtImage;
+
+// Called once per picture frame; the image is only valid during the call
+typedef void (*ArtImageFn)(int fd, const ArtImage *image, void *user);
+
+// Returns the number of picture frames reported, or -1 if the file has no ID3v2 tag
+int art_find_images(int fd, ArtImageFn fn, void *user);
+bool art_write_image(int fd, const ArtImage *image, int out_fd, uint64_t *written);
+bool art_hash_image(int fd, const ArtImage *image, uint64_t *hash);
+const char *art_file_extension(const ArtImage *image);
+
+// --- Library Extraction (thread-safe; one extractor shared by every worker) ---
+// Without dedupe each image is written as <stem>.<ext>, <stem>-2.<ext>, ... after its MP3.
+// With dedupe it is written once as <content hash>.<ext>; later copies are only counted.
+typedef struct ArtExtractor ArtExtractor;
+
+typedef struct {
+    uint64_t files;           // MP3 files looked at
+    uint64_t images;          // Images written
+    uint64_t duplicates;      // Images skipped because the same bytes were already written
+    uint64_t failures;
+    uint64_t bytes_written;
+} ArtCounts;
+
+ArtExtractor *art_extractor_create(const char *out_dir, bool dedupe);
+void art_extractor_destroy(ArtExtractor *extractor);
+bool art_extract_file(ArtExtractor *extractor, const char *path);
+void art_extract_visit(const char *path, void *extractor); // ScanVisitFn for scan_for_each_file
+void art_extractor_counts(ArtExtractor *extractor, ArtCounts *counts);
+
+#endif // ART_H
@@ -0,0 +1,456 @@
+#define _GNU_SOURCE // pread, O_CLOEXEC
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "audio.h"
+#include "read.h"
+#include "simd.h"
+#include "pool.h"
+#include "stats.h"
+
+// --- Frame Headers ---
+typedef struct {
+    uint8_t version;          // 10, 20 or 25
+    uint8_t layer;
+    uint8_t channels;
+    uint32_t bitrate;         // kbit/s
+    uint32_t sample_rate;
+    uint32_t length;          // Bytes, header included
+    uint32_t samples;         // Samples per channel
+} MpegFrame;
+
+static const uint16_t bitrate_table[2][3][15] = {
+    {   // MPEG-1: layer I, II, III
+        { 0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448 },
+        { 0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384 },
+        { 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320 },
+    },
+    {   // MPEG-2 and 2.5
+        { 0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256 },
+        { 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160 },
+        { 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160 },
+    },
+};
+
+static const uint32_t sample_rate_table[3][3] = {
+    { 44100, 48000, 32000 },  // MPEG-1
+    { 22050, 24000, 16000 },  // MPEG-2
+    { 11025, 12000, 8000 },   // MPEG-2.5
+};
+
+// Free-format (bitrate index 0) streams are rare and have no length in the header; they are
+// treated as no audio found.
+static bool decode_frame(const uint8_t *p, MpegFrame *frame) {
+    if (p[0] != 0xFF || (p[1] & 0xE0) != 0xE0) {
+        return false;
+    }
+    unsigned version_bits = (p[1] >> 3) & 3;  // 0 = 2.5, 1 = reserved, 2 = 2, 3 = 1
+    unsigned layer_bits = (p[1] >> 1) & 3;    // 0 = reserved, 1 = III, 2 = II, 3 = I
+    unsigned bitrate_index = p[2] >> 4;
+    unsigned rate_index = (p[2] >> 2) & 3;
+    if (version_bits == 1 || layer_bits == 0 || bitrate_index == 0 || bitrate_index == 15 || rate_index == 3) {
+        return false;
+    }
+
+    int v = (version_bits == 3) ? 0 : (version_bits == 2) ? 1 : 2;
+    uint32_t padding = (p[2] >> 1) & 1;
+    frame->version = (v == 0) ? 10 : (v == 1) ? 20 : 25;
+    frame->layer = 4 - layer_bits;
+    frame->channels = ((p[3] >> 6) == 3) ? 1 : 2;
+    frame->bitrate = bitrate_table[v != 0][frame->layer - 1][bitrate_index];
+    frame->sample_rate = sample_rate_table[v][rate_index];
+    uint32_t bits_per_sec = frame->bitrate * 1000;
+    if (frame->layer == 1) {
+        frame->samples = 384;
+        frame->length = (12 * bits_per_sec / frame->sample_rate + padding) * 4;
+    } else {
+        frame->samples = (frame->layer == 3 && v != 0) ? 576 : 1152;
+        frame->length = frame->samples / 8 * bits_per_sec / frame->sample_rate + padding;
+    }
+    return true;
+}
+
+static bool same_stream(const MpegFrame *a, const MpegFrame *b) {
+    return a->version == b->version && a->layer == b->layer && a->sample_rate == b->sample_rate;
+}
+
+static uint32_t read_be32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static uint32_t read_le32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// --- Read Window: one buffer over [0, end) of the file, refilled with pread on demand ---
+typedef struct {
+    int fd;
+    uint64_t end;             // End of the audio
+    uint8_t *data;
+    size_t capacity;
+    uint64_t start;           // File position of data[0]
+    size_t size;
+} AudioWindow;
+
+// Pointer to [pos, pos + need) of the file, or NULL if the audio ends first
+static const uint8_t *window_at(AudioWindow *window, uint64_t pos, size_t need) {
+    if (pos + need > window->end) {
+        return NULL;
+    }
+    if (pos < window->start || pos + need > window->start + window->size) {
+        uint64_t want = window->end - pos;
+        ssize_t got = pread(window->fd, window->data, want < window->capacity ? want : window->capacity, pos);
+        STATS_ADD(STAT_SYSCALLS, 1);
+        window->start = pos;
+        window->size = got > 0 ? (size_t)got : 0;
+        STATS_ADD(STAT_BYTES_READ, window->size);
+        if (window->size < need) {
+            return NULL;
+        }
+    }
+    return window->data + (pos - window->start);
+}
+
+// First frame at or after pos (of the given stream, or of any if stream is NULL) that the
+// next frame follows directly, or that ends exactly at the end of the audio. A lone 0xFFEx
+// in the audio data or in junk before it is very unlikely to pass both checks.
+static bool find_frame(AudioWindow *window, uint64_t pos, const MpegFrame *stream,
+                       uint64_t *found, MpegFrame *frame) {
+    while (pos + 4 <= window->end) {
+        const uint8_t *p = window_at(window, pos, 4);
+        if (!p) {
+            return false;
+        }
+        size_t available = window->start + window->size - pos;
+        size_t i = frame_sync_find(p, available);
+        if (i + 4 > available) {
+            // Nothing here, or a header cut by the end of the window: move on, keeping the
+            // last bytes so a header across the edge is seen whole
+            pos += (i < available) ? i : available - 3;
+            if (window->start + window->size >= window->end && i + 4 > available) {
+                return false;
+            }
+            window->size = 0;
+            continue;
+        }
+
+        uint64_t candidate = pos + i;
+        MpegFrame first;
+        if (decode_frame(p + i, &first) && (!stream || same_stream(&first, stream))) {
+            uint64_t next = candidate + first.length;
+            const uint8_t *q = (next + 4 <= window->end) ? window_at(window, next, 4) : NULL;
+            MpegFrame second;
+            if (next == window->end || (q && decode_frame(q, &second) && same_stream(&first, &second))) {
+                *found = candidate;
+                *frame = first;
+                return true;
+            }
+        }
+        pos = candidate + 1;
+    }
+    return false;
+}
+
+// --- Frame Walk ---
+typedef struct {
+    uint64_t first;           // First frame counted (UINT64_MAX if none)
+    uint64_t end;             // Where the walk stopped: the first frame at or after `stop`
+    uint64_t frames;
+    uint64_t samples;
+    uint64_t bytes;
+    uint32_t first_bitrate;
+    bool bitrate_varies;
+} WalkTotals;
+
+// Counts frames from pos until one starts at or after stop (or max_frames were counted).
+// With resync, pos need not be a frame start: the walk begins at the next real frame.
+// Junk between frames is skipped the same way.
+static void walk_frames(AudioWindow *window, const MpegFrame *stream, uint64_t pos, uint64_t stop,
+                        uint64_t max_frames, bool resync, WalkTotals *totals) {
+    memset(totals, 0, sizeof(WalkTotals));
+    totals->first = UINT64_MAX;
+    MpegFrame frame;
+    if (resync && !find_frame(window, pos, stream, &pos, &frame)) {
+        totals->end = window->end;
+        return;
+    }
+    totals->first = pos;
+
+    while (pos < stop && totals->frames < max_frames) {
+        const uint8_t *p = window_at(window, pos, 4);
+        if (!p) {
+            break;
+        }
+        if (!decode_frame(p, &frame) || !same_stream(&frame, stream) || pos + frame.length > window->end) {
+            if (!find_frame(window, pos + 1, stream, &pos, &frame)) {
+                pos = window->end;
+                break;
+            }
+            continue;
+        }
+        if (totals->frames == 0) {
+            totals->first_bitrate = frame.bitrate;
+        } else if (frame.bitrate != totals->first_bitrate) {
+            totals->bitrate_varies = true;
+        }
+        totals->frames++;
+        totals->samples += frame.samples;
+        totals->bytes += frame.length;
+        pos += frame.length;
+    }
+    totals->end = pos;
+}
+
+typedef struct {
+    int fd;
+    uint64_t audio_end;
+    const MpegFrame *stream;
+    uint64_t start;
+    uint64_t stop;
+    bool resync;
+    bool ok;
+    WalkTotals totals;
+} WalkChunk;
+
+static void *walk_chunk(void *arg) {
+    WalkChunk *chunk = arg;
+    AudioWindow window = { chunk->fd, chunk->audio_end, malloc(COPY_BUFFER_SIZE), COPY_BUFFER_SIZE, 0, 0 };
+    chunk->ok = window.data != NULL;
+    if (chunk->ok) {
+        walk_frames(&window, chunk->stream, chunk->start, chunk->stop, UINT64_MAX, chunk->resync, &chunk->totals);
+    }
+    free(window.data);
+    return NULL;
+}
+
+// Every frame from the first one, in chunks walked side by side. Each chunk after the first
+// starts at the first real frame past its boundary; that is normally exactly where the chunk
+// before it stopped. Where it is not (a false sync), the chunk is walked again from there.
+static bool walk_all_frames(int fd, const MpegFrame *stream, uint64_t offset, uint64_t end,
+                            int threads, WalkTotals *totals) {
+    uint64_t size = end - offset;
+    if (threads <= 0) {
+        threads = pool_default_workers();
+    }
+    uint64_t count = (threads > 1) ? size / AUDIO_CHUNK_MIN : 1;
+    count = count < 1 ? 1 : count > (uint64_t)threads ? (uint64_t)threads : count;
+
+    WalkChunk *chunks = calloc(count, sizeof(WalkChunk));
+    pthread_t *workers = calloc(count, sizeof(pthread_t));
+    bool *started = calloc(count, sizeof(bool));
+    if (!chunks || !workers || !started) {
+        free(chunks); free(workers); free(started);
+        return false;
+    }
+    for (uint64_t i = 0; i < count; i++) {
+        chunks[i] = (WalkChunk){ fd, end, stream, offset + size * i / count, offset + size * (i + 1) / count, i > 0, false, { 0 } };
+        started[i] = i > 0 && pthread_create(&workers[i], NULL, walk_chunk, &chunks[i]) == 0;
+    }
+    walk_chunk(&chunks[0]);
+
+    bool ok = chunks[0].ok;
+    memset(totals, 0, sizeof(WalkTotals));
+    uint64_t expected = chunks[0].totals.end;
+    *totals = chunks[0].totals;
+    for (uint64_t i = 1; i < count; i++) {
+        if (started[i]) {
+            pthread_join(workers[i], NULL);
+        }
+        WalkChunk *chunk = &chunks[i];
+        if (!started[i] || !chunk->ok || chunk->totals.first != expected) {
+            chunk->start = expected;
+            chunk->resync = false;
+            walk_chunk(chunk);
+            ok = ok && chunk->ok;
+        }
+        if (chunk->totals.frames > 0) {
+            if (totals->frames == 0) {
+                totals->first_bitrate = chunk->totals.first_bitrate;
+            } else if (chunk->totals.first_bitrate != totals->first_bitrate) {
+                totals->bitrate_varies = true;
+            }
+        }
+        totals->bitrate_varies |= chunk->totals.bitrate_varies;
+        totals->frames += chunk->totals.frames;
+        totals->samples += chunk->totals.samples;
+        totals->bytes += chunk->totals.bytes;
+        expected = chunk->totals.end;
+    }
+    totals->end = expected;
+
+    free(chunks);
+    free(workers);
+    free(started);
+    return ok;
+}
+
+// --- Layout of the File ---
+
+// End of the ID3v2 tag(s) at the start of the file
+static uint64_t audio_start(int fd) {
+    uint64_t pos = 0;
+    for (int tags = 0; tags < 4; tags++) {
+        uint8_t buffer[ID3_HEADER_SIZE];
+        ID3Header header;
+        if (pread(fd, buffer, ID3_HEADER_SIZE, pos) != ID3_HEADER_SIZE || !decode_id3_header(buffer, &header)) {
+            break;
+        }
+        pos += ID3_HEADER_SIZE + (uint64_t)header.size + ((header.flags & ID3_FLAG_FOOTER) ? ID3_HEADER_SIZE : 0);
+    }
+    return pos;
+}
+
+// Start of the ID3v1 trailer and APEv2 tag at the end of the file, if there are any
+static uint64_t audio_end(int fd, uint64_t end) {
+    uint8_t trailer[ID3V1_TAG_SIZE];
+    if (end >= ID3V1_TAG_SIZE && pread(fd, trailer, ID3V1_TAG_SIZE, end - ID3V1_TAG_SIZE) == ID3V1_TAG_SIZE &&
+        memcmp(trailer, "TAG", 3) == 0) {
+        end -= ID3V1_TAG_SIZE;
+    }
+    // APEv2 footer: "APETAGEX", version, size (items + footer), count, flags (bit 31: has header)
+    uint8_t footer[32];
+    if (end >= sizeof(footer) && pread(fd, footer, sizeof(footer), end - sizeof(footer)) == sizeof(footer) &&
+        memcmp(footer, "APETAGEX", 8) == 0) {
+        uint64_t size = read_le32(footer + 12) + ((read_le32(footer + 20) & 0x80000000u) ? 32 : 0);
+        if (size <= end) {
+            end -= size;
+        }
+    }
+    return end;
+}
+
+// Xing/Info (after the side information) or VBRI (at a fixed offset) in the first frame
+static bool read_vbr_header(const uint8_t *p, const MpegFrame *frame, AudioInfo *info, uint64_t *stream_bytes) {
+    size_t side_info = (frame->version == 10) ? (frame->channels == 1 ? 17 : 32)
+                                              : (frame->channels == 1 ? 9 : 17);
+    size_t x = 4 + side_info;
+    if (frame->layer == 3 && x + 12 <= frame->length &&
+        (memcmp(p + x, "Xing", 4) == 0 || memcmp(p + x, "Info", 4) == 0)) {
+        uint32_t flags = read_be32(p + x + 4);
+        if (!(flags & 1)) {
+            return false; // No frame count
+        }
+        info->frames = read_be32(p + x + 8);
+        *stream_bytes = ((flags & 2) && x + 16 <= frame->length) ? read_be32(p + x + 12) : 0;
+        info->vbr = p[x] == 'X';
+        info->source = AUDIO_FROM_XING;
+        return true;
+    }
+
+    size_t v = 4 + 32;
+    if (v + 18 <= frame->length && memcmp(p + v, "VBRI", 4) == 0) {
+        *stream_bytes = read_be32(p + v + 10);
+        info->frames = read_be32(p + v + 14);
+        info->vbr = true;
+        info->source = AUDIO_FROM_VBRI;
+        return true;
+    }
+    return false;
+}
+
+bool audio_payload_range(int fd, uint64_t file_size, uint64_t *start, uint64_t *end) {
+    *start = audio_start(fd);
+    *end = audio_end(fd, file_size);
+    return *start < *end;
+}
+
+bool audio_read_info(int fd, AudioScanMode mode, int threads, AudioInfo *info) {
+    memset(info, 0, sizeof(AudioInfo));
+    struct stat st;
+    if (mode == AUDIO_SCAN_NONE || fstat(fd, &st) != 0) {
+        return false;
+    }
+    uint64_t start = audio_start(fd);
+    uint64_t end = audio_end(fd, (uint64_t)st.st_size);
+    if (start >= end) {
+        return false;
+    }
+
+    AudioWindow window = { fd, end, malloc(AUDIO_PROBE_SIZE), AUDIO_PROBE_SIZE, 0, 0 };
+    MpegFrame first;
+    uint64_t offset;
+    if (!window.data || !find_frame(&window, start, NULL, &offset, &first)) {
+        free(window.data);
+        return false;
+    }
+    info->version = first.version;
+    info->layer = first.layer;
+    info->channels = first.channels;
+    info->sample_rate = first.sample_rate;
+    info->audio_offset = offset;
+    info->audio_size = end - offset;
+
+    uint64_t stream_bytes = 0;
+    const uint8_t *p = window_at(&window, offset, first.length);
+    if (p && read_vbr_header(p, &first, info, &stream_bytes)) {
+        info->duration_ms = info->frames * first.samples * 1000 / first.sample_rate;
+        uint64_t bytes = stream_bytes ? stream_bytes : info->audio_size;
+        info->bitrate = info->duration_ms ? (uint32_t)(bytes * 8 / info->duration_ms) : first.bitrate;
+    } else {
+        WalkTotals totals;
+        bool walked;
+        if (mode == AUDIO_SCAN_FULL) {
+            walked = walk_all_frames(fd, &first, offset, end, threads, &totals);
+            info->source = AUDIO_FROM_WALK;
+        } else {
+            walk_frames(&window, &first, offset, end, AUDIO_SAMPLE_FRAMES, false, &totals);
+            walked = true;
+            info->source = AUDIO_FROM_ESTIMATE;
+        }
+        if (!walked || totals.frames == 0 || totals.samples == 0) {
+            free(window.data);
+            info->source = AUDIO_FROM_NONE;
+            return false;
+        }
+
+        info->vbr = totals.bitrate_varies;
+        uint64_t walked_ms = totals.samples * 1000 / first.sample_rate;
+        uint32_t average = walked_ms ? (uint32_t)(totals.bytes * 8 / walked_ms) : first.bitrate;
+        if (mode == AUDIO_SCAN_FULL) {
+            info->frames = totals.frames;
+            info->duration_ms = walked_ms;
+            info->bitrate = info->vbr ? average : first.bitrate;
+        } else {
+            // Constant bitrate: the size gives the duration. Otherwise the first frames'
+            // average stands in for the whole file.
+            info->bitrate = info->vbr ? average : first.bitrate;
+            info->duration_ms = info->bitrate ? info->audio_size * 8 / info->bitrate : 0;
+            info->frames = info->duration_ms * first.sample_rate / 1000 / first.samples;
+        }
+    }
+    free(window.data);
+    return true;
+}
+
+bool audio_read_file(const char *path, AudioScanMode mode, int threads, AudioInfo *info) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    STATS_ADD(STAT_SYSCALLS, 1);
+    if (fd < 0) {
+        memset(info, 0, sizeof(AudioInfo));
+        return false;
+    }
+    bool ok = audio_read_info(fd, mode, threads, info);
+    close(fd);
+    return ok;
+}
+
+bool audio_parse_mode(const char *name, AudioScanMode *mode) {
+    if (strcmp(name, "none") == 0)      *mode = AUDIO_SCAN_NONE;
+    else if (strcmp(name, "fast") == 0) *mode = AUDIO_SCAN_FAST;
+    else if (strcmp(name, "full") == 0) *mode = AUDIO_SCAN_FULL;
+    else return false;
+    return true;
+}
+
+const char *audio_source_name(AudioSource source) {
+    static const char *const names[] = { "none", "xing", "vbri", "estimate", "walk" };
+    return names[source];
+}
+
+const char *audio_version_name(uint8_t version) {
+    return (version == 10) ? "MPEG-1" : (version == 20) ? "MPEG-2" : "MPEG-2.5";
+}
@@ -0,0 +1,23 @@
+#ifndef AUDIO_H
+#define AUDIO_H
+
+#include "types.h"
+
+// --- MPEG Audio Info (duration, bitrate) ---
+// The audio starts after the ID3v2 tag(s) and ends before any APEv2 tag and ID3v1 trailer.
+// The first frame is found with the vectorized sync search (frame_sync_find) and accepted
+// only if the next frame follows it. A Xing/Info or VBRI header in that frame gives the
+// duration at once. Without one, AUDIO_SCAN_FAST checks the first AUDIO_SAMPLE_FRAMES
+// frames and estimates from the audio size, while AUDIO_SCAN_FULL counts every frame,
+// split over up to `threads` threads (0 = one per CPU) for files of several AUDIO_CHUNK_MIN chunks.
+bool audio_read_info(int fd, AudioScanMode mode, int threads, AudioInfo *info);
+bool audio_read_file(const char *path, AudioScanMode mode, int threads, AudioInfo *info);
+
+// Bytes between the ID3v2 tag(s) and the APEv2/ID3v1 trailers; false if there are none
+bool audio_payload_range(int fd, uint64_t file_size, uint64_t *start, uint64_t *end);
+
+bool audio_parse_mode(const char *name, AudioScanMode *mode);
+const char *audio_source_name(AudioSource source);
+const char *audio_version_name(uint8_t version);  // "MPEG-1", "MPEG-2", "MPEG-2.5"
+
+#endif // AUDIO_H
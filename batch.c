@@ -0,0 +1,685 @@
+#define _GNU_SOURCE // sync_file_range
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include "batch.h"
+#include "edit.h"
+#include "helper.h"
+#include "hash.h"
+#include "stats.h"
+
+// --- Journal Layout ---
+// JOURNAL_MAGIC, then records: JournalRecord followed by `size` payload bytes whose hash64 is
+// `checksum`. A record cut short by a crash fails its checksum and ends the journal there.
+// Integers are stored in host byte order: a journal is only ever recovered on the machine
+// that wrote it.
+#define JOURNAL_MAGIC "MP3EDJ01"
+#define JOURNAL_MAGIC_SIZE 8
+
+enum { RECORD_EDIT = 1, RECORD_COMMIT = 2 };
+enum { KIND_IN_PLACE = 0, KIND_REWRITE = 1 };
+
+typedef struct {
+    uint32_t type;
+    uint32_t size;
+    uint64_t checksum;
+} JournalRecord;
+
+// Payload of RECORD_EDIT: this, the path and each edit as NUL-terminated strings
+// (frame ID, then value), then old_size bytes of the original tag (in-place edits only)
+typedef struct {
+    uint32_t group;
+    uint32_t seq;             // Record number; names the rewrite's backup link
+    uint8_t kind;
+    uint8_t edit_count;
+    uint16_t reserved;
+    uint32_t old_size;
+} JournalEdit;
+
+// --- Batch State ---
+typedef struct {
+    char *path;
+    int fd;                   // In-place: open between the write and its fdatasync
+    uint8_t *region;          // In-place: new header and body for the start of the file
+    size_t region_size;
+    char *temp_path;          // Rewrite: finished copy waiting to be renamed over path
+    char *backup_path;        // Rewrite: hard link to the original until the batch ends
+} BatchPending;
+
+struct EditBatch {
+    char *journal_path;
+    int journal_fd;
+    bool failed;              // A journal or file write failed: nothing more is applied
+
+    uint32_t group;
+    uint32_t seq;
+    uint32_t group_files;
+    BatchPending *pending;
+    uint32_t pending_count;
+    size_t pending_bytes;
+
+    char **backups;           // Every backup link of the batch, dropped by edit_batch_finish
+    uint32_t backup_count;
+    uint32_t backup_capacity;
+
+    BatchCounts counts;
+};
+
+static bool write_record(int fd, uint32_t type, const void *head, size_t head_size,
+                         const void *tail, size_t tail_size) {
+    Hash64State state;
+    hash64_init(&state);
+    hash64_update(&state, head, head_size);
+    if (tail_size > 0) {
+        hash64_update(&state, tail, tail_size);
+    }
+    JournalRecord record = { type, (uint32_t)(head_size + tail_size), hash64_final(&state) };
+
+    struct iovec iov[3] = {
+        { &record, sizeof(record) },
+        { (void *)head, head_size },
+        { (void *)tail, tail_size },
+    };
+    size_t total = sizeof(record) + head_size + tail_size;
+    STATS_ADD(STAT_SYSCALLS, 1);
+    STATS_ADD(STAT_BYTES_WRITTEN, total);
+    return writev(fd, iov, 3) == (ssize_t)total;
+}
+
+// Path, frame IDs and values, each NUL-terminated, after the JournalEdit
+static uint8_t *encode_edit(const JournalEdit *edit, const char *path, const EditSet *set, size_t *size) {
+    size_t total = sizeof(JournalEdit) + strlen(path) + 1;
+    for (int i = 0; i < set->count; i++) {
+        total += strlen(set->edits[i].frame_id) + 1 + strlen(set->edits[i].value) + 1;
+    }
+    uint8_t *head = malloc(total);
+    if (!head) {
+        return NULL;
+    }
+    memcpy(head, edit, sizeof(JournalEdit));
+    char *p = (char *)head + sizeof(JournalEdit);
+    p = stpcpy(p, path) + 1;
+    for (int i = 0; i < set->count; i++) {
+        p = stpcpy(p, set->edits[i].frame_id) + 1;
+        p = stpcpy(p, set->edits[i].value) + 1;
+    }
+    *size = total;
+    return head;
+}
+
+EditBatch *edit_batch_begin(const char *journal_path, uint32_t group_files) {
+    int fd = open(journal_path, O_WRONLY | O_CREAT | O_EXCL | O_APPEND, 0644);
+    if (fd < 0) {
+        if (errno == EEXIST) {
+            fprintf(stderr, "Error: Journal %s exists: an earlier batch was interrupted. "
+                            "Recover it first (--resume or --rollback).\n", journal_path);
+        } else {
+            perror("Error creating batch journal");
+        }
+        return NULL;
+    }
+
+    EditBatch *batch = calloc(1, sizeof(EditBatch));
+    if (batch) {
+        batch->journal_path = strdup(journal_path);
+        batch->journal_fd = fd;
+        batch->group_files = group_files ? group_files : EDIT_GROUP_FILES;
+        batch->pending = calloc(batch->group_files, sizeof(BatchPending));
+    }
+    // The journal must be complete on disk and reachable before it is relied on
+    if (!batch || !batch->journal_path || !batch->pending ||
+        write(fd, JOURNAL_MAGIC, JOURNAL_MAGIC_SIZE) != JOURNAL_MAGIC_SIZE ||
+        fdatasync(fd) != 0 || !sync_parent_dir(journal_path)) {
+        perror("Error creating batch journal");
+        close(fd);
+        unlink(journal_path);
+        if (batch) {
+            free(batch->journal_path);
+            free(batch->pending);
+            free(batch);
+        }
+        return NULL;
+    }
+    return batch;
+}
+
+static void free_pending(BatchPending *pending) {
+    if (pending->fd >= 0) {
+        close(pending->fd);
+    }
+    free(pending->path);
+    free(pending->region);
+    free(pending->temp_path);
+    free(pending->backup_path);
+    memset(pending, 0, sizeof(BatchPending));
+}
+
+static bool keep_backup(EditBatch *batch, char *backup_path) {
+    if (batch->backup_count == batch->backup_capacity) {
+        uint32_t capacity = batch->backup_capacity ? batch->backup_capacity * 2 : 64;
+        char **backups = realloc(batch->backups, capacity * sizeof(char *));
+        if (!backups) {
+            return false;
+        }
+        batch->backups = backups;
+        batch->backup_capacity = capacity;
+    }
+    batch->backups[batch->backup_count++] = backup_path;
+    return true;
+}
+
+static size_t dir_length(const char *path) {
+    const char *slash = strrchr(path, '/');
+    return slash ? (size_t)(slash - path) : 0;
+}
+
+static int compare_dirs(const void *a, const void *b) {
+    const char *pa = *(const char *const *)a;
+    const char *pb = *(const char *const *)b;
+    size_t la = dir_length(pa), lb = dir_length(pb);
+    int c = memcmp(pa, pb, la < lb ? la : lb);
+    return c ? c : (la > lb) - (la < lb);
+}
+
+// One fsync per directory that had a rename in it
+static void sync_renamed_dirs(char **paths, uint32_t count) {
+    qsort(paths, count, sizeof(char *), compare_dirs);
+    for (uint32_t i = 0; i < count; i++) {
+        if (i > 0 && compare_dirs(&paths[i - 1], &paths[i]) == 0) {
+            continue;
+        }
+        STATS_ADD(STAT_SYSCALLS, 3);
+        if (!sync_parent_dir(paths[i])) {
+            perror("Warning: could not sync a directory after renaming");
+        }
+    }
+}
+
+// Makes the group's undo records durable, then writes every file of the group and waits
+// for all of them at once. The COMMIT record goes out with the next journal sync.
+static bool flush_group(EditBatch *batch) {
+    if (batch->pending_count == 0) {
+        return true;
+    }
+
+    STATS_ADD(STAT_SYSCALLS, 1);
+    bool ok = fdatasync(batch->journal_fd) == 0;
+    if (!ok) {
+        perror("Error syncing batch journal");
+        batch->failed = true;
+    }
+
+    char **renamed = malloc(batch->pending_count * sizeof(char *));
+    uint32_t renamed_count = 0;
+    bool *written = calloc(batch->pending_count, sizeof(bool));
+    if (!renamed || !written) {
+        ok = false;
+    }
+
+    // Start every write before waiting for any
+    STATS_TIMER_START(write_start);
+    for (uint32_t i = 0; ok && i < batch->pending_count; i++) {
+        BatchPending *p = &batch->pending[i];
+        if (p->region) {
+            p->fd = open(p->path, O_WRONLY);
+            written[i] = p->fd >= 0 &&
+                         pwrite(p->fd, p->region, p->region_size, 0) == (ssize_t)p->region_size;
+            if (written[i]) {
+                sync_file_range(p->fd, 0, p->region_size, SYNC_FILE_RANGE_WRITE);
+            }
+            STATS_ADD(STAT_SYSCALLS, 3);
+            STATS_ADD(STAT_BYTES_WRITTEN, p->region_size);
+        } else {
+            // The copy's write-back started when it was written; wait for it before the
+            // rename can make it the only version of the file
+            int temp_fd = open(p->temp_path, O_RDONLY);
+            bool synced = temp_fd >= 0 && fdatasync(temp_fd) == 0;
+            if (temp_fd >= 0) {
+                close(temp_fd);
+            }
+            unlink(p->backup_path); // Left over from an earlier batch that was recovered
+            written[i] = synced && link(p->path, p->backup_path) == 0 &&
+                         rename(p->temp_path, p->path) == 0;
+            STATS_ADD(STAT_SYSCALLS, 6);
+            if (written[i]) {
+                renamed[renamed_count++] = p->path;
+                if (!keep_backup(batch, p->backup_path)) {
+                    unlink(p->backup_path);
+                    free(p->backup_path);
+                }
+                p->backup_path = NULL;
+            } else {
+                unlink(p->backup_path);
+            }
+        }
+        if (!written[i]) {
+            fprintf(stderr, "Error writing %s: %s\n", p->path, strerror(errno));
+        }
+    }
+    STATS_TIMER_STOP(PHASE_TAG_WRITE, write_start);
+
+    STATS_TIMER_START(sync_start);
+    for (uint32_t i = 0; i < batch->pending_count; i++) {
+        BatchPending *p = &batch->pending[i];
+        if (p->region && written && written[i]) {
+            STATS_ADD(STAT_SYSCALLS, 2);
+            written[i] = fdatasync(p->fd) == 0;
+            written[i] = close(p->fd) == 0 && written[i];
+            p->fd = -1;
+            if (!written[i]) {
+                fprintf(stderr, "Error syncing %s: %s\n", p->path, strerror(errno));
+            }
+        }
+    }
+    if (renamed) {
+        sync_renamed_dirs(renamed, renamed_count);
+    }
+    STATS_TIMER_STOP(PHASE_RENAME, sync_start);
+
+    // A file that failed may be half written. The group is then left uncommitted and the batch
+    // stops, keeping the journal so edit_batch_recover can put every file of it right.
+    for (uint32_t i = 0; i < batch->pending_count; i++) {
+        BatchPending *p = &batch->pending[i];
+        if (!written || !written[i]) {
+            ok = false;
+        }
+        if (written && written[i]) {
+            batch->counts.files++;
+            if (p->region) {
+                batch->counts.in_place++;
+            } else {
+                batch->counts.rewritten++;
+            }
+            edit_note_written(p->path);
+        } else {
+            batch->counts.failures++;
+            if (p->temp_path) {
+                unlink(p->temp_path);
+            }
+        }
+        free_pending(p);
+    }
+
+    uint32_t group = batch->group;
+    if (!ok) {
+        batch->failed = true;
+    } else if (!write_record(batch->journal_fd, RECORD_COMMIT, &group, sizeof(group), NULL, 0)) {
+        perror("Error writing batch journal");
+        batch->failed = true;
+        ok = false;
+    }
+    if (ok) {
+        batch->counts.groups++;
+    }
+
+    free(renamed);
+    free(written);
+    batch->group++;
+    batch->pending_count = 0;
+    batch->pending_bytes = 0;
+    return ok;
+}
+
+bool edit_batch_apply(EditBatch *batch, const char *filepath, const EditSet *set) {
+    if (batch->failed) {
+        batch->counts.failures++;
+        return false;
+    }
+    // A group holds each file once: its undo record must describe the file as it is on disk
+    for (uint32_t i = 0; i < batch->pending_count; i++) {
+        if (strcmp(batch->pending[i].path, filepath) == 0) {
+            flush_group(batch);
+            break;
+        }
+    }
+
+    EditPlan plan;
+    if (!edit_plan(filepath, set, &plan)) {
+        edit_report_error(filepath, plan.status, plan.sys_errno);
+        batch->counts.failures++;
+        return false;
+    }
+
+    BatchPending *p = &batch->pending[batch->pending_count];
+    memset(p, 0, sizeof(BatchPending));
+    p->fd = -1;
+    p->path = strdup(filepath);
+    JournalEdit edit = { batch->group, batch->seq, plan.in_place ? KIND_IN_PLACE : KIND_REWRITE,
+                         (uint8_t)set->count, 0, 0 };
+    bool ok = p->path != NULL;
+
+    if (ok && plan.in_place) {
+        p->region = edit_plan_region(&plan, &p->region_size);
+        edit.old_size = (uint32_t)p->region_size; // The old bytes this write covers
+        ok = p->region != NULL;
+    } else if (ok) {
+        char suffix[32];
+        snprintf(suffix, sizeof(suffix), "%s.%u", BACKUP_SUFFIX, batch->seq);
+        p->temp_path = path_with_suffix(filepath, TEMP_SUFFIX);
+        p->backup_path = path_with_suffix(filepath, suffix);
+        ok = p->temp_path && p->backup_path;
+    }
+
+    // Journaled before anything is created, so recovery also knows about the copy below
+    if (ok) {
+        size_t head_size;
+        uint8_t *head = encode_edit(&edit, filepath, set, &head_size);
+        ok = head && write_record(batch->journal_fd, RECORD_EDIT, head, head_size,
+                                  plan.old_region, edit.old_size);
+        free(head);
+        if (ok) {
+            batch->seq++;
+        } else {
+            perror("Error writing batch journal");
+            batch->failed = true;
+        }
+    }
+
+    // The copy is written now, its write-back starting at once, and renamed with its group
+    if (ok && p->temp_path && !edit_plan_write_temp(&plan, p->temp_path, false)) {
+        edit_report_error(filepath, plan.status, plan.sys_errno);
+        free(p->temp_path); // edit_plan_write_temp removed the file itself
+        p->temp_path = NULL;
+        ok = false;
+    }
+    edit_plan_free(&plan);
+
+    if (!ok) {
+        free_pending(p);
+        batch->counts.failures++;
+        return false;
+    }
+    batch->pending_count++;
+    batch->pending_bytes += p->region_size;
+    if (batch->pending_count == batch->group_files || batch->pending_bytes >= EDIT_GROUP_BYTES) {
+        return flush_group(batch);
+    }
+    return true;
+}
+
+bool edit_batch_finish(EditBatch *batch, BatchCounts *counts) {
+    bool ok = flush_group(batch) && !batch->failed;
+    STATS_ADD(STAT_SYSCALLS, 1);
+    ok = fdatasync(batch->journal_fd) == 0 && ok;
+
+    // Every group is committed: the journal goes first, so a crash from here on only leaves
+    // backups behind, never a journal that would undo finished edits. If the batch failed,
+    // both stay for edit_batch_recover.
+    close(batch->journal_fd);
+    if (ok) {
+        unlink(batch->journal_path);
+        sync_parent_dir(batch->journal_path);
+    } else {
+        fprintf(stderr, "Error: The batch did not complete; journal kept at %s\n", batch->journal_path);
+    }
+    for (uint32_t i = 0; i < batch->backup_count; i++) {
+        if (ok) {
+            unlink(batch->backups[i]);
+        }
+        free(batch->backups[i]);
+    }
+
+    if (counts) {
+        *counts = batch->counts;
+    }
+    free(batch->backups);
+    free(batch->pending);
+    free(batch->journal_path);
+    free(batch);
+    return ok;
+}
+
+// --- Recovery ---
+
+typedef struct {
+    uint64_t offset;          // Payload position in the journal
+    uint32_t size;
+    uint32_t group;
+} RecordRef;
+
+typedef struct {
+    JournalEdit edit;
+    const char *path;
+    EditSet set;
+    const uint8_t *old_bytes;
+} DecodedEdit;
+
+static bool decode_edit(uint8_t *payload, uint32_t size, DecodedEdit *out) {
+    if (size < sizeof(JournalEdit)) {
+        return false;
+    }
+    memcpy(&out->edit, payload, sizeof(JournalEdit));
+    if (out->edit.edit_count > MAX_EDIT_FRAMES || out->edit.old_size > size - sizeof(JournalEdit)) {
+        return false;
+    }
+    const char *p = (const char *)payload + sizeof(JournalEdit);
+    const char *end = (const char *)payload + size - out->edit.old_size;
+    if (!memchr(p, '\0', end - p)) {
+        return false;
+    }
+    out->path = p;
+    p += strlen(p) + 1;
+
+    edit_set_init(&out->set);
+    for (int i = 0; i < out->edit.edit_count; i++) {
+        const char *id = p;
+        const char *id_end = p < end ? memchr(p, '\0', end - p) : NULL;
+        const char *value = id_end ? id_end + 1 : NULL;
+        const char *value_end = value && value < end ? memchr(value, '\0', end - value) : NULL;
+        if (!value_end || !edit_set_add(&out->set, id, value)) {
+            return false;
+        }
+        p = value_end + 1;
+    }
+    out->old_bytes = (const uint8_t *)end;
+    return true;
+}
+
+// Collects the records that made it to disk whole, and the groups that committed
+static RecordRef *read_journal(int fd, uint32_t *count, uint32_t *group_limit, uint8_t **committed) {
+    char magic[JOURNAL_MAGIC_SIZE];
+    if (pread(fd, magic, JOURNAL_MAGIC_SIZE, 0) != JOURNAL_MAGIC_SIZE ||
+        memcmp(magic, JOURNAL_MAGIC, JOURNAL_MAGIC_SIZE) != 0) {
+        fprintf(stderr, "Error: Not a batch journal.\n");
+        return NULL;
+    }
+
+    RecordRef *refs = NULL;
+    uint32_t ref_count = 0, ref_capacity = 0;
+    uint8_t *done = NULL;
+    uint32_t done_size = 0;
+    uint8_t *payload = NULL;
+    uint64_t offset = JOURNAL_MAGIC_SIZE;
+    JournalRecord record;
+
+    while (pread(fd, &record, sizeof(record), offset) == sizeof(record)) {
+        uint8_t *grown = realloc(payload, record.size ? record.size : 1);
+        if (!grown) {
+            break;
+        }
+        payload = grown;
+        if (pread(fd, payload, record.size, offset + sizeof(record)) != (ssize_t)record.size ||
+            hash64(payload, record.size) != record.checksum) {
+            break; // Torn tail: the crash came while this record was being written
+        }
+
+        uint32_t group;
+        if (record.size < sizeof(group)) {
+            break;
+        }
+        memcpy(&group, payload, sizeof(group)); // Both record types start with the group
+        if (group >= done_size) {
+            uint32_t size = (group + 1) * 2;
+            uint8_t *grown_done = realloc(done, size);
+            if (!grown_done) {
+                break;
+            }
+            memset(grown_done + done_size, 0, size - done_size);
+            done = grown_done;
+            done_size = size;
+        }
+
+        if (record.type == RECORD_COMMIT) {
+            done[group] = 1;
+        } else if (record.type == RECORD_EDIT) {
+            if (ref_count == ref_capacity) {
+                ref_capacity = ref_capacity ? ref_capacity * 2 : 256;
+                RecordRef *grown_refs = realloc(refs, ref_capacity * sizeof(RecordRef));
+                if (!grown_refs) {
+                    break;
+                }
+                refs = grown_refs;
+            }
+            refs[ref_count++] = (RecordRef){ offset + sizeof(record), record.size, group };
+        }
+        offset += sizeof(record) + record.size;
+    }
+    free(payload);
+
+    if (!done) {
+        done = calloc(1, 1);
+        done_size = 1;
+    }
+    *count = ref_count;
+    *group_limit = done_size;
+    *committed = done;
+    return refs ? refs : calloc(1, sizeof(RecordRef));
+}
+
+static char *backup_path_for(const DecodedEdit *edit) {
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), "%s.%u", BACKUP_SUFFIX, edit->edit.seq);
+    return path_with_suffix(edit->path, suffix);
+}
+
+// Puts the file back the way it was before this record's edit
+static bool undo_edit(const DecodedEdit *edit) {
+    if (edit->edit.kind == KIND_IN_PLACE) {
+        int fd = open(edit->path, O_WRONLY);
+        bool ok = fd >= 0 &&
+                  pwrite(fd, edit->old_bytes, edit->edit.old_size, 0) == (ssize_t)edit->edit.old_size &&
+                  fdatasync(fd) == 0;
+        if (fd >= 0 && close(fd) != 0) {
+            ok = false;
+        }
+        return ok;
+    }
+
+    // No backup: the crash came before the rename, so the original is still in place
+    char *backup = backup_path_for(edit);
+    char *temp = path_with_suffix(edit->path, TEMP_SUFFIX);
+    bool ok = backup && temp;
+    if (ok && access(backup, F_OK) == 0) {
+        ok = rename(backup, edit->path) == 0;
+        unlink(backup); // rename() leaves it when it already names the same file
+        sync_parent_dir(edit->path);
+    }
+    if (temp) {
+        unlink(temp);
+    }
+    free(backup);
+    free(temp);
+    return ok;
+}
+
+static void drop_backup(const DecodedEdit *edit) {
+    if (edit->edit.kind == KIND_REWRITE) {
+        char *backup = backup_path_for(edit);
+        if (backup) {
+            unlink(backup);
+        }
+        free(backup);
+    }
+}
+
+static bool load_edit(int fd, const RecordRef *ref, uint8_t **payload, DecodedEdit *edit) {
+    uint8_t *grown = realloc(*payload, ref->size);
+    if (!grown) {
+        return false;
+    }
+    *payload = grown;
+    return pread(fd, grown, ref->size, ref->offset) == (ssize_t)ref->size &&
+           decode_edit(grown, ref->size, edit);
+}
+
+// Rollback undoes every record, newest first, leaving each file as it was before the batch.
+// Resume undoes only the groups that never committed and then applies their edits again, so
+// every file ends up as if the batch had reached its last journaled file.
+bool edit_batch_recover(const char *journal_path, bool rollback, BatchCounts *counts) {
+    BatchCounts local;
+    memset(&local, 0, sizeof(local));
+    int fd = open(journal_path, O_RDONLY);
+    if (fd < 0) {
+        perror("Error opening batch journal");
+        return false;
+    }
+
+    uint32_t count, group_limit;
+    uint8_t *committed = NULL;
+    RecordRef *refs = read_journal(fd, &count, &group_limit, &committed);
+    if (!refs) {
+        close(fd);
+        return false;
+    }
+
+    uint8_t *payload = NULL;
+    DecodedEdit edit;
+    bool ok = true;
+    for (uint32_t i = count; i-- > 0;) {
+        bool done = refs[i].group < group_limit && committed[refs[i].group];
+        if (!load_edit(fd, &refs[i], &payload, &edit)) {
+            ok = false;
+            continue;
+        }
+        if (rollback || !done) {
+            if (undo_edit(&edit)) {
+                if (rollback) {
+                    local.files++;
+                    local.in_place += edit.edit.kind == KIND_IN_PLACE;
+                    local.rewritten += edit.edit.kind == KIND_REWRITE;
+                }
+            } else {
+                fprintf(stderr, "Error restoring %s\n", edit.path);
+                local.failures++;
+                ok = false;
+            }
+        } else {
+            drop_backup(&edit);
+        }
+    }
+
+    if (!rollback && ok) {
+        for (uint32_t i = 0; i < count; i++) {
+            bool done = refs[i].group < group_limit && committed[refs[i].group];
+            if (done || !load_edit(fd, &refs[i], &payload, &edit)) {
+                continue;
+            }
+            if (apply_edit_set(edit.path, &edit.set)) {
+                local.files++;
+                local.in_place += edit.edit.kind == KIND_IN_PLACE;
+                local.rewritten += edit.edit.kind == KIND_REWRITE;
+            } else {
+                local.failures++;
+                ok = false;
+            }
+        }
+    }
+    free(payload);
+    free(refs);
+    free(committed);
+    close(fd);
+
+    // The journal goes only once every file is settled; otherwise recovery can run again
+    if (ok) {
+        unlink(journal_path);
+        sync_parent_dir(journal_path);
+    }
+    if (counts) {
+        *counts = local;
+    }
+    return ok;
+}
@@ -0,0 +1,33 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "types.h"
+
+// --- Transactional Batch Edits ---
+// Files are edited in groups. Before a group touches any file, the journal holds everything
+// needed to undo it (the old tag bytes of in-place edits; rewrites keep the original as a hard
+// link) plus the edits themselves, and one fdatasync makes that durable. The group's in-place
+// writes and renames then go out, followed by one fdatasync per file and one fsync per
+// directory. If the process dies, edit_batch_recover either rolls every journaled file back
+// or finishes the interrupted group (resume). Edits are idempotent, so a resumed batch may
+// simply be run again from the start.
+typedef struct EditBatch EditBatch;
+
+typedef struct {
+    uint64_t files;           // Files edited (or, when recovering, restored / redone)
+    uint64_t in_place;
+    uint64_t rewritten;
+    uint64_t failures;
+    uint64_t groups;          // Groups committed
+} BatchCounts;
+
+// Fails if the journal already exists: an earlier batch was interrupted, recover it first.
+// group_files = 0 uses EDIT_GROUP_FILES.
+EditBatch *edit_batch_begin(const char *journal_path, uint32_t group_files);
+bool edit_batch_apply(EditBatch *batch, const char *filepath, const EditSet *set);
+// Commits the last group, drops the backups and the journal, and frees the batch
+bool edit_batch_finish(EditBatch *batch, BatchCounts *counts);
+
+bool edit_batch_recover(const char *journal_path, bool rollback, BatchCounts *counts);
+
+#endif // BATCH_H
@@ -0,0 +1,900 @@
+#ifdef MP3_BENCH
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "bench.h"
+#include "read.h"
+#include "edit.h"
+#include "helper.h"
+#include "simd.h"
+#include "serve.h"
+
+#define MPEG_FRAME_SIZE 417           // MPEG-1 Layer III, 128 kbps, 44.1 kHz, no padding bit
+#define AUDIO_CHUNK_FRAMES 2500       // ~1 MB of audio frames written per fwrite
+
+// --- Deterministic random numbers (xorshift64*) ---
+static uint64_t next_random(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+static uint64_t random_range(uint64_t *state, uint64_t low, uint64_t high) {
+    if (high <= low) {
+        return low;
+    }
+    return low + next_random(state) % (high - low + 1);
+}
+
+static void fill_random(uint64_t *state, uint8_t *buffer, size_t size) {
+    for (size_t i = 0; i < size; i += 8) {
+        uint64_t value = next_random(state);
+        memcpy(buffer + i, &value, (size - i < 8) ? size - i : 8);
+    }
+}
+
+// --- Tag building ---
+typedef struct {
+    uint8_t *data;
+    size_t size;
+    size_t capacity;
+} ByteBuffer;
+
+static bool buffer_append(ByteBuffer *buffer, const void *data, size_t size) {
+    if (buffer->size + size > buffer->capacity) {
+        size_t new_capacity = buffer->capacity ? buffer->capacity : 4096;
+        while (new_capacity < buffer->size + size) {
+            new_capacity *= 2;
+        }
+        uint8_t *grown = realloc(buffer->data, new_capacity);
+        if (!grown) {
+            return false;
+        }
+        buffer->data = grown;
+        buffer->capacity = new_capacity;
+    }
+    memcpy(buffer->data + buffer->size, data, size);
+    buffer->size += size;
+    return true;
+}
+
+static bool append_frame(ByteBuffer *body, const char *frame_id, const uint8_t *content, uint32_t size) {
+    uint8_t header[ID3_FRAME_HEADER_SIZE];
+    uint32_t raw_size = size;
+    memcpy(header, frame_id, 4);
+    reverse_bytes((uint8_t *)&raw_size, 4);
+    memcpy(header + 4, &raw_size, 4);
+    memset(header + 8, 0, 2);
+    return buffer_append(body, header, sizeof(header)) && buffer_append(body, content, size);
+}
+
+static bool append_text_frame(ByteBuffer *body, const char *frame_id, const char *text) {
+    uint8_t content[512];
+    size_t len = strlen(text);
+    content[0] = 0x03; // UTF-8
+    memcpy(content + 1, text, len);
+    return append_frame(body, frame_id, content, len + 1);
+}
+
+static const char *const artist_pool[] = {
+    "Aurora Lane", "The Midnight Static", "DJ Kettle", "Ørjan Nilsen", "Los Tres Caminos",
+    "Yo Yo Honey Singh", "Black Harbour", "Neon Sœurs", "Kit & the Kites", "Various Artists"
+};
+static const char *const genre_pool[] = { "Pop", "(13)", "Electronic", "Rock", "(17)Rock", "Hip-Hop", "Jazz" };
+
+// Builds one tag body: 2..max_frames text-like frames, optional artwork, then padding
+static bool build_tag_body(uint64_t *rng, const CorpusOptions *options, uint32_t file_index, ByteBuffer *body) {
+    char text[256];
+    uint32_t frame_count = random_range(rng, 2, options->max_frames > 2 ? options->max_frames : 2);
+
+    snprintf(text, sizeof(text), "Track %u - %.*s", file_index,
+             (int)random_range(rng, 0, 40), "a long and winding synthetic title for testing");
+    bool ok = append_text_frame(body, "TIT2", text);
+    ok = ok && append_text_frame(body, "TPE1", artist_pool[next_random(rng) % 10]);
+
+    for (uint32_t i = 2; ok && i < frame_count; i++) {
+        switch (next_random(rng) % 8) {
+            case 0:
+                snprintf(text, sizeof(text), "Album %u", (unsigned)(next_random(rng) % 5000));
+                ok = append_text_frame(body, "TALB", text);
+                break;
+            case 1:
+                snprintf(text, sizeof(text), "%u", (unsigned)random_range(rng, 1950, 2025));
+                ok = append_text_frame(body, "TYER", text);
+                break;
+            case 2:
+                snprintf(text, sizeof(text), "%u/%u", (unsigned)random_range(rng, 1, 12), 12);
+                ok = append_text_frame(body, "TRCK", text);
+                break;
+            case 3:
+                ok = append_text_frame(body, "TCON", genre_pool[next_random(rng) % 7]);
+                break;
+            case 4: {
+                // COMM: encoding, language, empty description, text
+                uint8_t content[64] = { 0x03, 'e', 'n', 'g', 0x00 };
+                int len = snprintf((char *)content + 5, sizeof(content) - 5, "Comment %u", (unsigned)i);
+                ok = append_frame(body, "COMM", content, 5 + len);
+                break;
+            }
+            case 5: {
+                // TXXX: encoding, description, value
+                uint8_t content[64] = { 0x03 };
+                int len = snprintf((char *)content + 1, sizeof(content) - 1, "replaygain_track_gain");
+                len += 2 + snprintf((char *)content + len + 2, sizeof(content) - len - 2, "-%u.%02u dB",
+                                    (unsigned)(next_random(rng) % 12), (unsigned)(next_random(rng) % 100));
+                ok = append_frame(body, "TXXX", content, len);
+                break;
+            }
+            case 6:
+                ok = append_text_frame(body, "TCOM", artist_pool[next_random(rng) % 10]);
+                break;
+            default:
+                snprintf(text, sizeof(text), "%u", (unsigned)random_range(rng, 60, 180));
+                ok = append_text_frame(body, "TBPM", text);
+                break;
+        }
+    }
+
+    // APIC: encoding, MIME type, picture type (front cover), empty description, JPEG-ish bytes
+    if (ok && next_random(rng) % 100 < options->art_percent) {
+        uint32_t art_size = random_range(rng, 100 * 1024, 3 * 1024 * 1024);
+        uint8_t *content = malloc(art_size);
+        ok = content != NULL;
+        if (ok) {
+            static const uint8_t art_header[] = { 0x00, 'i', 'm', 'a', 'g', 'e', '/', 'j', 'p', 'e', 'g', 0x00,
+                                                  0x03, 0x00, 0xFF, 0xD8, 0xFF, 0xE0 };
+            fill_random(rng, content, art_size);
+            memcpy(content, art_header, sizeof(art_header));
+            ok = append_frame(body, "APIC", content, art_size);
+            free(content);
+        }
+    }
+
+    uint32_t padding = random_range(rng, 0, options->max_padding);
+    for (uint32_t i = 0; ok && i < padding; i += 1024) {
+        static const uint8_t zeros[1024] = {0};
+        ok = buffer_append(body, zeros, (padding - i < 1024) ? padding - i : 1024);
+    }
+    return ok;
+}
+
+// ID3v2.3 unsynchronisation of the whole tag body
+static bool unsynchronise(ByteBuffer *body) {
+    size_t capacity = 2 * body->size + 1;
+    uint8_t *out = malloc(capacity);
+    if (!out) {
+        return false;
+    }
+    body->size = unsync_encode(out, body->data, body->size);
+    body->capacity = capacity;
+    free(body->data);
+    body->data = out;
+    return true;
+}
+
+static bool write_corpus_file(const char *path, uint64_t *rng, const CorpusOptions *options,
+                              uint32_t file_index, uint8_t *audio_chunk)
+{
+    ByteBuffer body = { NULL, 0, 0 };
+    bool unsync = next_random(rng) % 100 < options->unsync_percent;
+    bool ok = build_tag_body(rng, options, file_index, &body) && (!unsync || unsynchronise(&body));
+
+    FILE *fp = ok ? fopen(path, "wb") : NULL;
+    if (!fp) {
+        free(body.data);
+        return false;
+    }
+
+    uint8_t header[ID3_HEADER_SIZE] = { 'I', 'D', '3', 0x03, 0x00, unsync ? 0x80 : 0x00 };
+    uint32_t raw_size = encode_syncsafe(body.size);
+    reverse_bytes((uint8_t *)&raw_size, 4);
+    memcpy(header + 6, &raw_size, 4);
+    fwrite(header, 1, ID3_HEADER_SIZE, fp);
+    fwrite(body.data, 1, body.size, fp);
+
+    // Audio: whole MPEG frames up to the target file size
+    uint64_t target = random_range(rng, options->min_size, options->max_size);
+    uint64_t tag_total = ID3_HEADER_SIZE + body.size;
+    uint64_t frames_left = (target > tag_total) ? (target - tag_total) / MPEG_FRAME_SIZE : 0;
+    free(body.data);
+
+    // Fresh payload per file so files differ; the frame headers stay in place
+    for (uint32_t f = 0; f < AUDIO_CHUNK_FRAMES; f++) {
+        fill_random(rng, audio_chunk + f * MPEG_FRAME_SIZE + 4, MPEG_FRAME_SIZE - 4);
+    }
+    while (ok && frames_left > 0) {
+        uint64_t frames = (frames_left < AUDIO_CHUNK_FRAMES) ? frames_left : AUDIO_CHUNK_FRAMES;
+        ok = fwrite(audio_chunk, MPEG_FRAME_SIZE, frames, fp) == frames;
+        frames_left -= frames;
+    }
+
+    return (fclose(fp) == 0) && ok;
+}
+
+bool generate_corpus(const CorpusOptions *options) {
+    mkdir(options->dir, 0755);
+
+    uint8_t *audio_chunk = malloc((size_t)AUDIO_CHUNK_FRAMES * MPEG_FRAME_SIZE);
+    if (!audio_chunk) {
+        return false;
+    }
+    for (uint32_t f = 0; f < AUDIO_CHUNK_FRAMES; f++) {
+        static const uint8_t frame_header[4] = { 0xFF, 0xFB, 0x90, 0x44 };
+        memcpy(audio_chunk + f * MPEG_FRAME_SIZE, frame_header, 4);
+    }
+
+    uint64_t rng = options->seed ? options->seed : 0x9E3779B97F4A7C15ULL;
+    bool ok = true;
+    for (uint32_t i = 0; ok && i < options->count; i++) {
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/corpus_%06u.mp3", options->dir, i);
+        ok = write_corpus_file(path, &rng, options, i, audio_chunk);
+    }
+
+    free(audio_chunk);
+    return ok;
+}
+
+// --- Measurement ---
+typedef struct {
+    struct timespec start;
+    uint64_t rchar;
+    uint64_t wchar;
+    bool peak_reset;          // VmHWM was reset, so it covers this benchmark only
+} Snapshot;
+
+// Bytes moved through read/write-style syscalls, from /proc/self/io
+static void read_io_counters(uint64_t *rchar, uint64_t *wchar) {
+    *rchar = 0;
+    *wchar = 0;
+    FILE *fp = fopen("/proc/self/io", "r");
+    if (!fp) {
+        return;
+    }
+    char line[128];
+    while (fgets(line, sizeof(line), fp)) {
+        if (strncmp(line, "rchar:", 6) == 0) {
+            *rchar = strtoull(line + 6, NULL, 10);
+        } else if (strncmp(line, "wchar:", 6) == 0) {
+            *wchar = strtoull(line + 6, NULL, 10);
+        }
+    }
+    fclose(fp);
+}
+
+// Writing 5 to clear_refs (Linux 4.0+) sets the peak RSS back to the current RSS
+static bool reset_peak_rss(void) {
+    int fd = open("/proc/self/clear_refs", O_WRONLY);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = write(fd, "5", 1) == 1;
+    close(fd);
+    return ok;
+}
+
+// VmHWM from /proc/self/status in kB, 0 if it can't be read
+static long read_peak_rss(void) {
+    FILE *fp = fopen("/proc/self/status", "r");
+    if (!fp) {
+        return 0;
+    }
+    char line[128];
+    long kb = 0;
+    while (fgets(line, sizeof(line), fp)) {
+        if (strncmp(line, "VmHWM:", 6) == 0) {
+            kb = strtol(line + 6, NULL, 10);
+            break;
+        }
+    }
+    fclose(fp);
+    return kb;
+}
+
+static void snapshot_begin(Snapshot *snapshot) {
+    snapshot->peak_reset = reset_peak_rss();
+    read_io_counters(&snapshot->rchar, &snapshot->wchar);
+    clock_gettime(CLOCK_MONOTONIC, &snapshot->start);
+}
+
+static double seconds_since(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void report(const char *bench, const Snapshot *snapshot, uint32_t files, uint32_t failures) {
+    double seconds = seconds_since(&snapshot->start);
+    uint64_t rchar, wchar;
+    read_io_counters(&rchar, &wchar);
+
+    // Without a reset only the process's lifetime peak is known
+    long peak_rss = snapshot->peak_reset ? read_peak_rss() : 0;
+    if (peak_rss == 0) {
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        peak_rss = usage.ru_maxrss;
+    }
+
+    printf("{\"bench\":\"%s\",\"files\":%u,\"failures\":%u,\"seconds\":%.6f,\"files_per_sec\":%.1f,"
+           "\"bytes_read\":%llu,\"bytes_written\":%llu,\"peak_rss_kb\":%ld}\n",
+           bench, files, failures, seconds, seconds > 0 ? files / seconds : 0.0,
+           (unsigned long long)(rchar - snapshot->rchar), (unsigned long long)(wchar - snapshot->wchar),
+           peak_rss);
+    fflush(stdout);
+}
+
+// --- Corpus listing ---
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static char **list_corpus(const char *dir_path, uint32_t *count) {
+    DIR *dir = opendir(dir_path);
+    char **paths = NULL;
+    uint32_t capacity = 0;
+    *count = 0;
+    if (!dir) {
+        return NULL;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        size_t len = strlen(entry->d_name);
+        if (len < 4 || strcmp(entry->d_name + len - 4, ".mp3") != 0) {
+            continue;
+        }
+        if (*count == capacity) {
+            capacity = capacity ? capacity * 2 : 256;
+            char **grown = realloc(paths, capacity * sizeof(char *));
+            if (!grown) {
+                break;
+            }
+            paths = grown;
+        }
+        size_t path_len = strlen(dir_path) + len + 2;
+        paths[*count] = malloc(path_len);
+        if (!paths[*count]) {
+            break;
+        }
+        snprintf(paths[*count], path_len, "%s/%s", dir_path, entry->d_name);
+        (*count)++;
+    }
+    closedir(dir);
+
+    if (*count > 1) {
+        qsort(paths, *count, sizeof(char *), compare_names);
+    }
+    return paths;
+}
+
+// --- Benchmarks over a corpus (the edits modify the corpus files) ---
+static void bench_read(char **paths, uint32_t count) {
+    TagData tags;
+    tag_data_init(&tags);
+    uint32_t failures = 0;
+
+    Snapshot snapshot;
+    snapshot_begin(&snapshot);
+    for (uint32_t i = 0; i < count; i++) {
+        if (!read_tags_from_file(paths[i], &tags)) {
+            failures++;
+        }
+    }
+    report("read", &snapshot, count, failures);
+    tag_data_free(&tags);
+}
+
+// Same-length title: always fits in the old frame's slot, so every edit is in place
+static void bench_edit_in_place(char **paths, uint32_t count) {
+    TagData tags;
+    tag_data_init(&tags);
+    uint32_t failures = 0;
+    char value[1024];
+
+    Snapshot snapshot;
+    snapshot_begin(&snapshot);
+    for (uint32_t i = 0; i < count; i++) {
+        const TagFrame *title = read_tags_from_file(paths[i], &tags) ? tag_find_frame(&tags, "TIT2") : NULL;
+        size_t len = (title && title->size > 1 && title->size <= sizeof(value)) ? title->size - 1 : 8;
+        memset(value, 'i', len);
+        value[len] = '\0';
+
+        EditSet set;
+        edit_set_init(&set);
+        edit_set_add(&set, "TIT2", value);
+        if (!apply_edit_set(paths[i], &set)) {
+            failures++;
+        }
+    }
+    report("edit_in_place", &snapshot, count, failures);
+    tag_data_free(&tags);
+}
+
+// Title longer than the old slot plus all the padding: every edit is a full rewrite
+static void bench_edit_rewrite(char **paths, uint32_t count) {
+    TagData tags;
+    tag_data_init(&tags);
+    uint32_t failures = 0;
+
+    Snapshot snapshot;
+    snapshot_begin(&snapshot);
+    for (uint32_t i = 0; i < count; i++) {
+        size_t len = 64;
+        if (read_tags_from_file(paths[i], &tags)) {
+            const TagFrame *title = tag_find_frame(&tags, "TIT2");
+            uint32_t padding = ID3_HEADER_SIZE + tags.header.size - tags.frames_end_pos;
+            len = (title ? title->size : 0) + padding + 1;
+        }
+
+        char *value = malloc(len + 1);
+        if (!value) {
+            failures++;
+            continue;
+        }
+        memset(value, 'r', len);
+        value[len] = '\0';
+
+        EditSet set;
+        edit_set_init(&set);
+        edit_set_add(&set, "TIT2", value);
+        if (!apply_edit_set(paths[i], &set)) {
+            failures++;
+        }
+        free(value);
+    }
+    report("edit_rewrite", &snapshot, count, failures);
+    tag_data_free(&tags);
+}
+
+// --- Copy strategies on 10 MB / 100 MB / 1 GB files (page cache warm) ---
+static const char *const copy_method_names[] = { "failed", "reflink", "copy_file_range", "sendfile", "buffered" };
+
+static void bench_copy(const char *dir, const uint64_t *sizes_mb, int size_count) {
+    char src_path[4096];
+    char dst_path[4096];
+    snprintf(src_path, sizeof(src_path), "%s/bench_copy_src.bin", dir);
+    snprintf(dst_path, sizeof(dst_path), "%s/bench_copy_dst.bin", dir);
+
+    uint8_t *chunk = malloc(COPY_BUFFER_SIZE);
+    if (!chunk) {
+        return;
+    }
+    uint64_t rng = 0x1234567ULL;
+    fill_random(&rng, chunk, COPY_BUFFER_SIZE);
+
+    for (int s = 0; s < size_count; s++) {
+        uint64_t size = sizes_mb[s] * 1024 * 1024;
+        int src = open(src_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (src < 0) {
+            break;
+        }
+        for (uint64_t written = 0; written < size; written += COPY_BUFFER_SIZE) {
+            if (write(src, chunk, COPY_BUFFER_SIZE) != COPY_BUFFER_SIZE) {
+                break;
+            }
+        }
+
+        for (CopyMethod method = COPY_REFLINK; method <= COPY_BUFFERED; method++) {
+            int dst = open(dst_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+            if (dst < 0) {
+                continue;
+            }
+            struct timespec start;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            bool ok = copy_file_region_using(method, src, 0, dst, 0, size);
+            double seconds = seconds_since(&start);
+            close(dst);
+
+            printf("{\"bench\":\"copy\",\"method\":\"%s\",\"size_bytes\":%llu,\"ok\":%s,"
+                   "\"seconds\":%.6f,\"mb_per_sec\":%.1f}\n",
+                   copy_method_names[method], (unsigned long long)size, ok ? "true" : "false",
+                   seconds, (ok && seconds > 0) ? sizes_mb[s] / seconds : 0.0);
+            fflush(stdout);
+        }
+        close(src);
+    }
+
+    remove(src_path);
+    remove(dst_path);
+    free(chunk);
+}
+
+// --- Unsynchronisation, padding and frame sync kernels, per implementation ---
+static void report_kernel(const char *bench, SimdLevel level, size_t bytes, double seconds, bool ok) {
+    printf("{\"bench\":\"%s\",\"kernel\":\"%s\",\"bytes\":%zu,\"ok\":%s,"
+           "\"seconds\":%.6f,\"mb_per_sec\":%.1f}\n",
+           bench, simd_level_name(level), bytes, ok ? "true" : "false",
+           seconds, seconds > 0 ? bytes / (1024.0 * 1024.0) / seconds : 0.0);
+    fflush(stdout);
+}
+
+static void bench_simd(size_t size) {
+    // Artwork-like payload: random bytes, so 0xFF shows up about once every 256 bytes,
+    // followed by the same amount of zero padding for the padding scan
+    uint8_t *plain = malloc(size);
+    uint8_t *encoded = malloc(2 * size);
+    uint8_t *reference = malloc(2 * size);
+    uint8_t *output = malloc(2 * size);
+    uint8_t *padded = calloc(1, 2 * size);
+    if (!plain || !encoded || !reference || !output || !padded) {
+        printf("Not enough memory for %zu byte buffers.\n", size);
+        free(plain); free(encoded); free(reference); free(output); free(padded);
+        return;
+    }
+    memset(output, 0, 2 * size); // Fault the pages in before any kernel is timed
+    uint64_t rng = 0x5EED5EEDULL;
+    fill_random(&rng, plain, size);
+    plain[size - 1] = 0x7F; // Keep the padding scan's answer at exactly `size`
+    memcpy(padded, plain, size);
+
+    size_t reference_size = unsync_encode_with(SIMD_SCALAR, reference, plain, size);
+    memcpy(encoded, reference, reference_size);
+    SimdLevel best = simd_best_level();
+
+    for (SimdLevel level = SIMD_SCALAR; level <= best; level++) {
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        size_t encoded_size = unsync_encode_with(level, output, plain, size);
+        double seconds = seconds_since(&start);
+        report_kernel("unsync_encode", level, size, seconds,
+                      encoded_size == reference_size && memcmp(output, reference, reference_size) == 0);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        size_t decoded_size = unsync_decode_with(level, output, encoded, reference_size);
+        seconds = seconds_since(&start);
+        report_kernel("unsync_decode", level, reference_size, seconds,
+                      decoded_size == size && memcmp(output, plain, size) == 0);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        size_t used = padding_start_with(level, padded, 2 * size);
+        seconds = seconds_since(&start);
+        report_kernel("padding_scan", level, 2 * size, seconds, used == size);
+
+        // Unsynchronised bytes hold no 0xFF 0xE0+ pair, so the only sync is the one at the end
+        memcpy(output, reference, reference_size);
+        memcpy(output + reference_size - 3, "\x00\xFF\xFB", 3);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        size_t sync = frame_sync_find_with(level, output, reference_size);
+        seconds = seconds_since(&start);
+        report_kernel("frame_sync", level, reference_size, seconds, sync == reference_size - 2);
+    }
+
+    free(plain);
+    free(encoded);
+    free(reference);
+    free(output);
+    free(padded);
+}
+
+// --- Daemon load: latency percentiles against serve, and against a process per call ---
+typedef struct {
+    const char *socket_path;
+    char **paths;
+    uint32_t path_count;
+    uint32_t requests;        // Requests this connection sends
+    uint32_t depth;           // Requests kept in flight (pipelining)
+    uint32_t edit_percent;
+    uint64_t seed;
+    uint64_t *latencies_ns;   // One per completed request
+    uint32_t completed;
+    uint32_t errors;
+} LoadClient;
+
+static uint64_t now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void report_latencies(const char *bench, uint32_t connections, uint32_t depth,
+                             uint64_t *latencies, uint32_t count, uint32_t errors, double seconds) {
+    qsort(latencies, count, sizeof(uint64_t), compare_u64);
+    double p50 = count ? latencies[(count - 1) / 2] / 1000.0 : 0.0;
+    double p99 = count ? latencies[(uint32_t)((count - 1) * 0.99)] / 1000.0 : 0.0;
+    double max = count ? latencies[count - 1] / 1000.0 : 0.0;
+    printf("{\"bench\":\"%s\",\"connections\":%u,\"depth\":%u,\"requests\":%u,\"errors\":%u,"
+           "\"seconds\":%.6f,\"requests_per_sec\":%.1f,\"p50_us\":%.1f,\"p99_us\":%.1f,\"max_us\":%.1f}\n",
+           bench, connections, depth, count, errors, seconds, seconds > 0 ? count / seconds : 0.0,
+           p50, p99, max);
+    fflush(stdout);
+}
+
+// Keeps `depth` requests in flight; each one's id is the slot holding its send time
+static void *run_load_client(void *arg) {
+    LoadClient *client = arg;
+    int fd = serve_connect(client->socket_path);
+    uint64_t *sent_at = calloc(client->depth, sizeof(uint64_t));
+    uint32_t *free_slots = malloc(client->depth * sizeof(uint32_t));
+    uint8_t *payload = NULL;
+    uint32_t payload_capacity = 0;
+    if (fd < 0 || !sent_at || !free_slots) {
+        client->errors = client->requests;
+        if (fd >= 0) {
+            close(fd);
+        }
+        free(sent_at);
+        free(free_slots);
+        return NULL;
+    }
+    for (uint32_t i = 0; i < client->depth; i++) {
+        free_slots[i] = i;
+    }
+
+    uint32_t free_count = client->depth;
+    uint32_t sent = 0;
+    char request[8192];
+    while (client->completed + client->errors < client->requests) {
+        while (sent < client->requests && free_count > 0) {
+            const char *path = client->paths[next_random(&client->seed) % client->path_count];
+            bool edit = next_random(&client->seed) % 100 < client->edit_percent;
+            int size = edit ? snprintf(request, sizeof(request), "%s%cTIT2%cLoad %u", path, 0, 0, sent) + 1
+                            : snprintf(request, sizeof(request), "%s", path);
+            uint32_t slot = free_slots[--free_count];
+            sent_at[slot] = now_ns();
+            if (!serve_send(fd, slot, edit ? SERVE_OP_EDIT : SERVE_OP_READ, request, (uint32_t)size)) {
+                client->errors += client->requests - sent;
+                sent = client->requests;
+                break;
+            }
+            sent++;
+        }
+
+        uint32_t id, size;
+        uint8_t status;
+        if (client->completed + client->errors >= client->requests) {
+            break;
+        }
+        if (!serve_receive(fd, &id, &status, &payload, &size, &payload_capacity) || id >= client->depth) {
+            client->errors += sent - client->completed - client->errors;
+            break;
+        }
+        client->latencies_ns[client->completed++] = now_ns() - sent_at[id];
+        if (status != SERVE_OK && status != SERVE_NO_TAG) {
+            client->errors++;
+        }
+        free_slots[free_count++] = id;
+    }
+
+    close(fd);
+    free(sent_at);
+    free(free_slots);
+    free(payload);
+    return NULL;
+}
+
+static void bench_serve(const char *socket_path, char **paths, uint32_t count, uint32_t connections,
+                        uint32_t requests, uint32_t depth, uint32_t edit_percent) {
+    LoadClient *clients = calloc(connections, sizeof(LoadClient));
+    pthread_t *threads = calloc(connections, sizeof(pthread_t));
+    uint64_t *latencies = calloc((size_t)requests, sizeof(uint64_t));
+    if (!clients || !threads || !latencies) {
+        free(clients); free(threads); free(latencies);
+        return;
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint32_t started = 0;
+    for (uint32_t i = 0; i < connections; i++) {
+        LoadClient *client = &clients[i];
+        client->socket_path = socket_path;
+        client->paths = paths;
+        client->path_count = count;
+        client->requests = requests / connections + (i < requests % connections);
+        client->depth = depth;
+        client->edit_percent = edit_percent;
+        client->seed = 0x10AD0000ULL + i;
+        client->latencies_ns = latencies + (size_t)i * (requests / connections) + (i < requests % connections ? i : requests % connections);
+        if (pthread_create(&threads[i], NULL, run_load_client, client) == 0) {
+            started++;
+        } else {
+            client->errors = client->requests;
+            threads[i] = 0;
+        }
+    }
+    for (uint32_t i = 0; i < connections; i++) {
+        if (threads[i]) {
+            pthread_join(threads[i], NULL);
+        }
+    }
+    double seconds = seconds_since(&start);
+
+    // Close the gaps left by connections that stopped early
+    uint32_t completed = 0, errors = 0;
+    for (uint32_t i = 0; i < connections; i++) {
+        memmove(latencies + completed, clients[i].latencies_ns, clients[i].completed * sizeof(uint64_t));
+        completed += clients[i].completed;
+        errors += clients[i].errors;
+    }
+    report_latencies("serve", started, depth, latencies, completed, errors, seconds);
+    free(clients);
+    free(threads);
+    free(latencies);
+}
+
+extern char **environ;
+
+// The same mix, one process per request, as a media server shelling out would run it
+static void bench_serve_baseline(const char *binary, char **paths, uint32_t count,
+                                 uint32_t requests, uint32_t edit_percent) {
+    uint64_t *latencies = calloc(requests, sizeof(uint64_t));
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+
+    uint64_t rng = 0x10AD0000ULL;
+    uint32_t completed = 0, errors = 0;
+    char title[32];
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (uint32_t i = 0; latencies && i < requests; i++) {
+        char *path = paths[next_random(&rng) % count];
+        bool edit = next_random(&rng) % 100 < edit_percent;
+        snprintf(title, sizeof(title), "TIT2=Load %u", i);
+        char *read_args[] = { (char *)binary, "read", path, NULL };
+        char *edit_args[] = { (char *)binary, "edit", "--set", title, path, NULL };
+
+        uint64_t sent_at = now_ns();
+        pid_t pid;
+        int status;
+        if (posix_spawn(&pid, binary, &actions, NULL, edit ? edit_args : read_args, environ) != 0 ||
+            waitpid(pid, &status, 0) != pid) {
+            errors++;
+            continue;
+        }
+        latencies[completed++] = now_ns() - sent_at;
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            errors++;
+        }
+    }
+    double seconds = seconds_since(&start);
+    report_latencies("serve-baseline", 1, 1, latencies, completed, errors, seconds);
+    posix_spawn_file_actions_destroy(&actions);
+    free(latencies);
+}
+
+// --- Command line: gen-corpus | bench | bench-copy | bench-simd | bench-serve ---
+int bench_main(int argc, char *argv[]) {
+    const char *command = argv[1];
+    if (argc < 3 && strcmp(command, "bench-simd") != 0) {
+        printf("Usage: %s gen-corpus <dir> [--count=N] [--min-mb=N] [--max-mb=N] [--max-frames=N]\n"
+               "          [--art=PCT] [--unsync=PCT] [--max-padding=N] [--seed=N]\n"
+               "       %s bench <dir> [--skip-edits]\n"
+               "       %s bench-copy <dir> [--sizes=10,100,1024]\n"
+               "       %s bench-simd [--size-mb=N]\n"
+               "       %s bench-serve <socket> <dir> [--connections=N] [--requests=N] [--depth=N]\n"
+               "          [--edit-pct=N] [--baseline=BINARY] [--baseline-requests=N]\n",
+               argv[0], argv[0], argv[0], argv[0], argv[0]);
+        return 1;
+    }
+
+    if (strcmp(command, "gen-corpus") == 0) {
+        CorpusOptions options = { argv[2], 1000, 3ULL << 20, 8ULL << 20, 40, 30, 10, 65536, 0 };
+        for (int i = 3; i < argc; i++) {
+            if (strncmp(argv[i], "--count=", 8) == 0) options.count = strtoul(argv[i] + 8, NULL, 10);
+            else if (strncmp(argv[i], "--min-mb=", 9) == 0) options.min_size = strtoull(argv[i] + 9, NULL, 10) << 20;
+            else if (strncmp(argv[i], "--max-mb=", 9) == 0) options.max_size = strtoull(argv[i] + 9, NULL, 10) << 20;
+            else if (strncmp(argv[i], "--max-frames=", 13) == 0) options.max_frames = strtoul(argv[i] + 13, NULL, 10);
+            else if (strncmp(argv[i], "--art=", 6) == 0) options.art_percent = strtoul(argv[i] + 6, NULL, 10);
+            else if (strncmp(argv[i], "--unsync=", 9) == 0) options.unsync_percent = strtoul(argv[i] + 9, NULL, 10);
+            else if (strncmp(argv[i], "--max-padding=", 14) == 0) options.max_padding = strtoul(argv[i] + 14, NULL, 10);
+            else if (strncmp(argv[i], "--seed=", 7) == 0) options.seed = strtoull(argv[i] + 7, NULL, 10);
+        }
+        if (options.max_size < options.min_size) {
+            options.max_size = options.min_size;
+        }
+        if (!generate_corpus(&options)) {
+            printf("Failed to generate corpus in %s.\n", options.dir);
+            return 1;
+        }
+        printf("{\"corpus\":\"%s\",\"files\":%u}\n", options.dir, options.count);
+        return 0;
+    }
+
+    if (strcmp(command, "bench") == 0) {
+        uint32_t count;
+        char **paths = list_corpus(argv[2], &count);
+        if (count == 0) {
+            printf("No .mp3 files in %s.\n", argv[2]);
+            free(paths);
+            return 1;
+        }
+
+        bool skip_edits = argc > 3 && strcmp(argv[3], "--skip-edits") == 0;
+        bench_read(paths, count);
+        if (!skip_edits) {
+            bench_edit_in_place(paths, count);
+            bench_edit_rewrite(paths, count);
+        }
+
+        for (uint32_t i = 0; i < count; i++) {
+            free(paths[i]);
+        }
+        free(paths);
+        return 0;
+    }
+
+    if (strcmp(command, "bench-copy") == 0) {
+        uint64_t sizes_mb[8] = { 10, 100, 1024 };
+        int size_count = 3;
+        if (argc > 3 && strncmp(argv[3], "--sizes=", 8) == 0) {
+            char *cursor = argv[3] + 8;
+            size_count = 0;
+            while (*cursor && size_count < 8) {
+                sizes_mb[size_count++] = strtoull(cursor, &cursor, 10);
+                if (*cursor == ',') {
+                    cursor++;
+                }
+            }
+        }
+        bench_copy(argv[2], sizes_mb, size_count);
+        return 0;
+    }
+
+    if (strcmp(command, "bench-simd") == 0) {
+        size_t size_mb = 64;
+        if (argc > 2 && strncmp(argv[2], "--size-mb=", 10) == 0) {
+            size_mb = strtoull(argv[2] + 10, NULL, 10);
+        }
+        bench_simd((size_mb ? size_mb : 1) << 20);
+        return 0;
+    }
+
+    if (strcmp(command, "bench-serve") == 0) {
+        uint32_t count;
+        char **paths = argc > 3 ? list_corpus(argv[3], &count) : NULL;
+        if (!paths || count == 0) {
+            printf("Usage: %s bench-serve <socket> <dir> [...]: no .mp3 files found.\n", argv[0]);
+            free(paths);
+            return 1;
+        }
+
+        uint32_t connections = 4, requests = 100000, depth = 16, edit_percent = 0, baseline_requests = 200;
+        const char *baseline = NULL;
+        for (int i = 4; i < argc; i++) {
+            if (strncmp(argv[i], "--connections=", 14) == 0) connections = strtoul(argv[i] + 14, NULL, 10);
+            else if (strncmp(argv[i], "--requests=", 11) == 0) requests = strtoul(argv[i] + 11, NULL, 10);
+            else if (strncmp(argv[i], "--depth=", 8) == 0) depth = strtoul(argv[i] + 8, NULL, 10);
+            else if (strncmp(argv[i], "--edit-pct=", 11) == 0) edit_percent = strtoul(argv[i] + 11, NULL, 10);
+            else if (strncmp(argv[i], "--baseline=", 11) == 0) baseline = argv[i] + 11;
+            else if (strncmp(argv[i], "--baseline-requests=", 20) == 0) baseline_requests = strtoul(argv[i] + 20, NULL, 10);
+        }
+        connections = connections ? connections : 1;
+        depth = depth ? depth : 1;
+
+        bench_serve(argv[2], paths, count, connections, requests, depth, edit_percent);
+        if (baseline) {
+            bench_serve_baseline(baseline, paths, count, baseline_requests, edit_percent);
+        }
+        for (uint32_t i = 0; i < count; i++) {
+            free(paths[i]);
+        }
+        free(paths);
+        return 0;
+    }
+
+    printf("Invalid benchmark command: '%s'.\n", command);
+    return 1;
+}
+
+#endif // MP3_BENCH
\ No newline at end of file
@@ -0,0 +1,20 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "types.h"
+
+// --- Benchmark Build (compile with -DMP3_BENCH) ---
+// gen-corpus: writes synthetic MP3 files with realistic tag variety
+// bench:      files/sec for read, in-place edit and full-rewrite edit over a corpus
+// bench-copy: audio copy strategies (reflink, copy_file_range, sendfile, buffered)
+// bench-simd: unsynchronisation decode/encode, padding scan and MPEG frame sync search,
+//             scalar vs SSE2 vs AVX2
+// bench-serve: p50/p99 latency and requests/sec against a running serve daemon, and
+//             optionally against one process per request (--baseline=BINARY)
+// Results are printed as one JSON object per line.
+#ifdef MP3_BENCH
+bool generate_corpus(const CorpusOptions *options);
+int bench_main(int argc, char *argv[]);
+#endif
+
+#endif // BENCH_H
\ No newline at end of file
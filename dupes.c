@@ -0,0 +1,280 @@
+#define _GNU_SOURCE // pread, strdup, posix_fadvise
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "dupes.h"
+#include "audio.h"
+#include "hash.h"
+#include "pool.h"
+#include "scan.h"
+#include "stats.h"
+
+typedef struct {
+    char *path;
+    uint64_t offset;          // Payload start
+    uint64_t size;            // Payload bytes
+    uint64_t prefix;          // Hash of the first DUPES_PREFIX_SIZE bytes (all of them if fewer)
+    uint64_t hash;            // Hash of the whole payload
+    bool failed;
+} DupesEntry;
+
+// Filled in by the library walk, one entry per file that has audio
+typedef struct {
+    pthread_mutex_t lock;
+    DupesEntry *entries;
+    size_t count;
+    size_t capacity;
+    DupesCounts counts;
+} DupesList;
+
+static void note_file(const char *path, void *user) {
+    DupesList *list = user;
+    DupesEntry entry = { NULL, 0, 0, 0, 0, false };
+    uint64_t end = 0;
+    struct stat st;
+
+    int fd = open(path, O_RDONLY);
+    STATS_ADD(STAT_SYSCALLS, 1);
+    bool ok = fd >= 0 && fstat(fd, &st) == 0;
+    bool has_audio = ok && audio_payload_range(fd, (uint64_t)st.st_size, &entry.offset, &end);
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (has_audio) {
+        entry.size = end - entry.offset;
+        entry.path = strdup(path);
+        ok = entry.path != NULL;
+    }
+
+    pthread_mutex_lock(&list->lock);
+    list->counts.files++;
+    if (ok && has_audio && list->count == list->capacity) {
+        size_t capacity = list->capacity ? list->capacity * 2 : 1024;
+        DupesEntry *grown = realloc(list->entries, capacity * sizeof(DupesEntry));
+        if (grown) {
+            list->entries = grown;
+            list->capacity = capacity;
+        } else {
+            ok = false;
+        }
+    }
+    if (!ok) {
+        list->counts.failures++;
+        free(entry.path);
+    } else if (has_audio) {
+        list->entries[list->count++] = entry;
+    }
+    pthread_mutex_unlock(&list->lock);
+}
+
+// --- Hashing ---
+
+// Hashes `size` payload bytes. After the first read, every read starts on a
+// DUPES_READ_SIZE boundary of the file, so they line up with the page cache and readahead.
+static bool hash_payload(const DupesEntry *entry, uint64_t size, uint64_t *hash) {
+    int fd = open(entry->path, O_RDONLY);
+    STATS_ADD(STAT_SYSCALLS, 1);
+    if (fd < 0) {
+        return false;
+    }
+    size_t buffer_size = size < DUPES_READ_SIZE ? (size_t)size : DUPES_READ_SIZE;
+    uint8_t *buffer = malloc(buffer_size ? buffer_size : 1);
+    if (size > DUPES_PREFIX_SIZE) {
+        posix_fadvise(fd, (off_t)entry->offset, (off_t)size, POSIX_FADV_SEQUENTIAL);
+    }
+
+    Hash64State state;
+    hash64_init(&state);
+    uint64_t pos = entry->offset;
+    uint64_t end = entry->offset + size;
+    bool ok = buffer != NULL;
+    while (ok && pos < end) {
+        uint64_t block_end = (pos / DUPES_READ_SIZE + 1) * DUPES_READ_SIZE;
+        size_t want = (size_t)((block_end < end ? block_end : end) - pos);
+        ssize_t got = pread(fd, buffer, want, (off_t)pos);
+        STATS_ADD(STAT_SYSCALLS, 1);
+        if (got <= 0) {
+            ok = false;
+            break;
+        }
+        STATS_ADD(STAT_BYTES_READ, (uint64_t)got);
+        hash64_update(&state, buffer, (size_t)got);
+        pos += (uint64_t)got;
+    }
+    free(buffer);
+    close(fd);
+    *hash = hash64_final(&state);
+    return ok;
+}
+
+static void hash_prefix_task(void *arg) {
+    DupesEntry *entry = arg;
+    uint64_t size = entry->size < DUPES_PREFIX_SIZE ? entry->size : DUPES_PREFIX_SIZE;
+    entry->failed = !hash_payload(entry, size, &entry->prefix);
+}
+
+static void hash_whole_task(void *arg) {
+    DupesEntry *entry = arg;
+    entry->failed = !hash_payload(entry, entry->size, &entry->hash);
+}
+
+// --- Grouping ---
+// Entries are sorted by size, then prefix, then hash, so every set that matches on the
+// keys compared so far is one contiguous run.
+typedef enum { MATCH_SIZE, MATCH_PREFIX, MATCH_HASH } MatchLevel;
+
+static int compare_entries(const void *a, const void *b) {
+    const DupesEntry *x = a;
+    const DupesEntry *y = b;
+    if (x->size != y->size) {
+        return x->size < y->size ? -1 : 1;
+    }
+    if (x->failed != y->failed) {
+        return x->failed ? 1 : -1;
+    }
+    if (x->prefix != y->prefix) {
+        return x->prefix < y->prefix ? -1 : 1;
+    }
+    if (x->hash != y->hash) {
+        return x->hash < y->hash ? -1 : 1;
+    }
+    return strcmp(x->path, y->path);
+}
+
+static bool entries_match(const DupesEntry *x, const DupesEntry *y, MatchLevel level) {
+    if (x->size != y->size) {
+        return false;
+    }
+    if (level == MATCH_SIZE) {
+        return true;
+    }
+    return !x->failed && !y->failed && x->prefix == y->prefix && (level == MATCH_PREFIX || x->hash == y->hash);
+}
+
+// End of the run that starts at `first`
+static size_t run_end(const DupesEntry *entries, size_t count, size_t first, MatchLevel level) {
+    size_t end = first + 1;
+    while (end < count && entries_match(&entries[first], &entries[end], level)) {
+        end++;
+    }
+    return end;
+}
+
+typedef struct {
+    size_t first;
+    size_t copies;
+    uint64_t waste;           // Bytes held by the copies beyond the first
+} DupesGroup;
+
+static int compare_groups(const void *a, const void *b) {
+    const DupesGroup *x = a;
+    const DupesGroup *y = b;
+    if (x->waste != y->waste) {
+        return x->waste > y->waste ? -1 : 1;
+    }
+    return x->first < y->first ? -1 : x->first > y->first;
+}
+
+bool dupes_report(const char *root, int num_threads, FILE *out, DupesCounts *counts) {
+    DupesList list;
+    memset(&list, 0, sizeof(list));
+    pthread_mutex_init(&list.lock, NULL);
+    memset(counts, 0, sizeof(DupesCounts));
+
+    ThreadPool *pool = NULL;
+    DupesGroup *groups = NULL;
+    bool ok = scan_for_each_file(root, num_threads, note_file, &list) && (pool = pool_create(num_threads));
+    DupesEntry *entries = list.entries;
+    size_t count = list.count;
+
+    // Pass 2: the prefix of every file whose payload size is shared
+    if (ok) {
+        qsort(entries, count, sizeof(DupesEntry), compare_entries);
+        for (size_t i = 0; i < count;) {
+            size_t end = run_end(entries, count, i, MATCH_SIZE);
+            for (size_t j = i; end - i > 1 && j < end; j++) {
+                list.counts.candidates++;
+                list.counts.bytes_hashed += entries[j].size < DUPES_PREFIX_SIZE ? entries[j].size : DUPES_PREFIX_SIZE;
+                if (!pool_submit(pool, hash_prefix_task, &entries[j])) {
+                    hash_prefix_task(&entries[j]); // Could not be queued: hash it here
+                }
+            }
+            i = end;
+        }
+        pool_wait(pool);
+    }
+
+    // Pass 3: the rest of the payload where size and prefix still agree. A payload no
+    // longer than the prefix has been hashed whole already.
+    if (ok) {
+        qsort(entries, count, sizeof(DupesEntry), compare_entries);
+        for (size_t i = 0; i < count;) {
+            size_t end = run_end(entries, count, i, MATCH_PREFIX);
+            for (size_t j = i; end - i > 1 && j < end; j++) {
+                if (entries[j].size <= DUPES_PREFIX_SIZE) {
+                    entries[j].hash = entries[j].prefix;
+                } else {
+                    list.counts.fully_hashed++;
+                    list.counts.bytes_hashed += entries[j].size;
+                    if (!pool_submit(pool, hash_whole_task, &entries[j])) {
+                        hash_whole_task(&entries[j]);
+                    }
+                }
+            }
+            i = end;
+        }
+        pool_wait(pool);
+        qsort(entries, count, sizeof(DupesEntry), compare_entries);
+        for (size_t i = 0; i < count; i++) {
+            list.counts.failures += entries[i].failed;
+        }
+    }
+
+    // Runs that match on everything, largest waste first
+    size_t group_count = 0;
+    if (ok && count > 0) {
+        groups = malloc(count * sizeof(DupesGroup));
+        ok = groups != NULL;
+    }
+    for (size_t i = 0; ok && i < count;) {
+        size_t end = run_end(entries, count, i, MATCH_HASH);
+        if (end - i > 1) {
+            groups[group_count++] = (DupesGroup){ i, end - i, entries[i].size * (end - i - 1) };
+            list.counts.duplicates += end - i - 1;
+            list.counts.redundant_bytes += entries[i].size * (end - i - 1);
+        }
+        i = end;
+    }
+    list.counts.groups = group_count;
+    if (ok) {
+        qsort(groups, group_count, sizeof(DupesGroup), compare_groups);
+    }
+    for (size_t g = 0; ok && g < group_count; g++) {
+        const DupesEntry *first = &entries[groups[g].first];
+        fprintf(out, "# %zu copies, %llu audio bytes each, xxh64 %016llx\n", groups[g].copies,
+                (unsigned long long)first->size, (unsigned long long)first->hash);
+        for (size_t j = 0; j < groups[g].copies; j++) {
+            fprintf(out, "%s\n", first[j].path);
+        }
+        fprintf(out, "\n");
+    }
+    if (ok && fflush(out) != 0) {
+        ok = false;
+    }
+
+    *counts = list.counts;
+    if (pool) {
+        pool_destroy(pool);
+    }
+    for (size_t i = 0; i < count; i++) {
+        free(entries[i].path);
+    }
+    free(entries);
+    free(groups);
+    pthread_mutex_destroy(&list.lock);
+    return ok;
+}
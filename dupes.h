@@ -0,0 +1,33 @@
+#ifndef DUPES_H
+#define DUPES_H
+
+#include <stdio.h>
+#include "types.h"
+
+// --- Duplicate Audio Finder (dupes) ---
+// Finds files whose audio payload is byte-for-byte the same, whatever their tags say. The
+// payload runs from the end of the ID3v2 tag(s) to the APEv2/ID3v1 trailers (see
+// audio_payload_range). Work is cut down in three passes, each on the thread pool:
+//   1. Walk the library and note every payload size; a size nobody else has is unique.
+//   2. Hash the first DUPES_PREFIX_SIZE bytes of each same-size file.
+//   3. Hash the whole payload only of files that still match on size and prefix, reading
+//      DUPES_READ_SIZE blocks aligned to the file so the kernel can read ahead.
+// Hashes are XXH64 (hash.h).
+typedef struct {
+    uint64_t files;           // MP3 files looked at
+    uint64_t candidates;      // Files sharing their payload size with another file
+    uint64_t fully_hashed;    // Files whose whole payload was read
+    uint64_t bytes_hashed;
+    uint64_t groups;          // Sets of identical payloads
+    uint64_t duplicates;      // Files in those sets beyond the first of each
+    uint64_t redundant_bytes; // Payload bytes held by those extra copies
+    uint64_t failures;
+} DupesCounts;
+
+// Writes one block per group to `out`, largest waste first:
+//   # <copies> copies, <bytes> audio bytes each, xxh64 <hash>
+//   <path>
+//   ...
+bool dupes_report(const char *root, int num_threads, FILE *out, DupesCounts *counts);
+
+#endif // DUPES_H
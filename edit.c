@@ -1,22 +1,31 @@
+#define _GNU_SOURCE // sync_file_range
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
 #include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "edit.h"
 #include "read.h"
 #include "helper.h"
+#include "simd.h"
+#include "tag.h"
+#include "tagindex.h"
+#include "stats.h"
 
-// Creates the full ID3v2.3 frame byte array for TIT2
-size_t create_tit2_frame(uint8_t *buffer, const char *title) 
+// Creates the full ID3v2.3/v2.4 text frame byte array (TIT2, TPE1, TALB, ...)
+size_t create_text_frame(uint8_t *buffer, const char *frame_id, const char *text, uint8_t version)
 {
     // Content = Encoding (1 byte) + Text (Variable)
-    size_t title_len = strlen(title);
-    uint32_t content_size = title_len + 1; 
+    size_t text_len = strlen(text);
+    uint32_t content_size = text_len + 1; 
     
-    // Frame ID (TIT2)
-    memcpy(buffer, "TIT2", 4);
+    // Frame ID
+    memcpy(buffer, frame_id, 4);
     
-    // Size (4 bytes, Big-Endian)
-    uint32_t raw_size = content_size;
+    // Size (4 bytes, Big-Endian; SyncSafe in v2.4)
+    uint32_t raw_size = (version == 4) ? encode_syncsafe(content_size) : content_size;
     reverse_bytes((uint8_t *)&raw_size, 4); 
     memcpy(buffer + 4, &raw_size, 4);
     
@@ -25,171 +34,501 @@ size_t create_tit2_frame(uint8_t *buffer, const char *title)
     
     // Content: Encoding (0x03 for UTF-8) + Text
     buffer[10] = 0x03; 
-    memcpy(buffer + 11, title, title_len);
+    memcpy(buffer + 11, text, text_len);
     
     return ID3_FRAME_HEADER_SIZE + content_size;
 }
 
-// Creates the full ID3v2.3 frame byte array for TPE1 (Artist) <--- NEW FUNCTION
-size_t create_tpe1_frame(uint8_t *buffer, const char *artist) 
-{
-    size_t artist_len = strlen(artist);
-    uint32_t content_size = artist_len + 1; 
-    
-    // Frame ID (TPE1)
-    memcpy(buffer, "TPE1", 4);
-    
-    // Size (4 bytes, Big-Endian)
-    uint32_t raw_size = content_size;
-    reverse_bytes((uint8_t *)&raw_size, 4); 
-    memcpy(buffer + 4, &raw_size, 4);
-    
-    // Flags (2 bytes, 0x0000)
-    memset(buffer + 8, 0, 2);
-    
-    // Content: Encoding (0x03 for UTF-8) + Text
-    buffer[10] = 0x03; 
-    memcpy(buffer + 11, artist, artist_len);
-    
-    return ID3_FRAME_HEADER_SIZE + content_size;
+
+// Padding reserved after the frames whenever the tag has to be rewritten
+static uint32_t tag_padding = DEFAULT_TAG_PADDING;
+
+void edit_set_padding(uint32_t padding) {
+    tag_padding = padding;
+}
+
+uint32_t edit_padding(void) {
+    return tag_padding;
 }
 
+// Tag index refreshed after each successful write (NULL = none)
+static TagIndex *tag_index = NULL;
+
+void edit_set_index(TagIndex *index) {
+    tag_index = index;
+}
+
+// --- Edit Set ---
+void edit_set_init(EditSet *set) {
+    memset(set, 0, sizeof(EditSet));
+}
+
+// Queues a text frame change; a later value for the same frame replaces the earlier one
+bool edit_set_add(EditSet *set, const char *frame_id, const char *value) {
+    // Only plain text frames (T***, except the user-defined TXXX) can be set from a string
+    if (strlen(frame_id) != 4 || frame_id[0] != 'T' || strcmp(frame_id, "TXXX") == 0) {
+        return false;
+    }
+    for (int i = 0; i < 4; i++) {
+        if (!((frame_id[i] >= 'A' && frame_id[i] <= 'Z') || (frame_id[i] >= '0' && frame_id[i] <= '9'))) {
+            return false;
+        }
+    }
+
+    for (int i = 0; i < set->count; i++) {
+        if (strcmp(set->edits[i].frame_id, frame_id) == 0) {
+            set->edits[i].value = value;
+            return true;
+        }
+    }
+
+    if (set->count >= MAX_EDIT_FRAMES) {
+        return false;
+    }
+    memcpy(set->edits[set->count].frame_id, frame_id, 5);
+    set->edits[set->count].value = value;
+    set->count++;
+    return true;
+}
+
+// Returns the index of the edit for this frame ID, or -1 if the frame is kept as is
+static int find_edit(const EditSet *set, const uint8_t *frame_id) {
+    for (int i = 0; i < set->count; i++) {
+        if (memcmp(set->edits[i].frame_id, frame_id, 4) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
 
-// Function to perform the actual file rewrite (Refactored from original edit_tag_title)
-static bool rewrite_file_with_new_frame(const char *filepath, const TagData *old_tag_data,
-                                        const ID3Header *old_header,
-                                        const char *frame_id, 
-                                        const uint8_t *new_frame_buffer, size_t new_frame_size,
-                                        uint32_t old_frame_pos, uint32_t old_frame_raw_size) 
+// Builds the new tag body from the old one: edited frames are rebuilt in the slot of their
+// first occurrence, duplicates are dropped, and frames not present yet are appended.
+static uint8_t *build_tag_body(const uint8_t *old_body, uint32_t old_size, uint8_t version,
+                               const EditSet *set, size_t *body_size, TagStatus *status)
 {
-    char temp_filepath[256];
-    strcpy(temp_filepath, filepath);
-    strcat(temp_filepath, TEMP_SUFFIX);
-    
-    // Calculate new tag size
-    // 1. Tag content size without the old frame
-    uint32_t tag_content_size_old = old_header->size;
-    if (old_frame_raw_size > 0) {
-        tag_content_size_old -= old_frame_raw_size;
+    size_t max_size = old_size;
+    for (int i = 0; i < set->count; i++) {
+        max_size += ID3_FRAME_HEADER_SIZE + 1 + strlen(set->edits[i].value);
     }
-    
-    // 2. New total tag size
-    uint32_t new_tag_size_decoded = tag_content_size_old + new_frame_size;
-    uint32_t new_tag_size_encoded = encode_syncsafe(new_tag_size_decoded);
-    
-    FILE *fp_in = fopen(filepath, "rb");
-    FILE *fp_out = fopen(temp_filepath, "wb");
-    if (!fp_in || !fp_out) {
-        if (fp_in) fclose(fp_in);
-        if (fp_out) fclose(fp_out);
-        perror("Error opening files for rewrite");
+
+    uint8_t *body = malloc(max_size);
+    if (!body) {
+        *status = TAG_ERR_NO_MEMORY;
+        return NULL;
+    }
+
+    bool written[MAX_EDIT_FRAMES] = {false};
+    size_t pos = 0;
+    uint32_t offset = 0;
+    ID3FrameHeader frame_header;
+
+    // Walk the old frames until the padding (or the end of the tag)
+    while (offset + ID3_FRAME_HEADER_SIZE <= old_size && old_body[offset] != 0) {
+        if (!decode_frame_header(old_body + offset, old_size - offset, version, &frame_header)) {
+            free(body); // Frame runs past the end of the tag: corrupt tag
+            *status = TAG_ERR_CORRUPT;
+            return NULL;
+        }
+        uint32_t frame_raw_size = ID3_FRAME_HEADER_SIZE + frame_header.size;
+
+        int edit = find_edit(set, old_body + offset);
+        if (edit < 0) {
+            memcpy(body + pos, old_body + offset, frame_raw_size);
+            pos += frame_raw_size;
+        } else if (!written[edit]) {
+            pos += create_text_frame(body + pos, set->edits[edit].frame_id, set->edits[edit].value, version);
+            written[edit] = true;
+        }
+
+        offset += frame_raw_size;
+        STATS_ADD(STAT_FRAMES_PARSED, 1);
+    }
+
+    // Frames that did not exist before go after the existing ones
+    for (int i = 0; i < set->count; i++) {
+        if (!written[i]) {
+            pos += create_text_frame(body + pos, set->edits[i].frame_id, set->edits[i].value, version);
+        }
+    }
+
+    *body_size = pos;
+    return body;
+}
+
+// Writes the 10-byte tag header. The extended header and footer are never written back:
+// the rebuilt body starts with the frames and the tag ends with its padding. The
+// unsynchronisation flag is kept, since the body is written back unsynchronised.
+static void encode_tag_header(uint8_t *buffer, const ID3Header *old_header, uint32_t tag_size) {
+    memcpy(buffer, "ID3", 3);
+    buffer[3] = old_header->version_major;
+    buffer[4] = 0x00; // Revision 0
+    buffer[5] = old_header->flags & ~(ID3_FLAG_EXTENDED | ID3_FLAG_FOOTER);
+
+    uint32_t raw_size_be = encode_syncsafe(tag_size);
+    reverse_bytes((uint8_t *)&raw_size_be, 4); // SyncSafe value stored Big-Endian
+    memcpy(buffer + 6, &raw_size_be, 4);
+}
+
+// Bytes that overwrite the start of the file in an in-place edit: the header (which drops an
+// extended header, if any) and the new body, zero-filled up to old_used. The padding past
+// old_used is zero already and is left alone, so a tag with a large padding costs one small write.
+uint8_t *edit_plan_region(const EditPlan *plan, size_t *region_size) {
+    size_t size = ID3_HEADER_SIZE + (plan->body_size > plan->old_used ? plan->body_size : plan->old_used);
+    uint8_t *region = calloc(1, size);
+    if (!region) {
+        return NULL;
+    }
+    encode_tag_header(region, &plan->old_header, plan->old_header.size);
+    memcpy(region + ID3_HEADER_SIZE, plan->body, plan->body_size);
+    *region_size = size;
+    return region;
+}
+
+// Records why a step failed (with errno for I/O errors) and returns false
+static bool plan_failed(EditPlan *plan, TagStatus status) {
+    plan->status = status;
+    plan->sys_errno = status == TAG_ERR_IO ? errno : 0;
+    return false;
+}
+
+// Overwrites only the tag region, filling the old tag exactly
+static bool write_tag_in_place(EditPlan *plan) {
+    size_t region_size;
+    uint8_t *tag_region = edit_plan_region(plan, &region_size);
+    if (!tag_region) {
+        return plan_failed(plan, TAG_ERR_NO_MEMORY);
+    }
+
+    STATS_TIMER_START(write_start);
+    ssize_t written = pwrite(plan->fd, tag_region, region_size, 0);
+    STATS_ADD(STAT_SYSCALLS, 1);
+    STATS_ADD(STAT_BYTES_WRITTEN, written > 0 ? written : 0);
+    STATS_TIMER_STOP(PHASE_TAG_WRITE, write_start);
+    bool ok = written == (ssize_t)region_size;
+    if (!ok) {
+        if (written >= 0) {
+            errno = ENOSPC; // A short write
+        }
+        plan_failed(plan, TAG_ERR_IO);
+    }
+    free(tag_region);
+    return ok;
+}
+
+// Writes the whole new file to temp_path when the tag has to grow: header, frames, padding,
+// then the audio that followed the old tag. The temp file gets the original's permissions.
+// With `durable` its data is on disk when this returns; otherwise write-back is only started
+// and the caller syncs the file later (batch edits sync many of them together).
+bool edit_plan_write_temp(EditPlan *plan, const char *temp_path, bool durable) {
+    const ID3Header *old_header = &plan->old_header;
+    FILE *fp_out = fopen(temp_path, "wb");
+    if (!fp_out) {
+        return plan_failed(plan, TAG_ERR_IO);
+    }
+
+    struct stat st_in;
+    if (fstat(plan->fd, &st_in) != 0 || fchmod(fileno(fp_out), st_in.st_mode & 07777) != 0) {
+        plan_failed(plan, TAG_ERR_IO);
+        fclose(fp_out);
+        remove(temp_path);
         return false;
     }
 
-    // --- 3a. Write the new ID3 Header ---
+    // New tag size: all frames plus the reserved padding, so the next edit fits in place.
+    // The padding is rounded up so the audio starts on a filesystem block boundary, which
+    // lets this and later rewrites share the audio blocks instead of copying them.
+    uint32_t padding = plan->padding;
+    struct stat st_out;
+    if (padding > 0 && fstat(fileno(fp_out), &st_out) == 0 && st_out.st_blksize > 0) {
+        uint32_t audio_start = ID3_HEADER_SIZE + plan->body_size + padding;
+        padding += (st_out.st_blksize - audio_start % st_out.st_blksize) % st_out.st_blksize;
+    }
+    if ((uint64_t)plan->body_size + padding > ID3_MAX_TAG_SIZE) {
+        padding = ID3_MAX_TAG_SIZE - (uint32_t)plan->body_size;
+    }
+    uint32_t new_tag_size_decoded = plan->body_size + padding;
+
+    // --- 1. Write the new ID3 Header ---
+    STATS_TIMER_START(write_start);
     uint8_t header_buffer[ID3_HEADER_SIZE];
-    memcpy(header_buffer, "ID3", 3);
-    header_buffer[3] = 0x03; // V2.3
-    header_buffer[4] = 0x00; // Revision 0
-    header_buffer[5] = 0x00; // Flags
-    
-    uint32_t raw_size_be = new_tag_size_encoded; // Already SyncSafe Big-Endian
-    memcpy(header_buffer + 6, &raw_size_be, 4);
+    encode_tag_header(header_buffer, old_header, new_tag_size_decoded);
     
     fwrite(header_buffer, 1, ID3_HEADER_SIZE, fp_out);
 
-    // --- 3b. Write the new frame (TIT2 or TPE1) ---
-    fwrite(new_frame_buffer, 1, new_frame_size, fp_out);
-    
-    // --- 3c. Copy remaining frames and audio ---
-    long data_start_pos = old_header->size + ID3_HEADER_SIZE;
-    
-    // The point in the old file right after the frame we replaced
-    long old_frame_end_pos = old_frame_pos + old_frame_raw_size;
-    
-    // Start copying from the beginning of the audio data if we couldn't find the old frame
-    long copy_start_pos = (old_frame_raw_size > 0) ? old_frame_end_pos : ID3_HEADER_SIZE;
+    // --- 2. Write all frames, then the zero padding ---
+    fwrite(plan->body, 1, plan->body_size, fp_out);
+
+    char zero_buffer[4096] = {0};
+    uint32_t padding_left = padding;
+    while (padding_left > 0) {
+        size_t chunk = (padding_left < sizeof(zero_buffer)) ? padding_left : sizeof(zero_buffer);
+        fwrite(zero_buffer, 1, chunk, fp_out);
+        padding_left -= chunk;
+    }
+    bool flushed = fflush(fp_out) == 0;
+    STATS_ADD(STAT_SYSCALLS, 2 + (ID3_HEADER_SIZE + plan->body_size + padding) / BUFSIZ); // open + stdio flushes
+    STATS_ADD(STAT_BYTES_WRITTEN, ID3_HEADER_SIZE + plan->body_size + padding);
+    STATS_TIMER_STOP(PHASE_TAG_WRITE, write_start);
+    if (!flushed) {
+        plan_failed(plan, TAG_ERR_IO);
+        fclose(fp_out);
+        remove(temp_path);
+        return false;
+    }
     
-    // If the old frame was found, we seek to copy all frames that followed it
-    if (fseek(fp_in, copy_start_pos, SEEK_SET) != 0) {
-        printf("Error: Failed to seek input file.\n");
-        fclose(fp_in);
+    // --- 3. Copy the audio that followed the old tag (in the kernel where possible) ---
+    STATS_TIMER_START(copy_start);
+    off_t data_start_pos = old_header->size + ID3_HEADER_SIZE +
+                           ((old_header->flags & ID3_FLAG_FOOTER) ? ID3_HEADER_SIZE : 0);
+    off_t new_data_start_pos = ID3_HEADER_SIZE + new_tag_size_decoded;
+    bool copied = st_in.st_size <= data_start_pos ||
+                  copy_file_region(plan->fd, data_start_pos, fileno(fp_out), new_data_start_pos,
+                                   st_in.st_size - data_start_pos) != COPY_FAILED;
+    STATS_ADD(STAT_SYSCALLS, 2);
+    STATS_ADD(STAT_BYTES_COPIED, (copied && st_in.st_size > data_start_pos) ? st_in.st_size - data_start_pos : 0);
+    STATS_TIMER_STOP(PHASE_AUDIO_COPY, copy_start);
+    if (!copied) {
+        plan_failed(plan, TAG_ERR_IO);
         fclose(fp_out);
+        remove(temp_path);
         return false;
     }
 
-    // Copy remaining tag data + audio data
-    char copy_buffer[4096];
-    size_t bytes_read;
-    while ((bytes_read = fread(copy_buffer, 1, 4096, fp_in)) > 0) {
-        fwrite(copy_buffer, 1, bytes_read, fp_out);
+    // --- 4. Get the data on its way to the disk ---
+    bool synced = durable ? fdatasync(fileno(fp_out)) == 0
+                          : sync_file_range(fileno(fp_out), 0, 0, SYNC_FILE_RANGE_WRITE) == 0;
+    STATS_ADD(STAT_SYSCALLS, 1);
+    if (fclose(fp_out) != 0 || !synced) {
+        plan_failed(plan, TAG_ERR_IO);
+        remove(temp_path);
+        return false;
     }
+    return true;
+}
 
-    // --- 4. CLEANUP and RENAME ---
-    fclose(fp_in);
-    fclose(fp_out);
-
-    if (remove(filepath) != 0) {
-        perror("Error deleting original file");
-        return false;
+// Replaces the file with its rewritten copy. The copy is complete and on disk before the
+// rename, which swaps it in atomically, so a crash leaves either the old or the new file.
+// Syncing the directory afterwards makes the rename itself survive a crash.
+static bool rewrite_file(const char *filepath, EditPlan *plan) {
+    char *temp_filepath = path_with_suffix(filepath, TEMP_SUFFIX);
+    if (!temp_filepath) {
+        return plan_failed(plan, TAG_ERR_NO_MEMORY);
     }
-    if (rename(temp_filepath, filepath) != 0) {
-        perror("Error renaming temporary file");
+    if (!edit_plan_write_temp(plan, temp_filepath, true)) {
+        free(temp_filepath);
         return false;
     }
 
+    STATS_TIMER_START(rename_start);
+    STATS_ADD(STAT_SYSCALLS, 3);
+    bool renamed = rename(temp_filepath, filepath) == 0;
+    if (!renamed) {
+        plan_failed(plan, TAG_ERR_IO);
+        remove(temp_filepath);
+    } else {
+        sync_parent_dir(filepath); // Best effort: the file itself is complete either way
+    }
+    STATS_TIMER_STOP(PHASE_RENAME, rename_start);
+
+    free(temp_filepath);
+    return renamed;
+}
+
+// Frees what the plan holds so far, keeping the reason it failed
+static bool plan_abort(EditPlan *plan, TagStatus status) {
+    int saved_errno = errno;
+    edit_plan_free(plan);
+    errno = saved_errno;
+    return plan_failed(plan, status);
+}
+
+// Reads the tag and builds its replacement. Nothing is written yet; the plan keeps the file
+// open for the write that follows. On failure plan->status says why.
+bool edit_plan(const char *filepath, const EditSet *set, EditPlan *plan) {
+    return edit_plan_padded(filepath, set, tag_padding, plan);
+}
+
+bool edit_plan_padded(const char *filepath, const EditSet *set, uint32_t padding, EditPlan *plan) {
+    memset(plan, 0, sizeof(EditPlan));
+    plan->fd = -1;
+    if (set->count == 0) {
+        return plan_abort(plan, TAG_ERR_INVALID);
+    }
+    STATS_TIMER_START(open_start);
+    plan->fd = open(filepath, O_RDWR);
+    STATS_ADD(STAT_SYSCALLS, 1);
+    STATS_TIMER_STOP(PHASE_OPEN, open_start);
+    if (plan->fd < 0) {
+        return plan_abort(plan, TAG_ERR_IO);
+    }
+
+    STATS_TIMER_START(header_start);
+    ID3Header *old_header = &plan->old_header;
+    uint8_t header_buffer[ID3_HEADER_SIZE];
+    ssize_t got = pread(plan->fd, header_buffer, ID3_HEADER_SIZE, 0);
+    if (got < 0) {
+        return plan_abort(plan, TAG_ERR_IO);
+    }
+    if (got != ID3_HEADER_SIZE || !decode_id3_header(header_buffer, old_header)) {
+        return plan_abort(plan, TAG_ERR_NO_TAG);
+    }
+
+    // v2.2 frames have a different layout
+    if (old_header->version_major == 2) {
+        return plan_abort(plan, TAG_ERR_UNSUPPORTED);
+    }
+
+    // Read the whole old tag in one go
+    size_t region_size = ID3_HEADER_SIZE + (size_t)old_header->size;
+    plan->old_region = malloc(region_size);
+    if (!plan->old_region) {
+        return plan_abort(plan, TAG_ERR_NO_MEMORY);
+    }
+    got = pread(plan->fd, plan->old_region, region_size, 0);
+    if (got != (ssize_t)region_size) {
+        return plan_abort(plan, got < 0 ? TAG_ERR_IO : TAG_ERR_CORRUPT); // Tag runs past the end of the file
+    }
+    STATS_ADD(STAT_SYSCALLS, 2);
+    STATS_ADD(STAT_BYTES_READ, ID3_HEADER_SIZE + region_size);
+    STATS_TIMER_STOP(PHASE_HEADER, header_start);
+
+    STATS_TIMER_START(frames_start);
+    const uint8_t *old_body = plan->old_region + ID3_HEADER_SIZE;
+    // Bytes of the old tag in use before its zero padding, as stored in the file
+    plan->old_used = padding_start(old_body, old_header->size);
+
+    // A v2.3 tag unsynchronised as a whole is decoded, edited, and unsynchronised again.
+    // v2.4 unsynchronises frame by frame: old frames are copied as they are, and the new
+    // UTF-8 text frames never contain 0xFF, so they need no stuffing.
+    bool tag_unsync = old_header->version_major < 4 && (old_header->flags & ID3_FLAG_UNSYNC);
+    ID3Header decoded_header = *old_header;
+    uint8_t *decoded = NULL;
+    if (tag_unsync) {
+        decoded = malloc(old_header->size + 1);
+        if (!decoded) {
+            return plan_abort(plan, TAG_ERR_NO_MEMORY);
+        }
+        decoded_header.size = unsync_decode(decoded, old_body, old_header->size);
+        old_body = decoded;
+    }
+
+    size_t body_size;
+    uint32_t frames_offset = first_frame_offset(&decoded_header, old_body);
+    TagStatus status = TAG_OK;
+    uint8_t *body = build_tag_body(old_body + frames_offset, decoded_header.size - frames_offset,
+                                   old_header->version_major, set, &body_size, &status);
+    free(decoded);
+    if (body && tag_unsync) {
+        uint8_t *encoded = malloc(2 * body_size);
+        if (encoded) {
+            body_size = unsync_encode(encoded, body, body_size);
+        } else {
+            status = TAG_ERR_NO_MEMORY;
+        }
+        free(body);
+        body = encoded;
+    }
+    STATS_TIMER_STOP(PHASE_FRAMES, frames_start);
+    if (!body) {
+        return plan_abort(plan, status);
+    }
+    plan->body = body;
+    plan->body_size = body_size;
+    plan->padding = padding;
+
+    // A SyncSafe tag size tops out at 256 MB; past that the header would wrap silently
+    if (body_size > ID3_MAX_TAG_SIZE) {
+        return plan_abort(plan, TAG_ERR_TOO_LARGE);
+    }
+
+    // The new frames fit in the old frames' slots plus the padding: no need to move the audio.
+    // A v2.4 footer sits where the padding would go, so those tags are always rewritten.
+    plan->in_place = body_size <= old_header->size && !(old_header->flags & ID3_FLAG_FOOTER);
     return true;
 }
 
+// Bytes the plan will write: the tag region in place, or the whole new file for a rewrite
+// (an upper bound there, since reflink and copy_file_range may share the audio instead)
+uint64_t edit_plan_write_size(const EditPlan *plan) {
+    if (plan->in_place) {
+        return ID3_HEADER_SIZE + (plan->body_size > plan->old_used ? plan->body_size : plan->old_used);
+    }
+    struct stat st;
+    uint64_t audio_start = ID3_HEADER_SIZE + (uint64_t)plan->old_header.size +
+                           ((plan->old_header.flags & ID3_FLAG_FOOTER) ? ID3_HEADER_SIZE : 0);
+    uint64_t audio = fstat(plan->fd, &st) == 0 && (uint64_t)st.st_size > audio_start ? st.st_size - audio_start : 0;
+    return ID3_HEADER_SIZE + plan->body_size + plan->padding + audio;
+}
 
-// Main function to edit the title tag (uses the rewrite helper)
-bool edit_tag_title(const char *filepath, const char *new_title) {
-    TagData old_tag_data;
-    if (!read_tags_from_file(filepath, &old_tag_data)) {
-        printf("Error: Could not read original tag data.\n");
-        return false;
+// Closes the file and frees the buffers; false if closing reported a write error
+bool edit_plan_free(EditPlan *plan) {
+    bool closed = plan->fd < 0 || close(plan->fd) == 0;
+    free(plan->old_region);
+    free(plan->body);
+    memset(plan, 0, sizeof(EditPlan));
+    plan->fd = -1;
+    return closed;
+}
+
+// Applies every queued frame change with one open, one tag read and at most one write.
+// Prints nothing; *sys_errno (may be NULL) gets the errno behind TAG_ERR_IO.
+TagStatus edit_apply(const char *filepath, const EditSet *set, uint32_t padding, int *sys_errno) {
+    EditPlan plan;
+    bool success = edit_plan_padded(filepath, set, padding, &plan) &&
+                   (plan.in_place ? write_tag_in_place(&plan) : rewrite_file(filepath, &plan));
+    TagStatus status = success ? TAG_OK : plan.status;
+    int error = plan.sys_errno;
+    if (!edit_plan_free(&plan) && status == TAG_OK) {
+        status = TAG_ERR_IO; // close reported a deferred write error
+        error = errno;
     }
-    
-    ID3Header old_header;
-    FILE *fp_in = fopen(filepath, "rb");
-    if (!fp_in || !read_id3_header(fp_in, &old_header)) {
-        printf("Error: Could not read original ID3 header.\n");
-        if (fp_in) fclose(fp_in);
-        return false;
+
+    if (sys_errno) {
+        *sys_errno = status == TAG_ERR_IO ? error : 0;
     }
-    fclose(fp_in);
-    
-    // BUILD new TIT2 frame
-    uint8_t new_tit2_buffer[256];
-    size_t new_tit2_size = create_tit2_frame(new_tit2_buffer, new_title);
-    
-    return rewrite_file_with_new_frame(filepath, &old_tag_data, &old_header, 
-                                       "TIT2", new_tit2_buffer, new_tit2_size,
-                                       old_tag_data.title_pos, old_tag_data.title_size_raw);
+    return status;
 }
 
-// Main function to edit the artist tag <--- NEW PUBLIC FUNCTION
-bool edit_tag_artist(const char *filepath, const char *new_artist) {
-    TagData old_tag_data;
-    if (!read_tags_from_file(filepath, &old_tag_data)) {
-        printf("Error: Could not read original tag data.\n");
+// Command-line form of edit_apply: the global padding, a message on failure, index refresh
+bool apply_edit_set(const char *filepath, const EditSet *set) {
+    int sys_errno;
+    TagStatus status = edit_apply(filepath, set, tag_padding, &sys_errno);
+    if (status != TAG_OK) {
+        edit_report_error(filepath, status, sys_errno);
         return false;
     }
-    
-    ID3Header old_header;
-    FILE *fp_in = fopen(filepath, "rb");
-    if (!fp_in || !read_id3_header(fp_in, &old_header)) {
-        printf("Error: Could not read original ID3 header.\n");
-        if (fp_in) fclose(fp_in);
-        return false;
+    edit_note_written(filepath);
+    return true;
+}
+
+void edit_report_error(const char *filepath, TagStatus status, int sys_errno) {
+    if (status == TAG_ERR_IO && sys_errno != 0) {
+        printf("Error: %s: %s (%s).\n", filepath, tag_status_string(status), strerror(sys_errno));
+    } else {
+        printf("Error: %s: %s.\n", filepath, tag_status_string(status));
     }
-    fclose(fp_in);
-    
-    // BUILD new TPE1 frame
-    uint8_t new_tpe1_buffer[256];
-    size_t new_tpe1_size = create_tpe1_frame(new_tpe1_buffer, new_artist);
-    
-    return rewrite_file_with_new_frame(filepath, &old_tag_data, &old_header, 
-                                       "TPE1", new_tpe1_buffer, new_tpe1_size,
-                                       old_tag_data.artist_pos, old_tag_data.artist_size_raw);
+}
+
+// Keeps the index in step with a file we just wrote
+void edit_note_written(const char *filepath) {
+    if (tag_index) {
+        tag_index_refresh_file(tag_index, filepath);
+    }
+}
+
+
+// Main function to edit the title tag
+bool edit_tag_title(const char *filepath, const char *new_title) {
+    EditSet set;
+    edit_set_init(&set);
+    edit_set_add(&set, "TIT2", new_title);
+    return apply_edit_set(filepath, &set);
+}
+
+// Main function to edit the artist tag
+bool edit_tag_artist(const char *filepath, const char *new_artist) {
+    EditSet set;
+    edit_set_init(&set);
+    edit_set_add(&set, "TPE1", new_artist);
+    return apply_edit_set(filepath, &set);
 }
\ No newline at end of file
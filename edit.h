@@ -7,4 +7,26 @@
 bool edit_tag_title(const char *filepath, const char *new_title);
 bool edit_tag_artist(const char *filepath, const char *new_artist); // <--- NEW DECLARATION
 
+// --- Batch Edits (all changes applied in a single pass per file) ---
+void edit_set_init(EditSet *set);
+bool edit_set_add(EditSet *set, const char *frame_id, const char *value);
+bool apply_edit_set(const char *filepath, const EditSet *set); // Prints errors, refreshes the index
+TagStatus edit_apply(const char *filepath, const EditSet *set, uint32_t padding, int *sys_errno);
+void edit_report_error(const char *filepath, TagStatus status, int sys_errno);
+
+// --- Edit Planning (the steps of apply_edit_set, also used by batch.c) ---
+// On failure plan->status (and plan->sys_errno) tell why; nothing is printed
+bool edit_plan(const char *filepath, const EditSet *set, EditPlan *plan); // Global padding
+bool edit_plan_padded(const char *filepath, const EditSet *set, uint32_t padding, EditPlan *plan);
+uint8_t *edit_plan_region(const EditPlan *plan, size_t *region_size); // In-place bytes (malloc'd)
+bool edit_plan_write_temp(EditPlan *plan, const char *temp_path, bool durable);
+uint64_t edit_plan_write_size(const EditPlan *plan); // Bytes in place, or the whole new file
+bool edit_plan_free(EditPlan *plan);
+void edit_note_written(const char *filepath); // Refreshes the tag index after an edit
+
+// --- Edit Settings ---
+void edit_set_padding(uint32_t padding); // Padding reserved when a tag has to grow
+uint32_t edit_padding(void);
+void edit_set_index(TagIndex *index);     // Tag index to refresh after each successful edit
+
 #endif
\ No newline at end of file
@@ -0,0 +1,123 @@
+#ifndef FRAMES_H
+#define FRAMES_H
+
+#include <stdint.h>
+
+// --- Frame ID Table ---
+// Frame IDs are handled as packed Big-Endian integers (see pack_frame_id). The table below
+// is the single list of frames we know by name; everything else is generated from it at
+// compile time: FRAME_ID_xxxx constants, the frame kind dispatch and the v2.2 -> v2.3 map.
+// Frames not listed still parse; they get their kind from the first letter of the ID.
+
+#define FRAME_ID(a, b, c, d) \
+    (((uint32_t)(a) << 24) | ((uint32_t)(b) << 16) | ((uint32_t)(c) << 8) | (uint32_t)(d))
+
+typedef enum {
+    FRAME_KIND_OTHER,         // Binary payload we don't interpret
+    FRAME_KIND_TEXT,          // T***: encoding + text
+    FRAME_KIND_USER_TEXT,     // TXXX: encoding + description + value
+    FRAME_KIND_COMMENT,       // COMM, USLT: encoding + language + description + text
+    FRAME_KIND_URL,           // W***: Latin-1 URL
+    FRAME_KIND_USER_URL,      // WXXX: encoding + description + URL
+    FRAME_KIND_PICTURE        // APIC (PIC in v2.2)
+} FrameKind;
+
+// X(name, v2.3/v2.4 ID characters, v2.2 ID characters, kind)
+#define ID3_FRAME_TABLE(X) \
+    X(TIT1, 'T','I','T','1', 'T','T','1', FRAME_KIND_TEXT) \
+    X(TIT2, 'T','I','T','2', 'T','T','2', FRAME_KIND_TEXT) \
+    X(TIT3, 'T','I','T','3', 'T','T','3', FRAME_KIND_TEXT) \
+    X(TPE1, 'T','P','E','1', 'T','P','1', FRAME_KIND_TEXT) \
+    X(TPE2, 'T','P','E','2', 'T','P','2', FRAME_KIND_TEXT) \
+    X(TPE3, 'T','P','E','3', 'T','P','3', FRAME_KIND_TEXT) \
+    X(TPE4, 'T','P','E','4', 'T','P','4', FRAME_KIND_TEXT) \
+    X(TALB, 'T','A','L','B', 'T','A','L', FRAME_KIND_TEXT) \
+    X(TYER, 'T','Y','E','R', 'T','Y','E', FRAME_KIND_TEXT) \
+    X(TDAT, 'T','D','A','T', 'T','D','A', FRAME_KIND_TEXT) \
+    X(TIME, 'T','I','M','E', 'T','I','M', FRAME_KIND_TEXT) \
+    X(TRDA, 'T','R','D','A', 'T','R','D', FRAME_KIND_TEXT) \
+    X(TORY, 'T','O','R','Y', 'T','O','R', FRAME_KIND_TEXT) \
+    X(TRCK, 'T','R','C','K', 'T','R','K', FRAME_KIND_TEXT) \
+    X(TPOS, 'T','P','O','S', 'T','P','A', FRAME_KIND_TEXT) \
+    X(TCON, 'T','C','O','N', 'T','C','O', FRAME_KIND_TEXT) \
+    X(TCOM, 'T','C','O','M', 'T','C','M', FRAME_KIND_TEXT) \
+    X(TEXT, 'T','E','X','T', 'T','X','T', FRAME_KIND_TEXT) \
+    X(TLAN, 'T','L','A','N', 'T','L','A', FRAME_KIND_TEXT) \
+    X(TLEN, 'T','L','E','N', 'T','L','E', FRAME_KIND_TEXT) \
+    X(TMED, 'T','M','E','D', 'T','M','T', FRAME_KIND_TEXT) \
+    X(TPUB, 'T','P','U','B', 'T','P','B', FRAME_KIND_TEXT) \
+    X(TCOP, 'T','C','O','P', 'T','C','R', FRAME_KIND_TEXT) \
+    X(TENC, 'T','E','N','C', 'T','E','N', FRAME_KIND_TEXT) \
+    X(TSSE, 'T','S','S','E', 'T','S','S', FRAME_KIND_TEXT) \
+    X(TBPM, 'T','B','P','M', 'T','B','P', FRAME_KIND_TEXT) \
+    X(TKEY, 'T','K','E','Y', 'T','K','E', FRAME_KIND_TEXT) \
+    X(TOAL, 'T','O','A','L', 'T','O','T', FRAME_KIND_TEXT) \
+    X(TOPE, 'T','O','P','E', 'T','O','A', FRAME_KIND_TEXT) \
+    X(TOLY, 'T','O','L','Y', 'T','O','L', FRAME_KIND_TEXT) \
+    X(TOFN, 'T','O','F','N', 'T','O','F', FRAME_KIND_TEXT) \
+    X(TSRC, 'T','S','R','C', 'T','R','C', FRAME_KIND_TEXT) \
+    X(TSIZ, 'T','S','I','Z', 'T','S','I', FRAME_KIND_TEXT) \
+    X(TDLY, 'T','D','L','Y', 'T','D','Y', FRAME_KIND_TEXT) \
+    X(TFLT, 'T','F','L','T', 'T','F','T', FRAME_KIND_TEXT) \
+    X(TXXX, 'T','X','X','X', 'T','X','X', FRAME_KIND_USER_TEXT) \
+    X(COMM, 'C','O','M','M', 'C','O','M', FRAME_KIND_COMMENT) \
+    X(USLT, 'U','S','L','T', 'U','L','T', FRAME_KIND_COMMENT) \
+    X(WXXX, 'W','X','X','X', 'W','X','X', FRAME_KIND_USER_URL) \
+    X(WCOM, 'W','C','O','M', 'W','C','M', FRAME_KIND_URL) \
+    X(WCOP, 'W','C','O','P', 'W','C','P', FRAME_KIND_URL) \
+    X(WOAF, 'W','O','A','F', 'W','A','F', FRAME_KIND_URL) \
+    X(WOAR, 'W','O','A','R', 'W','A','R', FRAME_KIND_URL) \
+    X(WOAS, 'W','O','A','S', 'W','A','S', FRAME_KIND_URL) \
+    X(WPUB, 'W','P','U','B', 'W','P','B', FRAME_KIND_URL) \
+    X(APIC, 'A','P','I','C', 'P','I','C', FRAME_KIND_PICTURE) \
+    X(GEOB, 'G','E','O','B', 'G','E','O', FRAME_KIND_OTHER) \
+    X(PCNT, 'P','C','N','T', 'C','N','T', FRAME_KIND_OTHER) \
+    X(POPM, 'P','O','P','M', 'P','O','P', FRAME_KIND_OTHER) \
+    X(UFID, 'U','F','I','D', 'U','F','I', FRAME_KIND_OTHER) \
+    X(MCDI, 'M','C','D','I', 'M','C','I', FRAME_KIND_OTHER) \
+    X(ETCO, 'E','T','C','O', 'E','T','C', FRAME_KIND_OTHER) \
+    X(SYLT, 'S','Y','L','T', 'S','L','T', FRAME_KIND_OTHER) \
+    X(RVAD, 'R','V','A','D', 'R','V','A', FRAME_KIND_OTHER)
+
+// Frames introduced after v2.2: Y(name, ID characters, kind)
+#define ID3_FRAME_TABLE_V23(Y) \
+    Y(TDRC, 'T','D','R','C', FRAME_KIND_TEXT) \
+    Y(TDOR, 'T','D','O','R', FRAME_KIND_TEXT) \
+    Y(PRIV, 'P','R','I','V', FRAME_KIND_OTHER)
+
+enum {
+#define X(name, a, b, c, d, a2, b2, c2, kind) FRAME_ID_##name = FRAME_ID(a, b, c, d),
+    ID3_FRAME_TABLE(X)
+#undef X
+#define Y(name, a, b, c, d, kind) FRAME_ID_##name = FRAME_ID(a, b, c, d),
+    ID3_FRAME_TABLE_V23(Y)
+#undef Y
+};
+
+// Kind of a (v2.3/v2.4) frame ID; compiles to a jump table / binary search on the packed ID
+static inline FrameKind frame_kind(uint32_t id) {
+    switch (id) {
+#define X(name, a, b, c, d, a2, b2, c2, kind) case FRAME_ID_##name: return kind;
+    ID3_FRAME_TABLE(X)
+#undef X
+#define Y(name, a, b, c, d, kind) case FRAME_ID_##name: return kind;
+    ID3_FRAME_TABLE_V23(Y)
+#undef Y
+    default:
+        return (id >> 24) == 'T' ? FRAME_KIND_TEXT : (id >> 24) == 'W' ? FRAME_KIND_URL : FRAME_KIND_OTHER;
+    }
+}
+
+// Maps a v2.2 ID (three characters packed in the top bytes, low byte 0) to its v2.3 ID.
+// IDs without a v2.3 equivalent are returned unchanged, so they keep a zero low byte.
+static inline uint32_t frame_id_from_v22(uint32_t id) {
+    switch (id) {
+#define X(name, a, b, c, d, a2, b2, c2, kind) case FRAME_ID(a2, b2, c2, 0): return FRAME_ID_##name;
+    ID3_FRAME_TABLE(X)
+#undef X
+    default:
+        return id;
+    }
+}
+
+#endif // FRAMES_H
@@ -0,0 +1,130 @@
+#include <string.h>
+#include "hash.h"
+
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+static uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+// Little-endian loads, whatever the alignment
+static uint64_t read64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+static uint32_t read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap32(v);
+#endif
+    return v;
+}
+
+static uint64_t round64(uint64_t acc, uint64_t input) {
+    acc += input * PRIME64_2;
+    acc = rotl64(acc, 31);
+    return acc * PRIME64_1;
+}
+
+static uint64_t merge_round(uint64_t acc, uint64_t lane) {
+    acc ^= round64(0, lane);
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+// Four independent lanes over 32-byte stripes, so the multiplies pipeline
+static void consume_stripes(uint64_t *lanes, const uint8_t *p, size_t stripes) {
+    uint64_t v1 = lanes[0], v2 = lanes[1], v3 = lanes[2], v4 = lanes[3];
+    for (size_t i = 0; i < stripes; i++, p += 32) {
+        v1 = round64(v1, read64(p));
+        v2 = round64(v2, read64(p + 8));
+        v3 = round64(v3, read64(p + 16));
+        v4 = round64(v4, read64(p + 24));
+    }
+    lanes[0] = v1; lanes[1] = v2; lanes[2] = v3; lanes[3] = v4;
+}
+
+void hash64_init(Hash64State *state) {
+    memset(state, 0, sizeof(Hash64State));
+    state->lanes[0] = PRIME64_1 + PRIME64_2;
+    state->lanes[1] = PRIME64_2;
+    state->lanes[2] = 0;
+    state->lanes[3] = -PRIME64_1;
+}
+
+void hash64_update(Hash64State *state, const void *data, size_t size) {
+    const uint8_t *p = data;
+    state->total += size;
+
+    if (state->pending_size > 0) {
+        size_t fill = 32 - state->pending_size;
+        if (size < fill) {
+            memcpy(state->pending + state->pending_size, p, size);
+            state->pending_size += size;
+            return;
+        }
+        memcpy(state->pending + state->pending_size, p, fill);
+        consume_stripes(state->lanes, state->pending, 1);
+        state->pending_size = 0;
+        p += fill;
+        size -= fill;
+    }
+
+    consume_stripes(state->lanes, p, size / 32);
+    memcpy(state->pending, p + (size & ~(size_t)31), size & 31);
+    state->pending_size = size & 31;
+}
+
+uint64_t hash64_final(const Hash64State *state) {
+    const uint64_t *v = state->lanes;
+    uint64_t h;
+    if (state->total >= 32) {
+        h = rotl64(v[0], 1) + rotl64(v[1], 7) + rotl64(v[2], 12) + rotl64(v[3], 18);
+        for (int i = 0; i < 4; i++) {
+            h = merge_round(h, v[i]);
+        }
+    } else {
+        h = v[2] + PRIME64_5; // v[2] still holds the seed
+    }
+    h += state->total;
+
+    const uint8_t *p = state->pending;
+    size_t left = state->pending_size;
+    for (; left >= 8; left -= 8, p += 8) {
+        h ^= round64(0, read64(p));
+        h = rotl64(h, 27) * PRIME64_1 + PRIME64_4;
+    }
+    if (left >= 4) {
+        h ^= (uint64_t)read32(p) * PRIME64_1;
+        h = rotl64(h, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+        left -= 4;
+    }
+    for (; left > 0; left--, p++) {
+        h ^= *p * PRIME64_5;
+        h = rotl64(h, 11) * PRIME64_1;
+    }
+
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+uint64_t hash64(const void *data, size_t size) {
+    Hash64State state;
+    hash64_init(&state);
+    hash64_update(&state, data, size);
+    return hash64_final(&state);
+}
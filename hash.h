@@ -0,0 +1,23 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// --- 64-bit Content Hash (XXH64) ---
+// Fast non-cryptographic hash for telling identical payloads apart. Data can be fed in
+// pieces of any size; the result is the same as hashing it in one go.
+typedef struct {
+    uint64_t lanes[4];
+    uint64_t total;           // Bytes hashed so far
+    uint8_t pending[32];      // Tail that does not fill a 32-byte stripe yet
+    size_t pending_size;
+} Hash64State;
+
+void hash64_init(Hash64State *state);
+void hash64_update(Hash64State *state, const void *data, size_t size);
+uint64_t hash64_final(const Hash64State *state);
+
+uint64_t hash64(const void *data, size_t size);
+
+#endif // HASH_H
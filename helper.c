@@ -1,6 +1,14 @@
+#define _GNU_SOURCE // copy_file_range
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
 #include "helper.h"
 
 // Function to reverse byte order (necessary for Little-Endian to Big-Endian conversion)
@@ -39,6 +47,83 @@ uint32_t encode_syncsafe(uint32_t std_int) {
     return encoded;
 }
 
+// Packs a 4-character frame ID into one integer so IDs compare with a single instruction
+uint32_t pack_frame_id(const uint8_t *id) {
+    return ((uint32_t)id[0] << 24) | ((uint32_t)id[1] << 16) | ((uint32_t)id[2] << 8) | id[3];
+}
+
+// Appends one Unicode code point as UTF-8; returns false when the output is full
+static bool put_utf8(uint32_t cp, char *out, size_t out_size, size_t *len) {
+    uint8_t bytes[4];
+    size_t n;
+    if (cp < 0x80) {
+        bytes[0] = cp; n = 1;
+    } else if (cp < 0x800) {
+        bytes[0] = 0xC0 | (cp >> 6); bytes[1] = 0x80 | (cp & 0x3F); n = 2;
+    } else if (cp < 0x10000) {
+        bytes[0] = 0xE0 | (cp >> 12); bytes[1] = 0x80 | ((cp >> 6) & 0x3F);
+        bytes[2] = 0x80 | (cp & 0x3F); n = 3;
+    } else {
+        bytes[0] = 0xF0 | (cp >> 18); bytes[1] = 0x80 | ((cp >> 12) & 0x3F);
+        bytes[2] = 0x80 | ((cp >> 6) & 0x3F); bytes[3] = 0x80 | (cp & 0x3F); n = 4;
+    }
+    if (*len + n >= out_size) {
+        return false;
+    }
+    memcpy(out + *len, bytes, n);
+    *len += n;
+    return true;
+}
+
+// Decodes ID3 text (any of the four encodings) into a NUL-terminated UTF-8 string.
+// Stops at the first NUL terminator; returns the number of bytes written (without the NUL).
+size_t decode_id3_text(uint8_t encoding, const uint8_t *data, uint32_t size, char *out, size_t out_size) {
+    size_t len = 0;
+    if (out_size == 0) {
+        return 0;
+    }
+
+    if (encoding == 0x01 || encoding == 0x02) {
+        // UTF-16: Big-Endian unless a Little-Endian BOM says otherwise
+        bool little_endian = false;
+        uint32_t i = 0;
+        if (encoding == 0x01 && size >= 2) {
+            if (data[0] == 0xFF && data[1] == 0xFE) { little_endian = true; i = 2; }
+            else if (data[0] == 0xFE && data[1] == 0xFF) { i = 2; }
+        }
+        for (; i + 1 < size; i += 2) {
+            uint32_t unit = little_endian ? (data[i] | (data[i + 1] << 8)) : ((data[i] << 8) | data[i + 1]);
+            if (unit == 0) {
+                break;
+            }
+            if (unit >= 0xD800 && unit < 0xDC00 && i + 3 < size) { // Surrogate pair
+                uint32_t low = little_endian ? (data[i + 2] | (data[i + 3] << 8)) : ((data[i + 2] << 8) | data[i + 3]);
+                unit = 0x10000 + ((unit - 0xD800) << 10) + (low - 0xDC00);
+                i += 2;
+            }
+            if (!put_utf8(unit, out, out_size, &len)) {
+                break;
+            }
+        }
+    } else {
+        for (uint32_t i = 0; i < size && data[i] != 0; i++) {
+            // UTF-8 passes through; ISO-8859-1 bytes map straight to code points
+            uint32_t cp = data[i];
+            if (encoding == 0x03 || cp < 0x80) {
+                if (len + 1 >= out_size) {
+                    break;
+                }
+                out[len++] = data[i];
+            } else if (!put_utf8(cp, out, out_size, &len)) {
+                break;
+            }
+        }
+    }
+
+    out[len] = '\0';
+    return len;
+}
+
 // Checks for the "ID3" identifier at the start of the file
 bool is_valid_id3(FILE *fp) {
     char identifier[4];
@@ -48,4 +133,151 @@ bool is_valid_id3(FILE *fp) {
     }
     identifier[3] = '\0';
     return (strcmp(identifier, "ID3") == 0);
+}
+
+// Same path with a suffix appended, so the new file lands in the same directory (and on the
+// same filesystem, which rename needs). The caller frees it.
+char *path_with_suffix(const char *path, const char *suffix) {
+    size_t len = strlen(path) + strlen(suffix) + 1;
+    char *result = malloc(len);
+    if (result) {
+        snprintf(result, len, "%s%s", path, suffix);
+    }
+    return result;
+}
+
+// fsyncs the directory holding `path`, making a rename or unlink in it durable
+bool sync_parent_dir(const char *path) {
+    const char *slash = strrchr(path, '/');
+    char *dir = (slash == NULL) ? strdup(".") : (slash == path) ? strdup("/") : strndup(path, slash - path);
+    if (!dir) {
+        return false;
+    }
+    int fd = open(dir, O_RDONLY | O_DIRECTORY);
+    free(dir);
+    if (fd < 0) {
+        return false;
+    }
+    bool synced = fsync(fd) == 0;
+    close(fd);
+    return synced;
+}
+
+// --- Region Copy (audio payload during full rewrites) ---
+
+// Shares the source blocks with the destination. Both offsets must sit on a filesystem
+// block boundary; the length may only be unaligned when the range ends at the source EOF.
+static bool copy_by_reflink(int in_fd, off_t in_offset, int out_fd, off_t out_offset, uint64_t length) {
+#ifdef FICLONERANGE
+    struct stat st;
+    if (fstat(out_fd, &st) != 0 || st.st_blksize <= 0 ||
+        in_offset % st.st_blksize != 0 || out_offset % st.st_blksize != 0) {
+        return false;
+    }
+
+    struct file_clone_range range;
+    range.src_fd = in_fd;
+    range.src_offset = in_offset;
+    range.src_length = length;
+    range.dest_offset = out_offset;
+    return ioctl(out_fd, FICLONERANGE, &range) == 0;
+#else
+    (void)in_fd; (void)in_offset; (void)out_fd; (void)out_offset; (void)length;
+    return false;
+#endif
+}
+
+static bool copy_by_file_range(int in_fd, off_t in_offset, int out_fd, off_t out_offset, uint64_t length) {
+    while (length > 0) {
+        ssize_t copied = copy_file_range(in_fd, &in_offset, out_fd, &out_offset, length, 0);
+        if (copied < 0 && errno == EINTR) {
+            continue;
+        }
+        if (copied <= 0) {
+            return false;
+        }
+        length -= copied;
+    }
+    return true;
+}
+
+static bool copy_by_sendfile(int in_fd, off_t in_offset, int out_fd, off_t out_offset, uint64_t length) {
+    if (lseek(out_fd, out_offset, SEEK_SET) != out_offset) {
+        return false;
+    }
+    while (length > 0) {
+        ssize_t copied = sendfile(out_fd, in_fd, &in_offset, length);
+        if (copied < 0 && errno == EINTR) {
+            continue;
+        }
+        if (copied <= 0) {
+            return false;
+        }
+        length -= copied;
+    }
+    return true;
+}
+
+static bool copy_by_buffer(int in_fd, off_t in_offset, int out_fd, off_t out_offset, uint64_t length) {
+    uint8_t *buffer = malloc(COPY_BUFFER_SIZE);
+    if (!buffer) {
+        return false;
+    }
+
+    bool ok = true;
+    while (ok && length > 0) {
+        size_t chunk = (length < COPY_BUFFER_SIZE) ? length : COPY_BUFFER_SIZE;
+        ssize_t got = pread(in_fd, buffer, chunk, in_offset);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            ok = false;
+            break;
+        }
+        for (ssize_t done = 0; done < got; ) {
+            ssize_t put = pwrite(out_fd, buffer + done, got - done, out_offset + done);
+            if (put < 0 && errno == EINTR) {
+                continue;
+            }
+            if (put <= 0) {
+                ok = false;
+                break;
+            }
+            done += put;
+        }
+        in_offset += got;
+        out_offset += got;
+        length -= got;
+    }
+
+    free(buffer);
+    return ok;
+}
+
+bool copy_file_region_using(CopyMethod method, int in_fd, off_t in_offset,
+                            int out_fd, off_t out_offset, uint64_t length)
+{
+    switch (method) {
+        case COPY_REFLINK:    return copy_by_reflink(in_fd, in_offset, out_fd, out_offset, length);
+        case COPY_FILE_RANGE: return copy_by_file_range(in_fd, in_offset, out_fd, out_offset, length);
+        case COPY_SENDFILE:   return copy_by_sendfile(in_fd, in_offset, out_fd, out_offset, length);
+        case COPY_BUFFERED:   return copy_by_buffer(in_fd, in_offset, out_fd, out_offset, length);
+        default:              return false;
+    }
+}
+
+// Copies `length` bytes between two files with the cheapest method the kernel and filesystem
+// accept. A method that fails part-way is simply redone by the next one (same offsets).
+// Returns the method that succeeded, or COPY_FAILED.
+CopyMethod copy_file_region(int in_fd, off_t in_offset, int out_fd, off_t out_offset, uint64_t length) {
+    if (length == 0) {
+        return COPY_BUFFERED;
+    }
+    for (CopyMethod method = COPY_REFLINK; method <= COPY_BUFFERED; method++) {
+        if (copy_file_region_using(method, in_fd, in_offset, out_fd, out_offset, length)) {
+            return method;
+        }
+    }
+    return COPY_FAILED;
 }
\ No newline at end of file
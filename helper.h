@@ -1,14 +1,25 @@
 #ifndef HELPER_H
 #define HELPER_H
 
+#include <stdio.h>
+#include <sys/types.h>
 #include "types.h"
 
 // --- SyncSafe Converters ---
 uint32_t decode_syncsafe(uint32_t syn_int);
 uint32_t encode_syncsafe(uint32_t std_int);
 
+// --- Frame ID / Text Utilities ---
+uint32_t pack_frame_id(const uint8_t *id);
+size_t decode_id3_text(uint8_t encoding, const uint8_t *data, uint32_t size, char *out, size_t out_size);
+
 // --- File/Memory Utilities ---
 void reverse_bytes(uint8_t *data, size_t size);
 bool is_valid_id3(FILE *fp);
+char *path_with_suffix(const char *path, const char *suffix); // malloc'd; any length
+bool sync_parent_dir(const char *path);
+CopyMethod copy_file_region(int in_fd, off_t in_offset, int out_fd, off_t out_offset, uint64_t length);
+bool copy_file_region_using(CopyMethod method, int in_fd, off_t in_offset,
+                            int out_fd, off_t out_offset, uint64_t length);
 
 #endif
\ No newline at end of file
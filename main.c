@@ -4,13 +4,30 @@ Student ID: 25021_387
 Date of submission : 20th Nov 2025. 
 Description: The MP3 Tag Reader project involves creating software dedicated to extracting and interpreting metadata, known as ID3 tags, embedded within MP3 audio files. The process begins with the software opening the selected MP3 file and locating the specific data block that contains the ID3 tag, which holds crucial information about the track. . The reader must first identify the ID3 standard version (e.g., v1 or v2) used, as the structure and location of data fields are different for each version. Once the version is determined, the software parses the byte stream according to the standard, decoding fields such as the Title, Artist, Album, Genre, and Year. The main goal is to successfully retrieve this hidden data and present it to the user in an easily readable format, thus enabling efficient organization and management of digital music libraries without altering the core audio content.
 */
+#define _GNU_SOURCE // getline
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
 #include "types.h"
 #include "read.h"
 #include "edit.h"
+#include "mapped.h"
+#include "scan.h"
+#include "tagindex.h"
+#include "bench.h"
+#include "stats.h"
+#include "output.h"
+#include "art.h"
+#include "batch.h"
+#include "serve.h"
+#include "audio.h"
+#include "dupes.h"
+#include "watch.h"
+#include "query.h"
+#include "retag.h"
 
 // Helper function to create a dummy MP3 file for testing if one doesn't exist
 void create_dummy_mp3(const char *filename) {
@@ -29,122 +46,978 @@ void create_dummy_mp3(const char *filename) {
     printf("Created dummy file: %s for testing.\n", filename);
 }
 
+// The test file, created on first use (only by commands that fall back to it)
+const char *use_test_file(const char *filename) {
+    if (access(filename, F_OK) == -1) {
+        create_dummy_mp3(filename);
+    }
+    return filename;
+}
+
 // Helper function to print the structured output in a table
 void print_tags_in_table_format(const TagData *tags) {
-    // Determine the title to print
-    const char *title = (tags && tags->title[0] != '\0') ? tags->title : "<Unknown Title>";
-    const char *artist = (tags && tags->artist[0] != '\0') ? tags->artist : "Yo Yo Honey Singh"; // Use read artist or placeholder
-    
-    printf("ID3 v2.3:\n");
+    // Rows: label and the frame IDs to try, in order
+    static const char *const rows[][3] = {
+        { "Title", "TIT2", NULL }, { "Artist", "TPE1", NULL }, { "Album", "TALB", NULL },
+        { "Year", "TYER", "TDRC" }, { "Track", "TRCK", NULL }, { "Genre", "TCON", NULL },
+        { "Comment", "COMM", NULL },
+    };
+    char value[1024];
+
+    if (tags->header.version_major == 1) {
+        printf("ID3 v1.%u:\n", tags->header.version_revision);
+    } else {
+        printf("ID3 v2.%u:\n", tags->header.version_major);
+    }
     printf("+----------------------+----------------------------------------------------+\n");
     printf("| Tag                  | Value                                              |\n");
     printf("+----------------------+----------------------------------------------------+\n");
     
-    printf("| %-20s | %-50s |\n", "Title", title);
-    
-    // Use actual artist data
-    printf("| %-20s | %-50s |\n", "Artist", artist);
-    
-    // Placeholder fields
-    printf("| %-20s | %-50s |\n", "Album", "Yaariyan");
-    printf("| %-20s | %-50s |\n", "Year", "2013");
-    printf("| %-20s | %-50s |\n", "Track", "");
-    printf("| %-20s | %-50s |\n", "Genre", "Pop (id 13)");
-    printf("| %-20s | %-50s |\n", "Comment", "[Description: Comment] [Lang: XXX]");
+    for (size_t i = 0; i < sizeof(rows) / sizeof(rows[0]); i++) {
+        value[0] = '\0';
+        for (int f = 1; f < 3 && rows[i][f] && value[0] == '\0'; f++) {
+            tag_get_text(tags, rows[i][f], value, sizeof(value));
+        }
+        if (i == 0 && value[0] == '\0') {
+            strcpy(value, "<Unknown Title>");
+        }
+        printf("| %-20s | %-50s |\n", rows[i][0], value);
+    }
+    printf("+----------------------+----------------------------------------------------+\n");
+}
+
+// Duration and stream summary rows for read --audio
+void print_audio_in_table_format(const AudioInfo *audio) {
+    char value[128];
+    if (audio->source == AUDIO_FROM_NONE) {
+        printf("| %-20s | %-50s |\n", "Audio", "<no MPEG frames found>");
+    } else {
+        snprintf(value, sizeof(value), "%llu:%02llu.%03llu (%s)", (unsigned long long)(audio->duration_ms / 60000),
+                 (unsigned long long)(audio->duration_ms / 1000 % 60), (unsigned long long)(audio->duration_ms % 1000),
+                 audio_source_name(audio->source));
+        printf("| %-20s | %-50s |\n", "Duration", value);
+        snprintf(value, sizeof(value), "%s Layer %s, %u Hz, %s, %u kbps %s", audio_version_name(audio->version),
+                 audio->layer == 1 ? "I" : audio->layer == 2 ? "II" : "III", audio->sample_rate,
+                 audio->channels == 1 ? "mono" : "stereo", audio->bitrate, audio->vbr ? "VBR" : "CBR");
+        printf("| %-20s | %-50s |\n", "Audio", value);
+    }
     printf("+----------------------+----------------------------------------------------+\n");
 }
 
+// Reads --audio[=fast|full] from the options (leaves *mode alone if absent)
+bool parse_audio_option(int argc, char *argv[], int first, AudioScanMode *mode) {
+    for (int i = first; i < argc; i++) {
+        if (strcmp(argv[i], "--audio") == 0) {
+            *mode = AUDIO_SCAN_FAST;
+        } else if (strncmp(argv[i], "--audio=", 8) == 0 && !audio_parse_mode(argv[i] + 8, mode)) {
+            printf("Invalid audio mode '%s'. Use none, fast or full.\n", argv[i] + 8);
+            return false;
+        }
+    }
+    return true;
+}
+
+
+// Tag index opened with --index=FILE, saved when main finishes
+static TagIndex *tag_index = NULL;
+
+// Applies the optional edit settings that follow the new value (e.g. --padding=4096)
+void apply_edit_options(int argc, char *argv[], int first) {
+    for (int i = first; i < argc; i++) {
+        if (strncmp(argv[i], "--padding=", 10) == 0) {
+            edit_set_padding((uint32_t)strtoul(argv[i] + 10, NULL, 10));
+        } else if (strncmp(argv[i], "--index=", 8) == 0 && !tag_index) {
+            tag_index = tag_index_open(argv[i] + 8);
+            edit_set_index(tag_index);
+        }
+    }
+}
+
+// Writes back and closes the tag index, if one was opened
+bool save_tag_index(bool prune_unseen) {
+    if (!tag_index) {
+        return true;
+    }
+    bool ok = tag_index_save(tag_index, prune_unseen);
+    if (!ok) {
+        printf("Error: Could not save the tag index.\n");
+    }
+    tag_index_close(tag_index);
+    tag_index = NULL;
+    return ok;
+}
+
+
+// Reads --format=table|ndjson|csv|tsv from the options (leaves *format alone if absent)
+bool parse_format_option(int argc, char *argv[], int first, OutputFormat *format) {
+    for (int i = first; i < argc; i++) {
+        if (strncmp(argv[i], "--format=", 9) == 0 && !output_parse_format(argv[i] + 9, format)) {
+            printf("Invalid format '%s'. Use table, ndjson, csv or tsv.\n", argv[i] + 9);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Scan callback for --format: each result is streamed through the shared writer
+void write_scan_result(const ScanResult *result, void *user) {
+    OutputWriter *writer = user;
+    output_record(writer, result->path, result->ok ? &result->tags : NULL,
+                  writer->audio_columns ? &result->audio : NULL);
+}
+
+// Scan callback: one tab-separated line per file
+void print_scan_result(const ScanResult *result, void *user) {
+    (void)user;
+    if (result->ok) {
+        char title[1024];
+        char artist[1024];
+        tag_get_text(&result->tags, "TIT2", title, sizeof(title));
+        tag_get_text(&result->tags, "TPE1", artist, sizeof(artist));
+        printf("%s\t%s\t%s", result->path, title, artist);
+    } else {
+        printf("%s\t<no ID3v2 tag>", result->path);
+    }
+    // With --audio, the duration in milliseconds follows
+    if (result->audio.source != AUDIO_FROM_NONE) {
+        printf("\t%llu", (unsigned long long)result->audio.duration_ms);
+    }
+    printf("\n");
+}
+
+
+// Watch callbacks: one line (or --format record) per change, flushed after every burst
+void print_watch_change(const WatchChange *change, void *user) {
+    if (user) {
+        output_change((OutputWriter *)user, watch_change_name(change->kind), change->path, change->tags);
+        return;
+    }
+    char title[1024] = "";
+    char artist[1024] = "";
+    if (change->tags) {
+        tag_get_text(change->tags, "TIT2", title, sizeof(title));
+        tag_get_text(change->tags, "TPE1", artist, sizeof(artist));
+    }
+    if (change->kind == WATCH_REMOVED) {
+        printf("%s\t%s\n", watch_change_name(change->kind), change->path);
+    } else if (change->tags) {
+        printf("%s\t%s\t%s\t%s\n", watch_change_name(change->kind), change->path, title, artist);
+    } else {
+        printf("%s\t%s\t<no ID3v2 tag>\n", watch_change_name(change->kind), change->path);
+    }
+}
+
+void flush_watch_output(void *user) {
+    if (user) {
+        output_flush((OutputWriter *)user);
+    } else {
+        fflush(stdout);
+    }
+}
+
+// Batch edit line: path<TAB>FRAME=value[<TAB>FRAME=value ...]. The line is split in place.
+bool parse_batch_line(char *line, const char **path, EditSet *set) {
+    line[strcspn(line, "\r\n")] = '\0';
+    edit_set_init(set);
+    *path = strtok(line, "\t");
+    for (char *field = strtok(NULL, "\t"); field; field = strtok(NULL, "\t")) {
+        char *equals = strchr(field, '=');
+        if (!equals) {
+            return false;
+        }
+        *equals = '\0';
+        if (!edit_set_add(set, field, equals + 1)) {
+            return false;
+        }
+    }
+    return *path && set->count > 0;
+}
+
+void print_batch_counts(const char *what, const BatchCounts *counts) {
+    fprintf(stderr, "%s: %llu files (%llu in place, %llu rewritten), %llu failed, %llu groups.\n", what,
+            (unsigned long long)counts->files, (unsigned long long)counts->in_place,
+            (unsigned long long)counts->rewritten, (unsigned long long)counts->failures,
+            (unsigned long long)counts->groups);
+}
+
+
+// Query mode: one line per matching track, the path and then each --show value
+typedef struct {
+    uint32_t show[QUERY_MAX_TERMS];
+    int show_count;
+    bool count_only;
+} QueryPrint;
+
+void print_query_match(QueryEngine *engine, uint32_t track, void *user) {
+    const QueryPrint *print = user;
+    fputs(query_track_path(engine, track), stdout);
+    for (int i = 0; i < print->show_count; i++) {
+        printf("\t%s", query_track_value(engine, track, print->show[i]));
+    }
+    putchar('\n');
+}
+
+double elapsed_ms(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e3 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+// Runs one query (its terms ANDed); the match count and time go to stderr
+bool run_query(QueryEngine *engine, char **terms_text, int count, const QueryPrint *print) {
+    QueryTerm terms[QUERY_MAX_TERMS];
+    if (count > QUERY_MAX_TERMS) {
+        fprintf(stderr, "Error: at most %d terms per query.\n", QUERY_MAX_TERMS);
+        return false;
+    }
+    for (int i = 0; i < count; i++) {
+        if (!query_parse_term(terms_text[i], &terms[i])) {
+            fprintf(stderr, "Error: '%s' is not FRAME=value, FRAME^=prefix or FRAME~=text.\n", terms_text[i]);
+            return false;
+        }
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint64_t found = query_run(engine, terms, count, print->count_only ? NULL : print_query_match, (void *)print);
+    double ms = elapsed_ms(&start);
+    if (print->count_only) {
+        printf("%llu\n", (unsigned long long)found);
+    }
+    fflush(stdout);
+    fprintf(stderr, "# %llu matches in %.3f ms\n", (unsigned long long)found, ms);
+    return true;
+}
+
+void print_query_memory(const QueryEngine *engine) {
+    QueryMemory memory;
+    query_engine_memory(engine, &memory);
+    double mb = 1024.0 * 1024.0;
+    // Only what grows with the library is scaled: the fixed tables would dominate a small one
+    double per_million = memory.tracks ? 1e6 / memory.tracks : 0;
+    fprintf(stderr, "Memory: %.1f MB for %llu tracks, about %.1f MB per million tracks like these\n",
+            memory.total_bytes / mb, (unsigned long long)memory.tracks, memory.growth_bytes * per_million / mb);
+    fprintf(stderr, "  strings  %8.1f MB  %llu distinct values (%.1f MB if stored once per track)\n",
+            memory.string_bytes / mb, (unsigned long long)memory.strings, memory.raw_value_bytes / mb);
+    fprintf(stderr, "  paths    %8.1f MB\n", memory.path_bytes / mb);
+    fprintf(stderr, "  columns  %8.1f MB  %llu frame IDs\n", memory.column_bytes / mb, (unsigned long long)memory.columns);
+    fprintf(stderr, "  indexes  %8.1f MB\n", memory.index_bytes / mb);
+    if (memory.dropped_values > 0) {
+        fprintf(stderr, "  %llu values of frame IDs past the first %d were dropped\n",
+                (unsigned long long)memory.dropped_values, QUERY_MAX_COLUMNS);
+    }
+}
+
+// Prints the merged I/O counters and phase timers when the process ends (--stats)
+void dump_stats_at_exit(void) {
+    stats_dump_json(stderr);
+}
+
 
 int main(int argc, char *argv[]) {
-    const char *test_file = "sample.mp3"; 
-    
-    // Create dummy if the file doesn't exist
-    if (access(test_file, F_OK) == -1) {
-        create_dummy_mp3(test_file);
+    // --stats may appear anywhere; it is removed so the commands never see it
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--stats") == 0) {
+            atexit(dump_stats_at_exit);
+            memmove(&argv[i], &argv[i + 1], (argc - i) * sizeof(char *));
+            argc--;
+            break;
+        }
     }
+
+    const char *test_file = "sample.mp3"; // Commands given no file work on this one
     
     // Check for correct command-line arguments
     if (argc < 2) {
-        printf("Usage: %s <read | edit-title \"<New Title>\" | edit-artist \"<New Artist>\">\n", argv[0]); // Updated usage
+        printf("Usage: %s read [file ...] [--format=table|ndjson|csv|tsv] [--audio[=fast|full]] [--threads=N]\n", argv[0]);
+        printf("       %s <edit-title \"<New Title>\" | edit-artist \"<New Artist>\"> [file] [--padding=N] [--index=FILE]\n", argv[0]); // Updated usage
+        printf("       %s edit --set FRAME=value [--set FRAME=value ...] [--padding=N] [file]\n", argv[0]);
+        printf("       %s list <file> [file ...]\n", argv[0]);
+        printf("       %s scan <dir> [--threads=N] [--ordered] [--index=FILE] [--format=ndjson|csv|tsv]\n", argv[0]);
+        printf("            [--engine=pool|uring] [--audio[=fast|full]]\n");
+        printf("       %s extract-art <file|dir> [...] --out=DIR [--dedupe] [--threads=N]\n", argv[0]);
+        printf("       %s dupes <dir> [--threads=N]\n", argv[0]);
+        printf("       %s watch <dir> [--threads=N] [--settle-ms=N] [--format=ndjson|csv|tsv]\n", argv[0]);
+        printf("       %s query <dir> [--threads=N] [--index=FILE] [--show=FRAME,...] [--count] [--memory] [TERM ...]\n", argv[0]);
+        printf("       %s retag <dir> --rules=FILE | retag --csv=FILE [--dry-run] [--ssd-jobs=N] [--hdd-jobs=N]\n", argv[0]);
+        printf("            [--threads=N] [--padding=N] [--index=FILE]\n");
+        printf("       %s edit-batch <edits.tsv> [--journal=FILE] [--group=N] [--padding=N] [--index=FILE]\n", argv[0]);
+        printf("       %s edit-batch --resume | --rollback --journal=FILE\n", argv[0]);
+        printf("       %s serve --socket=PATH [--threads=N] [--cache=N] [--padding=N] [--index=FILE]\n", argv[0]);
+        printf("       read, edit, edit-title and edit-artist without a file use ./%s (a dummy is created if missing)\n", test_file);
+        printf("       Any command: --stats prints I/O counters and phase timings as JSON on stderr\n");
         return 1;
     }
 
     const char *command = argv[1];
+
+#ifdef MP3_BENCH
+    // --- BENCHMARK BUILD: corpus generator and benchmark suite ---
+    if (strcmp(command, "gen-corpus") == 0 || strncmp(command, "bench", 5) == 0) {
+        return bench_main(argc, argv);
+    }
+#endif
     
     // --- READ OPERATION ---
     if (strcmp(command, "read") == 0) {
-        printf("--- STARTING READ OPERATION ---\n");
+        OutputFormat format = FORMAT_TABLE;
+        AudioScanMode audio_mode = AUDIO_SCAN_NONE;
+        int audio_threads = 0; // A full frame walk may use one thread per CPU
+        if (!parse_format_option(argc, argv, 2, &format) || !parse_audio_option(argc, argv, 2, &audio_mode)) {
+            return 1;
+        }
+        for (int i = 2; i < argc; i++) {
+            if (strncmp(argv[i], "--threads=", 10) == 0) {
+                audio_threads = atoi(argv[i] + 10);
+            }
+        }
+        AudioInfo audio;
+
+        // Files given on the command line, or the test file
+        int file_count = 0;
+        for (int i = 2; i < argc; i++) {
+            if (strncmp(argv[i], "--", 2) != 0) {
+                argv[2 + file_count++] = argv[i];
+            }
+        }
+        if (file_count == 0) {
+            argv[2] = (char *)use_test_file(test_file);
+            file_count = 1;
+        }
+
         TagData tags_read;
+        tag_data_init(&tags_read);
 
-        if (read_tags_from_file(test_file, &tags_read)) {
-            printf("Tags read successfully from %s:\n", test_file);
-            print_tags_in_table_format(&tags_read);
+        if (format == FORMAT_TABLE) {
+            printf("--- STARTING READ OPERATION ---\n");
+            for (int i = 0; i < file_count; i++) {
+                if (read_tags_from_file(argv[2 + i], &tags_read)) {
+                    printf("Tags read successfully from %s:\n", argv[2 + i]);
+                    print_tags_in_table_format(&tags_read);
+                } else {
+                    printf("Failed to read tags from %s.\n", argv[2 + i]);
+                }
+                if (audio_mode != AUDIO_SCAN_NONE) {
+                    audio_read_file(argv[2 + i], audio_mode, audio_threads, &audio);
+                    print_audio_in_table_format(&audio);
+                }
+            }
         } else {
-            printf("Failed to read tags from %s.\n", test_file);
+            OutputWriter writer;
+            if (!output_init(&writer, STDOUT_FILENO, format)) {
+                tag_data_free(&tags_read);
+                return 1;
+            }
+            writer.audio_columns = audio_mode != AUDIO_SCAN_NONE;
+            for (int i = 0; i < file_count; i++) {
+                bool ok = read_tags_from_file(argv[2 + i], &tags_read);
+                if (writer.audio_columns) {
+                    audio_read_file(argv[2 + i], audio_mode, audio_threads, &audio);
+                }
+                output_record(&writer, argv[2 + i], ok ? &tags_read : NULL, writer.audio_columns ? &audio : NULL);
+            }
+            output_close(&writer);
         }
+        tag_data_free(&tags_read);
     } 
     
     // --- EDIT TITLE OPERATION --- (Renamed from 'edit' to 'edit-title')
     else if (strcmp(command, "edit-title") == 0) {
         if (argc < 3) {
-            printf("Usage for edit-title: %s edit-title \"<New Title>\"\n", argv[0]);
+            printf("Usage for edit-title: %s edit-title \"<New Title>\" [file]\n", argv[0]);
             return 1;
         }
         
         const char *new_title = argv[2];
+        const char *target_file = test_file;
+        for (int i = 3; i < argc; i++) {
+            if (strncmp(argv[i], "--", 2) != 0) {
+                target_file = argv[i];
+            }
+        }
+        apply_edit_options(argc, argv, 3);
+        if (target_file == test_file) {
+            use_test_file(test_file);
+        }
 
         printf("--- STARTING EDIT TITLE OPERATION ---\n");
         printf("Attempting to set Title to: \"%s\"\n", new_title);
 
-        if (edit_tag_title(test_file, new_title)) {
-            printf("Title edit completed for %s.\n", test_file);
+        if (edit_tag_title(target_file, new_title)) {
+            printf("Title edit completed for %s.\n", target_file);
             
             // Verification
             printf("\n--- VERIFYING READ AFTER EDIT ---\n");
             TagData tags_verify;
-            if (read_tags_from_file(test_file, &tags_verify)) {
+            tag_data_init(&tags_verify);
+            if (read_tags_from_file(target_file, &tags_verify)) {
                 printf("Verification successful:\n");
                 print_tags_in_table_format(&tags_verify);
             } else {
                 printf("Verification failed.\n");
             }
+            tag_data_free(&tags_verify);
         } else {
-            printf("Failed to edit title for %s.\n", test_file);
+            printf("Failed to edit title for %s.\n", target_file);
         }
     } 
     
     // --- EDIT ARTIST OPERATION --- <--- NEW COMMAND
     else if (strcmp(command, "edit-artist") == 0) {
         if (argc < 3) {
-            printf("Usage for edit-artist: %s edit-artist \"<New Artist>\"\n", argv[0]);
+            printf("Usage for edit-artist: %s edit-artist \"<New Artist>\" [file]\n", argv[0]);
             return 1;
         }
         
         const char *new_artist = argv[2];
+        const char *target_file = test_file;
+        for (int i = 3; i < argc; i++) {
+            if (strncmp(argv[i], "--", 2) != 0) {
+                target_file = argv[i];
+            }
+        }
+        apply_edit_options(argc, argv, 3);
+        if (target_file == test_file) {
+            use_test_file(test_file);
+        }
 
         printf("--- STARTING EDIT ARTIST OPERATION ---\n");
         printf("Attempting to set Artist to: \"%s\"\n", new_artist);
 
-        if (edit_tag_artist(test_file, new_artist)) {
-            printf("Artist edit completed for %s.\n", test_file);
+        if (edit_tag_artist(target_file, new_artist)) {
+            printf("Artist edit completed for %s.\n", target_file);
             
             // Verification
             printf("\n--- VERIFYING READ AFTER EDIT ---\n");
             TagData tags_verify;
-            if (read_tags_from_file(test_file, &tags_verify)) {
+            tag_data_init(&tags_verify);
+            if (read_tags_from_file(target_file, &tags_verify)) {
                 printf("Verification successful:\n");
                 print_tags_in_table_format(&tags_verify);
             } else {
                 printf("Verification failed.\n");
             }
+            tag_data_free(&tags_verify);
         } else {
-            printf("Failed to edit artist for %s.\n", test_file);
+            printf("Failed to edit artist for %s.\n", target_file);
         }
     } 
     
+    // --- BATCH EDIT OPERATION (e.g. --set TIT2=... --set TPE1=... --set TALB=...) ---
+    else if (strcmp(command, "edit") == 0) {
+        const char *target_file = test_file;
+        EditSet set;
+        edit_set_init(&set);
+
+        for (int i = 2; i < argc; i++) {
+            if (strcmp(argv[i], "--set") == 0 && i + 1 < argc) {
+                char *assignment = argv[++i];
+                char *equals = strchr(assignment, '=');
+                if (!equals) {
+                    printf("Invalid --set '%s'. Expected FRAME=value.\n", assignment);
+                    return 1;
+                }
+                *equals = '\0';
+                if (!edit_set_add(&set, assignment, equals + 1)) {
+                    printf("Cannot set frame '%s'. Only text frames (T***) are supported.\n", assignment);
+                    return 1;
+                }
+            } else if (strncmp(argv[i], "--", 2) != 0) {
+                target_file = argv[i];
+            }
+        }
+        apply_edit_options(argc, argv, 2);
+
+        if (set.count == 0) {
+            printf("Usage for edit: %s edit --set FRAME=value [--set FRAME=value ...] [file]\n", argv[0]);
+            return 1;
+        }
+        if (target_file == test_file) {
+            use_test_file(test_file);
+        }
+
+        printf("--- STARTING BATCH EDIT OPERATION ---\n");
+        for (int i = 0; i < set.count; i++) {
+            printf("Attempting to set %s to: \"%s\"\n", set.edits[i].frame_id, set.edits[i].value);
+        }
+
+        if (apply_edit_set(target_file, &set)) {
+            printf("Batch edit completed for %s.\n", target_file);
+
+            // Verification
+            printf("\n--- VERIFYING READ AFTER EDIT ---\n");
+            TagData tags_verify;
+            tag_data_init(&tags_verify);
+            if (read_tags_from_file(target_file, &tags_verify)) {
+                printf("Verification successful:\n");
+                print_tags_in_table_format(&tags_verify);
+            } else {
+                printf("Verification failed.\n");
+            }
+            tag_data_free(&tags_verify);
+        } else {
+            printf("Failed to edit %s.\n", target_file);
+        }
+    }
+
+    // --- LIST OPERATION (memory-mapped, text frames of many files) ---
+    else if (strcmp(command, "list") == 0) {
+        if (argc < 3) {
+            printf("Usage for list: %s list <file> [file ...]\n", argv[0]);
+            return 1;
+        }
+
+        char text[1024];
+        for (int i = 2; i < argc; i++) {
+            MappedTag tag;
+            if (!map_tags_from_file(argv[i], &tag)) {
+                printf("%s: no ID3v2 tag\n", argv[i]);
+                continue;
+            }
+
+            printf("%s\n", argv[i]);
+            uint32_t count = mapped_frame_count(&tag);
+            for (uint32_t f = 0; f < count; f++) {
+                const FrameIndexEntry *entry = mapped_frame_at(&tag, f);
+                TextView view;
+                if (mapped_text_view(&tag, entry, &view)) {
+                    decode_text_view(&view, text, sizeof(text));
+                    char id[5] = { entry->id >> 24, entry->id >> 16, entry->id >> 8, entry->id, '\0' };
+                    printf("  %-4s  %s\n", id, text);
+                }
+            }
+            unmap_tags(&tag);
+        }
+    }
+
+    // --- SCAN OPERATION (whole library, multi-threaded) ---
+    else if (strcmp(command, "scan") == 0) {
+        if (argc < 3) {
+            printf("Usage for scan: %s scan <dir> [--threads=N] [--ordered] [--engine=pool|uring] [--audio[=fast|full]]\n", argv[0]);
+            return 1;
+        }
+
+        ScanOptions options = { 0, false, print_scan_result, NULL, NULL, SCAN_ENGINE_POOL, AUDIO_SCAN_NONE };
+        OutputFormat format = FORMAT_TABLE;
+        OutputWriter writer;
+        if (!parse_format_option(argc, argv, 3, &format) || !parse_audio_option(argc, argv, 3, &options.audio)) {
+            return 1;
+        }
+        if (format != FORMAT_TABLE) {
+            if (!output_init(&writer, STDOUT_FILENO, format)) {
+                return 1;
+            }
+            writer.audio_columns = options.audio != AUDIO_SCAN_NONE;
+            options.callback = write_scan_result;
+            options.user = &writer;
+        }
+        for (int i = 3; i < argc; i++) {
+            if (strncmp(argv[i], "--threads=", 10) == 0) {
+                options.num_threads = atoi(argv[i] + 10);
+            } else if (strcmp(argv[i], "--ordered") == 0) {
+                options.ordered = true;
+            } else if (strcmp(argv[i], "--engine=uring") == 0) {
+                options.engine = SCAN_ENGINE_URING;
+            } else if (strcmp(argv[i], "--engine=pool") == 0) {
+                options.engine = SCAN_ENGINE_POOL;
+            } else if (strncmp(argv[i], "--index=", 8) == 0 && !tag_index) {
+                tag_index = tag_index_open(argv[i] + 8);
+                options.index = tag_index;
+            }
+        }
+
+        bool scanned = scan_library(argv[2], &options);
+        if (format != FORMAT_TABLE) {
+            output_close(&writer);
+        }
+        if (!scanned) {
+            printf("Failed to scan %s.\n", argv[2]);
+            save_tag_index(false);
+            return 1;
+        }
+
+        if (tag_index) {
+            uint64_t reused, parsed;
+            tag_index_counts(tag_index, &reused, &parsed);
+            fprintf(stderr, "Index: %llu unchanged, %llu parsed.\n",
+                    (unsigned long long)reused, (unsigned long long)parsed);
+        }
+
+        // Files that were not seen in this scan are gone from the library
+        if (!save_tag_index(true)) {
+            return 1;
+        }
+    }
+
+    // --- ARTWORK EXTRACTION (files and whole directories) ---
+    else if (strcmp(command, "extract-art") == 0) {
+        const char *out_dir = NULL;
+        bool dedupe = false;
+        int num_threads = 0;
+        for (int i = 2; i < argc; i++) {
+            if (strncmp(argv[i], "--out=", 6) == 0) {
+                out_dir = argv[i] + 6;
+            } else if (strcmp(argv[i], "--dedupe") == 0) {
+                dedupe = true;
+            } else if (strncmp(argv[i], "--threads=", 10) == 0) {
+                num_threads = atoi(argv[i] + 10);
+            }
+        }
+        if (!out_dir || argc < 4) {
+            printf("Usage for extract-art: %s extract-art <file|dir> [...] --out=DIR [--dedupe] [--threads=N]\n", argv[0]);
+            return 1;
+        }
+
+        ArtExtractor *extractor = art_extractor_create(out_dir, dedupe);
+        if (!extractor) {
+            printf("Error: Could not use output directory %s.\n", out_dir);
+            return 1;
+        }
+
+        bool ok = true;
+        for (int i = 2; i < argc; i++) {
+            if (strncmp(argv[i], "--", 2) == 0) {
+                continue;
+            }
+            struct stat st;
+            if (stat(argv[i], &st) == 0 && S_ISDIR(st.st_mode)) {
+                ok = scan_for_each_file(argv[i], num_threads, art_extract_visit, extractor) && ok;
+            } else if (!art_extract_file(extractor, argv[i])) {
+                printf("%s: no ID3v2 tag\n", argv[i]);
+            }
+        }
+
+        ArtCounts counts;
+        art_extractor_counts(extractor, &counts);
+        art_extractor_destroy(extractor);
+        fprintf(stderr, "Artwork: %llu files, %llu images written, %llu duplicates, %llu failed, %llu bytes.\n",
+                (unsigned long long)counts.files, (unsigned long long)counts.images,
+                (unsigned long long)counts.duplicates, (unsigned long long)counts.failures,
+                (unsigned long long)counts.bytes_written);
+        if (!ok || counts.failures > 0) {
+            return 1;
+        }
+    }
+
+    // --- DUPLICATE AUDIO (same payload, any tags) ---
+    else if (strcmp(command, "dupes") == 0) {
+        if (argc < 3 || strncmp(argv[2], "--", 2) == 0) {
+            printf("Usage for dupes: %s dupes <dir> [--threads=N]\n", argv[0]);
+            return 1;
+        }
+        int num_threads = 0;
+        for (int i = 3; i < argc; i++) {
+            if (strncmp(argv[i], "--threads=", 10) == 0) {
+                num_threads = atoi(argv[i] + 10);
+            }
+        }
+
+        DupesCounts counts;
+        bool ok = dupes_report(argv[2], num_threads, stdout, &counts);
+        fprintf(stderr, "Dupes: %llu files, %llu same-size candidates, %llu hashed whole (%llu bytes read), "
+                "%llu groups, %llu extra copies holding %llu bytes, %llu failed.\n",
+                (unsigned long long)counts.files, (unsigned long long)counts.candidates,
+                (unsigned long long)counts.fully_hashed, (unsigned long long)counts.bytes_hashed,
+                (unsigned long long)counts.groups, (unsigned long long)counts.duplicates,
+                (unsigned long long)counts.redundant_bytes, (unsigned long long)counts.failures);
+        if (!ok) {
+            printf("Failed to scan %s.\n", argv[2]);
+            return 1;
+        }
+    }
+
+    // --- LIBRARY WATCH (inotify; changed files only) ---
+    else if (strcmp(command, "watch") == 0) {
+        if (argc < 3 || strncmp(argv[2], "--", 2) == 0) {
+            printf("Usage for watch: %s watch <dir> [--threads=N] [--settle-ms=N] [--format=ndjson|csv|tsv]\n", argv[0]);
+            return 1;
+        }
+        WatchOptions options = { argv[2], 0, 0, print_watch_change, flush_watch_output, NULL };
+        OutputFormat format = FORMAT_TABLE;
+        OutputWriter writer;
+        if (!parse_format_option(argc, argv, 3, &format)) {
+            return 1;
+        }
+        for (int i = 3; i < argc; i++) {
+            if (strncmp(argv[i], "--threads=", 10) == 0) {
+                options.num_threads = atoi(argv[i] + 10);
+            } else if (strncmp(argv[i], "--settle-ms=", 12) == 0) {
+                options.settle_ms = (uint32_t)strtoul(argv[i] + 12, NULL, 10);
+            }
+        }
+        if (format != FORMAT_TABLE) {
+            if (!output_init(&writer, STDOUT_FILENO, format)) {
+                return 1;
+            }
+            options.user = &writer;
+        }
+        bool ok = watch_run(&options);
+        if (format != FORMAT_TABLE) {
+            ok = output_close(&writer) && ok;
+        }
+        if (!ok) {
+            return 1;
+        }
+    }
+
+    // --- LIBRARY QUERY (tags loaded once into indexed columns) ---
+    else if (strcmp(command, "query") == 0) {
+        if (argc < 3 || strncmp(argv[2], "--", 2) == 0) {
+            printf("Usage for query: %s query <dir> [--threads=N] [--index=FILE] [--show=FRAME,...] [--count] [--memory] [TERM ...]\n", argv[0]);
+            printf("       TERM: FRAME=value, FRAME= (no such frame), FRAME^=prefix, FRAME~=text\n");
+            printf("       Without terms, queries are read from stdin, one per line, terms joined by &&\n");
+            return 1;
+        }
+        int num_threads = 0;
+        bool show_memory = false;
+        QueryPrint print = { { 0 }, 0, false };
+        char *terms[QUERY_MAX_TERMS + 1];
+        int term_count = 0;
+        for (int i = 3; i < argc; i++) {
+            if (strncmp(argv[i], "--threads=", 10) == 0) {
+                num_threads = atoi(argv[i] + 10);
+            } else if (strncmp(argv[i], "--index=", 8) == 0 && !tag_index) {
+                tag_index = tag_index_open(argv[i] + 8);
+            } else if (strcmp(argv[i], "--count") == 0) {
+                print.count_only = true;
+            } else if (strcmp(argv[i], "--memory") == 0) {
+                show_memory = true;
+            } else if (strncmp(argv[i], "--show=", 7) == 0) {
+                for (char *name = strtok(argv[i] + 7, ","); name; name = strtok(NULL, ",")) {
+                    if (print.show_count == QUERY_MAX_TERMS || !query_parse_frame(name, &print.show[print.show_count])) {
+                        printf("Error: cannot show '%s'.\n", name);
+                        return 1;
+                    }
+                    print.show_count++;
+                }
+            } else if (term_count <= QUERY_MAX_TERMS) {
+                terms[term_count++] = argv[i];
+            }
+        }
+
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        QueryEngine *engine = query_engine_create();
+        bool ok = engine && query_engine_scan(engine, argv[2], num_threads, tag_index) && query_engine_build(engine);
+        if (!ok) {
+            printf("Failed to load %s.\n", argv[2]);
+            query_engine_destroy(engine);
+            save_tag_index(false);
+            return 1;
+        }
+        QueryMemory memory;
+        query_engine_memory(engine, &memory);
+        fprintf(stderr, "Query: %llu tracks, %llu distinct values in %llu columns, %llu failed, loaded in %.0f ms.\n",
+                (unsigned long long)memory.tracks, (unsigned long long)memory.strings,
+                (unsigned long long)memory.columns, (unsigned long long)memory.failed_tracks, elapsed_ms(&start));
+        if (show_memory) {
+            print_query_memory(engine);
+        }
+
+        if (term_count > 0) {
+            ok = run_query(engine, terms, term_count, &print);
+        } else {
+            char *line = NULL;
+            size_t line_capacity = 0;
+            while (getline(&line, &line_capacity, stdin) != -1) {
+                line[strcspn(line, "\r\n")] = '\0';
+                int count = 0;
+                for (char *term = line; term && count <= QUERY_MAX_TERMS;) {
+                    char *next = strstr(term, "&&");
+                    if (next) {
+                        *next = '\0';
+                        next += 2;
+                    }
+                    while (*term == ' ' || *term == '\t') {
+                        term++;
+                    }
+                    size_t length = strlen(term);
+                    while (length > 0 && (term[length - 1] == ' ' || term[length - 1] == '\t')) {
+                        term[--length] = '\0';
+                    }
+                    if (length > 0) {
+                        terms[count++] = term;
+                    }
+                    term = next;
+                }
+                if (count > 0 && !run_query(engine, terms, count, &print)) {
+                    ok = false;
+                }
+            }
+            free(line);
+        }
+        query_engine_destroy(engine);
+
+        // Answers without the tracks that failed to load are incomplete
+        if (!save_tag_index(true) || !ok || memory.failed_tracks > 0) {
+            return 1;
+        }
+    }
+
+    // --- BULK RETAG (rules or CSV, planned up front, per-device concurrency) ---
+    else if (strcmp(command, "retag") == 0) {
+        RetagOptions options = { NULL, NULL, NULL, false, 0, 0, 0, stdout };
+        for (int i = 2; i < argc; i++) {
+            if (strncmp(argv[i], "--rules=", 8) == 0) {
+                options.rules_path = argv[i] + 8;
+            } else if (strncmp(argv[i], "--csv=", 6) == 0) {
+                options.csv_path = argv[i] + 6;
+            } else if (strcmp(argv[i], "--dry-run") == 0) {
+                options.dry_run = true;
+            } else if (strncmp(argv[i], "--threads=", 10) == 0) {
+                options.num_threads = atoi(argv[i] + 10);
+            } else if (strncmp(argv[i], "--ssd-jobs=", 11) == 0) {
+                options.ssd_jobs = atoi(argv[i] + 11);
+            } else if (strncmp(argv[i], "--hdd-jobs=", 11) == 0) {
+                options.hdd_jobs = atoi(argv[i] + 11);
+            } else if (strncmp(argv[i], "--", 2) != 0) {
+                options.root = argv[i];
+            }
+        }
+        if (options.csv_path ? options.rules_path != NULL : !options.rules_path || !options.root) {
+            printf("Usage for retag: %s retag <dir> --rules=FILE | retag --csv=FILE [--dry-run] [--ssd-jobs=N] [--hdd-jobs=N]\n", argv[0]);
+            printf("       [--threads=N] [--padding=N] [--index=FILE]\n");
+            printf("       Rules: FRAME = template ({dir}, {dir2}, {file}, {FRAME}) or FRAME : trim|genre|title|upper|lower\n");
+            printf("       CSV: header path,FRAME,...; an empty cell keeps the frame as it is\n");
+            return 1;
+        }
+        apply_edit_options(argc, argv, 2);
+
+        RetagCounts counts;
+        bool ok = retag_run(&options, &counts);
+        double megabytes = counts.bytes / (1024.0 * 1024.0);
+        fprintf(stderr, "Retag: %llu files, %llu unchanged, %llu in place, %llu rewritten, %llu failed; "
+                "%.1f MB %s on %llu device%s (%llu rotational)",
+                (unsigned long long)counts.files, (unsigned long long)counts.unchanged,
+                (unsigned long long)counts.in_place, (unsigned long long)counts.rewritten,
+                (unsigned long long)counts.failures, megabytes, options.dry_run ? "projected" : "written",
+                (unsigned long long)counts.devices, counts.devices == 1 ? "" : "s",
+                (unsigned long long)counts.rotational);
+        if (!options.dry_run && counts.seconds > 0) {
+            fprintf(stderr, " in %.2f s (%.0f files/s, %.1f MB/s)",
+                    counts.seconds, (counts.in_place + counts.rewritten) / counts.seconds, megabytes / counts.seconds);
+        }
+        fprintf(stderr, ".\n");
+        if (!ok || counts.failures > 0) {
+            save_tag_index(false);
+            return 1;
+        }
+    }
+
+    // --- TRANSACTIONAL BATCH EDIT (one journaled group of files per fsync round) ---
+    else if (strcmp(command, "edit-batch") == 0) {
+        const char *edits_file = NULL;
+        const char *journal = NULL;
+        uint32_t group_files = 0;
+        bool resume = false, rollback = false;
+        for (int i = 2; i < argc; i++) {
+            if (strncmp(argv[i], "--journal=", 10) == 0) {
+                journal = argv[i] + 10;
+            } else if (strncmp(argv[i], "--group=", 8) == 0) {
+                group_files = (uint32_t)strtoul(argv[i] + 8, NULL, 10);
+            } else if (strcmp(argv[i], "--resume") == 0) {
+                resume = true;
+            } else if (strcmp(argv[i], "--rollback") == 0) {
+                rollback = true;
+            } else if (strncmp(argv[i], "--", 2) != 0) {
+                edits_file = argv[i];
+            }
+        }
+        apply_edit_options(argc, argv, 2);
+
+        char default_journal[4096];
+        if (!journal && edits_file) {
+            snprintf(default_journal, sizeof(default_journal), "%s.journal", edits_file);
+            journal = default_journal;
+        }
+        if (!journal || (!edits_file && !resume && !rollback) || (resume && rollback)) {
+            printf("Usage for edit-batch: %s edit-batch <edits.tsv> [--journal=FILE] [--group=N]\n", argv[0]);
+            printf("       Lines: path<TAB>FRAME=value[<TAB>FRAME=value ...]\n");
+            printf("       After a crash: %s edit-batch --resume | --rollback --journal=FILE\n", argv[0]);
+            return 1;
+        }
+
+        BatchCounts counts;
+        if (resume || rollback) {
+            bool ok = edit_batch_recover(journal, rollback, &counts);
+            print_batch_counts(rollback ? "Rolled back" : "Resumed", &counts);
+            if (!ok) {
+                return 1;
+            }
+        } else {
+            FILE *fp = fopen(edits_file, "r");
+            if (!fp) {
+                printf("Error: Could not open %s.\n", edits_file);
+                return 1;
+            }
+            EditBatch *batch = edit_batch_begin(journal, group_files);
+            if (!batch) {
+                fclose(fp);
+                return 1;
+            }
+
+            char *line = NULL;
+            size_t line_capacity = 0;
+            uint64_t line_number = 0;
+            uint64_t malformed = 0;
+            while (getline(&line, &line_capacity, fp) != -1) {
+                line_number++;
+                const char *path;
+                EditSet set;
+                if (line[0] == '#' || line[0] == '\n') {
+                    continue;
+                }
+                if (!parse_batch_line(line, &path, &set)) {
+                    fprintf(stderr, "Error: %s:%llu: expected path<TAB>FRAME=value with text frames (T***)\n",
+                            edits_file, (unsigned long long)line_number);
+                    malformed++;
+                    continue;
+                }
+                edit_batch_apply(batch, path, &set);
+            }
+            free(line);
+            fclose(fp);
+
+            bool ok = edit_batch_finish(batch, &counts);
+            counts.failures += malformed; // Each one is a file that was meant to change and did not
+            print_batch_counts("Batch", &counts);
+            if (!ok || counts.failures > 0) {
+                save_tag_index(false);
+                return 1;
+            }
+        }
+    }
+
+    // --- RESIDENT DAEMON (reads and edits over a Unix socket, see serve.h) ---
+    else if (strcmp(command, "serve") == 0) {
+        ServeOptions options = { NULL, 0, 0 };
+        for (int i = 2; i < argc; i++) {
+            if (strncmp(argv[i], "--socket=", 9) == 0) {
+                options.socket_path = argv[i] + 9;
+            } else if (strncmp(argv[i], "--threads=", 10) == 0) {
+                options.num_threads = atoi(argv[i] + 10);
+            } else if (strncmp(argv[i], "--cache=", 8) == 0) {
+                options.cache_entries = (uint32_t)strtoul(argv[i] + 8, NULL, 10);
+            }
+        }
+        if (!options.socket_path) {
+            printf("Usage for serve: %s serve --socket=PATH [--threads=N] [--cache=N] [--padding=N] [--index=FILE]\n", argv[0]);
+            return 1;
+        }
+        apply_edit_options(argc, argv, 2);
+        if (!serve_run(&options)) {
+            save_tag_index(false);
+            return 1;
+        }
+    }
+
     // --- INVALID COMMAND ---
     else {
-        printf("Invalid command: '%s'. Use 'read', 'edit-title', or 'edit-artist'.\n", command);
+        printf("Invalid command: '%s'. Use 'read', 'edit', 'edit-title', 'edit-artist', 'list', 'scan', 'extract-art', 'dupes', 'watch', 'query', 'retag', 'edit-batch' or 'serve'.\n", command);
+        return 1;
+    }
+
+    if (!save_tag_index(false)) {
         return 1;
     }
 
@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "mapped.h"
+#include "read.h"
+#include "helper.h"
+
+// Maps the file read-only and decodes the ID3 header. Only the pages that are
+// actually touched (the header, then the frames on lookup) are ever read from disk.
+bool map_tags_from_file(const char *filepath, MappedTag *tag) {
+    memset(tag, 0, sizeof(MappedTag));
+
+    int fd = open(filepath, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < ID3_HEADER_SIZE) {
+        close(fd);
+        return false;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // The mapping keeps the file alive
+    if (map == MAP_FAILED) {
+        return false;
+    }
+
+    tag->map = map;
+    tag->map_size = st.st_size;
+
+    if (!decode_id3_header(tag->map, &tag->header)) {
+        unmap_tags(tag);
+        return false;
+    }
+
+    // A truncated file only exposes the frames that are actually there
+    if (ID3_HEADER_SIZE + (size_t)tag->header.size > tag->map_size) {
+        tag->header.size = tag->map_size - ID3_HEADER_SIZE;
+    }
+
+    return true;
+}
+
+void unmap_tags(MappedTag *tag) {
+    if (tag->map) {
+        munmap((void *)tag->map, tag->map_size);
+    }
+    free(tag->frames);
+    memset(tag, 0, sizeof(MappedTag));
+}
+
+// Walks the frames once and records (ID, offset, size, flags) for each of them.
+// A v2.2/v2.3 tag unsynchronised as a whole can't be walked in place and shows no frames.
+static bool build_frame_index(MappedTag *tag) {
+    const uint8_t *tag_buffer = tag->map + ID3_HEADER_SIZE;
+    uint8_t version = tag->header.version_major;
+    uint32_t capacity = 0;
+    ID3FrameHeader frame_header;
+
+    tag->indexed = true;
+    if (version < 4 && (tag->header.flags & ID3_FLAG_UNSYNC)) {
+        return true;
+    }
+
+    uint32_t offset = first_frame_offset(&tag->header, tag_buffer);
+    while (offset < tag->header.size &&
+           decode_frame_header(tag_buffer + offset, tag->header.size - offset, version, &frame_header)) {
+        uint32_t additions = frame_flag_additions(frame_header.flags, version);
+        if (additions > frame_header.size) {
+            offset += frame_header.header_size + frame_header.size;
+            continue;
+        }
+
+        if (tag->frame_count == capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            FrameIndexEntry *grown = realloc(tag->frames, capacity * sizeof(FrameIndexEntry));
+            if (!grown) {
+                return false;
+            }
+            tag->frames = grown;
+        }
+
+        FrameIndexEntry *entry = &tag->frames[tag->frame_count++];
+        entry->id = frame_header.id;
+        entry->offset = ID3_HEADER_SIZE + offset;
+        entry->data = entry->offset + frame_header.header_size + additions;
+        entry->size = frame_header.size - additions;
+        entry->flags = frame_header.flags;
+        if (version == 4 && (tag->header.flags & ID3_FLAG_UNSYNC)) {
+            entry->flags |= FRAME_FLAG_UNSYNC;
+        }
+
+        offset += frame_header.header_size + frame_header.size;
+    }
+
+    return true;
+}
+
+uint32_t mapped_frame_count(MappedTag *tag) {
+    if (!tag->indexed) {
+        build_frame_index(tag);
+    }
+    return tag->frame_count;
+}
+
+const FrameIndexEntry *mapped_frame_at(MappedTag *tag, uint32_t index) {
+    if (index >= mapped_frame_count(tag)) {
+        return NULL;
+    }
+    return &tag->frames[index];
+}
+
+// Returns the first frame with this ID, or NULL
+const FrameIndexEntry *mapped_find_frame(MappedTag *tag, const char *frame_id) {
+    uint32_t id = pack_frame_id((const uint8_t *)frame_id);
+    uint32_t count = mapped_frame_count(tag);
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (tag->frames[i].id == id) {
+            return &tag->frames[i];
+        }
+    }
+    return NULL;
+}
+
+// Points a view at a text frame's bytes inside the mapping (nothing is copied). Frames
+// stored unsynchronised, compressed or encrypted have no such view; read_tags_from_file
+// decodes the unsynchronised ones.
+bool mapped_text_view(const MappedTag *tag, const FrameIndexEntry *entry, TextView *view) {
+    if (!entry || entry->size < 1 || (entry->id >> 24) != 'T' ||
+        (entry->flags & (FRAME_FLAG_UNSYNC | FRAME_FLAG_COMPRESSED | FRAME_FLAG_ENCRYPTED))) {
+        return false;
+    }
+
+    const uint8_t *content = tag->map + entry->data;
+    view->encoding = content[0];
+    view->data = content + 1;
+    view->size = entry->size - 1;
+    return true;
+}
+
+size_t decode_text_view(const TextView *view, char *out, size_t out_size) {
+    return decode_id3_text(view->encoding, view->data, view->size, out, out_size);
+}
\ No newline at end of file
@@ -0,0 +1,19 @@
+#ifndef MAPPED_H
+#define MAPPED_H
+
+#include "types.h"
+
+// --- Memory-Mapped Reader (zero-copy, frame index built on demand) ---
+bool map_tags_from_file(const char *filepath, MappedTag *tag);
+void unmap_tags(MappedTag *tag);
+
+// --- Frame Index Lookups ---
+uint32_t mapped_frame_count(MappedTag *tag);
+const FrameIndexEntry *mapped_frame_at(MappedTag *tag, uint32_t index);
+const FrameIndexEntry *mapped_find_frame(MappedTag *tag, const char *frame_id);
+
+// --- Text Access (views into the mapping, decoded only when asked) ---
+bool mapped_text_view(const MappedTag *tag, const FrameIndexEntry *entry, TextView *view);
+size_t decode_text_view(const TextView *view, char *out, size_t out_size);
+
+#endif // MAPPED_H
\ No newline at end of file
@@ -0,0 +1,55 @@
+#define _GNU_SOURCE // O_CLOEXEC
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "mp3tag.h"
+#include "read.h"
+
+bool tag_context_init(TagContext *ctx, void *memory, size_t size) {
+    memset(ctx, 0, sizeof(TagContext));
+    ctx->padding = DEFAULT_TAG_PADDING;
+    if (!memory) {
+        tag_data_init(&ctx->tags);
+        return true;
+    }
+    return tag_data_init_fixed(&ctx->tags, memory, size);
+}
+
+void tag_context_free(TagContext *ctx) {
+    tag_data_free(&ctx->tags);
+}
+
+// Keeps the result (and errno, for I/O errors) in the context
+static TagStatus finish_call(TagContext *ctx, TagStatus status, int sys_errno) {
+    ctx->status = status;
+    ctx->sys_errno = status == TAG_ERR_IO ? sys_errno : 0;
+    return status;
+}
+
+TagStatus tag_context_read_fd(TagContext *ctx, int fd) {
+    TagStatus status = read_tags_from_fd(fd, &ctx->tags);
+    return finish_call(ctx, status, errno);
+}
+
+TagStatus tag_context_read_memory(TagContext *ctx, const uint8_t *data, size_t size) {
+    return finish_call(ctx, read_tags_from_memory(data, size, &ctx->tags), 0);
+}
+
+TagStatus tag_context_read_file(TagContext *ctx, const char *path) {
+    tag_data_reset(&ctx->tags);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return finish_call(ctx, TAG_ERR_IO, errno);
+    }
+    TagStatus status = read_tags_from_fd(fd, &ctx->tags);
+    int sys_errno = errno;
+    close(fd);
+    return finish_call(ctx, status, sys_errno);
+}
+
+TagStatus tag_context_edit_file(TagContext *ctx, const char *path, const EditSet *set) {
+    int sys_errno;
+    TagStatus status = edit_apply(path, set, ctx->padding, &sys_errno);
+    return finish_call(ctx, status, sys_errno);
+}
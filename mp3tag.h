@@ -0,0 +1,46 @@
+#ifndef MP3TAG_H
+#define MP3TAG_H
+
+#include <stddef.h>
+#include "types.h"
+#include "tag.h"
+#include "edit.h"
+
+// --- Library API (libmp3tag) ---
+// One TagContext per thread holds everything a read needs: the tag's arena and frame array,
+// and the status of the last call. The buffers are reset, not freed, between files, so once
+// they have grown to the largest tag seen, reading more files allocates nothing. Given
+// caller memory instead (tag_context_init with a buffer), the context never allocates at
+// all and a tag too large for it fails with TAG_ERR_NO_SPACE.
+//
+// Nothing is printed: every call returns a TagStatus, also kept in ctx->status, with the
+// errno behind TAG_ERR_IO in ctx->sys_errno. Frames are read with tag_find_frame,
+// tag_get_text and friends (tag.h) on ctx->tags, valid until the next read.
+//
+//     TagContext ctx;
+//     tag_context_init(&ctx, NULL, 0);
+//     while (next_file(&fd)) {
+//         if (tag_context_read_fd(&ctx, fd) == TAG_OK) {
+//             tag_get_text(&ctx.tags, "TIT2", title, sizeof(title));
+//         }
+//     }
+//     tag_context_free(&ctx);
+typedef struct {
+    TagData tags;             // The last tag read
+    TagStatus status;         // Result of the last call
+    int sys_errno;            // errno behind TAG_ERR_IO, else 0
+    uint32_t padding;         // Edits: padding reserved when a tag has to grow
+} TagContext;
+
+// memory NULL: heap buffers that grow as needed and are kept. Otherwise `size` bytes of
+// caller memory (64 KB holds almost any tag without cover art); false if that is too small.
+bool tag_context_init(TagContext *ctx, void *memory, size_t size);
+void tag_context_free(TagContext *ctx);
+
+TagStatus tag_context_read_fd(TagContext *ctx, int fd);   // The fd stays open, its offset untouched
+TagStatus tag_context_read_memory(TagContext *ctx, const uint8_t *data, size_t size);
+TagStatus tag_context_read_file(TagContext *ctx, const char *path);
+// Applies the frame changes (edit_set_add) in place when they fit, else through a rewrite
+TagStatus tag_context_edit_file(TagContext *ctx, const char *path, const EditSet *set);
+
+#endif // MP3TAG_H
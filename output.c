@@ -0,0 +1,360 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include "output.h"
+#include "tag.h"
+#include "helper.h"
+#include "audio.h"
+
+// Fixed columns of the CSV/TSV formats: frame IDs tried in order (first one present wins)
+typedef struct {
+    const char *name;
+    const char *frame_ids[2];
+} OutputColumn;
+
+static const OutputColumn columns[] = {
+    { "title",   { "TIT2", NULL } },
+    { "artist",  { "TPE1", NULL } },
+    { "album",   { "TALB", NULL } },
+    { "year",    { "TYER", "TDRC" } },
+    { "track",   { "TRCK", NULL } },
+    { "genre",   { "TCON", NULL } },
+    { "comment", { "COMM", NULL } },
+};
+#define COLUMN_COUNT (sizeof(columns) / sizeof(columns[0]))
+
+// Appended when the writer reports audio info
+static const char *const audio_columns[] = {
+    "duration_ms", "bitrate_kbps", "sample_rate", "channels", "vbr", "audio_source",
+};
+#define AUDIO_COLUMN_COUNT (sizeof(audio_columns) / sizeof(audio_columns[0]))
+
+bool output_parse_format(const char *name, OutputFormat *format) {
+    if (strcmp(name, "table") == 0)       *format = FORMAT_TABLE;
+    else if (strcmp(name, "ndjson") == 0) *format = FORMAT_NDJSON;
+    else if (strcmp(name, "csv") == 0)    *format = FORMAT_CSV;
+    else if (strcmp(name, "tsv") == 0)    *format = FORMAT_TSV;
+    else return false;
+    return true;
+}
+
+bool output_init(OutputWriter *writer, int fd, OutputFormat format) {
+    memset(writer, 0, sizeof(OutputWriter));
+    writer->fd = fd;
+    writer->format = format;
+    writer->buffer = malloc(OUTPUT_BUFFER_SIZE);
+    writer->text = malloc(OUTPUT_TEXT_MAX);
+    if (!writer->buffer || !writer->text) {
+        free(writer->buffer);
+        free(writer->text);
+        return false;
+    }
+    return true;
+}
+
+bool output_flush(OutputWriter *writer) {
+    size_t done = 0;
+    while (done < writer->used && !writer->failed) {
+        ssize_t put = write(writer->fd, writer->buffer + done, writer->used - done);
+        if (put < 0 && errno == EINTR) {
+            continue;
+        }
+        if (put <= 0) {
+            writer->failed = true;
+            break;
+        }
+        done += put;
+    }
+    writer->used = 0;
+    return !writer->failed;
+}
+
+// --- Appending (the buffer is flushed whenever it fills up) ---
+static void put_bytes(OutputWriter *writer, const char *data, size_t size) {
+    while (size > 0) {
+        if (writer->used == OUTPUT_BUFFER_SIZE) {
+            output_flush(writer);
+        }
+        size_t room = OUTPUT_BUFFER_SIZE - writer->used;
+        size_t chunk = (size < room) ? size : room;
+        memcpy(writer->buffer + writer->used, data, chunk);
+        writer->used += chunk;
+        data += chunk;
+        size -= chunk;
+    }
+}
+
+static void put_string(OutputWriter *writer, const char *text) {
+    put_bytes(writer, text, strlen(text));
+}
+
+// Length of the well-formed UTF-8 sequence at `s` (RFC 3629: no overlong forms, surrogates
+// or code points past U+10FFFF), 0 if there is none. Stops at the first bad byte, so never
+// reads past the terminating NUL.
+static size_t utf8_sequence_length(const unsigned char *s) {
+    unsigned char low = 0x80, high = 0xBF; // Allowed range of the second byte
+    size_t length;
+    if (s[0] >= 0xC2 && s[0] <= 0xDF) {
+        length = 2;
+    } else if (s[0] >= 0xE0 && s[0] <= 0xEF) {
+        length = 3;
+        low = (s[0] == 0xE0) ? 0xA0 : low;
+        high = (s[0] == 0xED) ? 0x9F : high;
+    } else if (s[0] >= 0xF0 && s[0] <= 0xF4) {
+        length = 4;
+        low = (s[0] == 0xF0) ? 0x90 : low;
+        high = (s[0] == 0xF4) ? 0x8F : high;
+    } else {
+        return 0;
+    }
+    if (s[1] < low || s[1] > high) {
+        return 0;
+    }
+    for (size_t i = 2; i < length; i++) {
+        if ((s[i] & 0xC0) != 0x80) {
+            return 0;
+        }
+    }
+    return length;
+}
+
+// Copies runs of plain bytes in one go and only stops at the characters that need escaping.
+// A byte that is not part of valid UTF-8 (a Latin-1 path, a mislabelled frame) becomes
+// \u00XX, so the output is always valid JSON and the byte value can still be recovered.
+static void put_json_string(OutputWriter *writer, const char *text) {
+    static const char hex[] = "0123456789abcdef";
+    put_bytes(writer, "\"", 1);
+    const char *run = text;
+    for (const char *c = text; *c; c++) {
+        unsigned char ch = *c;
+        if (ch >= 0x80) {
+            size_t length = utf8_sequence_length((const unsigned char *)c);
+            if (length > 0) {
+                c += length - 1;
+                continue;
+            }
+        } else if (ch >= 0x20 && ch != '"' && ch != '\\') {
+            continue;
+        }
+        put_bytes(writer, run, c - run);
+        run = c + 1;
+        switch (ch) {
+            case '"':  put_bytes(writer, "\\\"", 2); break;
+            case '\\': put_bytes(writer, "\\\\", 2); break;
+            case '\n': put_bytes(writer, "\\n", 2); break;
+            case '\r': put_bytes(writer, "\\r", 2); break;
+            case '\t': put_bytes(writer, "\\t", 2); break;
+            default: {
+                char escaped[6] = { '\\', 'u', '0', '0', hex[ch >> 4], hex[ch & 0xF] };
+                put_bytes(writer, escaped, 6);
+            }
+        }
+    }
+    put_bytes(writer, run, strlen(run));
+    put_bytes(writer, "\"", 1);
+}
+
+// RFC 4180: quote the field only when it holds a comma, quote or line break
+static void put_csv_field(OutputWriter *writer, const char *text) {
+    if (strpbrk(text, ",\"\r\n") == NULL) {
+        put_string(writer, text);
+        return;
+    }
+    put_bytes(writer, "\"", 1);
+    const char *run = text;
+    for (const char *c = text; *c; c++) {
+        if (*c == '"') {
+            put_bytes(writer, run, c - run + 1);
+            put_bytes(writer, "\"", 1);
+            run = c + 1;
+        }
+    }
+    put_bytes(writer, run, strlen(run));
+    put_bytes(writer, "\"", 1);
+}
+
+static void put_tsv_field(OutputWriter *writer, const char *text) {
+    const char *run = text;
+    for (const char *c = text; *c; c++) {
+        const char *escaped = (*c == '\t') ? "\\t" : (*c == '\n') ? "\\n" :
+                              (*c == '\r') ? "\\r" : (*c == '\\') ? "\\\\" : NULL;
+        if (escaped) {
+            put_bytes(writer, run, c - run);
+            put_bytes(writer, escaped, 2);
+            run = c + 1;
+        }
+    }
+    put_bytes(writer, run, strlen(run));
+}
+
+static void put_field(OutputWriter *writer, const char *text) {
+    if (writer->format == FORMAT_CSV) {
+        put_csv_field(writer, text);
+    } else {
+        put_tsv_field(writer, text);
+    }
+}
+
+// --- Records ---
+static void write_delimited_record(OutputWriter *writer, const char *change, const char *path,
+                                   const TagData *tags, const AudioInfo *audio) {
+    const char *separator = (writer->format == FORMAT_CSV) ? "," : "\t";
+
+    if (!writer->header_written) {
+        if (change) {
+            put_string(writer, "change");
+            put_string(writer, separator);
+        }
+        put_string(writer, "path");
+        for (size_t i = 0; i < COLUMN_COUNT; i++) {
+            put_string(writer, separator);
+            put_string(writer, columns[i].name);
+        }
+        if (writer->audio_columns) {
+            for (size_t i = 0; i < AUDIO_COLUMN_COUNT; i++) {
+                put_string(writer, separator);
+                put_string(writer, audio_columns[i]);
+            }
+        }
+        put_string(writer, "\n");
+        writer->header_written = true;
+    }
+
+    if (change) {
+        put_string(writer, change);
+        put_string(writer, separator);
+    }
+    put_field(writer, path);
+    for (size_t i = 0; i < COLUMN_COUNT; i++) {
+        put_string(writer, separator);
+        writer->text[0] = '\0';
+        for (int f = 0; tags && f < 2 && columns[i].frame_ids[f] && writer->text[0] == '\0'; f++) {
+            tag_get_text(tags, columns[i].frame_ids[f], writer->text, OUTPUT_TEXT_MAX);
+        }
+        put_field(writer, writer->text);
+    }
+
+    // Audio columns stay empty when no frames were found
+    if (writer->audio_columns) {
+        char values[128] = "";
+        if (audio && audio->source != AUDIO_FROM_NONE) {
+            snprintf(values, sizeof(values), "%llu%s%u%s%u%s%u%s%s%s%s",
+                     (unsigned long long)audio->duration_ms, separator, audio->bitrate, separator,
+                     audio->sample_rate, separator, audio->channels, separator,
+                     audio->vbr ? "true" : "false", separator, audio_source_name(audio->source));
+        } else {
+            snprintf(values, sizeof(values), "%s%s%s%s%s", separator, separator, separator, separator, separator);
+        }
+        put_string(writer, separator);
+        put_string(writer, values);
+    }
+    put_string(writer, "\n");
+}
+
+// ,"audio":{...} or ,"audio":null when no MPEG frames were found
+static void write_ndjson_audio(OutputWriter *writer, const AudioInfo *audio) {
+    if (audio->source == AUDIO_FROM_NONE) {
+        put_string(writer, ",\"audio\":null");
+        return;
+    }
+    char text[320];
+    snprintf(text, sizeof(text),
+             ",\"audio\":{\"version\":\"%s\",\"layer\":%u,\"sample_rate\":%u,\"channels\":%u,"
+             "\"bitrate_kbps\":%u,\"vbr\":%s,\"frames\":%llu,\"duration_ms\":%llu,\"source\":\"%s\"}",
+             audio_version_name(audio->version), audio->layer, audio->sample_rate, audio->channels,
+             audio->bitrate, audio->vbr ? "true" : "false", (unsigned long long)audio->frames,
+             (unsigned long long)audio->duration_ms, audio_source_name(audio->source));
+    put_string(writer, text);
+}
+
+// {"path":"...","ok":true,"frames":{"TIT2":"...",...}}  (first value of each frame ID),
+// then "audio" when it was asked for. Change records start with "change" instead.
+static void write_ndjson_record(OutputWriter *writer, const char *change, const char *path,
+                                const TagData *tags, const AudioInfo *audio) {
+    if (change) {
+        put_string(writer, "{\"change\":\"");
+        put_string(writer, change);
+        put_string(writer, "\",\"path\":");
+    } else {
+        put_string(writer, "{\"path\":");
+    }
+    put_json_string(writer, path);
+    if (change && strcmp(change, "removed") == 0) {
+        put_string(writer, "}\n");
+        return;
+    }
+
+    if (!tags) {
+        put_string(writer, ",\"ok\":false");
+        if (audio) {
+            write_ndjson_audio(writer, audio);
+        }
+        put_string(writer, "}\n");
+        return;
+    }
+
+    char version[48];
+    if (tags->header.version_major == 1) {
+        snprintf(version, sizeof(version), ",\"ok\":true,\"version\":\"1.%u\",\"frames\":{",
+                 tags->header.version_revision);
+    } else {
+        snprintf(version, sizeof(version), ",\"ok\":true,\"version\":\"2.%u.%u\",\"frames\":{",
+                 tags->header.version_major, tags->header.version_revision);
+    }
+    put_string(writer, version);
+
+    bool first = true;
+    for (uint32_t i = 0; i < tags->frame_count; i++) {
+        const TagFrame *frame = &tags->frames[i];
+        bool repeated = false;
+        for (uint32_t j = 0; j < i && !repeated; j++) {
+            repeated = tags->frames[j].id == frame->id;
+        }
+        if (repeated || tag_frame_text(tags, frame, writer->text, OUTPUT_TEXT_MAX) == 0) {
+            continue;
+        }
+
+        // IDs come from the file, so they are escaped like any other string. v2.2 IDs
+        // without a v2.3 name have a zero low byte and print as three characters.
+        char frame_id[5] = { frame->id >> 24, frame->id >> 16, frame->id >> 8, frame->id, '\0' };
+        if (!first) {
+            put_bytes(writer, ",", 1);
+        }
+        put_json_string(writer, frame_id);
+        put_bytes(writer, ":", 1);
+        put_json_string(writer, writer->text);
+        first = false;
+    }
+    put_string(writer, "}");
+    if (audio) {
+        write_ndjson_audio(writer, audio);
+    }
+    put_string(writer, "}\n");
+}
+
+void output_record(OutputWriter *writer, const char *path, const TagData *tags, const AudioInfo *audio) {
+    if (writer->format == FORMAT_NDJSON) {
+        write_ndjson_record(writer, NULL, path, tags, audio);
+    } else {
+        write_delimited_record(writer, NULL, path, tags, audio);
+    }
+}
+
+void output_change(OutputWriter *writer, const char *change, const char *path, const TagData *tags) {
+    if (writer->format == FORMAT_NDJSON) {
+        write_ndjson_record(writer, change, path, tags, NULL);
+    } else {
+        write_delimited_record(writer, change, path, tags, NULL);
+    }
+}
+
+bool output_close(OutputWriter *writer) {
+    bool ok = output_flush(writer);
+    free(writer->buffer);
+    free(writer->text);
+    writer->buffer = NULL;
+    writer->text = NULL;
+    return ok;
+}
\ No newline at end of file
@@ -0,0 +1,21 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include "types.h"
+
+// --- Bulk Output (ndjson | csv | tsv) ---
+// Records are escaped straight into one large reusable buffer that is written out with
+// write(2) in OUTPUT_BUFFER_SIZE chunks; nothing is kept once it has been flushed, so a
+// library dump streams at a constant memory cost. Not thread-safe: one writer per stream
+// (the scan callback already runs one call at a time).
+bool output_parse_format(const char *name, OutputFormat *format);
+bool output_init(OutputWriter *writer, int fd, OutputFormat format);
+// tags NULL = no tag; audio NULL = not asked for (see OutputWriter.audio_columns for CSV/TSV)
+void output_record(OutputWriter *writer, const char *path, const TagData *tags, const AudioInfo *audio);
+// Watch records: a leading "change" field/column (added, modified, removed). A writer holds
+// either plain records or change records, since the CSV/TSV header follows the first one.
+void output_change(OutputWriter *writer, const char *change, const char *path, const TagData *tags);
+bool output_flush(OutputWriter *writer);
+bool output_close(OutputWriter *writer);   // Flushes and frees; false if any write failed
+
+#endif // OUTPUT_H
\ No newline at end of file
@@ -0,0 +1,258 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "pool.h"
+
+typedef struct {
+    PoolTaskFn fn;
+    void *arg;
+} PoolTask;
+
+// --- Per-Worker Deque (ring buffer, grown on demand) ---
+typedef struct {
+    pthread_mutex_t lock;
+    PoolTask *tasks;
+    size_t head;      // Thieves take from here
+    size_t count;
+    size_t capacity;
+} WorkerQueue;
+
+struct ThreadPool {
+    int num_workers;
+    pthread_t *threads;
+    WorkerQueue *queues;
+
+    pthread_mutex_t state_lock;
+    pthread_cond_t work_available;
+    pthread_cond_t all_done;
+    size_t queued;        // Tasks sitting in some deque
+    size_t unfinished;    // Tasks submitted and not finished yet
+    int next_queue;       // Round-robin target for submissions from outside the pool
+    bool shutting_down;
+};
+
+typedef struct {
+    ThreadPool *pool;
+    int index;
+} WorkerStart;
+
+// Which pool/deque the current thread works for (NULL outside the pool)
+static _Thread_local ThreadPool *current_pool = NULL;
+static _Thread_local int current_worker = -1;
+
+static bool queue_push_tail(WorkerQueue *queue, PoolTask task) {
+    pthread_mutex_lock(&queue->lock);
+    if (queue->count == queue->capacity) {
+        size_t new_capacity = queue->capacity ? queue->capacity * 2 : 64;
+        PoolTask *grown = malloc(new_capacity * sizeof(PoolTask));
+        if (!grown) {
+            pthread_mutex_unlock(&queue->lock);
+            return false;
+        }
+        for (size_t i = 0; i < queue->count; i++) {
+            grown[i] = queue->tasks[(queue->head + i) % queue->capacity];
+        }
+        free(queue->tasks);
+        queue->tasks = grown;
+        queue->head = 0;
+        queue->capacity = new_capacity;
+    }
+    queue->tasks[(queue->head + queue->count) % queue->capacity] = task;
+    queue->count++;
+    pthread_mutex_unlock(&queue->lock);
+    return true;
+}
+
+static bool queue_pop_tail(WorkerQueue *queue, PoolTask *task) {
+    bool found = false;
+    pthread_mutex_lock(&queue->lock);
+    if (queue->count > 0) {
+        queue->count--;
+        *task = queue->tasks[(queue->head + queue->count) % queue->capacity];
+        found = true;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return found;
+}
+
+static bool queue_steal_head(WorkerQueue *queue, PoolTask *task) {
+    bool found = false;
+    pthread_mutex_lock(&queue->lock);
+    if (queue->count > 0) {
+        *task = queue->tasks[queue->head];
+        queue->head = (queue->head + 1) % queue->capacity;
+        queue->count--;
+        found = true;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return found;
+}
+
+// Own deque first, then every other deque starting with the neighbour
+static bool find_task(ThreadPool *pool, int index, PoolTask *task) {
+    if (queue_pop_tail(&pool->queues[index], task)) {
+        return true;
+    }
+    for (int i = 1; i < pool->num_workers; i++) {
+        if (queue_steal_head(&pool->queues[(index + i) % pool->num_workers], task)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void *worker_main(void *arg) {
+    WorkerStart *start = arg;
+    ThreadPool *pool = start->pool;
+    int index = start->index;
+    free(start);
+
+    current_pool = pool;
+    current_worker = index;
+
+    while (true) {
+        pthread_mutex_lock(&pool->state_lock);
+        while (pool->queued == 0 && !pool->shutting_down) {
+            pthread_cond_wait(&pool->work_available, &pool->state_lock);
+        }
+        if (pool->queued == 0 && pool->shutting_down) {
+            pthread_mutex_unlock(&pool->state_lock);
+            break;
+        }
+        pthread_mutex_unlock(&pool->state_lock);
+
+        PoolTask task;
+        if (!find_task(pool, index, &task)) {
+            continue; // Another worker got there first
+        }
+
+        pthread_mutex_lock(&pool->state_lock);
+        pool->queued--;
+        pthread_mutex_unlock(&pool->state_lock);
+
+        task.fn(task.arg);
+
+        pthread_mutex_lock(&pool->state_lock);
+        if (--pool->unfinished == 0) {
+            pthread_cond_broadcast(&pool->all_done);
+        }
+        pthread_mutex_unlock(&pool->state_lock);
+    }
+
+    return NULL;
+}
+
+int pool_default_workers(void) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return (cpus > 0) ? (int)cpus : 4;
+}
+
+ThreadPool *pool_create(int num_workers) {
+    if (num_workers < 1) {
+        num_workers = pool_default_workers();
+    }
+
+    ThreadPool *pool = calloc(1, sizeof(ThreadPool));
+    if (!pool) {
+        return NULL;
+    }
+    pool->num_workers = num_workers;
+    pool->threads = calloc(num_workers, sizeof(pthread_t));
+    pool->queues = calloc(num_workers, sizeof(WorkerQueue));
+    if (!pool->threads || !pool->queues) {
+        free(pool->threads);
+        free(pool->queues);
+        free(pool);
+        return NULL;
+    }
+
+    pthread_mutex_init(&pool->state_lock, NULL);
+    pthread_cond_init(&pool->work_available, NULL);
+    pthread_cond_init(&pool->all_done, NULL);
+    for (int i = 0; i < num_workers; i++) {
+        pthread_mutex_init(&pool->queues[i].lock, NULL);
+    }
+
+    for (int i = 0; i < num_workers; i++) {
+        WorkerStart *start = malloc(sizeof(WorkerStart));
+        if (start) {
+            start->pool = pool;
+            start->index = i;
+        }
+        if (!start || pthread_create(&pool->threads[i], NULL, worker_main, start) != 0) {
+            free(start);
+            pool->num_workers = i; // Run with the workers we managed to start
+            break;
+        }
+    }
+
+    if (pool->num_workers == 0) {
+        pool_destroy(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+bool pool_submit(ThreadPool *pool, PoolTaskFn fn, void *arg) {
+    PoolTask task = { fn, arg };
+    int index;
+
+    pthread_mutex_lock(&pool->state_lock);
+    if (current_pool == pool) {
+        index = current_worker;
+    } else {
+        index = pool->next_queue;
+        pool->next_queue = (pool->next_queue + 1) % pool->num_workers;
+    }
+    pool->unfinished++;
+    pthread_mutex_unlock(&pool->state_lock);
+
+    if (!queue_push_tail(&pool->queues[index], task)) {
+        pthread_mutex_lock(&pool->state_lock);
+        if (--pool->unfinished == 0) {
+            pthread_cond_broadcast(&pool->all_done);
+        }
+        pthread_mutex_unlock(&pool->state_lock);
+        return false;
+    }
+
+    pthread_mutex_lock(&pool->state_lock);
+    pool->queued++;
+    pthread_cond_signal(&pool->work_available);
+    pthread_mutex_unlock(&pool->state_lock);
+    return true;
+}
+
+void pool_wait(ThreadPool *pool) {
+    pthread_mutex_lock(&pool->state_lock);
+    while (pool->unfinished > 0) {
+        pthread_cond_wait(&pool->all_done, &pool->state_lock);
+    }
+    pthread_mutex_unlock(&pool->state_lock);
+}
+
+void pool_destroy(ThreadPool *pool) {
+    pool_wait(pool);
+
+    pthread_mutex_lock(&pool->state_lock);
+    pool->shutting_down = true;
+    pthread_cond_broadcast(&pool->work_available);
+    pthread_mutex_unlock(&pool->state_lock);
+
+    for (int i = 0; i < pool->num_workers; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    for (int i = 0; i < pool->num_workers; i++) {
+        pthread_mutex_destroy(&pool->queues[i].lock);
+        free(pool->queues[i].tasks);
+    }
+    pthread_mutex_destroy(&pool->state_lock);
+    pthread_cond_destroy(&pool->work_available);
+    pthread_cond_destroy(&pool->all_done);
+    free(pool->queues);
+    free(pool->threads);
+    free(pool);
+}
\ No newline at end of file
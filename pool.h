@@ -0,0 +1,21 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// --- Work-Stealing Thread Pool ---
+// Each worker owns a deque: it pushes and pops its own tasks at the tail (LIFO, cache-warm)
+// while idle workers steal from the head of the others (FIFO, oldest/biggest work first).
+// Tasks submitted from inside a task land on the submitting worker's own deque.
+typedef struct ThreadPool ThreadPool;
+typedef void (*PoolTaskFn)(void *arg);
+
+ThreadPool *pool_create(int num_workers);
+bool pool_submit(ThreadPool *pool, PoolTaskFn fn, void *arg);
+void pool_wait(ThreadPool *pool);     // Blocks until every submitted task has finished
+void pool_destroy(ThreadPool *pool);  // Waits, then joins the workers
+
+int pool_default_workers(void);
+
+#endif // POOL_H
\ No newline at end of file
@@ -0,0 +1,674 @@
+#define _GNU_SOURCE // strcasestr
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "query.h"
+#include "tag.h"
+#include "scan.h"
+#include "hash.h"
+#include "helper.h"
+#include "frames.h"
+
+#define QUERY_COLUMN_SLOTS (2 * QUERY_MAX_COLUMNS)
+
+// --- String Interning ---
+// Every distinct value is stored once, NUL-terminated, in one growing block; a string ID is
+// its index in `offsets`. ID 0 is the empty string, which also stands for "no value".
+typedef struct {
+    char *text;
+    size_t text_used;
+    size_t text_capacity;
+    uint32_t *offsets;        // String ID -> position in text
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t *slots;          // Open addressing on the text's hash: string ID, 0 = empty
+    uint32_t slot_mask;       // Slot count - 1 (a power of two, kept at most half full)
+} StringPool;
+
+static const char *strings_text(const StringPool *strings, uint32_t id) {
+    return strings->text + strings->offsets[id];
+}
+
+// The ID of `text`, or 0 if it was never interned
+static uint32_t strings_find(const StringPool *strings, const char *text, size_t length, uint64_t hash) {
+    if (!strings->slots) {
+        return 0;
+    }
+    for (uint32_t i = (uint32_t)hash & strings->slot_mask;; i = (i + 1) & strings->slot_mask) {
+        uint32_t id = strings->slots[i];
+        if (id == 0) {
+            return 0;
+        }
+        // strncmp stops at the end of a shorter candidate, which memcmp would read past
+        const char *candidate = strings_text(strings, id);
+        if (strncmp(candidate, text, length) == 0 && candidate[length] == '\0') {
+            return id;
+        }
+    }
+}
+
+static bool strings_rehash(StringPool *strings, uint32_t slot_count) {
+    uint32_t *slots = calloc(slot_count, sizeof(uint32_t));
+    if (!slots) {
+        return false;
+    }
+    for (uint32_t id = 1; id < strings->count; id++) {
+        const char *text = strings_text(strings, id);
+        uint32_t i = (uint32_t)hash64(text, strlen(text)) & (slot_count - 1);
+        while (slots[i]) {
+            i = (i + 1) & (slot_count - 1);
+        }
+        slots[i] = id;
+    }
+    free(strings->slots);
+    strings->slots = slots;
+    strings->slot_mask = slot_count - 1;
+    return true;
+}
+
+// The ID of `text`, stored first if it is new; false if out of memory
+static bool strings_intern(StringPool *strings, const char *text, uint32_t *id) {
+    size_t length = strlen(text);
+    if (length == 0) {
+        *id = 0;
+        return true;
+    }
+    uint64_t hash = hash64(text, length);
+    *id = strings_find(strings, text, length, hash);
+    if (*id) {
+        return true;
+    }
+
+    if (strings->text_used + length + 1 > strings->text_capacity) {
+        size_t capacity = strings->text_capacity * 2;
+        while (capacity < strings->text_used + length + 1) {
+            capacity *= 2;
+        }
+        char *grown = capacity <= UINT32_MAX ? realloc(strings->text, capacity) : NULL;
+        if (!grown) {
+            return false;
+        }
+        strings->text = grown;
+        strings->text_capacity = capacity;
+    }
+    if (strings->count == strings->capacity) {
+        uint32_t *grown = realloc(strings->offsets, 2 * (size_t)strings->capacity * sizeof(uint32_t));
+        if (!grown) {
+            return false;
+        }
+        strings->offsets = grown;
+        strings->capacity *= 2;
+    }
+    if ((strings->count + 1) * 2 > strings->slot_mask + 1 && !strings_rehash(strings, 2 * (strings->slot_mask + 1))) {
+        return false;
+    }
+
+    *id = strings->count++;
+    strings->offsets[*id] = (uint32_t)strings->text_used;
+    memcpy(strings->text + strings->text_used, text, length + 1);
+    strings->text_used += length + 1;
+
+    uint32_t i = (uint32_t)hash & strings->slot_mask;
+    while (strings->slots[i]) {
+        i = (i + 1) & strings->slot_mask;
+    }
+    strings->slots[i] = *id;
+    return true;
+}
+
+static bool strings_init(StringPool *strings) {
+    memset(strings, 0, sizeof(StringPool));
+    strings->text_capacity = 65536;
+    strings->capacity = 1024;
+    strings->text = malloc(strings->text_capacity);
+    strings->offsets = malloc(strings->capacity * sizeof(uint32_t));
+    if (!strings->text || !strings->offsets || !strings_rehash(strings, 2048)) {
+        return false;
+    }
+    strings->text[0] = '\0'; // ID 0
+    strings->text_used = 1;
+    strings->offsets[0] = 0;
+    strings->count = 1;
+    return true;
+}
+
+static void strings_free(StringPool *strings) {
+    free(strings->text);
+    free(strings->offsets);
+    free(strings->slots);
+}
+
+// --- Columns ---
+// The tracks that hold one value: postings[start .. start + count)
+typedef struct {
+    uint32_t string;
+    uint32_t start;
+    uint32_t count;
+} ValueRun;
+
+typedef struct {
+    uint32_t frame_id;
+    uint32_t *values;         // Per track: string ID, 0 = no value
+    // Built by query_engine_build
+    uint32_t *postings;       // Tracks grouped by value, ascending within each group
+    ValueRun *runs;           // One per distinct value, in byte order of the text (sorted index)
+    uint32_t run_count;
+    uint32_t *run_slots;      // Hash index: string ID -> run + 1, 0 = empty
+    uint32_t run_slot_mask;
+} Column;
+
+// A path is kept as its interned directory (shared by the whole album) plus its file name
+struct QueryEngine {
+    StringPool strings;
+    StringPool directories;
+    char *names;
+    size_t names_used;
+    size_t names_capacity;
+    size_t *name_offsets;     // Per track: file name in `names`
+    uint32_t *directory_ids;  // Per track: directory in `directories`
+    char *path;               // query_track_path result
+    size_t path_capacity;
+    uint32_t track_count;
+    uint32_t track_capacity;
+
+    Column columns[QUERY_MAX_COLUMNS];
+    uint32_t column_count;
+    uint16_t column_slots[QUERY_COLUMN_SLOTS]; // Frame ID -> column + 1, 0 = empty
+
+    uint64_t *matches;        // Query bitmaps, one bit per track
+    uint64_t *term_matches;
+    uint64_t raw_value_bytes;
+    uint64_t dropped_values;
+    uint64_t failed_tracks;
+    char text[OUTPUT_TEXT_MAX]; // Decoded frame text
+};
+
+static uint32_t column_slot(uint32_t frame_id) {
+    return (frame_id * 2654435761u) >> 23; // Top 9 bits: QUERY_COLUMN_SLOTS
+}
+
+static Column *find_column(const QueryEngine *engine, uint32_t frame_id) {
+    for (uint32_t i = column_slot(frame_id);; i = (i + 1) % QUERY_COLUMN_SLOTS) {
+        uint16_t column = engine->column_slots[i];
+        if (column == 0) {
+            return NULL;
+        }
+        if (engine->columns[column - 1].frame_id == frame_id) {
+            return (Column *)&engine->columns[column - 1];
+        }
+    }
+}
+
+// The column for this frame ID, added if there is room; NULL past QUERY_MAX_COLUMNS
+static Column *column_for(QueryEngine *engine, uint32_t frame_id) {
+    Column *column = find_column(engine, frame_id);
+    if (column || engine->column_count == QUERY_MAX_COLUMNS) {
+        return column;
+    }
+    column = &engine->columns[engine->column_count];
+    column->values = calloc(engine->track_capacity, sizeof(uint32_t));
+    if (!column->values) {
+        return NULL;
+    }
+    column->frame_id = frame_id;
+    uint32_t i = column_slot(frame_id);
+    while (engine->column_slots[i]) {
+        i = (i + 1) % QUERY_COLUMN_SLOTS;
+    }
+    engine->column_slots[i] = (uint16_t)++engine->column_count;
+    return column;
+}
+
+QueryEngine *query_engine_create(void) {
+    QueryEngine *engine = calloc(1, sizeof(QueryEngine));
+    if (!engine) {
+        return NULL;
+    }
+    if (!strings_init(&engine->strings) || !strings_init(&engine->directories)) {
+        query_engine_destroy(engine);
+        return NULL;
+    }
+    return engine;
+}
+
+void query_engine_destroy(QueryEngine *engine) {
+    if (!engine) {
+        return;
+    }
+    strings_free(&engine->strings);
+    strings_free(&engine->directories);
+    free(engine->names);
+    free(engine->name_offsets);
+    free(engine->directory_ids);
+    free(engine->path);
+    for (uint32_t i = 0; i < engine->column_count; i++) {
+        free(engine->columns[i].values);
+        free(engine->columns[i].postings);
+        free(engine->columns[i].runs);
+        free(engine->columns[i].run_slots);
+    }
+    free(engine->matches);
+    free(engine->term_matches);
+    free(engine);
+}
+
+// Room for one more track in every column
+static bool grow_tracks(QueryEngine *engine) {
+    uint32_t capacity = engine->track_capacity ? engine->track_capacity * 2 : 1024;
+    size_t *offsets = realloc(engine->name_offsets, capacity * sizeof(size_t));
+    if (offsets) {
+        engine->name_offsets = offsets;
+    }
+    uint32_t *directories = realloc(engine->directory_ids, capacity * sizeof(uint32_t));
+    if (directories) {
+        engine->directory_ids = directories;
+    }
+    if (!offsets || !directories) {
+        return false;
+    }
+    for (uint32_t i = 0; i < engine->column_count; i++) {
+        uint32_t *values = realloc(engine->columns[i].values, capacity * sizeof(uint32_t));
+        if (!values) {
+            return false;
+        }
+        memset(values + engine->track_capacity, 0, (capacity - engine->track_capacity) * sizeof(uint32_t));
+        engine->columns[i].values = values;
+    }
+    engine->track_capacity = capacity;
+    return true;
+}
+
+// Adds one track. Only the first frame of each ID counts, as in tag_get_text.
+bool query_engine_add(QueryEngine *engine, const char *path, const TagData *tags) {
+    if (engine->track_count == UINT32_MAX - 1 ||
+        (engine->track_count == engine->track_capacity && !grow_tracks(engine))) {
+        return false;
+    }
+
+    // The directory keeps its trailing slash, so "" stands for a bare file name
+    const char *name = strrchr(path, '/');
+    name = name ? name + 1 : path;
+    size_t length = strlen(name) + 1;
+    if (engine->names_used + length > engine->names_capacity) {
+        size_t capacity = engine->names_capacity ? engine->names_capacity * 2 : 65536;
+        while (capacity < engine->names_used + length) {
+            capacity *= 2;
+        }
+        char *grown = realloc(engine->names, capacity);
+        if (!grown) {
+            return false;
+        }
+        engine->names = grown;
+        engine->names_capacity = capacity;
+    }
+    size_t directory_length = (size_t)(name - path);
+    if (directory_length + 1 > sizeof(engine->text)) {
+        return false;
+    }
+    memcpy(engine->text, path, directory_length);
+    engine->text[directory_length] = '\0';
+    uint32_t track = engine->track_count;
+    if (!strings_intern(&engine->directories, engine->text, &engine->directory_ids[track])) {
+        return false;
+    }
+    memcpy(engine->names + engine->names_used, name, length);
+    engine->name_offsets[track] = engine->names_used;
+    engine->names_used += length;
+    engine->track_count++;
+
+    for (uint32_t i = 0; tags && i < tags->frame_count; i++) {
+        const TagFrame *frame = &tags->frames[i];
+        if (frame_kind(frame->id) != FRAME_KIND_TEXT && frame->id != FRAME_ID_COMM) {
+            continue;
+        }
+        Column *column = column_for(engine, frame->id);
+        if (!column) {
+            engine->dropped_values++;
+            continue;
+        }
+        if (column->values[track] != 0) {
+            continue;
+        }
+        size_t text_length = tag_frame_text(tags, frame, engine->text, sizeof(engine->text));
+        if (!strings_intern(&engine->strings, engine->text, &column->values[track])) {
+            return false;
+        }
+        engine->raw_value_bytes += text_length ? text_length + 1 : 0;
+    }
+    return true;
+}
+
+// The scan cannot be told to stop, so a track that does not fit is counted and skipped
+static void add_scan_result(const ScanResult *result, void *user) {
+    QueryEngine *engine = user;
+    if (!query_engine_add(engine, result->path, result->ok ? &result->tags : NULL)) {
+        engine->failed_tracks++;
+    }
+}
+
+// Loads a library through the scan (and the tag index, if any, so unchanged files are not read)
+bool query_engine_scan(QueryEngine *engine, const char *root, int num_threads, TagIndex *index) {
+    ScanOptions options;
+    memset(&options, 0, sizeof(options));
+    options.num_threads = num_threads;
+    options.callback = add_scan_result;
+    options.user = engine;
+    options.index = index;
+    return scan_library(root, &options);
+}
+
+// --- Index Building ---
+typedef struct {
+    const char *text;
+    uint32_t string;
+} SortedValue;
+
+static int compare_values(const void *a, const void *b) {
+    return strcmp(((const SortedValue *)a)->text, ((const SortedValue *)b)->text);
+}
+
+// One counting pass finds the distinct values and their track counts; the values are sorted
+// by text, then a second pass drops every track into its value's slice of the postings.
+// `counts` and `run_of` are indexed by string ID and come (and go back) zeroed.
+static bool build_column(QueryEngine *engine, Column *column, uint32_t *counts, uint32_t *run_of) {
+    SortedValue *sorted = NULL;
+    uint32_t distinct = 0, capacity = 0, present = 0;
+    bool ok = true;
+    for (uint32_t t = 0; ok && t < engine->track_count; t++) {
+        uint32_t string = column->values[t];
+        if (string == 0) {
+            continue;
+        }
+        present++;
+        if (counts[string]++ > 0) {
+            continue;
+        }
+        if (distinct == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            SortedValue *grown = realloc(sorted, capacity * sizeof(SortedValue));
+            if (!grown) {
+                ok = false;
+                break;
+            }
+            sorted = grown;
+        }
+        sorted[distinct++] = (SortedValue){ strings_text(&engine->strings, string), string };
+    }
+
+    uint32_t slot_count = 16;
+    while (slot_count < 2 * distinct) {
+        slot_count *= 2;
+    }
+    column->postings = ok ? malloc((present ? present : 1) * sizeof(uint32_t)) : NULL;
+    column->runs = ok ? malloc((distinct ? distinct : 1) * sizeof(ValueRun)) : NULL;
+    column->run_slots = ok ? calloc(slot_count, sizeof(uint32_t)) : NULL;
+    ok = column->postings && column->runs && column->run_slots;
+
+    if (ok) {
+        qsort(sorted, distinct, sizeof(SortedValue), compare_values);
+        uint32_t start = 0;
+        for (uint32_t r = 0; r < distinct; r++) {
+            uint32_t string = sorted[r].string;
+            column->runs[r] = (ValueRun){ string, start, 0 };
+            start += counts[string];
+            run_of[string] = r;
+
+            uint32_t i = (string * 2654435761u) & (slot_count - 1);
+            while (column->run_slots[i]) {
+                i = (i + 1) & (slot_count - 1);
+            }
+            column->run_slots[i] = r + 1;
+        }
+        for (uint32_t t = 0; t < engine->track_count; t++) {
+            uint32_t string = column->values[t];
+            if (string != 0) {
+                ValueRun *run = &column->runs[run_of[string]];
+                column->postings[run->start + run->count++] = t;
+            }
+        }
+        column->run_count = distinct;
+        column->run_slot_mask = slot_count - 1;
+    }
+
+    for (uint32_t r = 0; r < distinct; r++) {
+        counts[sorted[r].string] = 0;
+    }
+    free(sorted);
+    return ok;
+}
+
+bool query_engine_build(QueryEngine *engine) {
+    size_t words = (engine->track_count + 63) / 64;
+    engine->matches = calloc(words ? words : 1, sizeof(uint64_t));
+    engine->term_matches = calloc(words ? words : 1, sizeof(uint64_t));
+    uint32_t *counts = calloc(engine->strings.count, sizeof(uint32_t));
+    uint32_t *run_of = malloc(engine->strings.count * sizeof(uint32_t));
+    bool ok = engine->matches && engine->term_matches && counts && run_of;
+    for (uint32_t i = 0; ok && i < engine->column_count; i++) {
+        ok = build_column(engine, &engine->columns[i], counts, run_of);
+    }
+    free(counts);
+    free(run_of);
+    return ok;
+}
+
+// --- Queries ---
+// Names accepted in place of frame IDs (the bulk output's CSV columns)
+static const struct {
+    const char *name;
+    uint32_t frame_id;
+} query_names[] = {
+    { "title", FRAME_ID_TIT2 }, { "artist", FRAME_ID_TPE1 }, { "album", FRAME_ID_TALB },
+    { "year", FRAME_ID_TYER }, { "track", FRAME_ID_TRCK }, { "genre", FRAME_ID_TCON },
+    { "comment", FRAME_ID_COMM },
+};
+
+bool query_parse_frame(const char *name, uint32_t *frame_id) {
+    for (size_t i = 0; i < sizeof(query_names) / sizeof(query_names[0]); i++) {
+        if (strcmp(name, query_names[i].name) == 0) {
+            *frame_id = query_names[i].frame_id;
+            return true;
+        }
+    }
+    if (strlen(name) != 4) {
+        return false;
+    }
+    for (int i = 0; i < 4; i++) {
+        if (!((name[i] >= 'A' && name[i] <= 'Z') || (name[i] >= '0' && name[i] <= '9'))) {
+            return false;
+        }
+    }
+    *frame_id = pack_frame_id((const uint8_t *)name);
+    return true;
+}
+
+bool query_parse_term(const char *text, QueryTerm *term) {
+    const char *op = strchr(text, '=');
+    if (!op || op == text) {
+        return false;
+    }
+    const char *value = op + 1;
+    term->op = QUERY_EQUALS;
+    if (op[-1] == '^' || op[-1] == '~') {
+        term->op = op[-1] == '^' ? QUERY_PREFIX : QUERY_CONTAINS;
+        op--;
+    }
+
+    char name[16];
+    size_t length = (size_t)(op - text);
+    if (length == 0 || length >= sizeof(name)) {
+        return false;
+    }
+    memcpy(name, text, length);
+    name[length] = '\0';
+    term->value = value;
+    return query_parse_frame(name, &term->frame_id);
+}
+
+static void set_bit(uint64_t *bits, uint32_t track) {
+    bits[track / 64] |= 1ull << (track % 64);
+}
+
+static void set_run(uint64_t *bits, const Column *column, const ValueRun *run) {
+    for (uint32_t i = 0; i < run->count; i++) {
+        set_bit(bits, column->postings[run->start + i]);
+    }
+}
+
+// First run whose text is not below `prefix` (binary search of the sorted index)
+static uint32_t lower_bound(const QueryEngine *engine, const Column *column, const char *prefix) {
+    uint32_t low = 0, high = column->run_count;
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        if (strcmp(strings_text(&engine->strings, column->runs[mid].string), prefix) < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+// Sets the bit of every track the term matches (the bitmap starts out clear)
+static void match_term(const QueryEngine *engine, const QueryTerm *term, uint64_t *bits) {
+    const Column *column = find_column(engine, term->frame_id);
+    size_t length = strlen(term->value);
+
+    if (term->op == QUERY_EQUALS && length == 0) {
+        for (uint32_t t = 0; t < engine->track_count; t++) {
+            if (!column || column->values[t] == 0) {
+                set_bit(bits, t);
+            }
+        }
+        return;
+    }
+    if (!column) {
+        return;
+    }
+
+    if (term->op == QUERY_EQUALS) {
+        uint32_t string = strings_find(&engine->strings, term->value, length, hash64(term->value, length));
+        for (uint32_t i = (string * 2654435761u) & column->run_slot_mask; string && column->run_slots[i];
+             i = (i + 1) & column->run_slot_mask) {
+            const ValueRun *run = &column->runs[column->run_slots[i] - 1];
+            if (run->string == string) {
+                set_run(bits, column, run);
+                break;
+            }
+        }
+    } else if (term->op == QUERY_PREFIX) {
+        for (uint32_t r = lower_bound(engine, column, term->value); r < column->run_count; r++) {
+            if (strncmp(strings_text(&engine->strings, column->runs[r].string), term->value, length) != 0) {
+                break;
+            }
+            set_run(bits, column, &column->runs[r]);
+        }
+    } else {
+        for (uint32_t r = 0; r < column->run_count; r++) {
+            if (strcasestr(strings_text(&engine->strings, column->runs[r].string), term->value)) {
+                set_run(bits, column, &column->runs[r]);
+            }
+        }
+    }
+}
+
+uint64_t query_run(QueryEngine *engine, const QueryTerm *terms, int count, QueryMatchFn match, void *user) {
+    size_t words = (engine->track_count + 63) / 64;
+    if (count == 0) {
+        memset(engine->matches, 0xFF, words * sizeof(uint64_t));
+    } else {
+        memset(engine->matches, 0, words * sizeof(uint64_t));
+        match_term(engine, &terms[0], engine->matches);
+    }
+    for (int i = 1; i < count; i++) {
+        memset(engine->term_matches, 0, words * sizeof(uint64_t));
+        match_term(engine, &terms[i], engine->term_matches);
+        for (size_t w = 0; w < words; w++) {
+            engine->matches[w] &= engine->term_matches[w];
+        }
+    }
+
+    uint64_t found = 0;
+    for (size_t w = 0; w < words; w++) {
+        for (uint64_t bits = engine->matches[w]; bits; bits &= bits - 1) {
+            uint32_t track = (uint32_t)(w * 64 + __builtin_ctzll(bits));
+            if (track >= engine->track_count) {
+                break;
+            }
+            found++;
+            if (match) {
+                match(engine, track, user);
+            }
+        }
+    }
+    return found;
+}
+
+// Valid until the next call; "" if out of memory
+const char *query_track_path(QueryEngine *engine, uint32_t track) {
+    const char *directory = strings_text(&engine->directories, engine->directory_ids[track]);
+    const char *name = engine->names + engine->name_offsets[track];
+    size_t directory_length = strlen(directory);
+    size_t size = directory_length + strlen(name) + 1;
+    if (size > engine->path_capacity) {
+        char *grown = realloc(engine->path, size * 2);
+        if (!grown) {
+            return "";
+        }
+        engine->path = grown;
+        engine->path_capacity = size * 2;
+    }
+    memcpy(engine->path, directory, directory_length);
+    strcpy(engine->path + directory_length, name);
+    return engine->path;
+}
+
+const char *query_track_value(const QueryEngine *engine, uint32_t track, uint32_t frame_id) {
+    const Column *column = find_column(engine, frame_id);
+    return strings_text(&engine->strings, column ? column->values[track] : 0);
+}
+
+// Bytes actually allocated, capacity included
+void query_engine_memory(const QueryEngine *engine, QueryMemory *memory) {
+    memset(memory, 0, sizeof(QueryMemory));
+    const StringPool *strings = &engine->strings;
+    memory->tracks = engine->track_count;
+    memory->columns = engine->column_count;
+    memory->strings = strings->count - 1;
+    memory->string_bytes = strings->text_capacity + (uint64_t)strings->capacity * sizeof(uint32_t) +
+                           ((uint64_t)strings->slot_mask + 1) * sizeof(uint32_t);
+    const StringPool *directories = &engine->directories;
+    memory->path_bytes = engine->names_capacity + engine->path_capacity +
+                         (uint64_t)engine->track_capacity * (sizeof(size_t) + sizeof(uint32_t)) +
+                         directories->text_capacity + (uint64_t)directories->capacity * sizeof(uint32_t) +
+                         ((uint64_t)directories->slot_mask + 1) * sizeof(uint32_t);
+    uint64_t bitmap_bytes = 2 * ((engine->track_count + 63) / 64) * sizeof(uint64_t);
+    memory->index_bytes = bitmap_bytes;
+    uint64_t postings = 0, runs = 0;
+    for (uint32_t i = 0; i < engine->column_count; i++) {
+        const Column *column = &engine->columns[i];
+        memory->column_bytes += (uint64_t)engine->track_capacity * sizeof(uint32_t);
+        uint64_t present = 0;
+        for (uint32_t r = 0; r < column->run_count; r++) {
+            present += column->runs[r].count;
+        }
+        postings += present;
+        runs += column->run_count;
+        memory->index_bytes += present * sizeof(uint32_t) + (uint64_t)column->run_count * sizeof(ValueRun) +
+                               (column->run_slots ? ((uint64_t)column->run_slot_mask + 1) * sizeof(uint32_t) : 0);
+    }
+    memory->total_bytes = sizeof(QueryEngine) + memory->string_bytes + memory->path_bytes +
+                          memory->column_bytes + memory->index_bytes;
+
+    // Counted as used, not allocated, so neither the fixed starting tables nor the slack of
+    // the last doubling are scaled up; hash tables are taken at their half-full worst
+    uint64_t distinct = (uint64_t)(strings->count - 1) + (directories->count - 1);
+    memory->growth_bytes = (uint64_t)engine->track_count *
+                               (engine->column_count * sizeof(uint32_t) + sizeof(size_t) + sizeof(uint32_t)) +
+                           engine->names_used + strings->text_used + directories->text_used +
+                           distinct * 3 * sizeof(uint32_t) + postings * sizeof(uint32_t) +
+                           runs * (sizeof(ValueRun) + 2 * sizeof(uint32_t)) + bitmap_bytes;
+    memory->raw_value_bytes = engine->raw_value_bytes;
+    memory->dropped_values = engine->dropped_values;
+    memory->failed_tracks = engine->failed_tracks;
+}
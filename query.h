@@ -0,0 +1,71 @@
+#ifndef QUERY_H
+#define QUERY_H
+
+#include "types.h"
+
+// --- Library Query Engine (query) ---
+// The tags of a scanned library held in memory as columns: one per text frame ID (T***,
+// COMM), each an array with the value of every track. Values are interned: each distinct
+// string is stored once and a column holds 32-bit string IDs, so an artist on 300 tracks
+// costs its text once plus 4 bytes per track. Once loaded, each column gets
+//   - a hash index (string ID -> its tracks) for FRAME=value,
+//   - a sorted index (its distinct values in byte order) for FRAME^=prefix,
+// and FRAME~=text looks through the distinct values only, not every track. The terms of a
+// query are ANDed over track bitmaps; no MP3 is read again.
+#define QUERY_MAX_COLUMNS 256     // Frame IDs kept as columns; values of any others are dropped
+#define QUERY_MAX_TERMS 16
+
+typedef struct QueryEngine QueryEngine;
+
+typedef enum {
+    QUERY_EQUALS,             // FRAME=value (FRAME= matches tracks without the frame)
+    QUERY_PREFIX,             // FRAME^=prefix
+    QUERY_CONTAINS            // FRAME~=text, ASCII case-insensitive
+} QueryOp;
+
+typedef struct {
+    uint32_t frame_id;        // Packed (see pack_frame_id)
+    QueryOp op;
+    const char *value;
+} QueryTerm;
+
+typedef struct {
+    uint64_t tracks;
+    uint64_t columns;
+    uint64_t strings;         // Distinct values
+    uint64_t string_bytes;    // Interned text, offsets and hash table
+    uint64_t path_bytes;
+    uint64_t column_bytes;    // One string ID per track and column
+    uint64_t index_bytes;     // Postings, hash and sorted indexes, query bitmaps
+    uint64_t total_bytes;
+    uint64_t growth_bytes;    // The bytes in use that grow with the track count: per-track IDs,
+                              // names and postings, distinct values and directories
+    uint64_t raw_value_bytes; // The same values stored once per track instead of interned
+    uint64_t dropped_values;  // Frames past QUERY_MAX_COLUMNS
+    uint64_t failed_tracks;   // Scanned files that could not be added (out of memory, path too long)
+} QueryMemory;
+
+typedef void (*QueryMatchFn)(QueryEngine *engine, uint32_t track, void *user);
+
+QueryEngine *query_engine_create(void);
+void query_engine_destroy(QueryEngine *engine);
+
+// Loading: every track is added (tags NULL = no tag), then the indexes are built once
+bool query_engine_add(QueryEngine *engine, const char *path, const TagData *tags);
+bool query_engine_scan(QueryEngine *engine, const char *root, int num_threads, TagIndex *index);
+bool query_engine_build(QueryEngine *engine);
+
+// "TPE1=Daft Punk", "TYER=", "TALB^=The ", "TIT2~=love"; names from the CSV header
+// (title, artist, album, year, track, genre, comment) work in place of the frame ID
+bool query_parse_term(const char *text, QueryTerm *term);
+bool query_parse_frame(const char *name, uint32_t *frame_id);
+
+// Calls `match` for each track that satisfies every term, in the order the tracks were
+// added, and returns how many did. Allocates nothing: one query at a time per engine.
+uint64_t query_run(QueryEngine *engine, const QueryTerm *terms, int count, QueryMatchFn match, void *user);
+
+const char *query_track_path(QueryEngine *engine, uint32_t track); // Valid until the next call
+const char *query_track_value(const QueryEngine *engine, uint32_t track, uint32_t frame_id); // "" if none
+void query_engine_memory(const QueryEngine *engine, QueryMemory *memory);
+
+#endif // QUERY_H
@@ -1,15 +1,20 @@
+#define _GNU_SOURCE // pread
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "read.h"
 #include "helper.h"
+#include "tag.h"
+#include "stats.h"
+#include "frames.h"
+#include "simd.h"
 
-// Reads the ID3v2.3 Header
-bool read_id3_header(FILE *fp, ID3Header *header) {
-    uint8_t buffer[ID3_HEADER_SIZE];
-    
-    fseek(fp, 0, SEEK_SET);
-    if (fread(buffer, 1, ID3_HEADER_SIZE, fp) != ID3_HEADER_SIZE) {
+// Decodes the 10-byte ID3v2 Header from a buffer (versions 2.2 to 2.4)
+bool decode_id3_header(const uint8_t *buffer, ID3Header *header) {
+    if (memcmp(buffer, "ID3", 3) != 0 || buffer[3] < 2 || buffer[3] > 4) {
         return false;
     }
 
@@ -29,98 +34,384 @@ bool read_id3_header(FILE *fp, ID3Header *header) {
     return true;
 }
 
-// Parses the next frame and extracts data if it's a target frame (TIT2 or TPE1)
-bool parse_next_frame(FILE *fp, uint32_t tag_end_pos, TagData *tag_data) {
-    ID3FrameHeader frame_header;
-    long current_pos = ftell(fp);
+// Reads the ID3v2.3 Header
+bool read_id3_header(FILE *fp, ID3Header *header) {
+    uint8_t buffer[ID3_HEADER_SIZE];
+    
+    fseek(fp, 0, SEEK_SET);
+    if (fread(buffer, 1, ID3_HEADER_SIZE, fp) != ID3_HEADER_SIZE) {
+        return false;
+    }
 
-    if (current_pos >= tag_end_pos) {
-        return false; // Reached end of tag
+    return decode_id3_header(buffer, header);
+}
+
+// v2.4 frame flags in the v2.3 layout (see FRAME_FLAG_*)
+static uint16_t translate_v24_flags(uint8_t status, uint8_t format) {
+    uint16_t flags = (uint16_t)(status & 0x70) << 9; // Preservation / read-only bits
+    flags |= (format & 0x40) ? FRAME_FLAG_GROUPED : 0;
+    flags |= (format & 0x08) ? FRAME_FLAG_COMPRESSED : 0;
+    flags |= (format & 0x04) ? FRAME_FLAG_ENCRYPTED : 0;
+    flags |= (format & 0x02) ? FRAME_FLAG_UNSYNC : 0;
+    flags |= (format & 0x01) ? FRAME_FLAG_DATA_LENGTH : 0;
+    return flags;
+}
+
+// Decodes the frame header at the start of `frame` for the given tag version (2, 3 or 4).
+// Returns false at the padding, at the end of the tag, or when the frame claims more bytes
+// than are left in the tag.
+bool decode_frame_header(const uint8_t *frame, uint32_t remaining, uint8_t version,
+                         ID3FrameHeader *frame_header) {
+    uint8_t header_size = (version == 2) ? ID3V22_FRAME_HEADER_SIZE : ID3_FRAME_HEADER_SIZE;
+    if (remaining < header_size || frame[0] == 0) {
+        return false; // End of tag or padding
+    }
+
+    if (version == 2) {
+        // 3-byte ID and 3-byte size, no flags
+        frame_header->id = frame_id_from_v22(FRAME_ID(frame[0], frame[1], frame[2], 0));
+        frame_header->size = ((uint32_t)frame[3] << 16) | ((uint32_t)frame[4] << 8) | frame[5];
+        frame_header->flags = 0;
+    } else {
+        frame_header->id = pack_frame_id(frame);
+
+        uint32_t raw_size;
+        memcpy(&raw_size, frame + 4, 4);
+        reverse_bytes((uint8_t *)&raw_size, 4);
+        // v2.4 sizes are SyncSafe. Some writers still store plain integers there, which
+        // gives itself away by a high bit set in one of the bytes.
+        frame_header->size = (version == 4 && (raw_size & 0x80808080) == 0) ? decode_syncsafe(raw_size) : raw_size;
+
+        frame_header->flags = (version == 4) ? translate_v24_flags(frame[8], frame[9])
+                                             : (((frame[8] << 8) | frame[9]) & 0xE0E0);
+    }
+
+    frame_header->header_size = header_size;
+    for (int i = 0; i < 4; i++) {
+        frame_header->frame_id[i] = (char)(frame_header->id >> (24 - 8 * i));
+    }
+    frame_header->frame_id[4] = '\0';
+
+    return frame_header->size <= remaining - header_size;
+}
+
+// Bytes the frame flags add between the header and the content: group ID, encryption method,
+// and the data length (v2.4) or decompressed size (v2.3)
+uint32_t frame_flag_additions(uint16_t flags, uint8_t version) {
+    uint32_t additions = 0;
+    additions += (flags & FRAME_FLAG_GROUPED) ? 1 : 0;
+    additions += (flags & FRAME_FLAG_ENCRYPTED) ? 1 : 0;
+    additions += (flags & FRAME_FLAG_DATA_LENGTH) ? 4 : 0;
+    additions += (version == 3 && (flags & FRAME_FLAG_COMPRESSED)) ? 4 : 0;
+    return additions;
+}
+
+// Offset of the first frame in the tag body: past the extended header when there is one.
+// A compressed v2.2 tag has no frames we can read, so its whole body is skipped.
+uint32_t first_frame_offset(const ID3Header *header, const uint8_t *body) {
+    if (!(header->flags & ID3_FLAG_EXTENDED)) {
+        return 0;
     }
+    if (header->version_major == 2 || header->size < 4) {
+        return header->size;
+    }
+
+    uint32_t ext_size;
+    memcpy(&ext_size, body, 4);
+    reverse_bytes((uint8_t *)&ext_size, 4);
+    // v2.3 counts the bytes after the size field, v2.4 (SyncSafe) includes it
+    uint64_t skip = (header->version_major == 3) ? 4 + (uint64_t)ext_size : decode_syncsafe(ext_size);
+    return (skip < header->size) ? (uint32_t)skip : header->size;
+}
 
-    uint8_t buffer[ID3_FRAME_HEADER_SIZE];
-    if (fread(buffer, 1, ID3_FRAME_HEADER_SIZE, fp) != ID3_FRAME_HEADER_SIZE) {
-        return false; 
+// Parses the frame at *offset and records it in the tag's frame array. The payload stays
+// where it is in the arena (which holds the whole tag), so nothing is copied, except for
+// unsynchronised v2.4 frames: their decoded payload is appended to the arena.
+// Offsets are relative to the end of the ID3 header; stored positions are relative to start of file.
+bool parse_next_frame(TagData *tag_data, uint32_t *offset) {
+    const uint8_t *tag_buffer = tag_data->arena + ID3_HEADER_SIZE;
+    uint8_t version = tag_data->header.version_major;
+    uint32_t tag_size = tag_data->header.size;
+    uint32_t current = *offset;
+
+    // Every frame seen so far ends here; once we stop, this is where padding begins
+    tag_data->frames_end_pos = ID3_HEADER_SIZE + ((current < tag_size) ? current : tag_size);
+
+    if (current >= tag_size) {
+        return false; // Reached end of tag
     }
 
-    // Check for padding/empty frames
-    if (buffer[0] == 0) {
-        fseek(fp, tag_end_pos, SEEK_SET); // Skip remaining padding
+    ID3FrameHeader frame_header;
+    if (!decode_frame_header(tag_buffer + current, tag_size - current, version, &frame_header)) {
         return false;
     }
 
-    // Extract Frame ID and Size
-    memcpy(frame_header.frame_id, buffer, 4);
-    frame_header.frame_id[4] = '\0';
+    // Move on to the next frame header
+    *offset = current + frame_header.header_size + frame_header.size;
 
-    uint32_t raw_size;
-    memcpy(&raw_size, buffer + 4, 4);
-    reverse_bytes((uint8_t *)&raw_size, 4);
-    frame_header.size = raw_size;
-
-    // --- Process TIT2 Frame ---
-    if (strcmp(frame_header.frame_id, "TIT2") == 0) {
-        tag_data->title_pos = current_pos;
-        tag_data->title_size_raw = ID3_FRAME_HEADER_SIZE + frame_header.size;
-        
-        uint8_t encoding;
-        if (fread(&encoding, 1, 1, fp) == 1) { // Read encoding byte
-            uint32_t text_size = frame_header.size - 1; 
-            if (text_size < MAX_TITLE_LEN) {
-                fread(tag_data->title, 1, text_size, fp);
-                tag_data->title[text_size] = '\0';
-            }
+    uint32_t additions = frame_flag_additions(frame_header.flags, version);
+    if (additions > frame_header.size) {
+        return true; // Flag additions run past the frame: skip it
+    }
+
+    uint32_t frame_pos = ID3_HEADER_SIZE + current;
+    uint32_t data = frame_pos + frame_header.header_size + additions;
+    uint32_t size = frame_header.size - additions;
+    uint16_t flags = frame_header.flags;
+
+    // v2.4 unsynchronises frame by frame; the tag flag means every frame is
+    if (version == 4 && (tag_data->header.flags & ID3_FLAG_UNSYNC)) {
+        flags |= FRAME_FLAG_UNSYNC;
+    }
+    if (version == 4 && (flags & FRAME_FLAG_UNSYNC)) {
+        if (!tag_arena_reserve(tag_data, (size_t)tag_data->arena_used + size)) {
+            return false;
         }
-    } 
-    // --- Process TPE1 (Artist) Frame <--- NEW LOGIC
-    else if (strcmp(frame_header.frame_id, "TPE1") == 0) {
-        tag_data->artist_pos = current_pos;
-        tag_data->artist_size_raw = ID3_FRAME_HEADER_SIZE + frame_header.size;
-        
-        uint8_t encoding;
-        if (fread(&encoding, 1, 1, fp) == 1) { // Read encoding byte
-            uint32_t text_size = frame_header.size - 1; 
-            if (text_size < MAX_TITLE_LEN) {
-                fread(tag_data->artist, 1, text_size, fp);
-                tag_data->artist[text_size] = '\0';
-            }
+        size = unsync_decode(tag_data->arena + tag_data->arena_used, tag_data->arena + data, size);
+        data = tag_data->arena_used;
+        tag_data->arena_used += size;
+    }
+
+    return tag_add_frame(tag_data, frame_header.id, frame_pos, size, flags, data);
+}
+
+// TAG_ERR_NO_SPACE for a fixed TagData, TAG_ERR_NO_MEMORY for a heap one
+static TagStatus overflow_status(const TagData *tag_data) {
+    return tag_data->fixed ? TAG_ERR_NO_SPACE : TAG_ERR_NO_MEMORY;
+}
+
+// Reads the header and the whole tag into the tag's arena. A single read of TAG_READ_AHEAD
+// bytes covers most tags; larger tags need one more read for the remainder.
+static TagStatus load_tag_buffer(int fd, TagData *tag_data) {
+    size_t ahead = TAG_READ_AHEAD;
+    if (tag_data->fixed && tag_data->arena_capacity < ahead) {
+        ahead = tag_data->arena_capacity; // A small tag still fits a small fixed arena
+    }
+    uint8_t *buffer = tag_arena_reserve(tag_data, ahead);
+    if (!buffer) {
+        return overflow_status(tag_data);
+    }
+
+    ssize_t got = pread(fd, buffer, ahead, 0);
+    STATS_ADD(STAT_SYSCALLS, 1);
+    STATS_ADD(STAT_BYTES_READ, got > 0 ? got : 0);
+    if (got < 0) {
+        return TAG_ERR_IO;
+    }
+    if (got < ID3_HEADER_SIZE || !decode_id3_header(buffer, &tag_data->header)) {
+        return TAG_ERR_NO_TAG;
+    }
+
+    size_t tag_total = ID3_HEADER_SIZE + (size_t)tag_data->header.size;
+    if (tag_total > ahead) {
+        buffer = tag_arena_reserve(tag_data, tag_total);
+        if (!buffer) {
+            return overflow_status(tag_data);
         }
+
+        ssize_t rest = pread(fd, buffer + got, tag_total - got, got);
+        STATS_ADD(STAT_SYSCALLS, 1);
+        STATS_ADD(STAT_BYTES_READ, rest > 0 ? rest : 0);
+        if (rest < 0) {
+            return TAG_ERR_IO;
+        }
+        got += rest;
     }
 
-    // Skip the rest of the frame content to the next frame header
-    fseek(fp, current_pos + ID3_FRAME_HEADER_SIZE + frame_header.size, SEEK_SET);
+    finish_tag_buffer(tag_data, got);
+    return TAG_OK;
+}
 
-    return true;
+bool read_tag_buffer(int fd, TagData *tag_data) {
+    return load_tag_buffer(fd, tag_data) == TAG_OK;
 }
 
-// Main function to read tags
-bool read_tags_from_file(const char *filepath, TagData *tag_data) {
-    FILE *fp = fopen(filepath, "rb");
-    if (!fp) {
-        return false;
+// Called once `got` bytes of the file sit at the start of the arena and the header is decoded.
+// A truncated file only exposes the frames that are actually there.
+void finish_tag_buffer(TagData *tag_data, size_t got) {
+    if (got < ID3_HEADER_SIZE + (size_t)tag_data->header.size) {
+        tag_data->header.size = got - ID3_HEADER_SIZE;
     }
-    
-    // Initialize tag data (important for string termination)
-    memset(tag_data, 0, sizeof(TagData));
+    tag_data->arena_used = ID3_HEADER_SIZE + tag_data->header.size;
+}
+
+// Records every frame of the tag held in the arena. A v2.2/v2.3 tag unsynchronised as a
+// whole is decoded in place first, so its frame positions refer to the decoded tag.
+void parse_tag_frames(TagData *tag_data) {
+    ID3Header *header = &tag_data->header;
+    if (header->version_major < 2) {
+        return; // ID3v1: the frames were built from the trailer
+    }
+
+    STATS_TIMER_START(frames_start);
+    uint8_t *body = tag_data->arena + ID3_HEADER_SIZE;
+    if (header->version_major < 4 && (header->flags & ID3_FLAG_UNSYNC)) {
+        header->size = unsync_decode(body, body, header->size);
+        tag_data->arena_used = ID3_HEADER_SIZE + header->size;
+    }
+
+    uint32_t offset = first_frame_offset(header, body);
+    while (parse_next_frame(tag_data, &offset)) {
+        // Continue parsing frames
+    }
+    STATS_ADD(STAT_FRAMES_PARSED, tag_data->frame_count);
+    STATS_TIMER_STOP(PHASE_FRAMES, frames_start);
+}
+
+// --- ID3v1 Trailer ---
+// The 80 genres of the original ID3v1 list; other numbers are kept as "(n)" references
+static const char *const id3v1_genres[] = {
+    "Blues", "Classic Rock", "Country", "Dance", "Disco", "Funk", "Grunge", "Hip-Hop",
+    "Jazz", "Metal", "New Age", "Oldies", "Other", "Pop", "R&B", "Rap", "Reggae", "Rock",
+    "Techno", "Industrial", "Alternative", "Ska", "Death Metal", "Pranks", "Soundtrack",
+    "Euro-Techno", "Ambient", "Trip-Hop", "Vocal", "Jazz+Funk", "Fusion", "Trance",
+    "Classical", "Instrumental", "Acid", "House", "Game", "Sound Clip", "Gospel", "Noise",
+    "AlternRock", "Bass", "Soul", "Punk", "Space", "Meditative", "Instrumental Pop",
+    "Instrumental Rock", "Ethnic", "Gothic", "Darkwave", "Techno-Industrial", "Electronic",
+    "Pop-Folk", "Eurodance", "Dream", "Southern Rock", "Comedy", "Cult", "Gangsta", "Top 40",
+    "Christian Rap", "Pop/Funk", "Jungle", "Native American", "Cabaret", "New Wave",
+    "Psychadelic", "Rave", "Showtunes", "Trailer", "Lo-Fi", "Tribal", "Acid Punk", "Acid Jazz",
+    "Polka", "Retro", "Musical", "Rock & Roll", "Hard Rock",
+};
+
+// Name of an ID3v1 genre number, or NULL for numbers past the original list
+const char *id3v1_genre_name(unsigned number) {
+    return number < sizeof(id3v1_genres) / sizeof(id3v1_genres[0]) ? id3v1_genres[number] : NULL;
+}
+
+// Adds one fixed-width v1 field as an ISO-8859-1 frame (COMM gets an empty description)
+static bool add_id3v1_field(TagData *tag_data, uint32_t id, const uint8_t *field, size_t width) {
+    size_t len = 0;
+    while (len < width && field[len] != 0) {
+        len++;
+    }
+    while (len > 0 && field[len - 1] == ' ') {
+        len--;
+    }
+    if (len == 0) {
+        return true;
+    }
+
+    uint8_t content[1 + 4 + 30];
+    size_t prefix = 1;
+    content[0] = 0x00; // ISO-8859-1
+    if (id == FRAME_ID_COMM) {
+        memcpy(content + 1, "XXX", 4); // Unknown language, empty description
+        prefix += 4;
+    }
+    memcpy(content + prefix, field, len);
 
-    if (!is_valid_id3(fp)) {
-        fclose(fp);
+    uint32_t data;
+    return tag_arena_append(tag_data, content, prefix + len, &data) &&
+           tag_add_frame(tag_data, id, 0, prefix + len, 0, data);
+}
+
+// Builds the frames of a tag from a 128-byte ID3v1 trailer. The tag reports version 1
+// and has no ID3v2 body; its frames have position 0.
+bool decode_id3v1(const uint8_t *trailer_in, TagData *tag_data) {
+    uint8_t trailer[ID3V1_TAG_SIZE]; // The trailer may sit in the arena, which can move
+    memcpy(trailer, trailer_in, ID3V1_TAG_SIZE);
+    if (memcmp(trailer, "TAG", 3) != 0) {
         return false;
     }
 
-    ID3Header header;
-    if (!read_id3_header(fp, &header)) {
-        fclose(fp);
+    tag_data_reset(tag_data);
+    // v1.1 keeps the track number in the last byte of the comment, after a zero byte
+    bool has_track = trailer[125] == 0 && trailer[126] != 0;
+    memcpy(tag_data->header.identifier, "TAG", 4);
+    tag_data->header.version_major = 1;
+    tag_data->header.version_revision = has_track ? 1 : 0;
+
+    // 255 means "no genre"
+    char genre_number[8] = "";
+    const char *genre = genre_number;
+    if (trailer[127] < sizeof(id3v1_genres) / sizeof(id3v1_genres[0])) {
+        genre = id3v1_genres[trailer[127]];
+    } else if (trailer[127] != 0xFF) {
+        snprintf(genre_number, sizeof(genre_number), "(%u)", trailer[127]);
+    }
+
+    char track[4];
+    snprintf(track, sizeof(track), "%u", trailer[126]);
+
+    return add_id3v1_field(tag_data, FRAME_ID_TIT2, trailer + 3, 30) &&
+           add_id3v1_field(tag_data, FRAME_ID_TPE1, trailer + 33, 30) &&
+           add_id3v1_field(tag_data, FRAME_ID_TALB, trailer + 63, 30) &&
+           add_id3v1_field(tag_data, FRAME_ID_TYER, trailer + 93, 4) &&
+           add_id3v1_field(tag_data, FRAME_ID_COMM, trailer + 97, has_track ? 28 : 30) &&
+           (!has_track || add_id3v1_field(tag_data, FRAME_ID_TRCK, (const uint8_t *)track, strlen(track))) &&
+           add_id3v1_field(tag_data, FRAME_ID_TCON, (const uint8_t *)genre, strlen(genre));
+}
+
+// One pread of the last 128 bytes (plus the fstat that tells where they are)
+bool read_id3v1_tag(int fd, TagData *tag_data) {
+    struct stat st;
+    uint8_t trailer[ID3V1_TAG_SIZE];
+    STATS_ADD(STAT_SYSCALLS, 2);
+    if (fstat(fd, &st) != 0 || st.st_size < ID3V1_TAG_SIZE ||
+        pread(fd, trailer, ID3V1_TAG_SIZE, st.st_size - ID3V1_TAG_SIZE) != ID3V1_TAG_SIZE) {
         return false;
     }
-    
-    uint32_t tag_end_pos = ID3_HEADER_SIZE + header.size;
-    
-    // Loop through all frames
-    while (parse_next_frame(fp, tag_end_pos, tag_data)) {
-        // Continue parsing frames
+    STATS_ADD(STAT_BYTES_READ, ID3V1_TAG_SIZE);
+    return decode_id3v1(trailer, tag_data);
+}
+
+// Reads the tag of an open file. Only pread and fstat are used, so the file offset is left
+// alone and the caller keeps the fd.
+TagStatus read_tags_from_fd(int fd, TagData *tag_data) {
+    tag_data_reset(tag_data);
+
+    STATS_TIMER_START(header_start);
+    TagStatus status = load_tag_buffer(fd, tag_data);
+    // Without an ID3v2 tag, fall back to an ID3v1 trailer (an ID3v2 tag always wins)
+    if (status == TAG_ERR_NO_TAG && read_id3v1_tag(fd, tag_data)) {
+        status = TAG_OK;
     }
+    STATS_TIMER_STOP(PHASE_HEADER, header_start);
 
-    fclose(fp);
-    return true;
-}
\ No newline at end of file
+    if (status == TAG_OK) {
+        parse_tag_frames(tag_data);
+    }
+    return tag_data->overflow ? overflow_status(tag_data) : status;
+}
+
+// Same as read_tags_from_fd for a file already in memory (at least its start, plus its last
+// 128 bytes for the ID3v1 fallback). The tag is copied into the arena: `data` may go away.
+TagStatus read_tags_from_memory(const uint8_t *data, size_t size, TagData *tag_data) {
+    tag_data_reset(tag_data);
+
+    if (size >= ID3_HEADER_SIZE && decode_id3_header(data, &tag_data->header)) {
+        size_t tag_total = ID3_HEADER_SIZE + (size_t)tag_data->header.size;
+        size_t got = tag_total < size ? tag_total : size;
+        uint8_t *buffer = tag_arena_reserve(tag_data, got);
+        if (!buffer) {
+            return overflow_status(tag_data);
+        }
+        memcpy(buffer, data, got);
+        finish_tag_buffer(tag_data, got);
+    } else if (size < ID3V1_TAG_SIZE || !decode_id3v1(data + size - ID3V1_TAG_SIZE, tag_data)) {
+        return tag_data->overflow ? overflow_status(tag_data) : TAG_ERR_NO_TAG;
+    }
+
+    parse_tag_frames(tag_data);
+    return tag_data->overflow ? overflow_status(tag_data) : TAG_OK;
+}
+
+// Main function to read tags. tag_data must have been set up with tag_data_init; its
+// buffers are reused, so reading many files through one TagData allocates almost nothing.
+bool read_tags_from_file(const char *filepath, TagData *tag_data) {
+    tag_data_reset(tag_data);
+
+    STATS_TIMER_START(open_start);
+    int fd = open(filepath, O_RDONLY);
+    STATS_ADD(STAT_SYSCALLS, 1);
+    STATS_TIMER_STOP(PHASE_OPEN, open_start);
+    if (fd < 0) {
+        return false;
+    }
+
+    TagStatus status = read_tags_from_fd(fd, tag_data);
+    close(fd);
+    STATS_ADD(STAT_SYSCALLS, 1);
+    return status == TAG_OK;
+}
@@ -3,12 +3,28 @@
 
 #include <stdio.h>
 #include "types.h"
+#include "tag.h"
 
 // --- Public Read Function ---
 bool read_tags_from_file(const char *filepath, TagData *tag_data);
+TagStatus read_tags_from_fd(int fd, TagData *tag_data);
+TagStatus read_tags_from_memory(const uint8_t *data, size_t size, TagData *tag_data);
 
 // --- Internal Helper Functions ---
+bool decode_id3_header(const uint8_t *buffer, ID3Header *header);
 bool read_id3_header(FILE *fp, ID3Header *header);
-bool parse_next_frame(FILE *fp, uint32_t tag_end_pos, TagData *tag_data);
+bool read_tag_buffer(int fd, TagData *tag_data);
+void finish_tag_buffer(TagData *tag_data, size_t got);
+void parse_tag_frames(TagData *tag_data);
+
+// --- ID3v1 Trailer (used when a file has no ID3v2 tag) ---
+bool read_id3v1_tag(int fd, TagData *tag_data);
+bool decode_id3v1(const uint8_t *trailer, TagData *tag_data);
+const char *id3v1_genre_name(unsigned number);
+bool decode_frame_header(const uint8_t *frame, uint32_t remaining, uint8_t version,
+                         ID3FrameHeader *frame_header);
+uint32_t frame_flag_additions(uint16_t flags, uint8_t version);
+uint32_t first_frame_offset(const ID3Header *header, const uint8_t *body);
+bool parse_next_frame(TagData *tag_data, uint32_t *offset);
 
 #endif // READ_H
\ No newline at end of file
@@ -0,0 +1,937 @@
+#define _GNU_SOURCE // strcasecmp
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+#include "retag.h"
+#include "read.h"
+#include "edit.h"
+#include "tag.h"
+#include "pool.h"
+#include "scan.h"
+#include "query.h"
+
+typedef enum { RULE_SET, RULE_TRIM, RULE_GENRE, RULE_TITLE, RULE_UPPER, RULE_LOWER } RuleKind;
+
+typedef struct {
+    char frame[5];
+    RuleKind kind;
+    char *template;           // RULE_SET
+} RetagRule;
+
+// One file to edit: "path\0FRAME\0value\0FRAME\0value\0..."
+typedef struct {
+    char *data;
+    int edit_count;
+    bool in_place;
+    dev_t device;
+    ino_t inode;
+    uint64_t position;        // Physical offset of the first block (else the inode number)
+    uint64_t bytes;
+    unsigned line_number;     // CSV line (0 for rules): last sort key, so planning order never shows
+} RetagItem;
+
+typedef struct {
+    dev_t device;
+    bool rotational;
+    int jobs;
+    size_t first;             // Its items, in on-disk order
+    size_t count;
+    atomic_size_t next;
+    uint64_t in_place;
+    uint64_t bytes;
+    atomic_uint_fast64_t failures;
+} RetagDevice;
+
+typedef struct {
+    const RetagOptions *options;
+    RetagRule rules[RETAG_MAX_RULES];
+    int rule_count;
+    char columns[MAX_EDIT_FRAMES][5]; // CSV mode: frame of each column after the path
+    int column_count;
+
+    pthread_mutex_t lock;
+    RetagItem *items;
+    size_t item_count;
+    size_t item_capacity;
+    RetagCounts counts;
+} Retag;
+
+// A CSV row waiting to be planned
+typedef struct {
+    Retag *retag;
+    char *line;
+    char *fields[1 + MAX_EDIT_FRAMES];
+    unsigned line_number;
+    dev_t device;             // The file the row names (inode 0: could not stat it)
+    ino_t inode;
+} RetagRow;
+
+// --- Rules ---
+
+static void frame_name(uint32_t frame_id, char name[5]) {
+    for (int i = 0; i < 4; i++) {
+        name[i] = (char)(frame_id >> (24 - 8 * i));
+    }
+    name[4] = '\0';
+}
+
+// A frame that edits can set (T***, not TXXX), by ID or by name
+static bool parse_target(const char *text, char frame[5]) {
+    uint32_t frame_id;
+    EditSet probe;
+    edit_set_init(&probe);
+    if (!query_parse_frame(text, &frame_id)) {
+        return false;
+    }
+    frame_name(frame_id, frame);
+    return edit_set_add(&probe, frame, "");
+}
+
+static char *trim(char *text) {
+    while (isspace((unsigned char)*text)) {
+        text++;
+    }
+    size_t length = strlen(text);
+    while (length > 0 && isspace((unsigned char)text[length - 1])) {
+        text[--length] = '\0';
+    }
+    return text;
+}
+
+// Every {name} must be dir, dir2, file or a frame
+static bool check_template(const char *template) {
+    for (const char *open = strchr(template, '{'); open; open = strchr(open + 1, '{')) {
+        const char *close = strchr(open, '}');
+        char name[16];
+        uint32_t frame_id;
+        if (!close || close - open - 1 <= 0 || (size_t)(close - open - 1) >= sizeof(name)) {
+            return false;
+        }
+        memcpy(name, open + 1, close - open - 1);
+        name[close - open - 1] = '\0';
+        if (strcmp(name, "dir") != 0 && strcmp(name, "dir2") != 0 && strcmp(name, "file") != 0 &&
+            !query_parse_frame(name, &frame_id)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool load_rules(Retag *retag, const char *rules_path) {
+    static const struct { const char *name; RuleKind kind; } transforms[] = {
+        { "trim", RULE_TRIM }, { "genre", RULE_GENRE }, { "title", RULE_TITLE },
+        { "upper", RULE_UPPER }, { "lower", RULE_LOWER },
+    };
+    FILE *fp = fopen(rules_path, "r");
+    if (!fp) {
+        fprintf(stderr, "Error: Could not open %s.\n", rules_path);
+        return false;
+    }
+
+    char *line = NULL;
+    size_t line_capacity = 0;
+    unsigned line_number = 0;
+    bool ok = true;
+    EditSet targets; // Only checks that the rules touch at most MAX_EDIT_FRAMES frames
+    edit_set_init(&targets);
+    while (ok && getline(&line, &line_capacity, fp) != -1) {
+        line_number++;
+        line[strcspn(line, "#\r\n")] = '\0';
+        char *text = trim(line);
+        if (*text == '\0') {
+            continue;
+        }
+
+        char *op = text + strcspn(text, "=:");
+        RetagRule *rule = &retag->rules[retag->rule_count];
+        memset(rule, 0, sizeof(RetagRule));
+        char separator = *op;
+        if (separator != '\0') {
+            *op = '\0';
+        }
+        const char *argument = separator ? trim(op + 1) : "";
+        if (separator == '\0' || !parse_target(trim(text), rule->frame) ||
+            retag->rule_count == RETAG_MAX_RULES || !edit_set_add(&targets, rule->frame, "")) {
+            ok = false;
+        } else if (separator == '=') {
+            rule->kind = RULE_SET;
+            rule->template = strdup(argument);
+            ok = rule->template && check_template(argument);
+        } else {
+            ok = false;
+            for (size_t i = 0; i < sizeof(transforms) / sizeof(transforms[0]); i++) {
+                if (strcmp(argument, transforms[i].name) == 0) {
+                    rule->kind = transforms[i].kind;
+                    ok = true;
+                }
+            }
+        }
+        if (ok) {
+            retag->rule_count++;
+        } else {
+            free(rule->template);
+            fprintf(stderr, "%s:%u: expected FRAME = template or FRAME : trim|genre|title|upper|lower\n",
+                    rules_path, line_number);
+        }
+    }
+    free(line);
+    fclose(fp);
+    return ok;
+}
+
+// --- Values ---
+typedef struct {
+    char *text;
+    size_t length;
+    size_t capacity;
+    bool failed;
+} TextBuffer;
+
+static void text_append(TextBuffer *buffer, const char *text, size_t length) {
+    if (buffer->failed) {
+        return;
+    }
+    if (buffer->length + length + 1 > buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity : 64;
+        while (capacity < buffer->length + length + 1) {
+            capacity *= 2;
+        }
+        char *grown = realloc(buffer->text, capacity);
+        if (!grown) {
+            buffer->failed = true;
+            return;
+        }
+        buffer->text = grown;
+        buffer->capacity = capacity;
+    }
+    memcpy(buffer->text + buffer->length, text, length);
+    buffer->length += length;
+    buffer->text[buffer->length] = '\0';
+}
+
+// The values of one file as the rules go: what the tag holds, then what the rules made of it
+typedef struct {
+    char frame[5];
+    char *original;
+    char *value;
+} WorkValue;
+
+typedef struct {
+    const char *path;
+    const TagData *tags;      // NULL when the file has no readable tag
+    WorkValue values[MAX_EDIT_FRAMES];
+    int count;
+    char *text;               // OUTPUT_TEXT_MAX bytes for tag_get_text
+} WorkFile;
+
+// The current value of a frame (as changed by earlier rules); NULL if out of memory
+static WorkValue *work_value(WorkFile *work, const char *frame) {
+    for (int i = 0; i < work->count; i++) {
+        if (strcmp(work->values[i].frame, frame) == 0) {
+            return &work->values[i];
+        }
+    }
+    if (work->count == MAX_EDIT_FRAMES) {
+        return NULL;
+    }
+    WorkValue *value = &work->values[work->count];
+    memcpy(value->frame, frame, 5);
+    work->text[0] = '\0';
+    if (work->tags) {
+        tag_get_text(work->tags, frame, work->text, OUTPUT_TEXT_MAX);
+    }
+    value->original = strdup(work->text);
+    value->value = strdup(work->text);
+    if (!value->original || !value->value) {
+        free(value->original);
+        free(value->value);
+        return NULL;
+    }
+    work->count++;
+    return value;
+}
+
+// Name of the directory `up` levels above the file ("" past the root)
+static void append_directory(TextBuffer *buffer, const char *path, int up) {
+    const char *end = strrchr(path, '/');
+    for (int i = 1; end && i < up; i++) {
+        const char *parent = end;
+        while (parent > path && parent[-1] != '/') {
+            parent--;
+        }
+        end = parent > path ? parent - 1 : NULL;
+    }
+    if (!end) {
+        return;
+    }
+    const char *start = end;
+    while (start > path && start[-1] != '/') {
+        start--;
+    }
+    text_append(buffer, start, (size_t)(end - start));
+}
+
+static char *expand_template(WorkFile *work, const char *template) {
+    TextBuffer buffer = { NULL, 0, 0, false };
+    text_append(&buffer, "", 0);
+    const char *p = template;
+    for (const char *open = strchr(p, '{'); open; open = strchr(p, '{')) {
+        const char *close = strchr(open, '}');
+        char name[16];
+        text_append(&buffer, p, (size_t)(open - p));
+        memcpy(name, open + 1, close - open - 1);
+        name[close - open - 1] = '\0';
+        p = close + 1;
+
+        if (strcmp(name, "dir") == 0 || strcmp(name, "dir2") == 0) {
+            append_directory(&buffer, work->path, name[3] == '2' ? 2 : 1);
+        } else if (strcmp(name, "file") == 0) {
+            const char *file = strrchr(work->path, '/');
+            file = file ? file + 1 : work->path;
+            const char *dot = strrchr(file, '.');
+            text_append(&buffer, file, dot && dot != file ? (size_t)(dot - file) : strlen(file));
+        } else {
+            uint32_t frame_id;
+            char frame[5];
+            query_parse_frame(name, &frame_id);
+            frame_name(frame_id, frame);
+            WorkValue *value = work_value(work, frame);
+            if (!value) {
+                buffer.failed = true;
+            } else {
+                text_append(&buffer, value->value, strlen(value->value));
+            }
+        }
+    }
+    text_append(&buffer, p, strlen(p));
+    if (buffer.failed) {
+        free(buffer.text);
+        return NULL;
+    }
+    return buffer.text;
+}
+
+// ID3v1 genre references ("(17)", "17", "(17)Rock") become the genre's name
+static void normalize_genre(char *text) {
+    unsigned number = 0;
+    char *p = text + (text[0] == '(');
+    char *digits = p;
+    while (isdigit((unsigned char)*p) && p - digits < 4) {
+        number = number * 10 + (unsigned)(*p++ - '0');
+    }
+    if (p == digits) {
+        return;
+    }
+    const char *rest = NULL;
+    if (text[0] == '(' && *p == ')') {
+        rest = p[1] ? p + 1 : id3v1_genre_name(number);
+    } else if (text[0] != '(' && *p == '\0') {
+        rest = id3v1_genre_name(number);
+    }
+    if (rest) {
+        memmove(text, rest, strlen(rest) + 1);
+    }
+}
+
+// Applies a transform to the value in place (it never gets longer)
+static void apply_transform(RuleKind kind, char *text) {
+    if (kind == RULE_TRIM || kind == RULE_GENRE) {
+        // Leading and trailing whitespace goes, inner runs become one space
+        size_t out = 0;
+        bool space = false;
+        for (size_t i = 0; text[i]; i++) {
+            if (isspace((unsigned char)text[i])) {
+                space = out > 0;
+            } else {
+                if (space) {
+                    text[out++] = ' ';
+                }
+                text[out++] = text[i];
+                space = false;
+            }
+        }
+        text[out] = '\0';
+    }
+    if (kind == RULE_GENRE) {
+        normalize_genre(text);
+    }
+    for (size_t i = 0; text[i] && kind >= RULE_TITLE; i++) {
+        unsigned char c = (unsigned char)text[i];
+        if (kind == RULE_UPPER || (kind == RULE_TITLE && (i == 0 || strchr(" -(/", text[i - 1])))) {
+            text[i] = (char)toupper(c);
+        } else if (kind == RULE_LOWER) {
+            text[i] = (char)tolower(c);
+        }
+    }
+}
+
+static bool run_rules(const Retag *retag, WorkFile *work) {
+    for (int r = 0; r < retag->rule_count; r++) {
+        const RetagRule *rule = &retag->rules[r];
+        WorkValue *value = work_value(work, rule->frame);
+        if (!value) {
+            return false;
+        }
+        if (rule->kind != RULE_SET) {
+            apply_transform(rule->kind, value->value);
+            continue;
+        }
+        char *expanded = expand_template(work, rule->template);
+        if (!expanded) {
+            return false;
+        }
+        if (expanded[0] == '\0') {
+            free(expanded); // Nothing to set it to: keep the frame as it is
+        } else {
+            free(value->value);
+            value->value = expanded;
+        }
+    }
+    return true;
+}
+
+// --- Planning ---
+
+// Where the file starts on the disk, so a rotational disk can be walked in order. Without
+// FIEMAP the inode number stands in: filesystems tend to allocate both in creation order.
+static uint64_t disk_position(int fd, ino_t inode) {
+    struct {
+        struct fiemap map;
+        struct fiemap_extent extent;
+    } request;
+    memset(&request, 0, sizeof(request));
+    request.map.fm_length = FIEMAP_MAX_OFFSET;
+    request.map.fm_extent_count = 1;
+    if (ioctl(fd, FS_IOC_FIEMAP, &request.map) == 0 && request.map.fm_mapped_extents == 1) {
+        return request.extent.fe_physical;
+    }
+    return (uint64_t)inode;
+}
+
+static char *pack_item(const char *path, const EditSet *set) {
+    size_t size = strlen(path) + 1;
+    for (int i = 0; i < set->count; i++) {
+        size += 5 + strlen(set->edits[i].value) + 1;
+    }
+    char *data = malloc(size);
+    if (!data) {
+        return NULL;
+    }
+    char *p = stpcpy(data, path) + 1;
+    for (int i = 0; i < set->count; i++) {
+        p = stpcpy(p, set->edits[i].frame_id) + 1;
+        p = stpcpy(p, set->edits[i].value) + 1;
+    }
+    return data;
+}
+
+static const char *unpack_item(const RetagItem *item, EditSet *set) {
+    edit_set_init(set);
+    const char *p = item->data + strlen(item->data) + 1;
+    for (int i = 0; i < item->edit_count; i++) {
+        const char *value = p + strlen(p) + 1;
+        edit_set_add(set, p, value);
+        p = value + strlen(value) + 1;
+    }
+    return item->data;
+}
+
+// Works out the new values of one file and how it would be edited (`row`: its CSV cells)
+static void plan_file(Retag *retag, const char *path, char *const *row, unsigned line_number) {
+    TagData tags;
+    tag_data_init(&tags);
+    WorkFile work;
+    memset(&work, 0, sizeof(work));
+    work.path = path;
+    work.tags = read_tags_from_file(path, &tags) ? &tags : NULL;
+    work.text = malloc(OUTPUT_TEXT_MAX);
+    bool ok = work.text != NULL;
+
+    if (ok && row) {
+        for (int c = 0; ok && c < retag->column_count; c++) {
+            WorkValue *value = row[c][0] ? work_value(&work, retag->columns[c]) : NULL;
+            if (value) {
+                free(value->value);
+                value->value = strdup(row[c]);
+                ok = value->value != NULL;
+            } else if (row[c][0]) {
+                ok = false;
+            }
+        }
+    } else if (ok) {
+        ok = run_rules(retag, &work);
+    }
+
+    EditSet set;
+    edit_set_init(&set);
+    for (int i = 0; ok && i < work.count; i++) {
+        if (work.values[i].value && strcmp(work.values[i].value, work.values[i].original) != 0) {
+            edit_set_add(&set, work.values[i].frame, work.values[i].value);
+        }
+    }
+
+    RetagItem item;
+    memset(&item, 0, sizeof(item));
+    item.line_number = line_number;
+    EditPlan plan;
+    bool planned = false;
+    if (ok && set.count > 0) {
+        planned = edit_plan(path, &set, &plan);
+        if (!planned) {
+            edit_report_error(path, plan.status, plan.sys_errno);
+            ok = false;
+        }
+    }
+    if (planned) {
+        struct stat st;
+        item.in_place = plan.in_place;
+        item.bytes = edit_plan_write_size(&plan);
+        if (fstat(plan.fd, &st) == 0) {
+            item.device = st.st_dev;
+            item.inode = st.st_ino;
+            item.position = disk_position(plan.fd, st.st_ino);
+        }
+        item.edit_count = set.count;
+        item.data = pack_item(path, &set);
+        ok = item.data != NULL;
+        edit_plan_free(&plan);
+    }
+
+    pthread_mutex_lock(&retag->lock);
+    retag->counts.files++;
+    if (ok && planned && retag->item_count == retag->item_capacity) {
+        size_t capacity = retag->item_capacity ? retag->item_capacity * 2 : 1024;
+        RetagItem *grown = realloc(retag->items, capacity * sizeof(RetagItem));
+        if (grown) {
+            retag->items = grown;
+            retag->item_capacity = capacity;
+        } else {
+            ok = false;
+        }
+    }
+    if (!ok) {
+        retag->counts.failures++;
+        free(item.data);
+    } else if (!planned) {
+        retag->counts.unchanged++;
+    } else {
+        retag->items[retag->item_count++] = item;
+    }
+    pthread_mutex_unlock(&retag->lock);
+
+    for (int i = 0; i < work.count; i++) {
+        free(work.values[i].original);
+        free(work.values[i].value);
+    }
+    free(work.text);
+    tag_data_free(&tags);
+}
+
+static void plan_library_file(const char *path, void *user) {
+    plan_file(user, path, NULL, 0);
+}
+
+static void plan_row(void *arg) {
+    RetagRow *row = arg;
+    plan_file(row->retag, row->fields[0], row->fields + 1, row->line_number);
+}
+
+static void identify_row(void *arg) {
+    RetagRow *row = arg;
+    struct stat st;
+    if (stat(row->fields[0], &st) == 0) {
+        row->device = st.st_dev;
+        row->inode = st.st_ino;
+    }
+}
+
+static int compare_rows(const void *a, const void *b) {
+    const RetagRow *x = *(const RetagRow *const *)a;
+    const RetagRow *y = *(const RetagRow *const *)b;
+    if (x->device != y->device) {
+        return x->device < y->device ? -1 : 1;
+    }
+    if (x->inode != y->inode) {
+        return x->inode < y->inode ? -1 : 1;
+    }
+    return (x->line_number > y->line_number) - (x->line_number < y->line_number);
+}
+
+// Which of several rows for one file (same path, another spelling of it, or a hard link)
+// should win is anyone's guess, so none of them is planned; false when out of memory
+static bool refuse_duplicate_rows(Retag *retag, const char *csv_path, RetagRow *rows, size_t row_count,
+                                  bool *duplicate) {
+    RetagRow **by_file = malloc((row_count ? row_count : 1) * sizeof(RetagRow *));
+    if (!by_file) {
+        return false;
+    }
+    for (size_t i = 0; i < row_count; i++) {
+        by_file[i] = &rows[i];
+    }
+    qsort(by_file, row_count, sizeof(RetagRow *), compare_rows);
+    for (size_t first = 0, end; first < row_count; first = end) {
+        const RetagRow *row = by_file[first];
+        for (end = first + 1; end < row_count && row->inode != 0 && by_file[end]->device == row->device &&
+                              by_file[end]->inode == row->inode; end++) {
+        }
+        if (end - first == 1) {
+            continue;
+        }
+        fprintf(stderr, "Error: %s: listed on lines", row->fields[0]);
+        for (size_t i = first; i < end; i++) {
+            duplicate[by_file[i] - rows] = true;
+            fprintf(stderr, "%s %u", i == first ? "" : ",", by_file[i]->line_number);
+        }
+        fprintf(stderr, " of %s; none of them applied.\n", csv_path);
+        retag->counts.files += end - first;
+        retag->counts.failures += end - first;
+    }
+    free(by_file);
+    return true;
+}
+
+// Splits one CSV record in place (RFC 4180 quoting; no line breaks inside a field)
+static int split_csv(char *line, char **fields, int max_fields) {
+    int count = 0;
+    char *p = line;
+    while (count < max_fields) {
+        char *out = p;
+        fields[count++] = out;
+        if (*p == '"') {
+            for (p++; *p && !(*p == '"' && p[1] != '"'); p++) {
+                *out++ = *p;
+                p += *p == '"'; // "" is one quote
+            }
+            p += *p == '"';
+        }
+        while (*p && *p != ',') {
+            *out++ = *p++;
+        }
+        bool more = *p == ',';
+        *out = '\0';
+        if (!more) {
+            break;
+        }
+        p++;
+    }
+    return count;
+}
+
+// Reads the whole CSV, then plans its rows on the pool
+static bool plan_csv(Retag *retag, const char *csv_path, int num_threads) {
+    FILE *fp = fopen(csv_path, "r");
+    if (!fp) {
+        fprintf(stderr, "Error: Could not open %s.\n", csv_path);
+        return false;
+    }
+    char *line = NULL;
+    size_t line_capacity = 0;
+    RetagRow *rows = NULL;
+    size_t row_count = 0, row_capacity = 0;
+    unsigned line_number = 0;
+    bool ok = true;
+
+    while (ok && getline(&line, &line_capacity, fp) != -1) {
+        line_number++;
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0') {
+            continue;
+        }
+        char *fields[1 + MAX_EDIT_FRAMES];
+        if (retag->column_count == 0) {
+            int count = split_csv(line, fields, 1 + MAX_EDIT_FRAMES);
+            ok = count > 1 && strcasecmp(fields[0], "path") == 0;
+            for (int c = 1; ok && c < count; c++) {
+                ok = parse_target(trim(fields[c]), retag->columns[c - 1]);
+            }
+            if (!ok) {
+                fprintf(stderr, "%s:%u: expected a header row path,FRAME,... with text frames (T***)\n",
+                        csv_path, line_number);
+            }
+            retag->column_count = count - 1;
+            continue;
+        }
+
+        if (row_count == row_capacity) {
+            row_capacity = row_capacity ? row_capacity * 2 : 1024;
+            RetagRow *grown = realloc(rows, row_capacity * sizeof(RetagRow));
+            if (!grown) {
+                ok = false;
+                break;
+            }
+            rows = grown;
+        }
+        RetagRow *row = &rows[row_count];
+        memset(row, 0, sizeof(*row));
+        row->retag = retag;
+        row->line_number = line_number;
+        row->line = strdup(line);
+        if (!row->line) {
+            ok = false;
+            break;
+        }
+        int count = split_csv(row->line, row->fields, 1 + retag->column_count);
+        for (int c = count; c <= retag->column_count; c++) {
+            row->fields[c] = row->line + strlen(row->line); // Missing cells keep the value
+        }
+        row_count++;
+    }
+    free(line);
+    fclose(fp);
+
+    // Every row's file is identified before any is planned, so duplicates never reach the plan
+    ThreadPool *pool = ok ? pool_create(num_threads) : NULL;
+    ok = ok && pool;
+    for (size_t i = 0; ok && i < row_count; i++) {
+        if (!pool_submit(pool, identify_row, &rows[i])) {
+            identify_row(&rows[i]); // Could not be queued: do it here
+        }
+    }
+    if (pool) {
+        pool_destroy(pool);
+    }
+    bool *duplicate = ok ? calloc(row_count ? row_count : 1, sizeof(bool)) : NULL;
+    ok = ok && duplicate && refuse_duplicate_rows(retag, csv_path, rows, row_count, duplicate);
+    pool = ok ? pool_create(num_threads) : NULL;
+    ok = ok && pool;
+    for (size_t i = 0; ok && i < row_count; i++) {
+        if (!duplicate[i] && !pool_submit(pool, plan_row, &rows[i])) {
+            plan_row(&rows[i]);
+        }
+    }
+    if (pool) {
+        pool_destroy(pool);
+    }
+    free(duplicate);
+    for (size_t i = 0; i < row_count; i++) {
+        free(rows[i].line);
+    }
+    free(rows);
+    return ok;
+}
+
+// --- Execution ---
+
+// 1 in /sys/dev/block/MAJ:MIN/queue/rotational; a partition has its disk's queue one level up
+static bool device_rotational(dev_t device) {
+    char path[96];
+    snprintf(path, sizeof(path), "/sys/dev/block/%u:%u/queue/rotational", major(device), minor(device));
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        snprintf(path, sizeof(path), "/sys/dev/block/%u:%u/../queue/rotational", major(device), minor(device));
+        fp = fopen(path, "r");
+    }
+    int c = fp ? fgetc(fp) : '0';
+    if (fp) {
+        fclose(fp);
+    }
+    return c == '1';
+}
+
+static int compare_items(const void *a, const void *b) {
+    const RetagItem *x = a;
+    const RetagItem *y = b;
+    if (x->device != y->device) {
+        return x->device < y->device ? -1 : 1;
+    }
+    if (x->position != y->position) {
+        return x->position < y->position ? -1 : 1;
+    }
+    if (x->inode != y->inode) {
+        return x->inode < y->inode ? -1 : 1;
+    }
+    int cmp = strcmp(x->data, y->data);
+    return cmp != 0 ? cmp : (x->line_number > y->line_number) - (x->line_number < y->line_number);
+}
+
+typedef struct {
+    Retag *retag;
+    RetagDevice *device;
+} DeviceWorker;
+
+// Each worker of a device takes that device's next file until none are left
+static void drain_device(void *arg) {
+    DeviceWorker *worker = arg;
+    RetagDevice *device = worker->device;
+    for (;;) {
+        size_t next = atomic_fetch_add(&device->next, 1);
+        if (next >= device->count) {
+            break;
+        }
+        EditSet set;
+        const char *path = unpack_item(&worker->retag->items[device->first + next], &set);
+        if (!apply_edit_set(path, &set)) {
+            atomic_fetch_add(&device->failures, 1);
+        }
+    }
+}
+
+static void print_plan(FILE *out, const RetagItem *item) {
+    EditSet set;
+    const char *path = unpack_item(item, &set);
+    fprintf(out, "%s\t%llu\t%s", item->in_place ? "in-place" : "rewrite", (unsigned long long)item->bytes, path);
+    for (int i = 0; i < set.count; i++) {
+        fprintf(out, "\t%s=%s", set.edits[i].frame_id, set.edits[i].value);
+    }
+    fputc('\n', out);
+}
+
+static bool execute(Retag *retag, RetagDevice *devices, size_t device_count) {
+    int workers = 0;
+    for (size_t d = 0; d < device_count; d++) {
+        workers += devices[d].jobs < (int)devices[d].count ? devices[d].jobs : (int)devices[d].count;
+    }
+    if (workers > RETAG_MAX_WORKERS) {
+        workers = RETAG_MAX_WORKERS;
+    }
+
+    DeviceWorker *device_workers = calloc(device_count, sizeof(DeviceWorker));
+    ThreadPool *pool = device_workers ? pool_create(workers) : NULL;
+    if (!pool) {
+        free(device_workers);
+        return false;
+    }
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    // Rotational devices first: their single worker should not wait behind the others
+    for (int pass = 0; pass < 2; pass++) {
+        for (size_t d = 0; d < device_count; d++) {
+            if (devices[d].rotational != (pass == 0)) {
+                continue;
+            }
+            device_workers[d] = (DeviceWorker){ retag, &devices[d] };
+            for (int j = 0; j < devices[d].jobs && (size_t)j < devices[d].count; j++) {
+                pool_submit(pool, drain_device, &device_workers[d]);
+            }
+        }
+    }
+    pool_destroy(pool);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    retag->counts.seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    free(device_workers);
+    return true;
+}
+
+bool retag_run(const RetagOptions *options, RetagCounts *counts) {
+    Retag *retag = calloc(1, sizeof(Retag));
+    memset(counts, 0, sizeof(RetagCounts));
+    if (!retag) {
+        return false;
+    }
+    retag->options = options;
+    pthread_mutex_init(&retag->lock, NULL);
+
+    // 1. Plan every file
+    bool ok;
+    if (options->csv_path) {
+        ok = plan_csv(retag, options->csv_path, options->num_threads);
+    } else {
+        ok = load_rules(retag, options->rules_path) &&
+             scan_for_each_file(options->root, options->num_threads, plan_library_file, retag);
+    }
+
+    // 2. Group the files by device, each in on-disk order
+    RetagDevice *devices = NULL;
+    size_t device_count = 0;
+    int ssd_jobs = options->ssd_jobs > 0 ? options->ssd_jobs : pool_default_workers();
+    int hdd_jobs = options->hdd_jobs > 0 ? options->hdd_jobs : 1;
+    if (ok && retag->item_count > 0) {
+        qsort(retag->items, retag->item_count, sizeof(RetagItem), compare_items);
+        // Hard links in a library would have one file edited by two workers at once, and neither
+        // name is more right than the other: all of them are refused (CSV rows never get here)
+        size_t kept = 0;
+        for (size_t first = 0, end; first < retag->item_count; first = end) {
+            const RetagItem *item = &retag->items[first];
+            for (end = first + 1; end < retag->item_count && item->inode != 0 && // 0: fstat failed
+                                  retag->items[end].device == item->device &&
+                                  retag->items[end].inode == item->inode; end++) {
+            }
+            if (end - first == 1) {
+                retag->items[kept++] = *item;
+                continue;
+            }
+            for (size_t i = first; i < end; i++) {
+                fprintf(stderr, "Error: %s: the same file as %s; none of them applied.\n",
+                        retag->items[i].data, retag->items[i == first ? first + 1 : first].data);
+            }
+            for (size_t i = first; i < end; i++) {
+                free(retag->items[i].data);
+            }
+            retag->counts.failures += end - first;
+        }
+        retag->item_count = kept;
+        devices = calloc(retag->item_count, sizeof(RetagDevice)); // At most one per item
+        ok = devices != NULL;
+    }
+    for (size_t i = 0; ok && i < retag->item_count; i++) {
+        const RetagItem *item = &retag->items[i];
+        if (i == 0 || item->device != devices[device_count - 1].device) {
+            RetagDevice *device = &devices[device_count++];
+            device->device = item->device;
+            device->rotational = device_rotational(item->device);
+            device->jobs = device->rotational ? hdd_jobs : ssd_jobs;
+            device->first = i;
+            counts->rotational += device->rotational;
+        }
+        RetagDevice *device = &devices[device_count - 1];
+        device->count++;
+        device->in_place += item->in_place;
+        device->bytes += item->bytes;
+        counts->in_place += item->in_place;
+        counts->rewritten += !item->in_place;
+        counts->bytes += item->bytes;
+        if (options->dry_run) {
+            print_plan(options->out, item);
+        }
+    }
+    counts->devices = device_count;
+
+    // 3. Edit (unless this is a dry run)
+    if (ok && !options->dry_run && device_count > 0) {
+        ok = execute(retag, devices, device_count);
+    }
+    for (size_t d = 0; d < device_count; d++) {
+        const RetagDevice *device = &devices[d];
+        uint64_t failures = atomic_load(&device->failures);
+        fprintf(stderr, "Device %u:%u (%s, %d job%s): %zu files, %llu in place, %llu rewritten, %.1f MB%s",
+                major(device->device), minor(device->device), device->rotational ? "rotational" : "non-rotational",
+                device->jobs, device->jobs == 1 ? "" : "s", device->count, (unsigned long long)device->in_place,
+                (unsigned long long)(device->count - device->in_place), device->bytes / (1024.0 * 1024.0),
+                options->dry_run ? " projected.\n" : ".\n");
+        if (failures > 0) {
+            fprintf(stderr, "  %llu edits failed.\n", (unsigned long long)failures);
+        }
+        retag->counts.failures += failures;
+    }
+
+    retag->counts.in_place = counts->in_place;
+    retag->counts.rewritten = counts->rewritten;
+    retag->counts.bytes = counts->bytes;
+    retag->counts.devices = counts->devices;
+    retag->counts.rotational = counts->rotational;
+    *counts = retag->counts;
+
+    free(devices);
+    for (size_t i = 0; i < retag->item_count; i++) {
+        free(retag->items[i].data);
+    }
+    free(retag->items);
+    for (int r = 0; r < retag->rule_count; r++) {
+        free(retag->rules[r].template);
+    }
+    pthread_mutex_destroy(&retag->lock);
+    free(retag);
+    return ok;
+}
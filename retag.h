@@ -0,0 +1,54 @@
+#ifndef RETAG_H
+#define RETAG_H
+
+#include <stdio.h>
+#include "types.h"
+
+// --- Bulk Retag (retag) ---
+// New frame values come from a rules file applied to every file of a library, or from a CSV
+// of path,FRAME,... rows. Every file is planned first, on the thread pool: its tag is read,
+// the new values are worked out, frames that would not change are dropped, and edit_plan
+// says whether the rest fits in place and how many bytes it writes. Only then are the files
+// edited, through apply_edit_set, grouped by block device: a rotational disk gets
+// hdd_jobs workers (1 by default) taking its files in on-disk order, anything else gets
+// ssd_jobs workers. /sys/dev/block/MAJ:MIN/queue/rotational tells them apart; devices
+// without one (tmpfs, network filesystems) count as non-rotational.
+//
+// Rules, one per line, applied in order (# starts a comment):
+//   FRAME = template     {dir} parent directory name, {dir2} the one above it, {file} file
+//                        name without extension, {FRAME} the frame's current value
+//   FRAME : transform    trim | genre | title | upper | lower, on the current value
+// FRAME is a text frame ID (T***) or a name from the CSV header (artist, album, ...).
+// A rule that yields an empty value leaves the frame alone.
+#define RETAG_MAX_RULES 64
+#define RETAG_MAX_WORKERS 64
+
+typedef struct {
+    const char *root;         // Rules mode: the library
+    const char *rules_path;
+    const char *csv_path;     // CSV mode: header path,FRAME,...; an empty cell keeps the value;
+                              // a file on more than one row is not edited at all
+    bool dry_run;             // Plan only: one line per file to `out`
+    int num_threads;          // Planning; 0 = one per online CPU
+    int ssd_jobs;             // Files edited at once per non-rotational device; 0 = one per CPU
+    int hdd_jobs;             // Per rotational device; 0 = 1
+    FILE *out;
+} RetagOptions;
+
+typedef struct {
+    uint64_t files;           // Files planned
+    uint64_t unchanged;       // Already had the values
+    uint64_t in_place;
+    uint64_t rewritten;
+    uint64_t failures;        // Could not be planned or edited
+    uint64_t bytes;           // Planned bytes of the files edited (projected in a dry run)
+    uint64_t devices;
+    uint64_t rotational;      // Devices among them that are rotational
+    double seconds;           // Editing time
+} RetagCounts;
+
+// Dry run: "in-place|rewrite<TAB>bytes<TAB>path<TAB>FRAME=value..." per file, in the order
+// the edits would run. Per-device totals go to stderr.
+bool retag_run(const RetagOptions *options, RetagCounts *counts);
+
+#endif // RETAG_H
@@ -0,0 +1,873 @@
+#define _GNU_SOURCE // struct statx
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include "scan.h"
+#include "read.h"
+#include "audio.h"
+#include "pool.h"
+#include "tagindex.h"
+#include "uring.h"
+#include "stats.h"
+
+// --- Ordered delivery on the pool: every directory is listed in full and sorted by name, so
+// a file's place is its directory's place plus its index there. Results are delivered by a
+// cursor walking that tree in order; a directory is freed once the cursor leaves it. ---
+typedef struct ScanDir ScanDir;
+
+typedef struct {
+    char *name;               // Freed once the entry's task has been queued
+    bool is_dir;
+    bool done;                // Result or listing arrived, or the entry was given up on
+    ScanResult *result;       // File: NULL if it could not be read at all
+    ScanDir *child;           // Directory: NULL if it could not be listed
+} ScanEntry;
+
+struct ScanDir {
+    ScanDir *parent;
+    size_t index;             // Of this directory among the parent's entries
+    ScanEntry *entries;
+    size_t count;
+};
+
+// --- Shared state of one scan ---
+typedef struct {
+    ThreadPool *pool;
+    const ScanOptions *options;
+    ScanVisitFn visit;               // scan_for_each_file: called instead of reading the tags
+    atomic_uint_fast64_t next_seq;   // Sequence number handed to the next file found
+
+    pthread_mutex_t deliver_lock;    // Serializes the callback
+    ScanResult **heap;               // Ordered uring scans: results waiting for their turn (min-heap on seq)
+    size_t heap_count;
+    size_t heap_capacity;
+    uint64_t next_to_deliver;
+    bool order_lost;
+
+    ScanDir top;                     // Ordered pool scans: holds the root as its only entry
+    ScanEntry top_entry;
+    ScanDir *cursor_dir;             // Next entry to deliver
+    size_t cursor_index;
+} ScanState;
+
+typedef struct {
+    ScanState *state;
+    char *path;
+    uint64_t seq;
+    ScanDir *dir;             // Ordered pool scans: the entry this task fills in
+    size_t index;
+} ScanTask;
+
+static bool is_mp3_name(const char *name) {
+    size_t len = strlen(name);
+    return len > 4 && strcasecmp(name + len - 4, ".mp3") == 0;
+}
+
+// DT_DIR, DT_REG or anything else; symlinks are reported as such, never followed
+static unsigned char entry_type(const char *dir, const struct dirent *entry) {
+    unsigned char type = entry->d_type;
+    if (type == DT_UNKNOWN) { // Some filesystems (e.g. NFS, XFS) leave d_type empty
+        struct stat st;
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+        if (lstat(path, &st) != 0) {
+            return DT_UNKNOWN;
+        }
+        type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+    }
+    return type;
+}
+
+static int compare_entries(const void *a, const void *b) {
+    return strcmp(((const ScanEntry *)a)->name, ((const ScanEntry *)b)->name);
+}
+
+// The subdirectories and .mp3 files of `path`, sorted by name. An unreadable directory lists
+// as empty, and an allocation failure keeps what was read before it.
+static ScanEntry *list_dir(const char *path, size_t *count) {
+    ScanEntry *entries = NULL;
+    size_t capacity = 0;
+    *count = 0;
+
+    DIR *dir = opendir(path[0] ? path : "/");
+    if (!dir) {
+        return NULL;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        // Symlinks are not followed, so link loops cannot trap the walk
+        unsigned char type = entry_type(path, entry);
+        if (type != DT_DIR && (type != DT_REG || !is_mp3_name(entry->d_name))) {
+            continue;
+        }
+        if (*count == capacity) {
+            size_t new_capacity = capacity ? capacity * 2 : 64;
+            ScanEntry *grown = realloc(entries, new_capacity * sizeof(ScanEntry));
+            if (!grown) {
+                break;
+            }
+            entries = grown;
+            capacity = new_capacity;
+        }
+        char *name = strdup(entry->d_name);
+        if (!name) {
+            break;
+        }
+        memset(&entries[*count], 0, sizeof(ScanEntry));
+        entries[*count].name = name;
+        entries[*count].is_dir = type == DT_DIR;
+        (*count)++;
+    }
+    closedir(dir);
+
+    if (*count > 0) {
+        qsort(entries, *count, sizeof(ScanEntry), compare_entries);
+    }
+    return entries;
+}
+
+// --- Ordered uring scans: the walk finds files in path order, and a min-heap of finished
+// results keyed on seq puts them back in it ---
+static bool heap_push(ScanState *state, ScanResult *result) {
+    if (state->heap_count == state->heap_capacity) {
+        size_t new_capacity = state->heap_capacity ? state->heap_capacity * 2 : 64;
+        ScanResult **grown = realloc(state->heap, new_capacity * sizeof(ScanResult *));
+        if (!grown) {
+            return false;
+        }
+        state->heap = grown;
+        state->heap_capacity = new_capacity;
+    }
+
+    size_t i = state->heap_count++;
+    while (i > 0 && state->heap[(i - 1) / 2]->seq > result->seq) {
+        state->heap[i] = state->heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    state->heap[i] = result;
+    return true;
+}
+
+static ScanResult *heap_pop(ScanState *state) {
+    ScanResult *top = state->heap[0];
+    ScanResult *last = state->heap[--state->heap_count];
+    size_t i = 0;
+
+    while (2 * i + 1 < state->heap_count) {
+        size_t child = 2 * i + 1;
+        if (child + 1 < state->heap_count && state->heap[child + 1]->seq < state->heap[child]->seq) {
+            child++;
+        }
+        if (last->seq <= state->heap[child]->seq) {
+            break;
+        }
+        state->heap[i] = state->heap[child];
+        i = child;
+    }
+    if (state->heap_count > 0) {
+        state->heap[i] = last;
+    }
+    return top;
+}
+
+// Hands one result to the caller; the result owns its path and both are freed here
+static void emit(ScanState *state, ScanResult *result) {
+    state->options->callback(result, state->options->user);
+    tag_data_free(&result->tags);
+    free((char *)result->path);
+    free(result);
+}
+
+// Ordered pool scans: fills in one entry and delivers everything that is now next in line.
+// seq becomes the file's rank in path order.
+static void settle(ScanState *state, ScanDir *dir, size_t index, ScanResult *result, ScanDir *child) {
+    pthread_mutex_lock(&state->deliver_lock);
+
+    dir->entries[index].result = result;
+    dir->entries[index].child = child;
+    dir->entries[index].done = true;
+
+    ScanDir *cursor = state->cursor_dir;
+    size_t i = state->cursor_index;
+    while (cursor) {
+        if (i == cursor->count) {
+            ScanDir *parent = cursor->parent;
+            i = cursor->index + 1;
+            if (cursor != &state->top) {
+                free(cursor->entries);
+                free(cursor);
+            }
+            cursor = parent;
+            continue;
+        }
+        ScanEntry *entry = &cursor->entries[i];
+        if (!entry->done) {
+            break;
+        }
+        if (entry->child) {
+            cursor = entry->child;
+            i = 0;
+            continue;
+        }
+        if (entry->result) {
+            entry->result->seq = state->next_to_deliver++;
+            emit(state, entry->result);
+        }
+        i++;
+    }
+    state->cursor_dir = cursor;
+    state->cursor_index = i;
+
+    pthread_mutex_unlock(&state->deliver_lock);
+}
+
+static void deliver(ScanState *state, ScanResult *result) {
+    pthread_mutex_lock(&state->deliver_lock);
+
+    if (!state->options->ordered || state->order_lost) {
+        emit(state, result);
+    } else if (!heap_push(state, result)) {
+        // Out of memory: flush what is held back and carry on unordered rather than lose results
+        state->order_lost = true;
+        emit(state, result);
+        while (state->heap_count > 0) {
+            emit(state, heap_pop(state));
+        }
+    } else {
+        while (state->heap_count > 0 && state->heap[0]->seq == state->next_to_deliver) {
+            emit(state, heap_pop(state));
+            state->next_to_deliver++;
+        }
+    }
+
+    pthread_mutex_unlock(&state->deliver_lock);
+}
+
+// Only files whose stat changed since they were indexed are parsed again
+static bool read_file_through_index(TagIndex *index, const char *path, TagData *tags) {
+    struct stat st;
+    if (!index || stat(path, &st) != 0) {
+        return read_tags_from_file(path, tags);
+    }
+
+    bool has_tags;
+    if (tag_index_lookup(index, path, &st, tags, &has_tags)) {
+        return has_tags;
+    }
+
+    bool ok = read_tags_from_file(path, tags);
+    tag_index_put(index, path, &st, ok ? tags : NULL);
+    return ok;
+}
+
+// --- Tasks ---
+static void scan_file_task(void *arg) {
+    ScanTask *task = arg;
+    if (task->state->visit) {
+        task->state->visit(task->path, task->state->options->user);
+        free(task->path);
+        free(task);
+        return;
+    }
+
+    ScanResult *result = malloc(sizeof(ScanResult));
+
+    if (result) {
+        result->path = task->path; // The result takes over the path
+        result->seq = task->seq;
+        tag_data_init(&result->tags);
+        result->ok = read_file_through_index(task->state->options->index, task->path, &result->tags);
+        audio_read_file(task->path, task->state->options->audio, 1, &result->audio);
+    } else {
+        free(task->path);
+    }
+    if (task->dir) {
+        settle(task->state, task->dir, task->index, result, NULL);
+    } else if (result) {
+        deliver(task->state, result);
+    }
+
+    free(task);
+}
+
+static void scan_dir_task(void *arg);
+
+// `slot`/`index`: the entry an ordered scan fills in with the outcome (NULL otherwise)
+static bool submit_path(ScanState *state, const char *dir, const char *name, bool is_dir,
+                        ScanDir *slot, size_t index) {
+    ScanTask *task = malloc(sizeof(ScanTask));
+    size_t len = strlen(dir) + strlen(name) + 2;
+    char *path = malloc(len);
+    if (!task || !path) {
+        free(task);
+        free(path);
+        return false;
+    }
+    snprintf(path, len, "%s/%s", dir, name);
+
+    task->state = state;
+    task->path = path;
+    task->seq = is_dir ? 0 : atomic_fetch_add(&state->next_seq, 1);
+    task->dir = slot;
+    task->index = index;
+
+    if (!pool_submit(state->pool, is_dir ? scan_dir_task : scan_file_task, task)) {
+        free(path);
+        free(task);
+        return false;
+    }
+    return true;
+}
+
+// Ordered scans: the entries are queued in name order and the directory is handed to the
+// cursor only after the last of them, so nothing can free it while they are being queued
+static void scan_dir_ordered(ScanTask *task) {
+    ScanState *state = task->state;
+    ScanDir *node = malloc(sizeof(ScanDir));
+    if (node) {
+        node->parent = task->dir;
+        node->index = task->index;
+        node->entries = list_dir(task->path, &node->count);
+        for (size_t i = 0; i < node->count; i++) {
+            char *name = node->entries[i].name;
+            node->entries[i].name = NULL;
+            if (!submit_path(state, task->path, name, node->entries[i].is_dir, node, i)) {
+                settle(state, node, i, NULL, NULL);
+            }
+            free(name);
+        }
+    }
+    settle(state, task->dir, task->index, NULL, node);
+
+    free(task->path);
+    free(task);
+}
+
+static void scan_dir_task(void *arg) {
+    ScanTask *task = arg;
+    if (task->dir) {
+        scan_dir_ordered(task);
+        return;
+    }
+    DIR *dir = opendir(task->path[0] ? task->path : "/");
+
+    if (dir) {
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+                continue;
+            }
+
+            // Symlinks are not followed, so link loops cannot trap the walk
+            unsigned char type = entry_type(task->path, entry);
+            if (type == DT_DIR) {
+                submit_path(task->state, task->path, entry->d_name, true, NULL, 0);
+            } else if (type == DT_REG && is_mp3_name(entry->d_name)) {
+                submit_path(task->state, task->path, entry->d_name, false, NULL, 0);
+            }
+        }
+        closedir(dir);
+    }
+
+    free(task->path);
+    free(task);
+}
+
+// --- io_uring engine ---
+// One thread keeps up to URING_FILES_IN_FLIGHT files moving through
+// [statx, with an index] -> openat -> read(TAG_READ_AHEAD) -> [read(rest of tag)] -> close,
+// or, for files without an ID3v2 tag, [statx] -> read(ID3v1 trailer) -> close,
+// and parses each tag with the usual frame parser as soon as its bytes have arrived.
+// The directory walk runs on the same thread, in between batches.
+
+typedef enum {
+    STAGE_STATX,
+    STAGE_OPEN,
+    STAGE_HEAD,     // Header plus (usually) the whole tag
+    STAGE_REST,     // Remainder of a tag larger than TAG_READ_AHEAD
+    STAGE_V1_STAT,  // No ID3v2 tag: size of the file, to find the ID3v1 trailer
+    STAGE_V1        // Last 128 bytes
+} UringStage;
+
+typedef struct {
+    ScanResult *result;   // NULL while the slot is free
+    UringStage stage;
+    int fd;
+    size_t got;
+    int64_t file_size;    // -1 until a statx has told us
+    bool have_stat;       // st is valid and the index missed, so the result gets stored
+    struct stat st;
+    struct statx stx;
+} UringSlot;
+
+// Depth-first walk in path order: one sorted listing per directory on the way down, so the
+// files come out in the order an ordered scan delivers them
+typedef struct {
+    char *path;
+    ScanEntry *entries;
+    size_t count;
+    size_t next;
+} WalkFrame;
+
+typedef struct {
+    WalkFrame *frames;
+    size_t depth;
+    size_t capacity;
+} DirWalk;
+
+#define URING_CLOSE_TAG 0 // user_data of fire-and-forget closes; slots use index + 1
+
+static char *join_path(const char *dir, const char *name) {
+    size_t len = strlen(dir) + strlen(name) + 2;
+    char *path = malloc(len);
+    if (path) {
+        snprintf(path, len, "%s/%s", dir, name);
+    }
+    return path;
+}
+
+static void free_frame(WalkFrame *frame) {
+    for (size_t i = frame->next; i < frame->count; i++) {
+        free(frame->entries[i].name);
+    }
+    free(frame->entries);
+    free(frame->path);
+}
+
+// Lists `path` and descends into it; the walk takes over `path` only when this returns true
+static bool walk_push(DirWalk *walk, char *path) {
+    if (walk->depth == walk->capacity) {
+        size_t new_capacity = walk->capacity ? walk->capacity * 2 : 16;
+        WalkFrame *grown = realloc(walk->frames, new_capacity * sizeof(WalkFrame));
+        if (!grown) {
+            return false;
+        }
+        walk->frames = grown;
+        walk->capacity = new_capacity;
+    }
+    WalkFrame *frame = &walk->frames[walk->depth++];
+    frame->path = path;
+    frame->entries = list_dir(path, &frame->count);
+    frame->next = 0;
+    return true;
+}
+
+// Next .mp3 path (owned by the caller), or NULL once the tree is exhausted
+static char *walk_next(DirWalk *walk) {
+    while (walk->depth > 0) {
+        WalkFrame *frame = &walk->frames[walk->depth - 1];
+        if (frame->next == frame->count) {
+            free_frame(frame);
+            walk->depth--;
+            continue;
+        }
+
+        ScanEntry *entry = &frame->entries[frame->next++];
+        char *path = join_path(frame->path, entry->name);
+        free(entry->name);
+        if (!path) {
+            continue;
+        }
+        if (!entry->is_dir) {
+            return path;
+        }
+        if (!walk_push(walk, path)) {
+            free(path);
+        }
+    }
+    return NULL;
+}
+
+static void walk_free(DirWalk *walk) {
+    while (walk->depth > 0) {
+        free_frame(&walk->frames[--walk->depth]);
+    }
+    free(walk->frames);
+}
+
+static void close_slot_fd(UringRing *ring, UringSlot *slot, unsigned *pending) {
+    if (slot->fd < 0) {
+        return;
+    }
+    if (uring_prep_close(ring, slot->fd, URING_CLOSE_TAG)) {
+        (*pending)++;
+    } else {
+        close(slot->fd);
+    }
+    slot->fd = -1;
+}
+
+static void finish_slot(ScanState *state, UringSlot *slot, bool ok) {
+    ScanResult *result = slot->result;
+    if (ok) {
+        parse_tag_frames(&result->tags);
+    }
+    result->ok = ok;
+    if (slot->have_stat) {
+        tag_index_put(state->options->index, result->path, &slot->st, ok ? &result->tags : NULL);
+    }
+    slot->result = NULL;
+    deliver(state, result);
+}
+
+// Queues the next operation of a slot; a full queue (never expected with the ring sized at
+// two entries per slot) drops the file to the blocking path instead of stalling it.
+static bool queue_stage(UringRing *ring, UringSlot *slot, uint64_t user_data) {
+    ScanResult *result = slot->result;
+    TagData *tags = &result->tags;
+
+    switch (slot->stage) {
+    case STAGE_STATX:
+        return uring_prep_statx(ring, result->path, STATX_BASIC_STATS, &slot->stx, user_data);
+    case STAGE_OPEN:
+        return uring_prep_openat(ring, result->path, O_RDONLY | O_CLOEXEC, user_data);
+    case STAGE_HEAD:
+        return uring_prep_read(ring, slot->fd, tags->arena, TAG_READ_AHEAD, 0, user_data);
+    case STAGE_REST:
+        return uring_prep_read(ring, slot->fd, tags->arena + slot->got,
+                               ID3_HEADER_SIZE + tags->header.size - slot->got, slot->got, user_data);
+    case STAGE_V1_STAT:
+        return uring_prep_statx(ring, result->path, STATX_SIZE, &slot->stx, user_data);
+    case STAGE_V1:
+        return uring_prep_read(ring, slot->fd, tags->arena, ID3V1_TAG_SIZE,
+                               slot->file_size - ID3V1_TAG_SIZE, user_data);
+    }
+    return false;
+}
+
+static void read_slot_blocking(ScanState *state, UringSlot *slot) {
+    if (slot->fd >= 0) {
+        close(slot->fd);
+        slot->fd = -1;
+    }
+    ScanResult *result = slot->result;
+    result->ok = read_file_through_index(state->options->index, result->path, &result->tags);
+    slot->result = NULL;
+    deliver(state, result);
+}
+
+// Reads one file on the calling thread and delivers it
+static void start_blocking(ScanState *state, char *path, uint64_t seq) {
+    ScanResult *result = malloc(sizeof(ScanResult));
+    if (!result) {
+        free(path);
+        state->order_lost = true; // This seq never arrives; results held back go out at the end
+        return;
+    }
+    result->path = path;
+    result->seq = seq;
+    tag_data_init(&result->tags);
+    memset(&result->audio, 0, sizeof(AudioInfo));
+    result->ok = read_file_through_index(state->options->index, path, &result->tags);
+    deliver(state, result);
+}
+
+static void advance_slot(ScanState *state, UringRing *ring, UringSlot *slot, uint64_t user_data,
+                         unsigned *pending) {
+    if (queue_stage(ring, slot, user_data)) {
+        (*pending)++;
+    } else {
+        read_slot_blocking(state, slot);
+    }
+}
+
+static void start_slot(ScanState *state, UringRing *ring, UringSlot *slot, uint64_t user_data,
+                       char *path, unsigned *pending) {
+    ScanResult *result = malloc(sizeof(ScanResult));
+    if (!result) {
+        free(path);
+        state->order_lost = true; // See start_blocking
+        return;
+    }
+    result->path = path;
+    result->seq = atomic_fetch_add(&state->next_seq, 1);
+    tag_data_init(&result->tags);
+    memset(&result->audio, 0, sizeof(AudioInfo));
+
+    slot->result = result;
+    slot->fd = -1;
+    slot->got = 0;
+    slot->file_size = -1;
+    slot->have_stat = false;
+    slot->stage = state->options->index ? STAGE_STATX : STAGE_OPEN;
+    advance_slot(state, ring, slot, user_data, pending);
+}
+
+static void complete_slot(ScanState *state, UringRing *ring, UringSlot *slot, uint64_t user_data,
+                          int32_t res, unsigned *pending) {
+    TagData *tags = &slot->result->tags;
+
+    switch (slot->stage) {
+    case STAGE_STATX:
+        if (res == 0) {
+            memset(&slot->st, 0, sizeof(slot->st));
+            slot->st.st_dev = makedev(slot->stx.stx_dev_major, slot->stx.stx_dev_minor);
+            slot->st.st_ino = slot->stx.stx_ino;
+            slot->st.st_size = slot->stx.stx_size;
+            slot->st.st_mtim.tv_sec = slot->stx.stx_mtime.tv_sec;
+            slot->st.st_mtim.tv_nsec = slot->stx.stx_mtime.tv_nsec;
+            slot->file_size = slot->stx.stx_size;
+
+            bool has_tags;
+            if (tag_index_lookup(state->options->index, slot->result->path, &slot->st, tags, &has_tags)) {
+                ScanResult *result = slot->result;
+                result->ok = has_tags;
+                slot->result = NULL;
+                deliver(state, result);
+                return;
+            }
+            slot->have_stat = true;
+        }
+        slot->stage = STAGE_OPEN;
+        break;
+
+    case STAGE_OPEN:
+        if (res < 0 || !tag_arena_reserve(tags, TAG_READ_AHEAD)) {
+            if (res >= 0) {
+                slot->fd = res;
+                close_slot_fd(ring, slot, pending);
+            }
+            finish_slot(state, slot, false);
+            return;
+        }
+        slot->fd = res;
+        slot->stage = STAGE_HEAD;
+        break;
+
+    case STAGE_HEAD:
+        STATS_ADD(STAT_BYTES_READ, res > 0 ? res : 0);
+        if (res < ID3_HEADER_SIZE || !decode_id3_header(tags->arena, &tags->header)) {
+            // No ID3v2 tag: look for an ID3v1 trailer. A short read holds the whole file.
+            if (res == TAG_READ_AHEAD) {
+                slot->stage = (slot->file_size >= 0) ? STAGE_V1 : STAGE_V1_STAT;
+                if (slot->file_size >= 0 && slot->file_size < ID3V1_TAG_SIZE) {
+                    close_slot_fd(ring, slot, pending);
+                    finish_slot(state, slot, false);
+                    return;
+                }
+                break;
+            }
+            close_slot_fd(ring, slot, pending);
+            finish_slot(state, slot, res >= ID3V1_TAG_SIZE && decode_id3v1(tags->arena + res - ID3V1_TAG_SIZE, tags));
+            return;
+        }
+        slot->got = (size_t)res;
+        // A short first read means the file ends inside the read-ahead: nothing more to fetch
+        if (slot->got == TAG_READ_AHEAD && ID3_HEADER_SIZE + (size_t)tags->header.size > TAG_READ_AHEAD) {
+            if (!tag_arena_reserve(tags, ID3_HEADER_SIZE + (size_t)tags->header.size)) {
+                close_slot_fd(ring, slot, pending);
+                finish_slot(state, slot, false);
+                return;
+            }
+            slot->stage = STAGE_REST;
+            break;
+        }
+        close_slot_fd(ring, slot, pending);
+        finish_tag_buffer(tags, slot->got);
+        finish_slot(state, slot, true);
+        return;
+
+    case STAGE_REST:
+        STATS_ADD(STAT_BYTES_READ, res > 0 ? res : 0);
+        close_slot_fd(ring, slot, pending);
+        if (res < 0) {
+            finish_slot(state, slot, false);
+            return;
+        }
+        slot->got += (size_t)res;
+        finish_tag_buffer(tags, slot->got);
+        finish_slot(state, slot, true);
+        return;
+
+    case STAGE_V1_STAT:
+        if (res != 0 || slot->stx.stx_size < ID3V1_TAG_SIZE) {
+            close_slot_fd(ring, slot, pending);
+            finish_slot(state, slot, false);
+            return;
+        }
+        slot->file_size = slot->stx.stx_size;
+        slot->stage = STAGE_V1;
+        break;
+
+    case STAGE_V1:
+        STATS_ADD(STAT_BYTES_READ, res > 0 ? res : 0);
+        close_slot_fd(ring, slot, pending);
+        finish_slot(state, slot, res == ID3V1_TAG_SIZE && decode_id3v1(tags->arena, tags));
+        return;
+    }
+
+    advance_slot(state, ring, slot, user_data, pending);
+}
+
+// Returns false, before touching the tree, when io_uring can't be used so the caller can fall
+// back to the pool. `root` is taken over (and freed) only when this returns true.
+static bool scan_with_uring(ScanState *state, char *root) {
+    static const uint8_t needed_ops[] = { IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_CLOSE, IORING_OP_STATX };
+    UringRing *ring = uring_create(2 * URING_FILES_IN_FLIGHT, needed_ops, sizeof(needed_ops));
+    if (!ring) {
+        return false;
+    }
+
+    UringSlot *slots = calloc(URING_FILES_IN_FLIGHT, sizeof(UringSlot));
+    DirWalk walk;
+    memset(&walk, 0, sizeof(walk));
+    if (!slots || !walk_push(&walk, root)) {
+        free(slots);
+        walk_free(&walk);
+        uring_destroy(ring);
+        return false;
+    }
+
+    unsigned pending = 0;   // Operations queued or in the kernel, closes included
+    bool walk_done = false;
+    bool ring_failed = false;
+
+    for (;;) {
+        // Top up the free slots from the walk
+        for (unsigned i = 0; i < URING_FILES_IN_FLIGHT && !walk_done; i++) {
+            if (slots[i].result) {
+                continue;
+            }
+            char *path = walk_next(&walk);
+            if (!path) {
+                walk_done = true;
+                break;
+            }
+            start_slot(state, ring, &slots[i], i + 1, path, &pending);
+        }
+
+        if (pending == 0) {
+            break;
+        }
+        if (!uring_submit_and_wait(ring, 1)) {
+            ring_failed = true;
+            break;
+        }
+
+        uint64_t user_data;
+        int32_t res;
+        while (uring_next_cqe(ring, &user_data, &res)) {
+            pending--;
+            if (user_data != URING_CLOSE_TAG) {
+                UringSlot *slot = &slots[user_data - 1];
+                complete_slot(state, ring, slot, user_data, res, &pending);
+            }
+        }
+    }
+
+    if (ring_failed) {
+        // io_uring_enter itself failed. The kernel may still write into the buffers of the
+        // files in flight, so those results are abandoned (leaked) and the files read again;
+        // the rest of the walk goes through the blocking path too.
+        for (unsigned i = 0; i < URING_FILES_IN_FLIGHT; i++) {
+            ScanResult *stale = slots[i].result;
+            if (stale) {
+                slots[i].fd = -1;
+                slots[i].have_stat = false;
+                slots[i].result = NULL;
+                start_blocking(state, (char *)stale->path, stale->seq);
+            }
+        }
+        char *path;
+        while ((path = walk_next(&walk)) != NULL) {
+            start_blocking(state, path, atomic_fetch_add(&state->next_seq, 1));
+        }
+    }
+
+    walk_free(&walk);
+    free(slots);
+    uring_destroy(ring);
+    return true;
+}
+
+static void finish_scan(ScanState *state) {
+    // Anything still held back (only possible after an allocation failure) goes out now
+    while (state->heap_count > 0) {
+        emit(state, heap_pop(state));
+    }
+    free(state->heap);
+    pthread_mutex_destroy(&state->deliver_lock);
+}
+
+static bool scan_tree(const char *root, const ScanOptions *options, ScanVisitFn visit) {
+    struct stat st;
+    if (stat(root, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        return false;
+    }
+
+    ScanState state;
+    memset(&state, 0, sizeof(ScanState));
+    state.options = options;
+    state.visit = visit;
+    atomic_init(&state.next_seq, 0);
+    pthread_mutex_init(&state.deliver_lock, NULL);
+
+    // Paths are absolute so they match the tag index entries whatever directory the scan
+    // was started from.
+    char *root_path = realpath(root, NULL);
+    if (!root_path) {
+        pthread_mutex_destroy(&state.deliver_lock);
+        return false;
+    }
+    if (strcmp(root_path, "/") == 0) {
+        root_path[0] = '\0'; // Children become "/name", not "//name"
+    }
+
+    // The ring only stages the tag reads; scans that also want audio info use the pool
+    if (!visit && options->engine == SCAN_ENGINE_URING && options->audio == AUDIO_SCAN_NONE &&
+        scan_with_uring(&state, root_path)) {
+        finish_scan(&state);
+        return true;
+    }
+
+    state.pool = pool_create(options->num_threads);
+    if (!state.pool) {
+        free(root_path);
+        pthread_mutex_destroy(&state.deliver_lock);
+        return false;
+    }
+
+    // The root is just the first directory task; ordered, it is the only entry of `top`
+    state.top.entries = &state.top_entry;
+    state.top.count = 1;
+    state.cursor_dir = &state.top;
+    ScanTask *root_task = malloc(sizeof(ScanTask));
+    bool started = root_task != NULL;
+    if (started) {
+        root_task->state = &state;
+        root_task->path = root_path;
+        root_task->seq = 0;
+        root_task->dir = (options->ordered && !visit) ? &state.top : NULL;
+        root_task->index = 0;
+        started = pool_submit(state.pool, scan_dir_task, root_task);
+    }
+    if (!started) {
+        free(root_task);
+        free(root_path);
+    }
+
+    pool_destroy(state.pool);
+    finish_scan(&state);
+    return started;
+}
+
+// Main function to scan a library
+bool scan_library(const char *root, const ScanOptions *options) {
+    return options->callback && scan_tree(root, options, NULL);
+}
+
+bool scan_for_each_file(const char *root, int num_threads, ScanVisitFn visit, void *user) {
+    ScanOptions options = { num_threads, false, NULL, user, NULL, SCAN_ENGINE_POOL, AUDIO_SCAN_NONE };
+    return visit && scan_tree(root, &options, visit);
+}
@@ -0,0 +1,15 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include "types.h"
+
+// --- Parallel Library Scan ---
+// Walks `root` recursively and reads the tags of every .mp3 file on a work-stealing pool.
+// Directories are tasks too, so a slow directory only holds up the worker listing it.
+bool scan_library(const char *root, const ScanOptions *options);
+
+// Same walk, but each .mp3 path is handed to `visit` on a worker instead of being read,
+// for jobs that do their own I/O on the file (e.g. artwork extraction).
+bool scan_for_each_file(const char *root, int num_threads, ScanVisitFn visit, void *user);
+
+#endif // SCAN_H
\ No newline at end of file
@@ -0,0 +1,966 @@
+#define _GNU_SOURCE // accept4, ppoll
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "serve.h"
+#include "read.h"
+#include "edit.h"
+#include "hash.h"
+#include "pool.h"
+#include "tag.h"
+
+#define SERVE_READ_BUFFER 65536
+#define SERVE_MAX_OUTBOX (4u << 20) // Unsent response bytes before a connection's requests stop being read
+#define SERVE_CACHE_SHARDS 16     // Independent locks, so workers rarely wait for each other
+#define SERVE_PATH_LOCKS 64       // Edits of the same file never run at the same time
+#define SERVE_RACY_NS 2000000000LL // Files changed this recently are not cached (see cache_store)
+
+// --- Message Buffer ---
+typedef struct {
+    uint8_t *data;
+    size_t size;
+    size_t capacity;
+    bool failed;              // An append ran out of memory: the message is incomplete
+} MessageBuffer;
+
+static bool message_reserve(MessageBuffer *buffer, size_t extra) {
+    if (buffer->size + extra > buffer->capacity) {
+        size_t new_capacity = buffer->capacity ? buffer->capacity : 4096;
+        while (new_capacity < buffer->size + extra) {
+            new_capacity *= 2;
+        }
+        uint8_t *grown = realloc(buffer->data, new_capacity);
+        if (!grown) {
+            buffer->failed = true;
+            return false;
+        }
+        buffer->data = grown;
+        buffer->capacity = new_capacity;
+    }
+    return true;
+}
+
+static bool message_append(MessageBuffer *buffer, const void *data, size_t size) {
+    if (!message_reserve(buffer, size)) {
+        return false;
+    }
+    memcpy(buffer->data + buffer->size, data, size);
+    buffer->size += size;
+    return true;
+}
+
+static void put_u32(uint8_t *p, uint32_t value) {
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Header with a size of zero; message_finish fills it in once the payload is known
+static void message_start(MessageBuffer *buffer, uint32_t id, uint8_t op) {
+    uint8_t header[SERVE_HEADER_SIZE] = { 0 };
+    put_u32(header + 4, id);
+    header[8] = op;
+    buffer->size = 0;
+    buffer->failed = false;
+    message_append(buffer, header, SERVE_HEADER_SIZE);
+}
+
+static void message_finish(MessageBuffer *buffer) {
+    put_u32(buffer->data, (uint32_t)(buffer->size - 4));
+}
+
+static bool write_all(int fd, const uint8_t *data, size_t size) {
+    while (size > 0) {
+        ssize_t sent = send(fd, data, size, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            return false;
+        }
+        data += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+// Sends what the socket takes without waiting; false if the peer is gone
+static bool write_some(int fd, const uint8_t *data, size_t size, size_t *sent) {
+    while (*sent < size) {
+        ssize_t written = send(fd, data + *sent, size - *sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return true;
+        }
+        if (written <= 0) {
+            return false;
+        }
+        *sent += written;
+    }
+    return true;
+}
+
+// --- Tag Cache: READ responses by path, valid while the file's stat is unchanged ---
+typedef struct CacheEntry {
+    struct CacheEntry *bucket_next;
+    struct CacheEntry *lru_prev;
+    struct CacheEntry *lru_next;
+    uint64_t hash;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    int64_t mtime_ns;
+    uint8_t status;
+    uint32_t response_size;
+    uint8_t *response;        // Both point into the same allocation as the entry
+    char *path;
+} CacheEntry;
+
+typedef struct {
+    pthread_mutex_t lock;
+    CacheEntry **buckets;
+    uint32_t bucket_mask;
+    CacheEntry lru;           // Sentinel: lru.lru_next is the most recently used entry
+    uint32_t count;
+    uint32_t capacity;
+} CacheShard;
+
+static int64_t mtime_ns(const struct stat *st) {
+    return (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+}
+
+static bool cache_init(CacheShard *shards, uint32_t entries) {
+    uint32_t per_shard = entries / SERVE_CACHE_SHARDS + 1;
+    uint32_t buckets = 16;
+    while (buckets < per_shard) {
+        buckets *= 2;
+    }
+    for (int i = 0; i < SERVE_CACHE_SHARDS; i++) {
+        CacheShard *shard = &shards[i];
+        pthread_mutex_init(&shard->lock, NULL);
+        shard->buckets = calloc(buckets, sizeof(CacheEntry *));
+        shard->bucket_mask = buckets - 1;
+        shard->lru.lru_prev = shard->lru.lru_next = &shard->lru;
+        shard->capacity = per_shard;
+        if (!shard->buckets) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void cache_unlink(CacheShard *shard, CacheEntry *entry) {
+    CacheEntry **link = &shard->buckets[(entry->hash >> 8) & shard->bucket_mask];
+    while (*link != entry) {
+        link = &(*link)->bucket_next;
+    }
+    *link = entry->bucket_next;
+    entry->lru_prev->lru_next = entry->lru_next;
+    entry->lru_next->lru_prev = entry->lru_prev;
+    shard->count--;
+    free(entry);
+}
+
+static CacheEntry *cache_find(CacheShard *shard, const char *path, uint64_t hash) {
+    for (CacheEntry *entry = shard->buckets[(hash >> 8) & shard->bucket_mask]; entry; entry = entry->bucket_next) {
+        if (entry->hash == hash && strcmp(entry->path, path) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+static void cache_destroy(CacheShard *shards) {
+    for (int i = 0; i < SERVE_CACHE_SHARDS; i++) {
+        CacheShard *shard = &shards[i];
+        if (!shard->buckets) {
+            continue; // cache_init stopped before this shard
+        }
+        while (shard->lru.lru_next != &shard->lru) {
+            cache_unlink(shard, shard->lru.lru_next);
+        }
+        free(shard->buckets);
+        pthread_mutex_destroy(&shard->lock);
+    }
+}
+
+// Appends the cached response to out; false on a miss. A stale entry is dropped.
+static bool cache_lookup(CacheShard *shards, const char *path, uint64_t hash, const struct stat *st,
+                         MessageBuffer *out, uint8_t *status) {
+    CacheShard *shard = &shards[hash & (SERVE_CACHE_SHARDS - 1)];
+    bool hit = false;
+    pthread_mutex_lock(&shard->lock);
+    CacheEntry *entry = cache_find(shard, path, hash);
+    if (entry && (entry->dev != st->st_dev || entry->ino != st->st_ino ||
+                  entry->size != st->st_size || entry->mtime_ns != mtime_ns(st))) {
+        cache_unlink(shard, entry);
+        entry = NULL;
+    }
+    if (entry && message_append(out, entry->response, entry->response_size)) {
+        entry->lru_prev->lru_next = entry->lru_next;
+        entry->lru_next->lru_prev = entry->lru_prev;
+        entry->lru_next = shard->lru.lru_next;
+        entry->lru_prev = &shard->lru;
+        shard->lru.lru_next->lru_prev = entry;
+        shard->lru.lru_next = entry;
+        *status = entry->status;
+        hit = true;
+    }
+    pthread_mutex_unlock(&shard->lock);
+    return hit;
+}
+
+// st must be taken before the file was parsed: a change during the parse then shows up
+// as a stale entry on the next lookup instead of being hidden. mtime only moves in
+// timer ticks, so a write right after the stat may leave it unchanged; files modified in
+// the last SERVE_RACY_NS are therefore parsed again next time rather than cached.
+static void cache_store(CacheShard *shards, const char *path, uint64_t hash, const struct stat *st,
+                        uint8_t status, const uint8_t *response, uint32_t response_size) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    if ((int64_t)now.tv_sec * 1000000000 + now.tv_nsec - mtime_ns(st) < SERVE_RACY_NS) {
+        return;
+    }
+
+    size_t path_size = strlen(path) + 1;
+    CacheEntry *entry = malloc(sizeof(CacheEntry) + response_size + path_size);
+    if (!entry) {
+        return;
+    }
+    entry->hash = hash;
+    entry->dev = st->st_dev;
+    entry->ino = st->st_ino;
+    entry->size = st->st_size;
+    entry->mtime_ns = mtime_ns(st);
+    entry->status = status;
+    entry->response_size = response_size;
+    entry->response = (uint8_t *)(entry + 1);
+    entry->path = (char *)entry->response + response_size;
+    memcpy(entry->response, response, response_size);
+    memcpy(entry->path, path, path_size);
+
+    CacheShard *shard = &shards[hash & (SERVE_CACHE_SHARDS - 1)];
+    pthread_mutex_lock(&shard->lock);
+    CacheEntry *old = cache_find(shard, path, hash);
+    if (old) {
+        cache_unlink(shard, old);
+    } else if (shard->count == shard->capacity) {
+        cache_unlink(shard, shard->lru.lru_prev);
+    }
+    CacheEntry **bucket = &shard->buckets[(hash >> 8) & shard->bucket_mask];
+    entry->bucket_next = *bucket;
+    *bucket = entry;
+    entry->lru_next = shard->lru.lru_next;
+    entry->lru_prev = &shard->lru;
+    shard->lru.lru_next->lru_prev = entry;
+    shard->lru.lru_next = entry;
+    shard->count++;
+    pthread_mutex_unlock(&shard->lock);
+}
+
+static void cache_invalidate(CacheShard *shards, const char *path, uint64_t hash) {
+    CacheShard *shard = &shards[hash & (SERVE_CACHE_SHARDS - 1)];
+    pthread_mutex_lock(&shard->lock);
+    CacheEntry *entry = cache_find(shard, path, hash);
+    if (entry) {
+        cache_unlink(shard, entry);
+    }
+    pthread_mutex_unlock(&shard->lock);
+}
+
+// --- Server State ---
+typedef struct Connection Connection;
+
+typedef struct {
+    ThreadPool *pool;
+    CacheShard cache[SERVE_CACHE_SHARDS];
+    pthread_mutex_t path_locks[SERVE_PATH_LOCKS];
+    pthread_key_t worker_key;
+    uint32_t padding;         // For tags that have to be rewritten (--padding)
+
+    pthread_mutex_t lock;     // Guards the connection list
+    pthread_cond_t idle;      // Signalled when the last connection has gone
+    Connection *connections;
+
+    atomic_uint_fast64_t requests;
+    atomic_uint_fast64_t cache_hits;
+    atomic_uint_fast64_t parses;
+    atomic_uint_fast64_t edits;
+} Server;
+
+// Workers never wait for a client: a response the socket does not take at once is left in
+// the outbox, and the connection's own thread sends the rest when the socket is writable.
+// That thread stops reading requests while SERVE_MAX_IN_FLIGHT are queued or the outbox
+// holds SERVE_MAX_OUTBOX bytes, so a client that does not read only stalls itself.
+struct Connection {
+    int fd;
+    int wake_fd;              // eventfd: a worker has something for the connection thread
+    Server *server;
+    Connection *prev;
+    Connection *next;
+
+    pthread_mutex_t write_lock; // Guards the outbox
+    MessageBuffer outbox;     // Responses not yet sent, from outbox_sent on
+    size_t outbox_sent;
+    bool broken;              // The peer is gone or a response was lost: discard the rest
+
+    pthread_mutex_t lock;
+    bool reading;             // The connection thread still takes requests
+    uint32_t in_flight;       // Requests queued or running
+    uint32_t refs;            // The connection thread plus each request in flight
+};
+
+typedef struct {
+    Connection *connection;
+    uint32_t id;
+    uint8_t op;
+    uint32_t size;
+    uint8_t payload[];        // size bytes and a NUL, so a bare path is a C string
+} ServeTask;
+
+// Per-worker scratch, allocated on the worker's first request and reused after that
+typedef struct {
+    TagData tags;
+    char text[OUTPUT_TEXT_MAX];
+    MessageBuffer response;
+} WorkerState;
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void request_stop(int signal_number) {
+    (void)signal_number;
+    stop_requested = 1;
+}
+
+static void free_worker_state(void *state) {
+    WorkerState *worker = state;
+    tag_data_free(&worker->tags);
+    free(worker->response.data);
+    free(worker);
+}
+
+static WorkerState *worker_state(Server *server) {
+    WorkerState *worker = pthread_getspecific(server->worker_key);
+    if (!worker) {
+        worker = calloc(1, sizeof(WorkerState));
+        if (!worker) {
+            return NULL;
+        }
+        tag_data_init(&worker->tags);
+        pthread_setspecific(server->worker_key, worker);
+    }
+    return worker;
+}
+
+static void connection_release(Connection *connection) {
+    pthread_mutex_lock(&connection->lock);
+    bool last = --connection->refs == 0;
+    pthread_mutex_unlock(&connection->lock);
+    if (!last) {
+        return;
+    }
+
+    Server *server = connection->server;
+    pthread_mutex_lock(&server->lock);
+    if (connection->prev) {
+        connection->prev->next = connection->next;
+    } else {
+        server->connections = connection->next;
+    }
+    if (connection->next) {
+        connection->next->prev = connection->prev;
+    }
+    if (!server->connections) {
+        pthread_cond_broadcast(&server->idle);
+    }
+    pthread_mutex_unlock(&server->lock);
+
+    close(connection->fd);
+    close(connection->wake_fd);
+    free(connection->outbox.data);
+    pthread_mutex_destroy(&connection->write_lock);
+    pthread_mutex_destroy(&connection->lock);
+    free(connection);
+}
+
+static void connection_wake(Connection *connection) {
+    uint64_t one = 1;
+    ssize_t written = write(connection->wake_fd, &one, sizeof(one));
+    (void)written; // Only fails when the counter is already non-zero
+}
+
+// Sends what the socket takes now; write_lock held
+static void flush_outbox(Connection *connection) {
+    MessageBuffer *outbox = &connection->outbox;
+    if (!connection->broken &&
+        !write_some(connection->fd, outbox->data, outbox->size, &connection->outbox_sent)) {
+        connection->broken = true;
+    }
+    if (connection->broken || connection->outbox_sent == outbox->size) {
+        outbox->size = 0;
+        connection->outbox_sent = 0;
+    }
+}
+
+// Queues one response and sends as much as the socket takes; true if the connection thread
+// must be woken (output left over, or the connection was dropped)
+static bool connection_send(Connection *connection, const MessageBuffer *message) {
+    pthread_mutex_lock(&connection->write_lock);
+    bool was_broken = connection->broken;
+    bool was_empty = connection->outbox.size == 0;
+    if (!was_broken) {
+        if (message->failed || !message_append(&connection->outbox, message->data, message->size)) {
+            // A response is missing: the client could wait for it forever, so hang up instead
+            connection->broken = true;
+            shutdown(connection->fd, SHUT_RDWR);
+        } else if (was_empty) {
+            flush_outbox(connection);
+        }
+    }
+    bool wake = (!was_broken && connection->broken) || (was_empty && connection->outbox.size > 0);
+    pthread_mutex_unlock(&connection->write_lock);
+    return wake;
+}
+
+// --- Request Handlers (run on the pool's workers) ---
+
+// Version, then ID, length and UTF-8 text of each distinct text frame
+static void encode_tags(WorkerState *worker, MessageBuffer *out) {
+    const TagData *tags = &worker->tags;
+    uint8_t version[2] = { tags->header.version_major, tags->header.version_revision };
+    message_append(out, version, sizeof(version));
+
+    for (uint32_t i = 0; i < tags->frame_count; i++) {
+        const TagFrame *frame = &tags->frames[i];
+        bool repeated = false;
+        for (uint32_t j = 0; j < i && !repeated; j++) {
+            repeated = tags->frames[j].id == frame->id;
+        }
+        size_t length = repeated ? 0 : tag_frame_text(tags, frame, worker->text, OUTPUT_TEXT_MAX);
+        if (length == 0) {
+            continue;
+        }
+        uint8_t head[8];
+        head[0] = frame->id >> 24; // The ID goes out as its characters, not as a number
+        head[1] = frame->id >> 16;
+        head[2] = frame->id >> 8;
+        head[3] = frame->id;
+        put_u32(head + 4, (uint32_t)length);
+        message_append(out, head, sizeof(head));
+        message_append(out, worker->text, length);
+    }
+}
+
+static uint8_t handle_read(Server *server, WorkerState *worker, const char *path, MessageBuffer *out) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        return SERVE_NOT_FOUND;
+    }
+
+    uint64_t hash = hash64(path, strlen(path));
+    uint8_t status;
+    if (cache_lookup(server->cache, path, hash, &st, out, &status)) {
+        atomic_fetch_add(&server->cache_hits, 1);
+        return status;
+    }
+
+    atomic_fetch_add(&server->parses, 1);
+    size_t start = out->size;
+    status = read_tags_from_file(path, &worker->tags) ? SERVE_OK : SERVE_NO_TAG;
+    if (status == SERVE_OK) {
+        encode_tags(worker, out);
+    }
+    if (!out->failed) {
+        cache_store(server->cache, path, hash, &st, status, out->data + start, (uint32_t)(out->size - start));
+    }
+    return status;
+}
+
+// Edit failures by cause; the daemon never prints them, the client gets the reason
+static uint8_t edit_response_status(TagStatus status, int sys_errno) {
+    switch (status) {
+    case TAG_OK:
+        return SERVE_OK;
+    case TAG_ERR_NO_TAG:
+        return SERVE_NO_TAG;
+    case TAG_ERR_UNSUPPORTED:
+        return SERVE_UNSUPPORTED;
+    case TAG_ERR_CORRUPT:
+        return SERVE_CORRUPT;
+    case TAG_ERR_IO:
+        return sys_errno == ENOENT ? SERVE_NOT_FOUND : SERVE_IO_ERROR;
+    default:
+        return SERVE_FAILED;
+    }
+}
+
+// path NUL (FRAME NUL value NUL)*
+static uint8_t handle_edit(Server *server, const ServeTask *task, MessageBuffer *out) {
+    const char *path = (const char *)task->payload;
+    const char *end = path + task->size;
+    const char *p = path + strlen(path) + 1;
+    EditSet set;
+    edit_set_init(&set);
+    while (p < end) {
+        const char *value = p + strlen(p) + 1;
+        if (value >= end || !edit_set_add(&set, p, value)) {
+            return SERVE_BAD_REQUEST;
+        }
+        p = value + strlen(value) + 1;
+    }
+    if (set.count == 0) {
+        return SERVE_BAD_REQUEST;
+    }
+
+    uint64_t hash = hash64(path, strlen(path));
+    pthread_mutex_t *path_lock = &server->path_locks[hash % SERVE_PATH_LOCKS];
+    pthread_mutex_lock(path_lock);
+    int sys_errno;
+    TagStatus status = edit_apply(path, &set, server->padding, &sys_errno);
+    if (status == TAG_OK) {
+        edit_note_written(path);
+    }
+    cache_invalidate(server->cache, path, hash);
+    pthread_mutex_unlock(path_lock);
+    atomic_fetch_add(&server->edits, 1);
+
+    if (status != TAG_OK) {
+        const char *reason = tag_status_string(status);
+        message_append(out, reason, strlen(reason));
+        if (status == TAG_ERR_IO && sys_errno != 0) {
+            const char *detail = strerror(sys_errno);
+            message_append(out, ": ", 2);
+            message_append(out, detail, strlen(detail));
+        }
+    }
+    return edit_response_status(status, sys_errno);
+}
+
+static void run_request(void *arg) {
+    ServeTask *task = arg;
+    Connection *connection = task->connection;
+    Server *server = connection->server;
+    WorkerState *worker = worker_state(server);
+    atomic_fetch_add(&server->requests, 1);
+
+    MessageBuffer lost = { NULL, 0, 0, true }; // No memory for the response
+    MessageBuffer *out = worker ? &worker->response : &lost;
+    if (worker) {
+        message_start(out, task->id, SERVE_OK);
+    }
+    if (!out->failed) {
+        uint8_t status;
+        switch (task->op) {
+        case SERVE_OP_PING:
+            message_append(out, task->payload, task->size);
+            status = SERVE_OK;
+            break;
+        case SERVE_OP_READ:
+            status = handle_read(server, worker, (const char *)task->payload, out);
+            break;
+        case SERVE_OP_EDIT:
+            status = handle_edit(server, task, out);
+            break;
+        default:
+            status = SERVE_BAD_REQUEST;
+            break;
+        }
+        if (!out->failed) {
+            out->data[8] = status;
+            message_finish(out);
+        }
+    }
+    bool wake = connection_send(connection, out);
+
+    pthread_mutex_lock(&connection->lock);
+    wake |= connection->in_flight-- == SERVE_MAX_IN_FLIGHT || (!connection->reading && connection->in_flight == 0);
+    pthread_mutex_unlock(&connection->lock);
+    if (wake) {
+        connection_wake(connection);
+    }
+    free(task);
+    connection_release(connection);
+}
+
+// --- Connection Thread: splits the byte stream into requests, sends what workers left over ---
+static bool queue_request(Connection *connection, const uint8_t *message, uint32_t size) {
+    uint32_t payload_size = size - (SERVE_HEADER_SIZE - 4);
+    ServeTask *task = malloc(sizeof(ServeTask) + payload_size + 1);
+    if (!task) {
+        return false;
+    }
+    task->connection = connection;
+    task->id = get_u32(message + 4);
+    task->op = message[8];
+    task->size = payload_size;
+    memcpy(task->payload, message + SERVE_HEADER_SIZE, task->size);
+    task->payload[task->size] = '\0';
+
+    pthread_mutex_lock(&connection->lock);
+    connection->in_flight++;
+    connection->refs++;
+    pthread_mutex_unlock(&connection->lock);
+
+    if (!pool_submit(connection->server->pool, run_request, task)) {
+        pthread_mutex_lock(&connection->lock);
+        connection->in_flight--;
+        connection->refs--;
+        pthread_mutex_unlock(&connection->lock);
+        free(task);
+        return false;
+    }
+    return true;
+}
+
+// Queues every complete request in the buffer, up to the in-flight limit; a partial one
+// waits for more bytes. False on a framing error or when out of memory.
+static bool take_requests(Connection *connection, uint8_t **buffer, size_t *capacity, size_t *used) {
+    size_t offset = 0;
+    bool ok = true;
+    while (*used - offset >= 4) {
+        uint32_t size = get_u32(*buffer + offset);
+        if (size < SERVE_HEADER_SIZE - 4 || size > SERVE_MAX_MESSAGE) {
+            ok = false;
+            break;
+        }
+        if (*used - offset < 4 + (size_t)size) {
+            if (4 + (size_t)size > *capacity) {
+                uint8_t *grown = realloc(*buffer, 4 + (size_t)size);
+                if (!grown) {
+                    ok = false;
+                    break;
+                }
+                *buffer = grown;
+                *capacity = 4 + (size_t)size;
+            }
+            break;
+        }
+        pthread_mutex_lock(&connection->lock);
+        bool throttled = connection->in_flight >= SERVE_MAX_IN_FLIGHT;
+        pthread_mutex_unlock(&connection->lock);
+        if (throttled) {
+            break;
+        }
+        if (!queue_request(connection, *buffer + offset, size)) {
+            ok = false;
+            break;
+        }
+        offset += 4 + size;
+    }
+    memmove(*buffer, *buffer + offset, *used - offset);
+    *used -= offset;
+    return ok;
+}
+
+static void *serve_connection(void *arg) {
+    Connection *connection = arg;
+    size_t capacity = SERVE_READ_BUFFER;
+    uint8_t *buffer = malloc(capacity);
+    size_t used = 0;
+    bool open = buffer != NULL; // More requests may arrive
+    bool valid = open;          // The stream is still well-formed
+
+    for (;;) {
+        if (valid && !take_requests(connection, &buffer, &capacity, &used)) {
+            valid = false;
+        }
+
+        pthread_mutex_lock(&connection->write_lock);
+        size_t unsent = connection->outbox.size - connection->outbox_sent;
+        valid = valid && !connection->broken;
+        pthread_mutex_unlock(&connection->write_lock);
+
+        // After end-of-file, requests still in the buffer are queued once there is room
+        pthread_mutex_lock(&connection->lock);
+        bool throttled = connection->in_flight >= SERVE_MAX_IN_FLIGHT;
+        bool reading = valid && (open || (throttled && used > 0));
+        connection->reading = reading;
+        bool idle = connection->in_flight == 0;
+        pthread_mutex_unlock(&connection->lock);
+        if (!reading && idle && unsent == 0) {
+            break; // Every request answered (or the peer is gone)
+        }
+
+        // The socket only when there is something to do with it: a hung-up socket polled for
+        // nothing would still report POLLHUP and spin
+        short events = (open && valid && !throttled && unsent < SERVE_MAX_OUTBOX ? POLLIN : 0) | (unsent > 0 ? POLLOUT : 0);
+        struct pollfd fds[2] = { { events ? connection->fd : -1, events, 0 }, { connection->wake_fd, POLLIN, 0 } };
+        if (poll(fds, 2, -1) < 0) {
+            continue; // EINTR
+        }
+        if (fds[1].revents & POLLIN) {
+            uint64_t count;
+            ssize_t got = read(connection->wake_fd, &count, sizeof(count));
+            (void)got;
+        }
+        if (fds[0].revents & (POLLOUT | POLLERR | POLLHUP)) {
+            pthread_mutex_lock(&connection->write_lock);
+            flush_outbox(connection);
+            pthread_mutex_unlock(&connection->write_lock);
+        }
+        if ((events & POLLIN) && (fds[0].revents & (POLLIN | POLLERR | POLLHUP))) {
+            ssize_t got = recv(connection->fd, buffer + used, capacity - used, MSG_DONTWAIT);
+            if (got > 0) {
+                used += got;
+            } else if (got == 0 || (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK)) {
+                open = false;
+            }
+        }
+    }
+
+    free(buffer);
+    shutdown(connection->fd, SHUT_RD);
+    connection_release(connection);
+    return NULL;
+}
+
+static bool start_connection(Server *server, int fd) {
+    Connection *connection = calloc(1, sizeof(Connection));
+    if (!connection) {
+        return false;
+    }
+    connection->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (connection->wake_fd < 0) {
+        free(connection);
+        return false;
+    }
+    connection->fd = fd;
+    connection->server = server;
+    connection->refs = 1;
+    connection->reading = true;
+    pthread_mutex_init(&connection->write_lock, NULL);
+    pthread_mutex_init(&connection->lock, NULL);
+
+    pthread_mutex_lock(&server->lock);
+    connection->next = server->connections;
+    if (server->connections) {
+        server->connections->prev = connection;
+    }
+    server->connections = connection;
+    pthread_mutex_unlock(&server->lock);
+
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    bool started = pthread_create(&thread, &attr, serve_connection, connection) == 0;
+    pthread_attr_destroy(&attr);
+    if (!started) {
+        connection_release(connection);
+    }
+    return started;
+}
+
+static int listen_on(const char *socket_path) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Error: Socket path is too long (%zu bytes max).\n", sizeof(address.sun_path) - 1);
+        return -1;
+    }
+    strcpy(address.sun_path, socket_path);
+
+    // A socket left behind by a daemon that died is replaced; a live one is not
+    int probe = serve_connect(socket_path);
+    if (probe >= 0) {
+        close(probe);
+        fprintf(stderr, "Error: A daemon is already listening on %s.\n", socket_path);
+        return -1;
+    }
+    struct stat st;
+    if (lstat(socket_path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(socket_path);
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(fd, 128) != 0) {
+        perror("Error listening on socket");
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    return fd;
+}
+
+bool serve_run(const ServeOptions *options) {
+    int listen_fd = listen_on(options->socket_path);
+    if (listen_fd < 0) {
+        return false;
+    }
+
+    // Only the accept loop takes SIGINT / SIGTERM, and only while it waits in ppoll: every
+    // thread started from here on inherits the blocked mask
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = request_stop;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    sigset_t stop_signals, wait_mask;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop_signals, &wait_mask);
+    sigdelset(&wait_mask, SIGINT);
+    sigdelset(&wait_mask, SIGTERM);
+
+    Server *server = calloc(1, sizeof(Server));
+    int num_threads = options->num_threads > 0 ? options->num_threads : pool_default_workers();
+    if (!server || !cache_init(server->cache, options->cache_entries ? options->cache_entries : SERVE_CACHE_ENTRIES) ||
+        pthread_key_create(&server->worker_key, free_worker_state) != 0 ||
+        !(server->pool = pool_create(num_threads))) {
+        fprintf(stderr, "Error: Could not start the daemon.\n");
+        close(listen_fd);
+        unlink(options->socket_path);
+        if (server) {
+            cache_destroy(server->cache);
+            free(server);
+        }
+        return false;
+    }
+    for (int i = 0; i < SERVE_PATH_LOCKS; i++) {
+        pthread_mutex_init(&server->path_locks[i], NULL);
+    }
+    pthread_mutex_init(&server->lock, NULL);
+    pthread_cond_init(&server->idle, NULL);
+    server->padding = edit_padding();
+    fprintf(stderr, "Serving on %s with %d workers.\n", options->socket_path, num_threads);
+
+    while (!stop_requested) {
+        struct pollfd waiting = { listen_fd, POLLIN, 0 };
+        if (ppoll(&waiting, 1, NULL, &wait_mask) <= 0) {
+            continue;
+        }
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno != EINTR && errno != ECONNABORTED && errno != EAGAIN) {
+                perror("Error accepting connection");
+            }
+            continue;
+        }
+        if (!start_connection(server, fd)) {
+            close(fd);
+        }
+    }
+    close(listen_fd);
+    unlink(options->socket_path);
+
+    // Readers see end-of-file, requests already queued still get their responses
+    pthread_mutex_lock(&server->lock);
+    for (Connection *connection = server->connections; connection; connection = connection->next) {
+        shutdown(connection->fd, SHUT_RD);
+    }
+    while (server->connections) {
+        pthread_cond_wait(&server->idle, &server->lock);
+    }
+    pthread_mutex_unlock(&server->lock);
+    pool_destroy(server->pool);
+
+    fprintf(stderr, "Served %llu requests: %llu cache hits, %llu parsed, %llu edits.\n",
+            (unsigned long long)atomic_load(&server->requests), (unsigned long long)atomic_load(&server->cache_hits),
+            (unsigned long long)atomic_load(&server->parses), (unsigned long long)atomic_load(&server->edits));
+
+    cache_destroy(server->cache);
+    for (int i = 0; i < SERVE_PATH_LOCKS; i++) {
+        pthread_mutex_destroy(&server->path_locks[i]);
+    }
+    pthread_key_delete(server->worker_key);
+    pthread_mutex_destroy(&server->lock);
+    pthread_cond_destroy(&server->idle);
+    free(server);
+    return true;
+}
+
+// --- Client Side ---
+
+int serve_connect(const char *socket_path) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(address.sun_path)) {
+        return -1;
+    }
+    strcpy(address.sun_path, socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd >= 0 && connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+bool serve_send(int fd, uint32_t id, uint8_t op, const void *payload, uint32_t size) {
+    uint8_t header[SERVE_HEADER_SIZE];
+    put_u32(header, size + SERVE_HEADER_SIZE - 4);
+    put_u32(header + 4, id);
+    header[8] = op;
+    if (size == 0) {
+        return write_all(fd, header, SERVE_HEADER_SIZE);
+    }
+    if (size > 4096) {
+        return write_all(fd, header, SERVE_HEADER_SIZE) && write_all(fd, payload, size);
+    }
+    uint8_t message[SERVE_HEADER_SIZE + 4096]; // Small requests go out in one send
+    memcpy(message, header, SERVE_HEADER_SIZE);
+    memcpy(message + SERVE_HEADER_SIZE, payload, size);
+    return write_all(fd, message, SERVE_HEADER_SIZE + size);
+}
+
+static bool read_exactly(int fd, uint8_t *data, size_t size) {
+    while (size > 0) {
+        ssize_t got = recv(fd, data, size, 0);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            return false;
+        }
+        data += got;
+        size -= got;
+    }
+    return true;
+}
+
+bool serve_receive(int fd, uint32_t *id, uint8_t *status, uint8_t **payload, uint32_t *size,
+                   uint32_t *capacity) {
+    uint8_t header[SERVE_HEADER_SIZE];
+    if (!read_exactly(fd, header, SERVE_HEADER_SIZE)) {
+        return false;
+    }
+    uint32_t message_size = get_u32(header);
+    if (message_size < SERVE_HEADER_SIZE - 4 || message_size > SERVE_MAX_MESSAGE) {
+        return false;
+    }
+    *id = get_u32(header + 4);
+    *status = header[8];
+    *size = message_size - (SERVE_HEADER_SIZE - 4);
+    if (*size > *capacity) {
+        uint8_t *grown = realloc(*payload, *size);
+        if (!grown) {
+            return false;
+        }
+        *payload = grown;
+        *capacity = *size;
+    }
+    return *size == 0 || read_exactly(fd, *payload, *size);
+}
@@ -0,0 +1,53 @@
+#ifndef SERVE_H
+#define SERVE_H
+
+#include "types.h"
+
+// --- Resident Daemon (serve) ---
+// Listens on a Unix stream socket and answers tag reads and edits without a process per
+// call. Every message, both ways, is a SERVE_HEADER_SIZE header and then a payload:
+//   u32 size     Bytes after this field (little-endian)
+//   u32 id       Chosen by the client, echoed in the response
+//   u8  op       SERVE_OP_* in a request, SERVE_* status in a response
+// Requests may be pipelined. They run on a worker pool, so responses come back as they
+// finish, not necessarily in request order; match them by id.
+//
+// READ  payload: the path. Response: u8 version_major, u8 version_revision, then per text
+//       frame a 4-byte frame ID, u32 length and that many bytes of UTF-8.
+// EDIT  payload: the path, then FRAME and value pairs, each string NUL-terminated.
+//       Response: empty, or on failure the reason as text ("editing ID3v2.2 tags is not supported").
+// PING  payload: anything. Response: the same bytes.
+#define SERVE_HEADER_SIZE 9
+#define SERVE_MAX_MESSAGE (1u << 20)
+#define SERVE_MAX_IN_FLIGHT 256   // Requests one connection may have queued before reading stops
+#define SERVE_CACHE_ENTRIES 65536 // Parsed tags kept (READ responses, ready to send)
+
+enum { SERVE_OP_PING = 0, SERVE_OP_READ = 1, SERVE_OP_EDIT = 2 };
+enum {
+    SERVE_OK = 0,
+    SERVE_NO_TAG = 1,
+    SERVE_NOT_FOUND = 2,
+    SERVE_BAD_REQUEST = 3,
+    SERVE_FAILED = 4,         // Any other edit failure (out of memory, tag too large)
+    SERVE_UNSUPPORTED = 5,    // Editing a tag that is read-only here (ID3v2.2)
+    SERVE_CORRUPT = 6,
+    SERVE_IO_ERROR = 7
+};
+
+typedef struct {
+    const char *socket_path;
+    int num_threads;          // 0 = one per online CPU
+    uint32_t cache_entries;   // 0 = SERVE_CACHE_ENTRIES
+} ServeOptions;
+
+// Runs until SIGINT or SIGTERM; false if the socket could not be set up
+bool serve_run(const ServeOptions *options);
+
+// --- Client Side (load generator, scripts) ---
+int serve_connect(const char *socket_path);
+bool serve_send(int fd, uint32_t id, uint8_t op, const void *payload, uint32_t size);
+// Reads one whole message; *payload is grown as needed (free it when done)
+bool serve_receive(int fd, uint32_t *id, uint8_t *status, uint8_t **payload, uint32_t *size,
+                   uint32_t *capacity);
+
+#endif // SERVE_H
@@ -0,0 +1,311 @@
+#include <string.h>
+#include <stdbool.h>
+#include "simd.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SIMD_X86 1
+#endif
+
+// --- Scalar kernels (also finish the tails of the vector ones) ---
+
+// Decodes src[i..end) and carries on past `end` when a pair straddles it; returns the new i
+static size_t decode_span(uint8_t *dst, size_t *out, const uint8_t *src, size_t i, size_t end, size_t size) {
+    while (i < end) {
+        dst[(*out)++] = src[i];
+        i += (src[i] == 0xFF && i + 1 < size && src[i + 1] == 0x00) ? 2 : 1;
+    }
+    return i;
+}
+
+static size_t encode_span(uint8_t *dst, size_t *out, const uint8_t *src, size_t i, size_t end, size_t size) {
+    for (; i < end; i++) {
+        dst[(*out)++] = src[i];
+        if (src[i] == 0xFF && (i + 1 == size || src[i + 1] == 0x00 || src[i + 1] >= 0xE0)) {
+            dst[(*out)++] = 0x00;
+        }
+    }
+    return i;
+}
+
+static size_t unsync_decode_scalar(uint8_t *dst, const uint8_t *src, size_t size) {
+    size_t out = 0;
+    decode_span(dst, &out, src, 0, size, size);
+    return out;
+}
+
+static size_t unsync_encode_scalar(uint8_t *dst, const uint8_t *src, size_t size) {
+    size_t out = 0;
+    encode_span(dst, &out, src, 0, size, size);
+    return out;
+}
+
+static size_t padding_start_scalar(const uint8_t *data, size_t size) {
+    while (size > 0 && data[size - 1] == 0) {
+        size--;
+    }
+    return size;
+}
+
+static size_t frame_sync_find_scalar(const uint8_t *data, size_t size) {
+    for (size_t i = 0; i + 1 < size; i++) {
+        if (data[i] == 0xFF && (data[i + 1] & 0xE0) == 0xE0) {
+            return i;
+        }
+    }
+    return size;
+}
+
+#ifdef SIMD_X86
+// --- SSE2 (baseline on x86-64) ---
+// Each block is compared together with the same block shifted by one byte, so a pair that
+// ends in the next block is still seen. Clean blocks are stored as they are; a block with a
+// pair in it goes through the scalar span.
+
+__attribute__((target("sse2")))
+static size_t unsync_decode_sse2(uint8_t *dst, const uint8_t *src, size_t size) {
+    const __m128i ff = _mm_set1_epi8((char)0xFF);
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    size_t out = 0;
+
+    // In place, dst + out never passes src + i, and both loads happen before the store
+    while (i + 17 <= size) {
+        __m128i block = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i next = _mm_loadu_si128((const __m128i *)(src + i + 1));
+        __m128i pairs = _mm_and_si128(_mm_cmpeq_epi8(block, ff), _mm_cmpeq_epi8(next, zero));
+        if (_mm_movemask_epi8(pairs) == 0) {
+            _mm_storeu_si128((__m128i *)(dst + out), block);
+            out += 16;
+            i += 16;
+        } else {
+            i = decode_span(dst, &out, src, i, i + 16, size);
+        }
+    }
+    decode_span(dst, &out, src, i, size, size);
+    return out;
+}
+
+__attribute__((target("sse2")))
+static size_t unsync_encode_sse2(uint8_t *dst, const uint8_t *src, size_t size) {
+    const __m128i ff = _mm_set1_epi8((char)0xFF);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i e0 = _mm_set1_epi8((char)0xE0);
+    size_t i = 0;
+    size_t out = 0;
+
+    while (i + 17 <= size) {
+        __m128i block = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i next = _mm_loadu_si128((const __m128i *)(src + i + 1));
+        __m128i needs = _mm_or_si128(_mm_cmpeq_epi8(next, zero),
+                                     _mm_cmpeq_epi8(_mm_max_epu8(next, e0), next)); // next >= 0xE0
+        __m128i stuff = _mm_and_si128(_mm_cmpeq_epi8(block, ff), needs);
+        if (_mm_movemask_epi8(stuff) == 0) {
+            _mm_storeu_si128((__m128i *)(dst + out), block);
+            out += 16;
+            i += 16;
+        } else {
+            i = encode_span(dst, &out, src, i, i + 16, size);
+        }
+    }
+    encode_span(dst, &out, src, i, size, size);
+    return out;
+}
+
+__attribute__((target("sse2")))
+static size_t padding_start_sse2(const uint8_t *data, size_t size) {
+    const __m128i zero = _mm_setzero_si128();
+    while (size >= 16) {
+        __m128i block = _mm_loadu_si128((const __m128i *)(data + size - 16));
+        unsigned zeros = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(block, zero));
+        if (zeros != 0xFFFF) {
+            // Highest non-zero byte of the block
+            return size - 16 + (31 - __builtin_clz(~zeros & 0xFFFF)) + 1;
+        }
+        size -= 16;
+    }
+    return padding_start_scalar(data, size);
+}
+
+// 0xFF in one lane and 0xE0-0xFF in the next: the block and the block one byte on
+__attribute__((target("sse2")))
+static size_t frame_sync_find_sse2(const uint8_t *data, size_t size) {
+    const __m128i ff = _mm_set1_epi8((char)0xFF);
+    const __m128i e0 = _mm_set1_epi8((char)0xE0);
+    size_t i = 0;
+    for (; i + 17 <= size; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i *)(data + i));
+        __m128i next = _mm_loadu_si128((const __m128i *)(data + i + 1));
+        __m128i sync = _mm_and_si128(_mm_cmpeq_epi8(block, ff),
+                                     _mm_cmpeq_epi8(_mm_and_si128(next, e0), e0));
+        unsigned mask = (unsigned)_mm_movemask_epi8(sync);
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + frame_sync_find_scalar(data + i, size - i);
+}
+
+// --- AVX2 ---
+
+__attribute__((target("avx2")))
+static size_t unsync_decode_avx2(uint8_t *dst, const uint8_t *src, size_t size) {
+    const __m256i ff = _mm256_set1_epi8((char)0xFF);
+    const __m256i zero = _mm256_setzero_si256();
+    size_t i = 0;
+    size_t out = 0;
+
+    while (i + 33 <= size) {
+        __m256i block = _mm256_loadu_si256((const __m256i *)(src + i));
+        __m256i next = _mm256_loadu_si256((const __m256i *)(src + i + 1));
+        __m256i pairs = _mm256_and_si256(_mm256_cmpeq_epi8(block, ff), _mm256_cmpeq_epi8(next, zero));
+        if (_mm256_movemask_epi8(pairs) == 0) {
+            _mm256_storeu_si256((__m256i *)(dst + out), block);
+            out += 32;
+            i += 32;
+        } else {
+            i = decode_span(dst, &out, src, i, i + 32, size);
+        }
+    }
+    decode_span(dst, &out, src, i, size, size);
+    return out;
+}
+
+__attribute__((target("avx2")))
+static size_t unsync_encode_avx2(uint8_t *dst, const uint8_t *src, size_t size) {
+    const __m256i ff = _mm256_set1_epi8((char)0xFF);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i e0 = _mm256_set1_epi8((char)0xE0);
+    size_t i = 0;
+    size_t out = 0;
+
+    while (i + 33 <= size) {
+        __m256i block = _mm256_loadu_si256((const __m256i *)(src + i));
+        __m256i next = _mm256_loadu_si256((const __m256i *)(src + i + 1));
+        __m256i needs = _mm256_or_si256(_mm256_cmpeq_epi8(next, zero),
+                                        _mm256_cmpeq_epi8(_mm256_max_epu8(next, e0), next));
+        __m256i stuff = _mm256_and_si256(_mm256_cmpeq_epi8(block, ff), needs);
+        if (_mm256_movemask_epi8(stuff) == 0) {
+            _mm256_storeu_si256((__m256i *)(dst + out), block);
+            out += 32;
+            i += 32;
+        } else {
+            i = encode_span(dst, &out, src, i, i + 32, size);
+        }
+    }
+    encode_span(dst, &out, src, i, size, size);
+    return out;
+}
+
+__attribute__((target("avx2")))
+static size_t padding_start_avx2(const uint8_t *data, size_t size) {
+    const __m256i zero = _mm256_setzero_si256();
+    while (size >= 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i *)(data + size - 32));
+        uint32_t zeros = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, zero));
+        if (zeros != 0xFFFFFFFFu) {
+            return size - 32 + (31 - __builtin_clz(~zeros)) + 1;
+        }
+        size -= 32;
+    }
+    return padding_start_sse2(data, size);
+}
+
+__attribute__((target("avx2")))
+static size_t frame_sync_find_avx2(const uint8_t *data, size_t size) {
+    const __m256i ff = _mm256_set1_epi8((char)0xFF);
+    const __m256i e0 = _mm256_set1_epi8((char)0xE0);
+    size_t i = 0;
+    for (; i + 33 <= size; i += 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i *)(data + i));
+        __m256i next = _mm256_loadu_si256((const __m256i *)(data + i + 1));
+        __m256i sync = _mm256_and_si256(_mm256_cmpeq_epi8(block, ff),
+                                        _mm256_cmpeq_epi8(_mm256_and_si256(next, e0), e0));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(sync);
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + frame_sync_find_sse2(data + i, size - i);
+}
+#endif // SIMD_X86
+
+// --- Dispatch ---
+
+SimdLevel simd_best_level(void) {
+#ifdef SIMD_X86
+    if (__builtin_cpu_supports("avx2")) {
+        return SIMD_AVX2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return SIMD_SSE2;
+    }
+#endif
+    return SIMD_SCALAR;
+}
+
+const char *simd_level_name(SimdLevel level) {
+    static const char *const names[] = { "scalar", "sse2", "avx2" };
+    return names[level];
+}
+
+static SimdLevel usable_level(SimdLevel level) {
+    SimdLevel best = simd_best_level();
+    return (level > best) ? best : level;
+}
+
+size_t unsync_decode_with(SimdLevel level, uint8_t *dst, const uint8_t *src, size_t size) {
+    switch (usable_level(level)) {
+#ifdef SIMD_X86
+    case SIMD_AVX2: return unsync_decode_avx2(dst, src, size);
+    case SIMD_SSE2: return unsync_decode_sse2(dst, src, size);
+#endif
+    default:        return unsync_decode_scalar(dst, src, size);
+    }
+}
+
+size_t unsync_encode_with(SimdLevel level, uint8_t *dst, const uint8_t *src, size_t size) {
+    switch (usable_level(level)) {
+#ifdef SIMD_X86
+    case SIMD_AVX2: return unsync_encode_avx2(dst, src, size);
+    case SIMD_SSE2: return unsync_encode_sse2(dst, src, size);
+#endif
+    default:        return unsync_encode_scalar(dst, src, size);
+    }
+}
+
+size_t padding_start_with(SimdLevel level, const uint8_t *data, size_t size) {
+    switch (usable_level(level)) {
+#ifdef SIMD_X86
+    case SIMD_AVX2: return padding_start_avx2(data, size);
+    case SIMD_SSE2: return padding_start_sse2(data, size);
+#endif
+    default:        return padding_start_scalar(data, size);
+    }
+}
+
+size_t frame_sync_find_with(SimdLevel level, const uint8_t *data, size_t size) {
+    switch (usable_level(level)) {
+#ifdef SIMD_X86
+    case SIMD_AVX2: return frame_sync_find_avx2(data, size);
+    case SIMD_SSE2: return frame_sync_find_sse2(data, size);
+#endif
+    default:        return frame_sync_find_scalar(data, size);
+    }
+}
+
+size_t unsync_decode(uint8_t *dst, const uint8_t *src, size_t size) {
+    return unsync_decode_with(SIMD_AVX2, dst, src, size);
+}
+
+size_t unsync_encode(uint8_t *dst, const uint8_t *src, size_t size) {
+    return unsync_encode_with(SIMD_AVX2, dst, src, size);
+}
+
+size_t padding_start(const uint8_t *data, size_t size) {
+    return padding_start_with(SIMD_AVX2, data, size);
+}
+
+size_t frame_sync_find(const uint8_t *data, size_t size) {
+    return frame_sync_find_with(SIMD_AVX2, data, size);
+}
@@ -0,0 +1,39 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// --- Vectorized Byte Kernels ---
+// Unsynchronisation, padding and MPEG frame sync scans over whole buffers. Each kernel has a scalar,
+// an SSE2 and an AVX2 version; the plain entry points use the best one the CPU supports.
+// Blocks without a byte of interest (0xFF, or non-zero for the padding scan) are handled
+// 16/32 bytes at a time, so artwork and padding cost about as much as a memcpy.
+typedef enum {
+    SIMD_SCALAR,
+    SIMD_SSE2,
+    SIMD_AVX2
+} SimdLevel;
+
+SimdLevel simd_best_level(void);
+const char *simd_level_name(SimdLevel level);
+
+// Drops the 0x00 stuffed after every 0xFF. May run in place (dst == src); returns the new size.
+size_t unsync_decode(uint8_t *dst, const uint8_t *src, size_t size);
+// Stuffs a 0x00 after every 0xFF that precedes 0x00, 0xE0-0xFF or the end of the buffer.
+// dst must hold 2 * size bytes and must not overlap src; returns the new size.
+size_t unsync_encode(uint8_t *dst, const uint8_t *src, size_t size);
+// Offset where the trailing run of zero bytes (the padding) starts; size if there is none
+size_t padding_start(const uint8_t *data, size_t size);
+// Offset of the first MPEG frame sync candidate (0xFF, then a byte with its top 3 bits set);
+// size if there is none. The frame header still has to be checked.
+size_t frame_sync_find(const uint8_t *data, size_t size);
+
+// The same, forcing one implementation (used by the benchmarks). A level the CPU lacks
+// falls back to the best one it has.
+size_t unsync_decode_with(SimdLevel level, uint8_t *dst, const uint8_t *src, size_t size);
+size_t unsync_encode_with(SimdLevel level, uint8_t *dst, const uint8_t *src, size_t size);
+size_t padding_start_with(SimdLevel level, const uint8_t *data, size_t size);
+size_t frame_sync_find_with(SimdLevel level, const uint8_t *data, size_t size);
+
+#endif // SIMD_H
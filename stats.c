@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include "stats.h"
+
+#ifdef MP3_STATS
+
+static const char *const counter_names[STAT_COUNTER_COUNT] = {
+    "syscalls", "bytes_read", "bytes_written", "frames_parsed", "bytes_copied"
+};
+static const char *const phase_names[PHASE_COUNT] = {
+    "open", "header", "frames", "tag_write", "audio_copy", "rename"
+};
+
+// --- Per-thread block, linked into a global list on first use and never freed ---
+typedef struct ThreadStats {
+    uint64_t counters[STAT_COUNTER_COUNT];
+    uint64_t phase_ns[PHASE_COUNT];
+    uint64_t phase_calls[PHASE_COUNT];
+    struct ThreadStats *next;
+} ThreadStats;
+
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static ThreadStats *registry = NULL;
+static _Thread_local ThreadStats *thread_stats = NULL;
+
+static ThreadStats *current_stats(void) {
+    if (!thread_stats) {
+        ThreadStats *stats = calloc(1, sizeof(ThreadStats));
+        if (!stats) {
+            static ThreadStats overflow; // Out of memory: lose precision, not the process
+            return &overflow;
+        }
+        pthread_mutex_lock(&registry_lock);
+        stats->next = registry;
+        registry = stats;
+        pthread_mutex_unlock(&registry_lock);
+        thread_stats = stats;
+    }
+    return thread_stats;
+}
+
+void stats_add(StatCounter counter, uint64_t amount) {
+    current_stats()->counters[counter] += amount;
+}
+
+uint64_t stats_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+void stats_add_time(StatPhase phase, uint64_t start) {
+    ThreadStats *stats = current_stats();
+    stats->phase_ns[phase] += stats_now() - start;
+    stats->phase_calls[phase]++;
+}
+
+bool stats_enabled(void) {
+    return true;
+}
+
+// Sums every thread's block; meant to be called once the work is done
+void stats_dump_json(FILE *out) {
+    ThreadStats total;
+    int threads = 0;
+    memset(&total, 0, sizeof(total));
+
+    pthread_mutex_lock(&registry_lock);
+    for (ThreadStats *stats = registry; stats; stats = stats->next) {
+        for (int i = 0; i < STAT_COUNTER_COUNT; i++) {
+            total.counters[i] += stats->counters[i];
+        }
+        for (int i = 0; i < PHASE_COUNT; i++) {
+            total.phase_ns[i] += stats->phase_ns[i];
+            total.phase_calls[i] += stats->phase_calls[i];
+        }
+        threads++;
+    }
+    pthread_mutex_unlock(&registry_lock);
+
+    fprintf(out, "{\"threads\":%d", threads);
+    for (int i = 0; i < STAT_COUNTER_COUNT; i++) {
+        fprintf(out, ",\"%s\":%llu", counter_names[i], (unsigned long long)total.counters[i]);
+    }
+    fprintf(out, ",\"phases\":{");
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        fprintf(out, "%s\"%s\":{\"calls\":%llu,\"ms\":%.3f}", i ? "," : "", phase_names[i],
+                (unsigned long long)total.phase_calls[i], total.phase_ns[i] / 1e6);
+    }
+    fprintf(out, "}}\n");
+}
+
+#else
+
+bool stats_enabled(void) {
+    return false;
+}
+
+void stats_dump_json(FILE *out) {
+    fprintf(out, "{\"error\":\"statistics not compiled in (build with -DMP3_STATS)\"}\n");
+}
+
+#endif // MP3_STATS
\ No newline at end of file
@@ -0,0 +1,46 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include "types.h"
+
+// --- I/O and Timing Instrumentation (compile with -DMP3_STATS) ---
+// Counters and phase timers are kept per thread and merged when dumped, so the hot paths
+// never share a cache line. Without MP3_STATS every macro compiles to nothing.
+typedef enum {
+    STAT_SYSCALLS,
+    STAT_BYTES_READ,
+    STAT_BYTES_WRITTEN,
+    STAT_FRAMES_PARSED,
+    STAT_BYTES_COPIED,
+    STAT_COUNTER_COUNT
+} StatCounter;
+
+typedef enum {
+    PHASE_OPEN,
+    PHASE_HEADER,             // Header and tag read
+    PHASE_FRAMES,             // Frame walk / tag rebuild
+    PHASE_TAG_WRITE,
+    PHASE_AUDIO_COPY,
+    PHASE_RENAME,             // remove + rename at the end of a rewrite
+    PHASE_COUNT
+} StatPhase;
+
+#ifdef MP3_STATS
+void stats_add(StatCounter counter, uint64_t amount);
+uint64_t stats_now(void);
+void stats_add_time(StatPhase phase, uint64_t start);
+
+#define STATS_ADD(counter, amount) stats_add((counter), (amount))
+#define STATS_TIMER_START(name) uint64_t name = stats_now()
+#define STATS_TIMER_STOP(phase, name) stats_add_time((phase), (name))
+#else
+#define STATS_ADD(counter, amount) ((void)0)
+#define STATS_TIMER_START(name) ((void)0)
+#define STATS_TIMER_STOP(phase, name) ((void)0)
+#endif
+
+bool stats_enabled(void);
+void stats_dump_json(FILE *out);
+
+#endif // STATS_H
\ No newline at end of file
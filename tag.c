@@ -0,0 +1,210 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "tag.h"
+#include "helper.h"
+#include "frames.h"
+
+void tag_data_init(TagData *tag) {
+    memset(tag, 0, sizeof(TagData));
+}
+
+bool tag_data_init_fixed(TagData *tag, void *memory, size_t size) {
+    memset(tag, 0, sizeof(TagData));
+    uintptr_t start = (uintptr_t)memory;
+    size_t skip = (_Alignof(TagFrame) - start % _Alignof(TagFrame)) % _Alignof(TagFrame);
+    if (!memory || size < skip + sizeof(TagFrame) + ID3_HEADER_SIZE) {
+        return false;
+    }
+    size -= skip;
+
+    size_t frame_bytes = size / 4;
+    tag->frames = (TagFrame *)(start + skip);
+    tag->frame_capacity = (uint32_t)(frame_bytes / sizeof(TagFrame));
+    if (tag->frame_capacity == 0) {
+        tag->frame_capacity = 1;
+    }
+    tag->arena = (uint8_t *)(tag->frames + tag->frame_capacity);
+    tag->arena_capacity = size - tag->frame_capacity * sizeof(TagFrame);
+    tag->fixed = true;
+    return true;
+}
+
+void tag_data_reset(TagData *tag) {
+    memset(&tag->header, 0, sizeof(ID3Header));
+    tag->frames_end_pos = 0;
+    tag->frame_count = 0;
+    tag->arena_used = 0;
+    tag->overflow = false;
+}
+
+void tag_data_free(TagData *tag) {
+    if (tag->fixed) {
+        tag_data_reset(tag);
+        return;
+    }
+    free(tag->frames);
+    free(tag->arena);
+    tag_data_init(tag);
+}
+
+// Makes room for `size` bytes in total; the arena only ever grows (contents are kept)
+uint8_t *tag_arena_reserve(TagData *tag, size_t size) {
+    if (size > tag->arena_capacity && tag->fixed) {
+        tag->overflow = true;
+        return NULL;
+    }
+    if (size > tag->arena_capacity) {
+        size_t new_capacity = tag->arena_capacity ? tag->arena_capacity : TAG_READ_AHEAD;
+        while (new_capacity < size) {
+            new_capacity *= 2;
+        }
+        uint8_t *grown = realloc(tag->arena, new_capacity);
+        if (!grown) {
+            tag->overflow = true;
+            return NULL;
+        }
+        tag->arena = grown;
+        tag->arena_capacity = new_capacity;
+    }
+    return tag->arena;
+}
+
+// Copies a payload to the end of the arena and returns where it landed
+bool tag_arena_append(TagData *tag, const uint8_t *data, size_t size, uint32_t *offset) {
+    if (!tag_arena_reserve(tag, tag->arena_used + size)) {
+        return false;
+    }
+    memcpy(tag->arena + tag->arena_used, data, size);
+    *offset = tag->arena_used;
+    tag->arena_used += size;
+    return true;
+}
+
+bool tag_add_frame(TagData *tag, uint32_t id, uint32_t pos, uint32_t size, uint16_t flags, uint32_t data) {
+    if (tag->frame_count == tag->frame_capacity && tag->fixed) {
+        tag->overflow = true;
+        return false;
+    }
+    if (tag->frame_count == tag->frame_capacity) {
+        uint32_t new_capacity = tag->frame_capacity ? tag->frame_capacity * 2 : TAG_INITIAL_FRAMES;
+        TagFrame *grown = realloc(tag->frames, new_capacity * sizeof(TagFrame));
+        if (!grown) {
+            tag->overflow = true;
+            return false;
+        }
+        tag->frames = grown;
+        tag->frame_capacity = new_capacity;
+    }
+
+    TagFrame *frame = &tag->frames[tag->frame_count++];
+    frame->id = id;
+    frame->pos = pos;
+    frame->size = size;
+    frame->flags = flags;
+    frame->data = data;
+    return true;
+}
+
+// Returns the first frame with this ID, or NULL
+const TagFrame *tag_find_frame(const TagData *tag, const char *frame_id) {
+    uint32_t id = pack_frame_id((const uint8_t *)frame_id);
+    for (uint32_t i = 0; i < tag->frame_count; i++) {
+        if (tag->frames[i].id == id) {
+            return &tag->frames[i];
+        }
+    }
+    return NULL;
+}
+
+const uint8_t *tag_frame_data(const TagData *tag, const TagFrame *frame) {
+    return tag->arena + frame->data;
+}
+
+// Skips one NUL-terminated string in the given encoding (2-byte terminator for UTF-16)
+static uint32_t skip_terminated(uint8_t encoding, const uint8_t *data, uint32_t size) {
+    uint32_t i = 0;
+    if (encoding == 0x01 || encoding == 0x02) {
+        while (i + 1 < size && (data[i] != 0 || data[i + 1] != 0)) {
+            i += 2;
+        }
+        return (i + 2 <= size) ? i + 2 : size;
+    }
+    while (i < size && data[i] != 0) {
+        i++;
+    }
+    return (i + 1 <= size) ? i + 1 : size;
+}
+
+// Decodes the readable text of a frame to UTF-8:
+//   T*** -> the text, TXXX -> the value (after the description),
+//   COMM / USLT -> the text (after language and description).
+// Returns 0 (and an empty string) for frames that carry no text.
+size_t tag_frame_text(const TagData *tag, const TagFrame *frame, char *out, size_t out_size) {
+    if (out_size > 0) {
+        out[0] = '\0';
+    }
+
+    // Compressed or encrypted content is not readable text
+    FrameKind kind = frame_kind(frame->id);
+    if (frame->size < 1 || (frame->flags & (FRAME_FLAG_COMPRESSED | FRAME_FLAG_ENCRYPTED))) {
+        return 0;
+    }
+    const uint8_t *content = tag_frame_data(tag, frame);
+    uint8_t encoding = content[0];
+    const uint8_t *text = content + 1;
+    uint32_t text_size = frame->size - 1;
+
+    switch (kind) {
+    case FRAME_KIND_TEXT:
+        break;
+    case FRAME_KIND_USER_TEXT: {
+        uint32_t skip = skip_terminated(encoding, text, text_size);
+        text += skip;
+        text_size -= skip;
+        break;
+    }
+    case FRAME_KIND_COMMENT: {
+        if (text_size < 3) {
+            return 0;
+        }
+        text += 3; // Language
+        text_size -= 3;
+        uint32_t skip = skip_terminated(encoding, text, text_size);
+        text += skip;
+        text_size -= skip;
+        break;
+    }
+    default:
+        return 0;
+    }
+
+    return decode_id3_text(encoding, text, text_size, out, out_size);
+}
+
+// Text of the first frame with this ID, or 0 (empty string) if the tag doesn't have one
+size_t tag_get_text(const TagData *tag, const char *frame_id, char *out, size_t out_size) {
+    const TagFrame *frame = tag_find_frame(tag, frame_id);
+    if (!frame) {
+        if (out_size > 0) {
+            out[0] = '\0';
+        }
+        return 0;
+    }
+    return tag_frame_text(tag, frame, out, out_size);
+}
+
+const char *tag_status_string(TagStatus status) {
+    switch (status) {
+    case TAG_OK:              return "success";
+    case TAG_ERR_IO:          return "I/O error";
+    case TAG_ERR_NO_TAG:      return "no ID3 tag found";
+    case TAG_ERR_UNSUPPORTED: return "editing ID3v2.2 tags is not supported";
+    case TAG_ERR_CORRUPT:     return "corrupt tag frames";
+    case TAG_ERR_NO_SPACE:    return "tag does not fit the buffer";
+    case TAG_ERR_NO_MEMORY:   return "out of memory";
+    case TAG_ERR_TOO_LARGE:   return "tag would exceed the ID3v2 size limit";
+    case TAG_ERR_INVALID:     return "invalid argument";
+    }
+    return "unknown error";
+}
@@ -0,0 +1,29 @@
+#ifndef TAG_H
+#define TAG_H
+
+#include <stddef.h>
+#include "types.h"
+
+// --- TagData Lifetime ---
+void tag_data_init(TagData *tag);
+// Frames and arena carved out of `size` bytes of caller memory (a quarter for the frames);
+// nothing is ever allocated, and a tag too large for it sets tag->overflow
+bool tag_data_init_fixed(TagData *tag, void *memory, size_t size);
+void tag_data_reset(TagData *tag);   // Forget the frames, keep the arena and frame array
+void tag_data_free(TagData *tag);     // Frees heap buffers; a fixed TagData is only reset
+
+// --- Arena / Frame Building (used by the readers) ---
+uint8_t *tag_arena_reserve(TagData *tag, size_t size);
+bool tag_arena_append(TagData *tag, const uint8_t *data, size_t size, uint32_t *offset);
+bool tag_add_frame(TagData *tag, uint32_t id, uint32_t pos, uint32_t size, uint16_t flags, uint32_t data);
+
+// --- Frame Access ---
+const TagFrame *tag_find_frame(const TagData *tag, const char *frame_id);
+const uint8_t *tag_frame_data(const TagData *tag, const TagFrame *frame);
+size_t tag_frame_text(const TagData *tag, const TagFrame *frame, char *out, size_t out_size);
+size_t tag_get_text(const TagData *tag, const char *frame_id, char *out, size_t out_size);
+
+// --- Result Codes ---
+const char *tag_status_string(TagStatus status); // e.g. "no ID3 tag found"
+
+#endif // TAG_H
\ No newline at end of file
@@ -0,0 +1,538 @@
+#define _GNU_SOURCE // strdup, strndup, realpath, st_mtim
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include "tagindex.h"
+#include "read.h"
+#include "helper.h"
+#include "frames.h"
+
+#define TAG_INDEX_MAGIC "MP3TIDX"
+#define TAG_INDEX_VERSION 3  // 2: every frame of the tag is stored, not just TIT2/TPE1
+                             // 3: v2.2/v2.4/ID3v1 tags parsed natively
+
+// --- On-disk layout: header, fixed-size records sorted by path, then one blob ---
+typedef struct {
+    char magic[8];            // "MP3TIDX\0"
+    uint32_t version;
+    uint32_t record_count;
+    uint64_t blob_size;
+} IndexFileHeader;
+
+typedef struct {
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t path_offset;     // Into the blob (not NUL-terminated)
+    uint64_t data_offset;     // Serialized frames, into the blob
+    uint32_t path_len;
+    uint32_t data_len;        // 0 = the file has no readable tag
+} IndexRecord;
+
+// State of each mapped record during this session
+enum { RECORD_UNSEEN = 0, RECORD_SEEN = 1, RECORD_REPLACED = 2 };
+
+typedef struct {
+    char *path;
+    IndexRecord key;          // Stat key only; offsets are assigned on save
+    uint8_t *data;
+} PendingEntry;
+
+struct TagIndex {
+    char *index_path;
+
+    // Table loaded from disk (read-only mapping)
+    const uint8_t *map;
+    size_t map_size;
+    const IndexRecord *records;
+    uint32_t record_count;
+    const uint8_t *blob;
+    atomic_uchar *record_state; // Written by scan workers without the lock (see tag_index_lookup)
+
+    // New and changed entries, merged into the table on save
+    pthread_mutex_t lock;
+    PendingEntry *pending;
+    size_t pending_count;
+    size_t pending_capacity;
+
+    atomic_uint_fast64_t reused;
+    atomic_uint_fast64_t parsed;
+};
+
+// --- Serialized TagData (per record blob) ---
+// Tag header: frames_end_pos (u32), version major/revision/flags + pad (4 x u8), tag size (u32),
+// frame count (u32); then per frame: ID, pos, size (u32 each), flags + pad (2 x u16), payload.
+// Artwork (APIC) is left out: it is large and always read from the file itself.
+#define TAG_BLOB_HEADER_SIZE 16
+#define TAG_BLOB_FRAME_SIZE 16
+
+static bool is_indexed_frame(const TagFrame *frame) {
+    return frame_kind(frame->id) != FRAME_KIND_PICTURE;
+}
+
+static uint8_t *encode_tags(const TagData *tags, uint32_t *data_len) {
+    size_t total = TAG_BLOB_HEADER_SIZE;
+    for (uint32_t i = 0; i < tags->frame_count; i++) {
+        if (is_indexed_frame(&tags->frames[i])) {
+            total += TAG_BLOB_FRAME_SIZE + tags->frames[i].size;
+        }
+    }
+
+    uint8_t *out = malloc(total);
+    if (!out) {
+        return NULL;
+    }
+
+    uint32_t frame_count = 0;
+    size_t pos = TAG_BLOB_HEADER_SIZE;
+    for (uint32_t i = 0; i < tags->frame_count; i++) {
+        const TagFrame *frame = &tags->frames[i];
+        if (!is_indexed_frame(frame)) {
+            continue;
+        }
+        uint32_t flags = frame->flags;
+        memcpy(out + pos, &frame->id, 4);
+        memcpy(out + pos + 4, &frame->pos, 4);
+        memcpy(out + pos + 8, &frame->size, 4);
+        memcpy(out + pos + 12, &flags, 4);
+        memcpy(out + pos + TAG_BLOB_FRAME_SIZE, tag_frame_data(tags, frame), frame->size);
+        pos += TAG_BLOB_FRAME_SIZE + frame->size;
+        frame_count++;
+    }
+
+    memcpy(out, &tags->frames_end_pos, 4);
+    out[4] = tags->header.version_major;
+    out[5] = tags->header.version_revision;
+    out[6] = tags->header.flags;
+    out[7] = 0;
+    memcpy(out + 8, &tags->header.size, 4);
+    memcpy(out + 12, &frame_count, 4);
+
+    *data_len = total;
+    return out;
+}
+
+static bool decode_tags(const uint8_t *data, uint32_t data_len, TagData *tags) {
+    tag_data_reset(tags);
+    if (data_len < TAG_BLOB_HEADER_SIZE) {
+        return false;
+    }
+
+    uint32_t frame_count;
+    memcpy(&tags->frames_end_pos, data, 4);
+    tags->header.version_major = data[4];
+    memcpy(tags->header.identifier, (data[4] == 1) ? "TAG" : "ID3", 4);
+    tags->header.version_revision = data[5];
+    tags->header.flags = data[6];
+    memcpy(&tags->header.size, data + 8, 4);
+    memcpy(&frame_count, data + 12, 4);
+
+    size_t pos = TAG_BLOB_HEADER_SIZE;
+    for (uint32_t i = 0; i < frame_count; i++) {
+        uint32_t id, frame_pos, size, flags, offset;
+        if (pos + TAG_BLOB_FRAME_SIZE > data_len) {
+            return false;
+        }
+        memcpy(&id, data + pos, 4);
+        memcpy(&frame_pos, data + pos + 4, 4);
+        memcpy(&size, data + pos + 8, 4);
+        memcpy(&flags, data + pos + 12, 4);
+        pos += TAG_BLOB_FRAME_SIZE;
+        if (size > data_len - pos ||
+            !tag_arena_append(tags, data + pos, size, &offset) ||
+            !tag_add_frame(tags, id, frame_pos, size, flags, offset)) {
+            return false;
+        }
+        pos += size;
+    }
+    return true;
+}
+
+static void fill_key(IndexRecord *key, const struct stat *st) {
+    memset(key, 0, sizeof(IndexRecord));
+    key->dev = st->st_dev;
+    key->ino = st->st_ino;
+    key->size = st->st_size;
+    key->mtime_sec = st->st_mtim.tv_sec;
+    key->mtime_nsec = st->st_mtim.tv_nsec;
+}
+
+static bool same_key(const IndexRecord *a, const IndexRecord *b) {
+    return a->dev == b->dev && a->ino == b->ino && a->size == b->size &&
+           a->mtime_sec == b->mtime_sec && a->mtime_nsec == b->mtime_nsec;
+}
+
+static int compare_path(const char *path, size_t path_len, const uint8_t *other, size_t other_len) {
+    size_t common = (path_len < other_len) ? path_len : other_len;
+    int cmp = memcmp(path, other, common);
+    if (cmp != 0) {
+        return cmp;
+    }
+    return (path_len > other_len) - (path_len < other_len);
+}
+
+// Binary search of the mapped table; returns the record index or -1
+static long find_record(const TagIndex *index, const char *filepath) {
+    size_t path_len = strlen(filepath);
+    long low = 0;
+    long high = (long)index->record_count - 1;
+
+    while (low <= high) {
+        long mid = low + (high - low) / 2;
+        const IndexRecord *record = &index->records[mid];
+        int cmp = compare_path(filepath, path_len, index->blob + record->path_offset, record->path_len);
+        if (cmp == 0) {
+            return mid;
+        }
+        if (cmp < 0) {
+            high = mid - 1;
+        } else {
+            low = mid + 1;
+        }
+    }
+    return -1;
+}
+
+// Every path and data range inside the blob, paths in strictly increasing order (find_record
+// relies on it). The file may be truncated or damaged: one bad record discards the table.
+static bool records_valid(const IndexRecord *records, uint32_t record_count, const uint8_t *blob,
+                          uint64_t blob_size) {
+    for (uint32_t i = 0; i < record_count; i++) {
+        const IndexRecord *record = &records[i];
+        if (record->path_offset > blob_size || record->path_len > blob_size - record->path_offset ||
+            record->data_offset > blob_size || record->data_len > blob_size - record->data_offset) {
+            return false;
+        }
+        if (i > 0 && compare_path((const char *)blob + records[i - 1].path_offset, records[i - 1].path_len,
+                                  blob + record->path_offset, record->path_len) >= 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Maps an existing index file; anything unreadable, damaged or from another version is
+// ignored (rebuilt)
+static void load_index_file(TagIndex *index) {
+    int fd = open(index->index_path, O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(IndexFileHeader)) {
+        close(fd);
+        return;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return;
+    }
+
+    const IndexFileHeader *header = map;
+    size_t records_size = (size_t)header->record_count * sizeof(IndexRecord);
+    size_t body_size = (size_t)st.st_size - sizeof(IndexFileHeader);
+    const IndexRecord *records = (const IndexRecord *)((const uint8_t *)map + sizeof(IndexFileHeader));
+    if (memcmp(header->magic, TAG_INDEX_MAGIC, 8) != 0 || header->version != TAG_INDEX_VERSION ||
+        records_size > body_size || header->blob_size != body_size - records_size ||
+        !records_valid(records, header->record_count, (const uint8_t *)records + records_size, header->blob_size)) {
+        munmap(map, st.st_size);
+        return;
+    }
+
+    index->record_state = calloc(header->record_count ? header->record_count : 1, sizeof(atomic_uchar));
+    if (!index->record_state) {
+        munmap(map, st.st_size);
+        return;
+    }
+
+    index->map = map;
+    index->map_size = st.st_size;
+    index->record_count = header->record_count;
+    index->records = (const IndexRecord *)(index->map + sizeof(IndexFileHeader));
+    index->blob = index->map + sizeof(IndexFileHeader) + records_size;
+}
+
+// Drops the mapped table and every pending entry
+static void reset_loaded_state(TagIndex *index) {
+    if (index->map) {
+        munmap((void *)index->map, index->map_size);
+    }
+    for (size_t i = 0; i < index->pending_count; i++) {
+        free(index->pending[i].path);
+        free(index->pending[i].data);
+    }
+    free(index->record_state);
+
+    index->map = NULL;
+    index->map_size = 0;
+    index->records = NULL;
+    index->record_count = 0;
+    index->blob = NULL;
+    index->record_state = NULL;
+    index->pending_count = 0;
+}
+
+TagIndex *tag_index_open(const char *index_path) {
+    TagIndex *index = calloc(1, sizeof(TagIndex));
+    if (!index) {
+        return NULL;
+    }
+    index->index_path = strdup(index_path);
+    if (!index->index_path) {
+        free(index);
+        return NULL;
+    }
+
+    pthread_mutex_init(&index->lock, NULL);
+    atomic_init(&index->reused, 0);
+    atomic_init(&index->parsed, 0);
+    load_index_file(index);
+    return index;
+}
+
+// A hit needs the same path and the same (dev, inode, size, mtime) as when it was stored
+bool tag_index_lookup(TagIndex *index, const char *filepath, const struct stat *st,
+                      TagData *tags, bool *has_tags)
+{
+    long found = find_record(index, filepath);
+    if (found < 0) {
+        return false;
+    }
+
+    const IndexRecord *record = &index->records[found];
+    IndexRecord key;
+    fill_key(&key, st);
+    if (!same_key(record, &key)) {
+        return false;
+    }
+
+    *has_tags = record->data_len > 0 &&
+                decode_tags(index->blob + record->data_offset, record->data_len, tags);
+    // Only UNSEEN -> SEEN: a tag_index_put of the same path may already have marked it REPLACED
+    unsigned char unseen = RECORD_UNSEEN;
+    atomic_compare_exchange_strong(&index->record_state[found], &unseen, RECORD_SEEN);
+    atomic_fetch_add(&index->reused, 1);
+    return true;
+}
+
+// Stores freshly parsed tags (NULL = the file has no readable tag)
+bool tag_index_put(TagIndex *index, const char *filepath, const struct stat *st, const TagData *tags) {
+    uint32_t data_len = 0;
+    PendingEntry entry;
+    fill_key(&entry.key, st);
+    entry.path = strdup(filepath);
+    entry.data = tags ? encode_tags(tags, &data_len) : malloc(1);
+    entry.key.data_len = data_len;
+    if (!entry.path || !entry.data) {
+        free(entry.path);
+        free(entry.data);
+        return false;
+    }
+
+    pthread_mutex_lock(&index->lock);
+    if (index->pending_count == index->pending_capacity) {
+        size_t new_capacity = index->pending_capacity ? index->pending_capacity * 2 : 256;
+        PendingEntry *grown = realloc(index->pending, new_capacity * sizeof(PendingEntry));
+        if (!grown) {
+            pthread_mutex_unlock(&index->lock);
+            free(entry.path);
+            free(entry.data);
+            return false;
+        }
+        index->pending = grown;
+        index->pending_capacity = new_capacity;
+    }
+    index->pending[index->pending_count++] = entry;
+
+    long found = find_record(index, filepath);
+    if (found >= 0) {
+        atomic_store(&index->record_state[found], RECORD_REPLACED);
+    }
+    pthread_mutex_unlock(&index->lock);
+
+    atomic_fetch_add(&index->parsed, 1);
+    return true;
+}
+
+// Entries are keyed on absolute paths (as produced by scan_library), so resolve it first
+bool tag_index_refresh_file(TagIndex *index, const char *filepath) {
+    char resolved[PATH_MAX];
+    struct stat st;
+    if (!realpath(filepath, resolved) || stat(resolved, &st) != 0) {
+        return false;
+    }
+
+    TagData tags;
+    tag_data_init(&tags);
+    bool ok = read_tags_from_file(resolved, &tags);
+    ok = tag_index_put(index, resolved, &st, ok ? &tags : NULL);
+    tag_data_free(&tags);
+    return ok;
+}
+
+static int compare_pending(const void *a, const void *b) {
+    const PendingEntry *pa = a;
+    const PendingEntry *pb = b;
+    int cmp = strcmp(pa->path, pb->path);
+    if (cmp != 0) {
+        return cmp;
+    }
+    // Same path stored twice: keep the order of the puts so the last one wins
+    return (pa < pb) ? -1 : (pa > pb);
+}
+
+static bool write_record(FILE *fp, IndexRecord record, const char *path, const uint8_t *data,
+                         uint64_t *blob_offset, FILE *blob_fp)
+{
+    record.path_offset = *blob_offset;
+    record.path_len = strlen(path);
+    record.data_offset = record.path_offset + record.path_len;
+    *blob_offset = record.data_offset + record.data_len;
+
+    return fwrite(&record, sizeof(IndexRecord), 1, fp) == 1 &&
+           fwrite(path, 1, record.path_len, blob_fp) == record.path_len &&
+           fwrite(data, 1, record.data_len, blob_fp) == record.data_len;
+}
+
+// Merges the mapped table with the pending entries and atomically replaces the index file
+bool tag_index_save(TagIndex *index, bool prune_unseen) {
+    pthread_mutex_lock(&index->lock);
+    if (index->pending_count > 1) {
+        qsort(index->pending, index->pending_count, sizeof(PendingEntry), compare_pending);
+    }
+
+    // Drop all but the last put for each path
+    size_t unique = 0;
+    for (size_t i = 0; i < index->pending_count; i++) {
+        if (i + 1 < index->pending_count && strcmp(index->pending[i].path, index->pending[i + 1].path) == 0) {
+            free(index->pending[i].path);
+            free(index->pending[i].data);
+            continue;
+        }
+        index->pending[unique++] = index->pending[i];
+    }
+    index->pending_count = unique;
+
+    size_t path_len = strlen(index->index_path);
+    char *temp_path = malloc(path_len + sizeof(TEMP_SUFFIX));
+    char *blob_path = malloc(path_len + sizeof(TEMP_SUFFIX) + 5);
+    FILE *fp = NULL;
+    FILE *blob_fp = NULL;
+    if (temp_path && blob_path) {
+        sprintf(temp_path, "%s%s", index->index_path, TEMP_SUFFIX);
+        sprintf(blob_path, "%s%s.blob", index->index_path, TEMP_SUFFIX);
+        fp = fopen(temp_path, "w+b");
+        blob_fp = fopen(blob_path, "w+b");
+    }
+    if (!fp || !blob_fp) {
+        if (fp) fclose(fp);
+        if (blob_fp) fclose(blob_fp);
+        if (temp_path) remove(temp_path);
+        if (blob_path) remove(blob_path);
+        free(temp_path);
+        free(blob_path);
+        pthread_mutex_unlock(&index->lock);
+        return false;
+    }
+
+    // Header first (count patched at the end), then the records in path order
+    IndexFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TAG_INDEX_MAGIC, 8);
+    header.version = TAG_INDEX_VERSION;
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+
+    uint64_t blob_offset = 0;
+    size_t r = 0;
+    size_t p = 0;
+    while (ok && (r < index->record_count || p < index->pending_count)) {
+        // Skip mapped records that were replaced, or not seen when pruning
+        if (r < index->record_count &&
+            (atomic_load(&index->record_state[r]) == RECORD_REPLACED ||
+             (prune_unseen && atomic_load(&index->record_state[r]) != RECORD_SEEN))) {
+            r++;
+            continue;
+        }
+
+        bool take_pending;
+        if (r >= index->record_count) {
+            take_pending = true;
+        } else if (p >= index->pending_count) {
+            take_pending = false;
+        } else {
+            const IndexRecord *record = &index->records[r];
+            const char *pending_path = index->pending[p].path;
+            take_pending = compare_path(pending_path, strlen(pending_path),
+                                        index->blob + record->path_offset, record->path_len) <= 0;
+        }
+
+        if (take_pending) {
+            PendingEntry *entry = &index->pending[p++];
+            ok = write_record(fp, entry->key, entry->path, entry->data, &blob_offset, blob_fp);
+        } else {
+            const IndexRecord *record = &index->records[r++];
+            char *path = strndup((const char *)index->blob + record->path_offset, record->path_len);
+            ok = path && write_record(fp, *record, path, index->blob + record->data_offset,
+                                      &blob_offset, blob_fp);
+            free(path);
+        }
+        header.record_count++;
+    }
+
+    // Append the blob after the records
+    char copy_buffer[65536];
+    size_t bytes_read;
+    if (ok && fseek(blob_fp, 0, SEEK_SET) == 0) {
+        while ((bytes_read = fread(copy_buffer, 1, sizeof(copy_buffer), blob_fp)) > 0) {
+            if (fwrite(copy_buffer, 1, bytes_read, fp) != bytes_read) {
+                ok = false;
+                break;
+            }
+        }
+    }
+    header.blob_size = blob_offset;
+    ok = ok && fseek(fp, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, fp) == 1;
+
+    ok = (fclose(fp) == 0) && ok;
+    fclose(blob_fp);
+    remove(blob_path);
+    if (ok) {
+        ok = rename(temp_path, index->index_path) == 0;
+    } else {
+        remove(temp_path);
+    }
+    free(temp_path);
+    free(blob_path);
+
+    // Continue from the file just written
+    if (ok) {
+        reset_loaded_state(index);
+        load_index_file(index);
+    }
+    pthread_mutex_unlock(&index->lock);
+    return ok;
+}
+
+void tag_index_counts(const TagIndex *index, uint64_t *reused, uint64_t *parsed) {
+    *reused = atomic_load(&index->reused);
+    *parsed = atomic_load(&index->parsed);
+}
+
+void tag_index_close(TagIndex *index) {
+    reset_loaded_state(index);
+    pthread_mutex_destroy(&index->lock);
+    free(index->pending);
+    free(index->index_path);
+    free(index);
+}
\ No newline at end of file
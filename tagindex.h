@@ -0,0 +1,24 @@
+#ifndef TAGINDEX_H
+#define TAGINDEX_H
+
+#include <sys/stat.h>
+#include "types.h"
+
+// --- Persistent Tag Index ---
+// A versioned, memory-mappable table of parsed tags sorted by path. Each entry is keyed by
+// (device, inode, size, mtime) so a rescan only re-parses files whose stat changed.
+// Lookups and puts may run from many threads; save must not overlap with them.
+
+TagIndex *tag_index_open(const char *index_path);   // Empty index if the file doesn't exist yet
+bool tag_index_lookup(TagIndex *index, const char *filepath, const struct stat *st,
+                      TagData *tags, bool *has_tags);
+bool tag_index_put(TagIndex *index, const char *filepath, const struct stat *st, const TagData *tags);
+bool tag_index_save(TagIndex *index, bool prune_unseen); // prune_unseen drops files not looked up
+void tag_index_close(TagIndex *index);
+
+void tag_index_counts(const TagIndex *index, uint64_t *reused, uint64_t *parsed);
+
+// Re-reads one file and stores its tags (used after edits)
+bool tag_index_refresh_file(TagIndex *index, const char *filepath);
+
+#endif // TAGINDEX_H
\ No newline at end of file
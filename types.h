@@ -7,34 +7,252 @@
 // --- Constants ---
 #define ID3_HEADER_SIZE 10
 #define ID3_FRAME_HEADER_SIZE 10
-#define MAX_TITLE_LEN 255
+#define ID3V22_FRAME_HEADER_SIZE 6 // v2.2: 3-byte ID, 3-byte size, no flags
+#define ID3V1_TAG_SIZE 128         // "TAG" trailer in the last 128 bytes of the file
+#define ID3_MAX_TAG_SIZE ((1u << 28) - 1) // Largest tag size a SyncSafe integer can hold
 #define TEMP_SUFFIX "_temp"
+#define BACKUP_SUFFIX "_orig"     // Batch edits: hard link to the original until the batch ends
+#define EDIT_GROUP_FILES 256      // Batch edits: files per journal/fsync group
+#define EDIT_GROUP_BYTES (64u << 20) // Batch edits: new tag bytes held per group
+#define DEFAULT_TAG_PADDING 1024  // Padding reserved when a tag has to grow
+#define MAX_EDIT_FRAMES 16
+#define TAG_READ_AHEAD 16384      // First read of a file: header plus (usually) the whole tag
+#define TAG_INITIAL_FRAMES 32
+#define COPY_BUFFER_SIZE (1 << 20) // Userspace fallback for audio copies
+#define OUTPUT_BUFFER_SIZE (1 << 20) // Bulk output is written in chunks of this size
+#define OUTPUT_TEXT_MAX 65536      // Longest frame value written by the bulk output
+#define URING_FILES_IN_FLIGHT 256  // io_uring scan engine: files being opened/read at once
+#define AUDIO_PROBE_SIZE 65536     // Audio info: bytes read at a time while looking for frames
+#define AUDIO_SAMPLE_FRAMES 64     // Audio info (fast): frames checked for a constant bitrate
+#define AUDIO_CHUNK_MIN (8u << 20) // Audio info (full walk): smallest share of a file per thread
+#define DUPES_PREFIX_SIZE 65536   // Duplicate audio: leading payload bytes hashed before the rest
+#define DUPES_READ_SIZE (4u << 20) // Duplicate audio: aligned read size for the full hash
 
-// --- ID3v2.3 Header Structure (10 bytes) ---
+// --- ID3 Tag Header Flags ---
+#define ID3_FLAG_UNSYNC 0x80      // Every frame is unsynchronised
+#define ID3_FLAG_EXTENDED 0x40    // Extended header follows (v2.2: the tag is compressed)
+#define ID3_FLAG_FOOTER 0x10      // v2.4: 10-byte footer after the tag
+
+// --- ID3v2 Header Structure (10 bytes) ---
 typedef struct {
-    char identifier[4];       // "ID3"
-    uint8_t version_major;    // 03
+    char identifier[4];       // "ID3" ("TAG" for a tag taken from an ID3v1 trailer)
+    uint8_t version_major;    // 2, 3 or 4 (1 for ID3v1)
     uint8_t version_revision; // 00
     uint8_t flags;
     uint32_t size;            // Total size of the tag, decoded SyncSafe
 } ID3Header;
 
-// --- ID3v2.3 Frame Header Structure (10 bytes) ---
+// --- Frame Flags ---
+// Stored in the v2.3 layout whatever the tag version; v2.4 flags are translated on parse.
+// The two low bits are not used by v2.3 and carry the v2.4-only flags.
+#define FRAME_FLAG_COMPRESSED 0x0080
+#define FRAME_FLAG_ENCRYPTED 0x0040
+#define FRAME_FLAG_GROUPED 0x0020
+#define FRAME_FLAG_UNSYNC 0x0002      // Payload was unsynchronised (stored payload is decoded)
+#define FRAME_FLAG_DATA_LENGTH 0x0001 // A 4-byte data length preceded the payload
+
+// --- ID3v2 Frame Header Structure (10 bytes, 6 in v2.2) ---
 typedef struct {
-    char frame_id[5];         // e.g., "TIT2"
+    char frame_id[5];         // e.g., "TIT2"; v2.2 IDs are mapped to their v2.3 names
+    uint32_t id;              // The same, packed (see frames.h)
     uint32_t size;            // Frame size (standard integer)
-    uint16_t flags;
+    uint16_t flags;           // FRAME_FLAG_*
+    uint8_t header_size;      // ID3_FRAME_HEADER_SIZE or ID3V22_FRAME_HEADER_SIZE
 } ID3FrameHeader;
 
+// --- Audio Copy Strategies (fastest first) ---
+typedef enum {
+    COPY_FAILED = 0,
+    COPY_REFLINK,             // FICLONERANGE: shares the blocks (btrfs, XFS)
+    COPY_FILE_RANGE,          // copy_file_range: in-kernel copy, may offload to the filesystem
+    COPY_SENDFILE,            // sendfile: in-kernel copy through the page cache
+    COPY_BUFFERED             // pread/pwrite through a large userspace buffer
+} CopyMethod;
+
+// --- One Frame of a Tag (payload lives in the tag's arena) ---
+typedef struct {
+    uint32_t id;              // Frame ID packed Big-Endian, e.g. 'T','I','T','2' (v2.2 IDs mapped)
+    uint32_t pos;             // Position of the frame header (relative to start of file);
+                              // 0 for frames taken from an ID3v1 trailer
+    uint32_t size;            // Frame content size (without the header and flag additions)
+    uint16_t flags;           // FRAME_FLAG_*
+    uint32_t data;            // Offset of the content in the arena (always resynchronised)
+} TagFrame;
+
+// --- Result Codes (library API, see mp3tag.h) ---
+typedef enum {
+    TAG_OK = 0,
+    TAG_ERR_IO,               // open/read/write failed (the errno is kept alongside)
+    TAG_ERR_NO_TAG,           // Neither an ID3v2 tag nor an ID3v1 trailer
+    TAG_ERR_UNSUPPORTED,      // Editing a v2.2 tag
+    TAG_ERR_CORRUPT,          // A frame runs past the end of the tag
+    TAG_ERR_NO_SPACE,         // The tag does not fit the caller's fixed buffer
+    TAG_ERR_NO_MEMORY,
+    TAG_ERR_TOO_LARGE,        // The edited tag would exceed the 256 MB a SyncSafe size can hold
+    TAG_ERR_INVALID           // Bad argument (e.g. an empty edit set)
+} TagStatus;
+
 // --- Main Data Structure for Tag Content ---
+// Every frame of the tag is kept. The arena holds all payloads in one allocation and,
+// like the frame array, is kept across tag_data_reset so a scan reuses it file after file.
+// A fixed TagData (tag_data_init_fixed) lives in caller memory and never grows: a tag that
+// does not fit sets `overflow` instead.
 typedef struct {
-    char title[MAX_TITLE_LEN + 1]; // TIT2
-    uint32_t title_pos;            // Position of TIT2 frame (relative to start of file)
-    uint32_t title_size_raw;       // Size of the original TIT2 frame
+    ID3Header header;
+    uint32_t frames_end_pos;       // End of the last frame / start of padding (relative to start of file)
+
+    TagFrame *frames;
+    uint32_t frame_count;
+    uint32_t frame_capacity;
 
-    char artist[MAX_TITLE_LEN + 1]; // TPE1 <--- NEW FIELD
-    uint32_t artist_pos;           // Position of TPE1 frame
-    uint32_t artist_size_raw;      // Size of the original TPE1 frame
+    uint8_t *arena;
+    size_t arena_used;
+    size_t arena_capacity;
+
+    bool fixed;                    // Caller-owned frames and arena: never reallocated or freed
+    bool overflow;                 // A frame or payload did not fit (or could not be allocated)
 } TagData;
 
+// --- Frame Index Entry (memory-mapped reader) ---
+typedef struct {
+    uint32_t id;              // Frame ID packed Big-Endian, e.g. 'T','I','T','2'
+    uint32_t offset;          // Position of the frame header (relative to start of file)
+    uint32_t data;            // Position of the content, after the header and any flag additions
+    uint32_t size;            // Frame content size
+    uint16_t flags;           // FRAME_FLAG_*
+} FrameIndexEntry;
+
+// --- Text View: frame text inside the mapping, decoded only on request ---
+typedef struct {
+    const uint8_t *data;      // Text bytes (after the encoding byte)
+    uint32_t size;
+    uint8_t encoding;         // 0 = ISO-8859-1, 1 = UTF-16 (BOM), 2 = UTF-16BE, 3 = UTF-8
+} TextView;
+
+// --- Memory-Mapped Tag: zero-copy access to the frames of one file ---
+typedef struct {
+    const uint8_t *map;       // Mapping of the file
+    size_t map_size;
+    ID3Header header;
+    FrameIndexEntry *frames;  // Built lazily on the first lookup
+    uint32_t frame_count;
+    bool indexed;
+} MappedTag;
+
+// --- MPEG Audio Summary (see audio.h) ---
+typedef enum {
+    AUDIO_SCAN_NONE,          // Tags only
+    AUDIO_SCAN_FAST,          // Xing/Info/VBRI header, else the first frames (CBR estimate)
+    AUDIO_SCAN_FULL           // Xing/Info/VBRI header, else every frame is counted
+} AudioScanMode;
+
+typedef enum {
+    AUDIO_FROM_NONE,          // No audio frames found
+    AUDIO_FROM_XING,          // Xing (VBR) or Info (CBR) header in the first frame
+    AUDIO_FROM_VBRI,          // Fraunhofer VBRI header in the first frame
+    AUDIO_FROM_ESTIMATE,      // Audio size and the bitrate of the first frames
+    AUDIO_FROM_WALK           // Every frame counted
+} AudioSource;
+
+typedef struct {
+    AudioSource source;       // Where the duration came from
+    uint8_t version;          // 10 = MPEG-1, 20 = MPEG-2, 25 = MPEG-2.5
+    uint8_t layer;            // 1, 2 or 3
+    uint8_t channels;
+    bool vbr;
+    uint32_t sample_rate;     // Hz
+    uint32_t bitrate;         // Average, kbit/s
+    uint64_t frames;
+    uint64_t duration_ms;
+    uint64_t audio_offset;    // First frame
+    uint64_t audio_size;      // Bytes from the first frame to the end of the audio
+} AudioInfo;
+
+// --- Library Scan: one result per file, handed to the caller's callback ---
+typedef struct {
+    const char *path;         // Valid only during the callback
+    uint64_t seq;             // Discovery order of the file within the scan; ordered: rank in path order
+    bool ok;                  // false if the file has no readable ID3v2 tag
+    TagData tags;
+    AudioInfo audio;          // Filled in when ScanOptions.audio asks for it
+} ScanResult;
+
+typedef void (*ScanCallback)(const ScanResult *result, void *user);
+typedef void (*ScanVisitFn)(const char *path, void *user); // Runs on the pool's workers
+
+typedef struct TagIndex TagIndex; // Persistent tag index (tagindex.c)
+
+typedef enum {
+    SCAN_ENGINE_POOL,         // Blocking reads on the work-stealing pool
+    SCAN_ENGINE_URING         // Batched io_uring reads; falls back to the pool if unavailable
+} ScanEngine;
+
+typedef struct {
+    int num_threads;          // 0 = one per online CPU
+    bool ordered;             // Deliver results in path order (each directory's entries sorted
+                              // byte-wise by name) instead of completion order
+    ScanCallback callback;    // Called from one thread at a time
+    void *user;
+    TagIndex *index;          // Optional: reuse unchanged entries, store re-parsed ones
+    ScanEngine engine;
+    AudioScanMode audio;      // Also read duration/bitrate (pool engine only)
+} ScanOptions;
+
+// --- Bulk Output Formats ---
+typedef enum {
+    FORMAT_TABLE,             // Human-readable table (read only)
+    FORMAT_NDJSON,            // One JSON object per file with every text frame
+    FORMAT_CSV,               // RFC 4180, fixed columns, header row
+    FORMAT_TSV                // Fixed columns, header row, \t \n \r \\ escaped
+} OutputFormat;
+
+typedef struct {
+    int fd;
+    OutputFormat format;
+    char *buffer;             // OUTPUT_BUFFER_SIZE bytes, reused for the whole stream
+    size_t used;
+    char *text;               // Scratch space for one decoded frame value
+    bool header_written;
+    bool audio_columns;       // Records carry audio info: extra CSV/TSV columns (set before the first record)
+    bool failed;
+} OutputWriter;
+
+// --- Synthetic Corpus (benchmark build) ---
+typedef struct {
+    const char *dir;
+    uint32_t count;           // Number of files
+    uint64_t min_size;        // File size range in bytes (audio is sized to fit)
+    uint64_t max_size;
+    uint32_t max_frames;      // Text frames per tag: 2..max_frames
+    uint32_t art_percent;     // Share of files carrying an APIC picture (100 KB - 3 MB)
+    uint32_t unsync_percent;  // Share of tags written with unsynchronisation
+    uint32_t max_padding;     // Padding per tag: 0..max_padding
+    uint64_t seed;
+} CorpusOptions;
+
+// --- Batch Edit: frame changes collected and applied in one pass ---
+typedef struct {
+    char frame_id[5];         // e.g., "TALB"
+    const char *value;        // New text (UTF-8), owned by the caller
+} FrameEdit;
+
+typedef struct {
+    FrameEdit edits[MAX_EDIT_FRAMES];
+    int count;
+} EditSet;
+
+// --- Planned Edit: the tag as stored and its replacement, before anything is written ---
+typedef struct {
+    int fd;                   // The file, open read-write
+    ID3Header old_header;
+    uint8_t *old_region;      // ID3 header plus tag body, exactly as stored
+    uint8_t *body;            // New tag body (unsynchronised again if the old one was)
+    size_t body_size;
+    size_t old_used;          // Bytes of the old body before its zero padding
+    bool in_place;            // The new body fits in the old tag: no need to move the audio
+    uint32_t padding;         // Padding reserved if the tag is rewritten
+    TagStatus status;         // Why the last step failed
+    int sys_errno;            // errno behind TAG_ERR_IO
+} EditPlan;
+
 #endif // TYPE_H
\ No newline at end of file
@@ -0,0 +1,239 @@
+#define _GNU_SOURCE // syscall, MAP_POPULATE, AT_FDCWD
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "uring.h"
+#include "stats.h"
+
+struct UringRing {
+    int fd;
+    void *sq_map;
+    size_t sq_map_size;
+    void *cq_map;                 // Same as sq_map with IORING_FEAT_SINGLE_MMAP
+    size_t cq_map_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    unsigned sq_local_tail;       // SQEs handed out but not yet published to the kernel
+    unsigned sq_entries;
+};
+
+// The kernel shares the head/tail words with us: tails we publish need release order,
+// heads and tails we read from it need acquire order.
+static unsigned load_acquire(const unsigned *p) {
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static void store_release(unsigned *p, unsigned value) {
+    __atomic_store_n(p, value, __ATOMIC_RELEASE);
+}
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+// Asks the kernel which opcodes it implements (5.6+); older kernels fail the probe
+static bool ops_supported(int fd, const uint8_t *ops, unsigned op_count) {
+    size_t probe_size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, probe_size);
+    if (!probe) {
+        return false;
+    }
+
+    bool ok = sys_io_uring_register(fd, IORING_REGISTER_PROBE, probe, 256) == 0;
+    for (unsigned i = 0; ok && i < op_count; i++) {
+        ok = ops[i] <= probe->last_op && (probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+    return ok;
+}
+
+UringRing *uring_create(unsigned entries, const uint8_t *ops, unsigned op_count) {
+    UringRing *ring = calloc(1, sizeof(UringRing));
+    if (!ring) {
+        return NULL;
+    }
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring->fd = sys_io_uring_setup(entries, &params);
+    if (ring->fd < 0) {
+        free(ring);
+        return NULL;
+    }
+    if (!ops_supported(ring->fd, ops, op_count)) {
+        close(ring->fd);
+        free(ring);
+        return NULL;
+    }
+
+    ring->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap && ring->cq_map_size > ring->sq_map_size) {
+        ring->sq_map_size = ring->cq_map_size;
+    }
+
+    ring->sq_map = mmap(NULL, ring->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring->fd, IORING_OFF_SQ_RING);
+    ring->cq_map = single_mmap ? ring->sq_map
+                               : mmap(NULL, ring->cq_map_size, PROT_READ | PROT_WRITE,
+                                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring->fd, IORING_OFF_SQES);
+    if (ring->sq_map == MAP_FAILED || ring->cq_map == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        uring_destroy(ring);
+        return NULL;
+    }
+
+    uint8_t *sq = ring->sq_map;
+    uint8_t *cq = ring->cq_map;
+    ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    ring->sq_entries = params.sq_entries;
+    ring->sq_local_tail = *ring->sq_tail;
+
+    return ring;
+}
+
+void uring_destroy(UringRing *ring) {
+    if (!ring) {
+        return;
+    }
+    if (ring->sqes && ring->sqes != MAP_FAILED) {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if (ring->cq_map && ring->cq_map != MAP_FAILED && ring->cq_map != ring->sq_map) {
+        munmap(ring->cq_map, ring->cq_map_size);
+    }
+    if (ring->sq_map && ring->sq_map != MAP_FAILED) {
+        munmap(ring->sq_map, ring->sq_map_size);
+    }
+    close(ring->fd);
+    free(ring);
+}
+
+// Hands out the next free SQE, zeroed, or NULL if the queue is full
+static struct io_uring_sqe *get_sqe(UringRing *ring, uint8_t opcode, uint64_t user_data) {
+    if (ring->sq_local_tail - load_acquire(ring->sq_head) >= ring->sq_entries) {
+        return NULL;
+    }
+
+    unsigned index = ring->sq_local_tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->user_data = user_data;
+    ring->sq_array[index] = index;
+    ring->sq_local_tail++;
+    return sqe;
+}
+
+bool uring_prep_openat(UringRing *ring, const char *path, int flags, uint64_t user_data) {
+    struct io_uring_sqe *sqe = get_sqe(ring, IORING_OP_OPENAT, user_data);
+    if (!sqe) {
+        return false;
+    }
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (uintptr_t)path;
+    sqe->open_flags = flags;
+    return true;
+}
+
+bool uring_prep_read(UringRing *ring, int fd, void *buffer, unsigned len, uint64_t offset, uint64_t user_data) {
+    struct io_uring_sqe *sqe = get_sqe(ring, IORING_OP_READ, user_data);
+    if (!sqe) {
+        return false;
+    }
+    sqe->fd = fd;
+    sqe->addr = (uintptr_t)buffer;
+    sqe->len = len;
+    sqe->off = offset;
+    return true;
+}
+
+bool uring_prep_close(UringRing *ring, int fd, uint64_t user_data) {
+    struct io_uring_sqe *sqe = get_sqe(ring, IORING_OP_CLOSE, user_data);
+    if (!sqe) {
+        return false;
+    }
+    sqe->fd = fd;
+    return true;
+}
+
+bool uring_prep_statx(UringRing *ring, const char *path, unsigned mask, void *statx_buffer, uint64_t user_data) {
+    struct io_uring_sqe *sqe = get_sqe(ring, IORING_OP_STATX, user_data);
+    if (!sqe) {
+        return false;
+    }
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (uintptr_t)path;
+    sqe->len = mask;
+    sqe->off = (uintptr_t)statx_buffer;
+    return true;
+}
+
+bool uring_submit_and_wait(UringRing *ring, unsigned wait_nr) {
+    unsigned to_submit = ring->sq_local_tail - *ring->sq_tail;
+    store_release(ring->sq_tail, ring->sq_local_tail);
+
+    for (;;) {
+        int ret = sys_io_uring_enter(ring->fd, to_submit, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0);
+        STATS_ADD(STAT_SYSCALLS, 1);
+        if (ret >= 0) {
+            to_submit -= (unsigned)ret;
+            if (to_submit == 0) {
+                return true;
+            }
+        } else if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            return false;
+        }
+        // Partial submission or a transient error: the kernel still has entries to take.
+        // Completions already waiting satisfy wait_nr, so don't block on them again.
+        if (load_acquire(ring->cq_tail) != *ring->cq_head) {
+            return true;
+        }
+    }
+}
+
+bool uring_next_cqe(UringRing *ring, uint64_t *user_data, int32_t *res) {
+    unsigned head = *ring->cq_head;
+    if (head == load_acquire(ring->cq_tail)) {
+        return false;
+    }
+
+    struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+    *user_data = cqe->user_data;
+    *res = cqe->res;
+    store_release(ring->cq_head, head + 1);
+    return true;
+}
@@ -0,0 +1,27 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <linux/io_uring.h>
+
+// --- Minimal io_uring Ring ---
+// Just enough of what liburing offers, on raw syscalls: one ring, SQE preparation for the
+// few operations the scanner needs, submit-and-wait and CQE reaping. Not thread-safe.
+typedef struct UringRing UringRing;
+
+// NULL when io_uring is missing, disabled (seccomp, sysctl) or lacks one of `ops`
+UringRing *uring_create(unsigned entries, const uint8_t *ops, unsigned op_count);
+void uring_destroy(UringRing *ring);
+
+// Each returns false when the submission queue is full
+bool uring_prep_openat(UringRing *ring, const char *path, int flags, uint64_t user_data);
+bool uring_prep_read(UringRing *ring, int fd, void *buffer, unsigned len, uint64_t offset, uint64_t user_data);
+bool uring_prep_close(UringRing *ring, int fd, uint64_t user_data);
+bool uring_prep_statx(UringRing *ring, const char *path, unsigned mask, void *statx_buffer, uint64_t user_data);
+
+// Submits everything prepared and waits until at least `wait_nr` completions are available
+bool uring_submit_and_wait(UringRing *ring, unsigned wait_nr);
+bool uring_next_cqe(UringRing *ring, uint64_t *user_data, int32_t *res); // false when none are left
+
+#endif // URING_H
@@ -0,0 +1,719 @@
+#define _GNU_SOURCE // ppoll
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include "watch.h"
+#include "read.h"
+#include "tag.h"
+#include "hash.h"
+#include "pool.h"
+#include "stats.h"
+
+#define WATCH_DIR_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_CREATE | \
+                          IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK)
+
+// --- String-Keyed Map (open addressing, linear probing) ---
+typedef struct {
+    char *key;                // NULL = empty slot, MAP_TOMBSTONE = removed
+    uint64_t hash;
+    uint64_t value;           // Known files: stamp; pending files: index; directories: unused
+    void *item;               // Directories: the DirWatch
+} MapSlot;
+
+typedef struct {
+    MapSlot *slots;
+    size_t capacity;          // Power of two, 0 until the first insert
+    size_t used;              // Keys plus tombstones
+    size_t count;             // Keys
+} StrMap;
+
+static char map_tombstone;
+#define MAP_TOMBSTONE (&map_tombstone)
+#define MAP_LIVE(slot) ((slot)->key && (slot)->key != MAP_TOMBSTONE)
+
+static MapSlot *map_find(const StrMap *map, const char *key) {
+    if (map->count == 0) {
+        return NULL;
+    }
+    uint64_t hash = hash64(key, strlen(key));
+    for (size_t i = hash & (map->capacity - 1);; i = (i + 1) & (map->capacity - 1)) {
+        MapSlot *slot = &map->slots[i];
+        if (!slot->key) {
+            return NULL;
+        }
+        if (slot->key != MAP_TOMBSTONE && slot->hash == hash && strcmp(slot->key, key) == 0) {
+            return slot;
+        }
+    }
+}
+
+static bool map_rehash(StrMap *map, size_t capacity) {
+    MapSlot *slots = calloc(capacity, sizeof(MapSlot));
+    if (!slots) {
+        return false;
+    }
+    for (size_t i = 0; i < map->capacity; i++) {
+        if (MAP_LIVE(&map->slots[i])) {
+            size_t j = map->slots[i].hash & (capacity - 1);
+            while (slots[j].key) {
+                j = (j + 1) & (capacity - 1);
+            }
+            slots[j] = map->slots[i];
+        }
+    }
+    free(map->slots);
+    map->slots = slots;
+    map->capacity = capacity;
+    map->used = map->count;
+    return true;
+}
+
+// The slot for `key`, added (value 0, item NULL) if it was not there; NULL if out of memory
+static MapSlot *map_insert(StrMap *map, const char *key, bool *added) {
+    MapSlot *slot = map_find(map, key);
+    *added = slot == NULL;
+    if (slot) {
+        return slot;
+    }
+    if ((map->used + 1) * 4 > map->capacity * 3) {
+        size_t capacity = map->capacity ? map->capacity : 16;
+        while ((map->count + 1) * 2 > capacity) {
+            capacity *= 2;
+        }
+        if (!map_rehash(map, capacity)) {
+            return NULL;
+        }
+    }
+    char *copy = strdup(key);
+    if (!copy) {
+        return NULL;
+    }
+    uint64_t hash = hash64(key, strlen(key));
+    size_t i = hash & (map->capacity - 1);
+    while (MAP_LIVE(&map->slots[i])) {
+        i = (i + 1) & (map->capacity - 1);
+    }
+    slot = &map->slots[i];
+    map->used += slot->key == NULL;
+    map->count++;
+    *slot = (MapSlot){ copy, hash, 0, NULL };
+    return slot;
+}
+
+static void map_remove(StrMap *map, MapSlot *slot) {
+    free(slot->key);
+    slot->key = MAP_TOMBSTONE;
+    map->count--;
+}
+
+static void map_free(StrMap *map) {
+    for (size_t i = 0; i < map->capacity; i++) {
+        if (MAP_LIVE(&map->slots[i])) {
+            free(map->slots[i].key);
+        }
+    }
+    free(map->slots);
+    memset(map, 0, sizeof(StrMap));
+}
+
+// --- Watcher State ---
+typedef struct {
+    char *path;               // No trailing slash ("" for "/")
+    int wd;                   // -1 while unwatched (watch limit reached): listed every poll
+    StrMap files;             // Known .mp3 names -> stamp
+} DirWatch;
+
+typedef struct {
+    const char *path;         // Key in Watcher.pending
+    bool gone;                // Last event removed it (otherwise it was written or moved in)
+    bool known;               // Known before its directory was forgotten
+    bool present;             // Parse result: the file is there
+    bool ok;                  // Parse result: tags were read
+    uint64_t stamp;
+    TagData tags;
+} PendingFile;
+
+typedef struct {
+    const WatchOptions *options;
+    int fd;
+    StrMap dirs;              // Path -> DirWatch
+    DirWatch **by_wd;
+    size_t by_wd_capacity;
+    size_t unwatched;
+    bool limit_warned;
+    bool resync;              // The event queue overflowed
+
+    StrMap pending;           // Path -> index in files
+    PendingFile *files;
+    size_t file_count;
+    size_t file_capacity;
+    uint64_t first_event;     // Monotonic ns of the oldest pending event
+    uint64_t last_event;
+
+    ThreadPool *pool;
+    uint64_t counts[3];       // Per WatchChangeKind
+    uint64_t bursts;
+} Watcher;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static bool is_mp3_name(const char *name) {
+    size_t len = strlen(name);
+    return len > 4 && strcasecmp(name + len - 4, ".mp3") == 0;
+}
+
+// Modification time, size and inode folded into one value: any change shows up as a new stamp
+static uint64_t file_stamp(const struct stat *st) {
+    uint64_t fields[3] = { (uint64_t)st->st_mtim.tv_sec * 1000000000ull + (uint64_t)st->st_mtim.tv_nsec,
+                           (uint64_t)st->st_size, (uint64_t)st->st_ino };
+    return hash64(fields, sizeof(fields));
+}
+
+static void join_path(char *out, size_t size, const char *dir, const char *name) {
+    snprintf(out, size, "%s/%s", dir, name);
+}
+
+// Directory part of a file path (the DirWatch key)
+static void parent_path(char *out, size_t size, const char *path) {
+    const char *slash = strrchr(path, '/');
+    size_t len = slash ? (size_t)(slash - path) : 0;
+    snprintf(out, size, "%.*s", (int)len, path);
+}
+
+static void note_event(Watcher *watcher, const char *path, bool gone, bool known) {
+    bool added;
+    MapSlot *slot = map_insert(&watcher->pending, path, &added);
+    if (!slot) {
+        return;
+    }
+    if (added) {
+        if (watcher->file_count == watcher->file_capacity) {
+            size_t capacity = watcher->file_capacity ? watcher->file_capacity * 2 : 256;
+            PendingFile *grown = realloc(watcher->files, capacity * sizeof(PendingFile));
+            if (!grown) {
+                map_remove(&watcher->pending, slot);
+                return;
+            }
+            watcher->files = grown;
+            watcher->file_capacity = capacity;
+        }
+        slot->value = watcher->file_count;
+        PendingFile *file = &watcher->files[watcher->file_count++];
+        memset(file, 0, sizeof(PendingFile));
+        file->path = slot->key;
+        tag_data_init(&file->tags);
+    }
+    PendingFile *file = &watcher->files[slot->value];
+    file->gone = gone;
+    file->known |= known;
+
+    uint64_t now = now_ns();
+    if (watcher->file_count == 1 && added) {
+        watcher->first_event = now;
+    }
+    watcher->last_event = now;
+}
+
+// --- Directories ---
+static void map_wd(Watcher *watcher, int wd, DirWatch *dir) {
+    if ((size_t)wd >= watcher->by_wd_capacity) {
+        size_t capacity = watcher->by_wd_capacity ? watcher->by_wd_capacity : 1024;
+        while ((size_t)wd >= capacity) {
+            capacity *= 2;
+        }
+        DirWatch **grown = realloc(watcher->by_wd, capacity * sizeof(DirWatch *));
+        if (!grown) {
+            return;
+        }
+        memset(grown + watcher->by_wd_capacity, 0, (capacity - watcher->by_wd_capacity) * sizeof(DirWatch *));
+        watcher->by_wd = grown;
+        watcher->by_wd_capacity = capacity;
+    }
+    DirWatch *previous = watcher->by_wd[wd];
+    if (previous && previous != dir) {
+        previous->wd = -1; // Same inode reached by another path; that one gets polled
+        watcher->unwatched++;
+    }
+    watcher->by_wd[wd] = dir;
+}
+
+static DirWatch *dir_for_wd(Watcher *watcher, int wd) {
+    return (wd >= 0 && (size_t)wd < watcher->by_wd_capacity) ? watcher->by_wd[wd] : NULL;
+}
+
+// Adds the inotify watch; false only if the directory is gone
+static bool start_watch(Watcher *watcher, DirWatch *dir) {
+    int wd = inotify_add_watch(watcher->fd, dir->path[0] ? dir->path : "/", WATCH_DIR_EVENTS);
+    STATS_ADD(STAT_SYSCALLS, 1);
+    if (wd >= 0) {
+        dir->wd = wd;
+        map_wd(watcher, wd, dir);
+        return true;
+    }
+    if (errno == ENOENT || errno == ENOTDIR) {
+        return false;
+    }
+    if (errno == ENOSPC && !watcher->limit_warned) {
+        fprintf(stderr, "Warning: inotify watch limit reached (fs.inotify.max_user_watches); "
+                "the remaining directories are checked every %d seconds.\n", WATCH_POLL_SECONDS);
+        watcher->limit_warned = true;
+    }
+    dir->wd = -1;
+    return true;
+}
+
+static void free_dir(DirWatch *dir) {
+    map_free(&dir->files);
+    free(dir->path);
+    free(dir);
+}
+
+// Forgets `path` and every directory below it. Their known files are reported removed.
+static void forget_tree(Watcher *watcher, const char *path) {
+    size_t len = strlen(path);
+    char file_path[4096];
+    for (size_t i = 0; i < watcher->dirs.capacity; i++) {
+        MapSlot *slot = &watcher->dirs.slots[i];
+        if (!MAP_LIVE(slot) || strncmp(slot->key, path, len) != 0 ||
+            (slot->key[len] != '\0' && slot->key[len] != '/')) {
+            continue;
+        }
+        DirWatch *dir = slot->item;
+        for (size_t f = 0; f < dir->files.capacity; f++) {
+            if (MAP_LIVE(&dir->files.slots[f])) {
+                join_path(file_path, sizeof(file_path), dir->path, dir->files.slots[f].key);
+                note_event(watcher, file_path, true, true);
+            }
+        }
+        if (dir->wd >= 0) {
+            inotify_rm_watch(watcher->fd, dir->wd); // Already gone if the directory was deleted
+            if (dir_for_wd(watcher, dir->wd) == dir) {
+                watcher->by_wd[dir->wd] = NULL;
+            }
+        } else {
+            watcher->unwatched--;
+        }
+        free_dir(dir);
+        map_remove(&watcher->dirs, slot);
+    }
+}
+
+// Lists one directory. Subdirectories not seen yet are returned through `subdirs`.
+// Files are compared against the known ones: with `report`, new or changed files and
+// vanished known ones become pending events; without it they are simply taken as known.
+typedef struct {
+    char **paths;
+    size_t count;
+    size_t capacity;
+} PathList;
+
+static bool push_path(PathList *list, const char *path) {
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity ? list->capacity * 2 : 64;
+        char **grown = realloc(list->paths, capacity * sizeof(char *));
+        if (!grown) {
+            return false;
+        }
+        list->paths = grown;
+        list->capacity = capacity;
+    }
+    char *copy = strdup(path);
+    if (!copy) {
+        return false;
+    }
+    list->paths[list->count++] = copy;
+    return true;
+}
+
+static bool list_dir(Watcher *watcher, DirWatch *dir, bool report, PathList *subdirs) {
+    DIR *handle = opendir(dir->path[0] ? dir->path : "/");
+    STATS_ADD(STAT_SYSCALLS, 1);
+    if (!handle) {
+        return false;
+    }
+    StrMap seen;
+    memset(&seen, 0, sizeof(seen));
+    char path[4096];
+    struct dirent *entry;
+    while ((entry = readdir(handle)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        unsigned char type = entry->d_type;
+        if (type != DT_UNKNOWN && type != DT_DIR && type != DT_REG) {
+            continue;
+        }
+        if (type == DT_REG && !is_mp3_name(entry->d_name)) {
+            continue;
+        }
+        struct stat st;
+        if (fstatat(dirfd(handle), entry->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+            continue;
+        }
+        join_path(path, sizeof(path), dir->path, entry->d_name);
+        if (S_ISDIR(st.st_mode)) {
+            if (!map_find(&watcher->dirs, path)) {
+                push_path(subdirs, path);
+            }
+            continue;
+        }
+        if (!S_ISREG(st.st_mode) || !is_mp3_name(entry->d_name)) {
+            continue;
+        }
+
+        bool added;
+        if (report) {
+            map_insert(&seen, entry->d_name, &added);
+            MapSlot *known = map_find(&dir->files, entry->d_name);
+            if (!known || known->value != file_stamp(&st)) {
+                note_event(watcher, path, false, false);
+            }
+        } else {
+            MapSlot *known = map_insert(&dir->files, entry->d_name, &added);
+            if (known) {
+                known->value = file_stamp(&st);
+            }
+        }
+    }
+    closedir(handle);
+
+    // Known files that are no longer there
+    for (size_t i = 0; report && i < dir->files.capacity; i++) {
+        MapSlot *slot = &dir->files.slots[i];
+        if (MAP_LIVE(slot) && !map_find(&seen, slot->key)) {
+            join_path(path, sizeof(path), dir->path, slot->key);
+            note_event(watcher, path, true, false);
+        }
+    }
+    map_free(&seen);
+    return true;
+}
+
+// Watches `root` and every directory below it. The watch goes on before the listing, so a
+// file written in between is seen by both and merged as one pending event.
+static bool add_tree(Watcher *watcher, const char *root, bool report) {
+    PathList todo = { NULL, 0, 0 };
+    if (!push_path(&todo, root)) {
+        return false;
+    }
+    bool root_ok = false;
+    while (todo.count > 0) {
+        char *path = todo.paths[--todo.count];
+        bool added;
+        MapSlot *slot = map_find(&watcher->dirs, path) ? NULL : map_insert(&watcher->dirs, path, &added);
+        DirWatch *dir = slot ? calloc(1, sizeof(DirWatch)) : NULL;
+        if (dir && !(dir->path = strdup(path))) {
+            free(dir);
+            dir = NULL;
+        }
+        if (!dir) {
+            if (slot) {
+                map_remove(&watcher->dirs, slot);
+            }
+            free(path);
+            continue;
+        }
+        slot->item = dir;
+        if (!start_watch(watcher, dir) || !list_dir(watcher, dir, report, &todo)) {
+            if (dir->wd >= 0) {
+                inotify_rm_watch(watcher->fd, dir->wd);
+                watcher->by_wd[dir->wd] = NULL;
+            }
+            free_dir(dir);
+            map_remove(&watcher->dirs, slot);
+            free(path);
+            continue;
+        }
+        watcher->unwatched += dir->wd < 0;
+        root_ok |= strcmp(path, root) == 0;
+        free(path);
+    }
+    free(todo.paths);
+    return root_ok;
+}
+
+// Lists directories again and turns the differences into pending events: every directory
+// after a queue overflow, otherwise only those without a watch (which also retry theirs)
+static void rescan(Watcher *watcher, bool all) {
+    PathList paths = { NULL, 0, 0 };
+    for (size_t i = 0; i < watcher->dirs.capacity; i++) {
+        MapSlot *slot = &watcher->dirs.slots[i];
+        if (MAP_LIVE(slot) && (all || ((DirWatch *)slot->item)->wd < 0)) {
+            push_path(&paths, slot->key);
+        }
+    }
+    for (size_t i = 0; i < paths.count; i++) {
+        MapSlot *slot = map_find(&watcher->dirs, paths.paths[i]);
+        if (slot) {
+            DirWatch *dir = slot->item;
+            PathList subdirs = { NULL, 0, 0 };
+            if (dir->wd < 0 && start_watch(watcher, dir) && dir->wd >= 0) {
+                watcher->unwatched--;
+            }
+            if (!list_dir(watcher, dir, true, &subdirs)) {
+                forget_tree(watcher, paths.paths[i]);
+            }
+            for (size_t s = 0; s < subdirs.count; s++) {
+                add_tree(watcher, subdirs.paths[s], true);
+                free(subdirs.paths[s]);
+            }
+            free(subdirs.paths);
+        }
+        free(paths.paths[i]);
+    }
+    free(paths.paths);
+}
+
+// --- Events ---
+static void handle_event(Watcher *watcher, const struct inotify_event *event) {
+    if (event->mask & IN_Q_OVERFLOW) {
+        watcher->resync = true;
+        return;
+    }
+    DirWatch *dir = dir_for_wd(watcher, event->wd);
+    if (!dir) {
+        return;
+    }
+    if (event->mask & IN_IGNORED) {
+        // The directory itself was deleted (or its filesystem unmounted)
+        watcher->by_wd[event->wd] = NULL;
+        dir->wd = -1;
+        watcher->unwatched++;
+        char path[4096];
+        snprintf(path, sizeof(path), "%s", dir->path);
+        forget_tree(watcher, path);
+        return;
+    }
+    if (event->len == 0) {
+        return;
+    }
+
+    char path[4096];
+    join_path(path, sizeof(path), dir->path, event->name);
+    if (event->mask & IN_ISDIR) {
+        if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+            add_tree(watcher, path, true);
+        } else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+            forget_tree(watcher, path);
+        }
+    } else if (is_mp3_name(event->name)) {
+        if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+            note_event(watcher, path, false, false);
+        } else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+            note_event(watcher, path, true, false);
+        }
+    }
+}
+
+static void parse_task(void *arg) {
+    PendingFile *file = arg;
+    struct stat st;
+    file->present = lstat(file->path, &st) == 0 && S_ISREG(st.st_mode);
+    STATS_ADD(STAT_SYSCALLS, 1);
+    if (file->present) {
+        file->stamp = file_stamp(&st);
+        file->ok = read_tags_from_file(file->path, &file->tags);
+    }
+}
+
+static void report(Watcher *watcher, WatchChangeKind kind, const PendingFile *file) {
+    WatchChange change = { kind, file->path, (kind != WATCH_REMOVED && file->ok) ? &file->tags : NULL };
+    watcher->counts[kind]++;
+    watcher->options->callback(&change, watcher->options->user);
+}
+
+// Parses the burst's files side by side, then reports them in the order they first changed
+static void flush_pending(Watcher *watcher) {
+    if (watcher->file_count == 0) {
+        return;
+    }
+    for (size_t i = 0; i < watcher->file_count; i++) {
+        if (!watcher->files[i].gone) {
+            pool_submit(watcher->pool, parse_task, &watcher->files[i]);
+        }
+    }
+    pool_wait(watcher->pool);
+
+    char dir_path[4096];
+    for (size_t i = 0; i < watcher->file_count; i++) {
+        PendingFile *file = &watcher->files[i];
+        parent_path(dir_path, sizeof(dir_path), file->path);
+        const char *name = file->path + strlen(dir_path) + 1;
+        MapSlot *dir_slot = map_find(&watcher->dirs, dir_path);
+        DirWatch *dir = dir_slot ? dir_slot->item : NULL;
+        MapSlot *known = dir ? map_find(&dir->files, name) : NULL;
+        bool was_known = file->known || known;
+
+        if (file->gone || !file->present) {
+            if (known) {
+                map_remove(&dir->files, known);
+            }
+            if (was_known) {
+                report(watcher, WATCH_REMOVED, file);
+            }
+        } else if (dir) {
+            bool added;
+            if (!known) {
+                known = map_insert(&dir->files, name, &added);
+            }
+            if (known) {
+                known->value = file->stamp;
+            }
+            report(watcher, was_known ? WATCH_MODIFIED : WATCH_ADDED, file);
+        }
+        tag_data_free(&file->tags);
+    }
+    watcher->file_count = 0;
+    map_free(&watcher->pending);
+    watcher->bursts++;
+    if (watcher->options->burst_done) {
+        watcher->options->burst_done(watcher->options->user);
+    }
+}
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void request_stop(int signal_number) {
+    (void)signal_number;
+    stop_requested = 1;
+}
+
+bool watch_run(const WatchOptions *options) {
+    Watcher watcher;
+    memset(&watcher, 0, sizeof(watcher));
+    watcher.options = options;
+    watcher.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watcher.fd < 0) {
+        perror("Error starting inotify");
+        return false;
+    }
+
+    // As in serve: SIGINT / SIGTERM only arrive while the loop waits in ppoll
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = request_stop;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    sigset_t stop_signals, wait_mask;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop_signals, &wait_mask);
+    sigdelset(&wait_mask, SIGINT);
+    sigdelset(&wait_mask, SIGTERM);
+
+    char root[4096];
+    snprintf(root, sizeof(root), "%s", options->root);
+    size_t root_len = strlen(root);
+    while (root_len > 0 && root[root_len - 1] == '/') {
+        root[--root_len] = '\0'; // "/" becomes "", so children are "/name"
+    }
+    watcher.pool = pool_create(options->num_threads);
+    if (!watcher.pool || !add_tree(&watcher, root, false)) {
+        fprintf(stderr, "Error: Could not watch %s.\n", options->root);
+        if (watcher.pool) {
+            pool_destroy(watcher.pool);
+        }
+        close(watcher.fd);
+        return false;
+    }
+    fprintf(stderr, "Watching %zu directories under %s (%zu without a watch).\n", watcher.dirs.count,
+            options->root, watcher.unwatched);
+
+    uint64_t settle = (uint64_t)(options->settle_ms ? options->settle_ms : WATCH_SETTLE_MS) * 1000000ull;
+    uint64_t next_poll = now_ns() + WATCH_POLL_SECONDS * 1000000000ull;
+    static char buffer[65536] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    while (!stop_requested) {
+        uint64_t now = now_ns();
+        uint64_t deadline = UINT64_MAX;
+        if (watcher.file_count > 0) {
+            uint64_t quiet = watcher.last_event + settle;
+            uint64_t oldest = watcher.first_event + WATCH_MAX_DELAY_MS * 1000000ull;
+            deadline = quiet < oldest ? quiet : oldest;
+        }
+        if (watcher.unwatched > 0 && next_poll < deadline) {
+            deadline = next_poll;
+        }
+        struct timespec timeout = { 0, 0 };
+        if (deadline != UINT64_MAX && deadline > now) {
+            timeout.tv_sec = (time_t)((deadline - now) / 1000000000ull);
+            timeout.tv_nsec = (long)((deadline - now) % 1000000000ull);
+        }
+        struct pollfd waiting = { watcher.fd, POLLIN, 0 };
+        int ready = ppoll(&waiting, 1, deadline == UINT64_MAX ? NULL : &timeout, &wait_mask);
+
+        // Drain the queue completely before parsing anything, so the kernel's queue
+        // (fs.inotify.max_queued_events) is emptied as fast as it fills
+        while (ready > 0) {
+            ssize_t got = read(watcher.fd, buffer, sizeof(buffer));
+            STATS_ADD(STAT_SYSCALLS, 1);
+            if (got <= 0) {
+                break;
+            }
+            for (char *p = buffer; p < buffer + got;) {
+                const struct inotify_event *event = (const struct inotify_event *)p;
+                handle_event(&watcher, event);
+                p += sizeof(struct inotify_event) + event->len;
+            }
+            if (watcher.file_count >= WATCH_MAX_PENDING) {
+                flush_pending(&watcher);
+            }
+        }
+
+        now = now_ns();
+        if (watcher.resync) {
+            fprintf(stderr, "Warning: inotify event queue overflowed; comparing the whole tree.\n");
+            watcher.resync = false;
+            rescan(&watcher, true);
+        }
+        if (watcher.unwatched > 0 && now >= next_poll) {
+            rescan(&watcher, false);
+            next_poll = now + WATCH_POLL_SECONDS * 1000000000ull;
+        }
+        if (watcher.file_count > 0 &&
+            (now >= watcher.last_event + settle || now >= watcher.first_event + WATCH_MAX_DELAY_MS * 1000000ull)) {
+            flush_pending(&watcher);
+        }
+    }
+    flush_pending(&watcher);
+
+    fprintf(stderr, "Watched %llu bursts: %llu added, %llu modified, %llu removed.\n",
+            (unsigned long long)watcher.bursts, (unsigned long long)watcher.counts[WATCH_ADDED],
+            (unsigned long long)watcher.counts[WATCH_MODIFIED], (unsigned long long)watcher.counts[WATCH_REMOVED]);
+
+    pool_destroy(watcher.pool);
+    for (size_t i = 0; i < watcher.dirs.capacity; i++) {
+        if (MAP_LIVE(&watcher.dirs.slots[i])) {
+            free_dir(watcher.dirs.slots[i].item);
+        }
+    }
+    map_free(&watcher.dirs);
+    map_free(&watcher.pending);
+    free(watcher.files);
+    free(watcher.by_wd);
+    close(watcher.fd);
+    return true;
+}
+
+const char *watch_change_name(WatchChangeKind kind) {
+    switch (kind) {
+        case WATCH_ADDED: return "added";
+        case WATCH_MODIFIED: return "modified";
+        default: return "removed";
+    }
+}
@@ -0,0 +1,44 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include "types.h"
+
+// --- Library Watcher (watch) ---
+// Every directory under the root gets an inotify watch, so only files that change are
+// read again. Events are gathered per path until the library has been quiet for
+// settle_ms (or WATCH_MAX_DELAY_MS have passed, or WATCH_MAX_PENDING paths are waiting):
+// a file written, renamed and rewritten during an album copy is read once. The files of a
+// burst are parsed on the thread pool, then reported one at a time in event order.
+//
+// When fs.inotify.max_user_watches runs out, the remaining directories are listed again
+// every WATCH_POLL_SECONDS instead (modification time and size tell what changed). After
+// an event queue overflow the whole tree is compared against what is known the same way.
+#define WATCH_SETTLE_MS 200
+#define WATCH_MAX_DELAY_MS 2000
+#define WATCH_MAX_PENDING 4096
+#define WATCH_POLL_SECONDS 30
+
+typedef enum { WATCH_ADDED, WATCH_MODIFIED, WATCH_REMOVED } WatchChangeKind;
+
+typedef struct {
+    WatchChangeKind kind;
+    const char *path;
+    const TagData *tags;      // NULL when removed, or when the file has no readable tag
+} WatchChange;
+
+typedef void (*WatchCallback)(const WatchChange *change, void *user);
+
+typedef struct {
+    const char *root;
+    int num_threads;          // Parsing; 0 = one per online CPU
+    uint32_t settle_ms;       // 0 = WATCH_SETTLE_MS
+    WatchCallback callback;   // Called from the watching thread only
+    void (*burst_done)(void *user); // After the last record of each burst (e.g. to flush output)
+    void *user;
+} WatchOptions;
+
+// Runs until SIGINT or SIGTERM; false if the root could not be watched
+bool watch_run(const WatchOptions *options);
+const char *watch_change_name(WatchChangeKind kind); // "added", "modified", "removed"
+
+#endif // WATCH_H